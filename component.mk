@@ -44,6 +44,13 @@ SOURCE_PATHS += $(BASE_PATH)/mcu/spi
 endif
 
 
+ifneq ($(filter STORAGE,$(MCU_EXCLUDES)),)
+SYMBOLS += EXCLUDE_STORAGE
+else
+SOURCE_PATHS += $(BASE_PATH)/mcu/storage
+endif
+
+
 ifneq ($(filter TIMER,$(MCU_EXCLUDES)),)
 SYMBOLS += EXCLUDE_TIMER
 else
@@ -63,3 +70,9 @@ SYMBOLS += EXCLUDE_USB
 else
 SOURCE_PATHS += $(BASE_PATH)/mcu/usb
 endif
+
+
+# PendSV handler is opt-in, an RTOS usually defines its own
+ifneq ($(filter PENDSV,$(MCU_INCLUDES)),)
+SYMBOLS += INCLUDE_PENDSV
+endif
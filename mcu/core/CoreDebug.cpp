@@ -11,6 +11,9 @@
 // Corresponding header
 #include "CoreDebug.h"
 
+// This component
+#include "../utility/bit_manipulation.h"
+
 
 namespace mcu {
 
@@ -20,6 +23,20 @@ namespace mcu {
 // ============================================================================
 
 
+void CoreDebug::setTraceEnable(bool state)
+{
+    auto registers = CoreDebug_Registers::get();
+
+    if (state) {
+        registers->DEMCR
+            = bitSet(registers->DEMCR, CoreDebug_Registers::DEMCR::TRCENA);
+    } else {
+        registers->DEMCR
+            = bitReset(registers->DEMCR, CoreDebug_Registers::DEMCR::TRCENA);
+    }
+}
+
+
 // ============================================================================
 // Protected members
 // ============================================================================
@@ -31,6 +31,13 @@ class CoreDebug
             return instance;
         }
 
+        /**
+         * Enable/disable DWT and ITM units
+         *
+         * @param state         True to enable
+         */
+        void setTraceEnable(bool state);
+
     protected:
         /**
          * Private constructors because of singleton pattern, no copy allowed
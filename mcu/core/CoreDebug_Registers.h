@@ -32,6 +32,11 @@ class CoreDebug_Registers
             volatile uint32_t DEMCR;    // Offset 0x00C (R/W)  Debug Exception and Monitor Control Register
         } __attribute__((packed));
 
+        struct DEMCR
+        {
+            static const uint32_t TRCENA = 24;
+        };
+
         /**
          * Return pointer to registers block
          *
@@ -11,6 +11,12 @@
 // Corresponding header
 #include "DWT.h"
 
+// Local includes
+#include "CoreDebug.h"
+
+// This component
+#include "../utility/bit_manipulation.h"
+
 
 namespace mcu {
 
@@ -20,6 +26,26 @@ namespace mcu {
 // ============================================================================
 
 
+void DWT::enableCycleCounter()
+{
+    CoreDebug::get().setTraceEnable(true);
+
+    auto registers = DWT_Registers::get();
+
+    registers->CYCCNT = 0;
+    registers->CTRL = bitSet(registers->CTRL, DWT_Registers::CTRL::CYCCNTENA);
+}
+
+
+void DWT::disableCycleCounter()
+{
+    auto registers = DWT_Registers::get();
+
+    registers->CTRL
+        = bitReset(registers->CTRL, DWT_Registers::CTRL::CYCCNTENA);
+}
+
+
 // ============================================================================
 // Protected members
 // ============================================================================
@@ -31,6 +31,26 @@ class DWT
             return instance;
         }
 
+        /**
+         * Reset and start cycle counter, enables trace in CoreDebug
+         */
+        void enableCycleCounter();
+
+        /**
+         * Stop cycle counter
+         */
+        void disableCycleCounter();
+
+        /**
+         * Return number of core clock cycles, wraps around at 32 bits
+         *
+         * @return              Cycle count
+         */
+        uint32_t getCycleCount()
+        {
+            return DWT_Registers::get()->CYCCNT;
+        }
+
     protected:
         /**
          * Private constructors because of singleton pattern, no copy allowed
@@ -52,6 +52,11 @@ class DWT_Registers
             volatile uint32_t _RESERVED_3;
         } __attribute__((packed));
 
+        struct CTRL
+        {
+            static const uint32_t CYCCNTENA = 0;
+        };
+
         /**
          * Return pointer to registers block
          *
@@ -39,6 +39,14 @@ void NVIC::disableIrq(int irqNum)
 }
 
 
+bool NVIC::isIrqEnabled(int irqNum)
+{
+    auto registers = NVIC_Registers::get();
+
+    return registers->ISER[irqNum >> 5] & (1 << (irqNum & 0x1F));
+}
+
+
 void NVIC::setPriority(int irqNum, int priority, int subPriority)
 {
     auto encodedPriority = encodePriority(getPriorityGrouping(),
@@ -45,6 +45,14 @@ class NVIC
          */
         void disableIrq(int irqNum);
 
+        /**
+         * Return if interrupt is enabled
+         *
+         * @param   irqNum          IRQ number
+         * @return                  True if enabled
+         */
+        bool isIrqEnabled(int irqNum);
+
         /**
          * Set interrupt priority
          *
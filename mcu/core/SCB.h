@@ -31,6 +31,27 @@ class SCB
             return instance;
         }
 
+        /**
+         * Set PendSV exception pending, e.g. to defer work from an
+         * interrupt to the lowest priority
+         */
+        void triggerPendSV()
+        {
+            auto registers = SCB_Registers::get();
+
+            registers->ICSR = (1 << SCB_Registers::ICSR::PENDSVSET);
+        }
+
+        /**
+         * Clear pending PendSV exception
+         */
+        void clearPendSV()
+        {
+            auto registers = SCB_Registers::get();
+
+            registers->ICSR = (1 << SCB_Registers::ICSR::PENDSVCLR);
+        }
+
     protected:
         /**
          * Private constructors because of singleton pattern, no copy allowed
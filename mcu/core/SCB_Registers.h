@@ -49,6 +49,14 @@ class SCB_Registers
             volatile uint32_t CPACR;            // Offset 0x088 (R/W)  Coprocessor Access Control Register
         } __attribute__((packed));
 
+        struct ICSR
+        {
+            static const uint32_t PENDSTCLR = 25;
+            static const uint32_t PENDSTSET = 26;
+            static const uint32_t PENDSVCLR = 27;
+            static const uint32_t PENDSVSET = 28;
+        };
+
         struct AIRCR
         {
             static const uint32_t PRIGROUP  = 8;
@@ -47,6 +47,26 @@ static inline void disableInterrupts()
 }
 
 
+/**
+ * Data synchronization barrier
+ */
+__attribute__((always_inline))
+static inline void dataSynchronizationBarrier()
+{
+  __asm volatile ("dsb 0xF" : : : "memory");
+}
+
+
+/**
+ * Instruction synchronization barrier
+ */
+__attribute__((always_inline))
+static inline void instructionSynchronizationBarrier()
+{
+  __asm volatile ("isb 0xF" : : : "memory");
+}
+
+
 /**
  * Breakpoint
  */
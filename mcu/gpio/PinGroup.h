@@ -0,0 +1,244 @@
+/**
+ * @file        PinGroup.h
+ *
+ * Batched configuration of multiple pins for STM32L4xx
+ *
+ * Settings are collected as per-port masks and written with a single
+ * read-modify-write per register and port on apply().
+ *
+ * @author      Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "GPIO_Base.h"
+#include "GPIO_Registers.h"
+#include "Pin.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class PinGroup : public GPIO_Base
+{
+    public:
+        /**
+         * Number of GPIO ports
+         */
+        static const int PORT_COUNT = 6;
+
+        /**
+         * Set mode
+         *
+         * @param   pinId           Pin id, Pin::NONE is ignored
+         * @param   mode            Mode corresponding to enum
+         */
+        void setMode(Pin::Id pinId, Pin::Mode mode)
+        {
+            setField(pinId, &PortConfig::moder, 2, (uint32_t)mode);
+        }
+
+        /**
+         * Set output type
+         *
+         * @param   pinId           Pin id, Pin::NONE is ignored
+         * @param   outputType      Output type corresponding to enum
+         */
+        void setOutputType(Pin::Id pinId, Pin::OutputType outputType)
+        {
+            setField(pinId, &PortConfig::otyper, 1, (uint32_t)outputType);
+        }
+
+        /**
+         * Set output speed
+         *
+         * @param   pinId           Pin id, Pin::NONE is ignored
+         * @param   outputSpeed     Output speed corresponding to enum
+         */
+        void setOutputSpeed(Pin::Id pinId, Pin::OutputSpeed outputSpeed)
+        {
+            setField(pinId, &PortConfig::ospeedr, 2, (uint32_t)outputSpeed);
+        }
+
+        /**
+         * Set pullup/pulldown mode
+         *
+         * @param   pinId           Pin id, Pin::NONE is ignored
+         * @param   pullMode        Mode corresponding to enum
+         */
+        void setPullMode(Pin::Id pinId, Pin::PullMode pullMode)
+        {
+            setField(pinId, &PortConfig::pupdr, 2, (uint32_t)pullMode);
+        }
+
+        /**
+         * Set alternate function
+         *
+         * @param   pinId           Pin id, Pin::NONE is ignored
+         * @param   af              Alternate function corresponding to enum
+         */
+        void setAlternateFunction(Pin::Id pinId, Pin::AF af)
+        {
+            setField(pinId, &PortConfig::afr, 4, (uint32_t)af);
+        }
+
+        /**
+         * Set alternate function mode with output speed, as used by
+         * peripheral pins
+         *
+         * @param   pinId           Pin id, Pin::NONE is ignored
+         * @param   af              Alternate function corresponding to enum
+         * @param   outputSpeed     Output speed corresponding to enum
+         */
+        void setAlternateFunctionMode(Pin::Id pinId, Pin::AF af,
+                                      Pin::OutputSpeed outputSpeed)
+        {
+            setAlternateFunction(pinId, af);
+            setOutputSpeed(pinId, outputSpeed);
+            setMode(pinId, Pin::Mode::AF);
+        }
+
+        /**
+         * Set input mode and reset alternate function, as used when
+         * releasing peripheral pins
+         *
+         * @param   pinId           Pin id, Pin::NONE is ignored
+         */
+        void setInputMode(Pin::Id pinId)
+        {
+            setAlternateFunction(pinId, Pin::AF::AF0);
+            setMode(pinId, Pin::Mode::INPUT);
+        }
+
+        /**
+         * Write collected settings to port registers
+         *
+         * Mode is written last, so alternate function and output settings
+         * are valid when a pin starts driving.
+         */
+        void apply()
+        {
+            for (auto i = 0; i < PORT_COUNT; i++) {
+                auto& port = ports[i];
+
+                if (!port.used) {
+                    continue;
+                }
+
+                auto registers = GPIO_Registers::get((PortId)i);
+
+                if (port.afr[0].mask != 0) {
+                    registers->AFRL = replaceField(registers->AFRL,
+                                                   port.afr[0]);
+                }
+
+                if (port.afr[1].mask != 0) {
+                    registers->AFRH = replaceField(registers->AFRH,
+                                                   port.afr[1]);
+                }
+
+                if (port.otyper[0].mask != 0) {
+                    registers->OTYPER = replaceField(registers->OTYPER,
+                                                     port.otyper[0]);
+                }
+
+                if (port.ospeedr[0].mask != 0) {
+                    registers->OSPEEDR = replaceField(registers->OSPEEDR,
+                                                      port.ospeedr[0]);
+                }
+
+                if (port.pupdr[0].mask != 0) {
+                    registers->PUPDR = replaceField(registers->PUPDR,
+                                                    port.pupdr[0]);
+                }
+
+                if (port.moder[0].mask != 0) {
+                    registers->MODER = replaceField(registers->MODER,
+                                                    port.moder[0]);
+                }
+            }
+        }
+
+        /**
+         * Discard collected settings
+         */
+        void clear()
+        {
+            for (auto& port : ports) {
+                port = PortConfig();
+            }
+        }
+
+    protected:
+        /**
+         * Mask of bits to change and their new values
+         */
+        struct Field
+        {
+            uint32_t mask = 0;
+            uint32_t value = 0;
+        };
+
+        /**
+         * Collected settings of a port, AFR is split into low and high
+         * register, other registers only use the first entry
+         */
+        struct PortConfig
+        {
+            bool used = false;
+            Field moder[2];
+            Field otyper[2];
+            Field ospeedr[2];
+            Field pupdr[2];
+            Field afr[2];
+        };
+
+        /**
+         * Record a field of a pin
+         */
+        void setField(Pin::Id pinId, Field (PortConfig::*field)[2],
+                      int width, uint32_t value)
+        {
+            if (pinId == Pin::NONE) {
+                return;
+            }
+
+            auto portId = Pin::getPortId(pinId);
+            auto pinNo = Pin::getPinNo(pinId);
+            auto& port = ports[portId];
+
+            // Fields of 4 bits span 2 registers
+            auto index = (pinNo * width) / 32;
+            auto position = (pinNo * width) % 32;
+            uint32_t mask = ((1U << width) - 1) << position;
+
+            auto& entry = (port.*field)[index];
+            entry.mask |= mask;
+            entry.value = (entry.value & ~mask) | ((value << position) & mask);
+
+            port.used = true;
+        }
+
+        /**
+         * Return register value with field bits replaced
+         */
+        static uint32_t replaceField(uint32_t value, Field& field)
+        {
+            return (value & ~field.mask) | field.value;
+        }
+
+        /**
+         * Settings per port
+         */
+        PortConfig ports[PORT_COUNT];
+};
+
+
+}   // namespace mcu
@@ -27,6 +27,24 @@ extern "C" __attribute__((interrupt("IRQ"))) void SysTick_Handler()
 }
 
 
+// ============================================================================
+// PendSV
+// ============================================================================
+
+
+#ifdef INCLUDE_PENDSV
+
+extern "C" __attribute__((interrupt("IRQ"))) void PendSV_Handler()
+{
+#ifndef EXCLUDE_USB
+    auto& usb = USB::get();
+    usb.pendSVIrq();
+#endif
+}
+
+#endif
+
+
 // ============================================================================
 // DMA
 // ============================================================================
@@ -11,8 +11,12 @@
 // Corresponding header
 #include "QUADSPI.h"
 
+// Local includes
+#include "QUADSPI_ReadCache.h"
+
 // This component
 #include "../core/NVIC.h"
+#include "../gpio/PinGroup.h"
 #include "../rcc/RCC_Registers.h"
 #include "../utility/register.h"
 #include "../utility/bit_manipulation.h"
@@ -20,6 +24,7 @@
 // System libraries
 #include <cstdlib>
 #include <cstring>
+#include <initializer_list>
 
 
 namespace mcu {
@@ -40,18 +45,36 @@ void QUADSPI::init(Config& config)
 {
     init();
 
-    initClockPin(config.clkPinId);
-    initBankPins(config.bk1ncsPinId, config.bk1io0PinId, config.bk1io1PinId,
-                 config.bk1io2PinId, config.bk1io3PinId);
-    initBankPins(config.bk2ncsPinId, config.bk2io0PinId, config.bk2io1PinId,
-                 config.bk2io2PinId, config.bk2io3PinId);
+    // All pins are configured with a single register write per port
+    PinGroup pins;
+
+    for (auto pinId : {config.clkPinId,
+                       config.bk1ncsPinId, config.bk1io0PinId,
+                       config.bk1io1PinId, config.bk1io2PinId,
+                       config.bk1io3PinId,
+                       config.bk2ncsPinId, config.bk2io0PinId,
+                       config.bk2io1PinId, config.bk2io2PinId,
+                       config.bk2io3PinId}) {
+        pins.setAlternateFunctionMode(pinId, Pin::AF::AF10,
+                                      Pin::OutputSpeed::MEDIUM);
+    }
+
+    pins.apply();
 
     disable();
 
     setPrescaler(config.prescaler);
     setSampleShift(config.sampleShift);
     setFIFOThreshold(config.fifoThreshold);
-    setFlashSize(config.flashSize);
+    setDualFlashMode(config.dualFlash);
+
+    if (config.dualFlash) {
+        // Both devices together double the addressable memory
+        setFlashSize(config.flashSize + 1);
+    } else {
+        setFlashSize(config.flashSize);
+    }
+
     setCSHighTime(config.csHighTime);
     setClockPolarity(config.clockPolarity);
     setPollingMatchMode(config.pollingMatchMode);
@@ -71,103 +94,45 @@ void QUADSPI::deinit()
 
 void QUADSPI::initClockPin(Pin::Id clkPinId)
 {
-    auto af = Pin::AF::AF10;
-    auto speed = Pin::OutputSpeed::MEDIUM;
-
-    if (clkPinId != Pin::NONE) {
-        auto pin = Pin::get(clkPinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
+    PinGroup pins;
+    pins.setAlternateFunctionMode(clkPinId, Pin::AF::AF10,
+                                  Pin::OutputSpeed::MEDIUM);
+    pins.apply();
 }
 
 
 void QUADSPI::initBankPins(Pin::Id ncsPinId, Pin::Id io0PinId, Pin::Id io1PinId,
                            Pin::Id io2PinId, Pin::Id io3PinId)
 {
-    auto af = Pin::AF::AF10;
-    auto speed = Pin::OutputSpeed::MEDIUM;
-
-    if (ncsPinId != Pin::NONE) {
-        auto pin = Pin::get(ncsPinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
-
-    if (io0PinId != Pin::NONE) {
-        auto pin = Pin::get(io0PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
-
-    if (io1PinId != Pin::NONE) {
-        auto pin = Pin::get(io1PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
+    PinGroup pins;
 
-    if (io2PinId != Pin::NONE) {
-        auto pin = Pin::get(io2PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
+    for (auto pinId : {ncsPinId, io0PinId, io1PinId, io2PinId, io3PinId}) {
+        pins.setAlternateFunctionMode(pinId, Pin::AF::AF10,
+                                      Pin::OutputSpeed::MEDIUM);
     }
 
-    if (io3PinId != Pin::NONE) {
-        auto pin = Pin::get(io3PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
+    pins.apply();
 }
 
 
 void QUADSPI::deinitClockPin(Pin::Id clkPinId)
 {
-    if (clkPinId != Pin::NONE) {
-        auto pin = Pin::get(clkPinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+    PinGroup pins;
+    pins.setInputMode(clkPinId);
+    pins.apply();
 }
 
 
 void QUADSPI::deinitBankPins(Pin::Id ncsPinId, Pin::Id io0PinId, Pin::Id io1PinId,
                            Pin::Id io2PinId, Pin::Id io3PinId)
 {
-    if (ncsPinId != Pin::NONE) {
-        auto pin = Pin::get(ncsPinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
-
-    if (io0PinId != Pin::NONE) {
-        auto pin = Pin::get(io0PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+    PinGroup pins;
 
-    if (io1PinId != Pin::NONE) {
-        auto pin = Pin::get(io1PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
+    for (auto pinId : {ncsPinId, io0PinId, io1PinId, io2PinId, io3PinId}) {
+        pins.setInputMode(pinId);
     }
 
-    if (io2PinId != Pin::NONE) {
-        auto pin = Pin::get(io2PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
-
-    if (io3PinId != Pin::NONE) {
-        auto pin = Pin::get(io3PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+    pins.apply();
 }
 
 
@@ -251,6 +216,36 @@ void QUADSPI::selectMemory(MemorySelect memory)
 }
 
 
+void QUADSPI::setDualFlashMode(bool state)
+{
+    auto registers = getRegisters();
+
+    if (state) {
+        registers->CR = bitSet(registers->CR, QUADSPI_Registers::CR::DFM);
+    } else {
+        registers->CR = bitReset(registers->CR, QUADSPI_Registers::CR::DFM);
+    }
+
+    dualFlashMode = state;
+}
+
+
+bool QUADSPI::isDualFlashMode()
+{
+    return dualFlashMode;
+}
+
+
+uint32_t QUADSPI::getMemorySize()
+{
+    auto registers = getRegisters();
+
+    auto fsize = bitsValue(registers->DCR, 5, QUADSPI_Registers::DCR::FSIZE_0);
+
+    return (uint32_t)1 << (fsize + 1);
+}
+
+
 void QUADSPI::setAddress(volatile uint32_t address)
 {
     auto registers = getRegisters();
@@ -350,14 +345,35 @@ void QUADSPI::initTransaction(TransactionConfig& config)
     ccrValue = bitsReplace(ccrValue, (int)config.dataMode, 2,
             QUADSPI_Registers::CCR::DMODE_0);
 
-    setDataLength(config.dataLength);
+    if (config.functionalMode != FunctionalMode::MEMORY_MAPPED) {
+        setDataLength(config.dataLength);
+    }
+
     setAlternateBytes(config.alternateBytes);
 
     registers->CCR = ccrValue;
 
-    if (config.addressMode != AddressMode::NONE) {
+    if (config.addressMode != AddressMode::NONE
+            && config.functionalMode != FunctionalMode::MEMORY_MAPPED) {
         setAddress(config.address);
     }
+
+    if (readCache != nullptr
+            && config.functionalMode == FunctionalMode::INDIRECT_WRITE
+            && config.addressMode != AddressMode::NONE) {
+        if (config.dataMode != DataMode::NONE) {
+            readCache->invalidate(config.address, config.dataLength);
+        } else {
+            // Erase granularity is unknown here
+            readCache->invalidate();
+        }
+    }
+}
+
+
+void QUADSPI::setReadCache(QUADSPI_ReadCache* cache)
+{
+    readCache = cache;
 }
 
 
@@ -388,7 +404,16 @@ void QUADSPI::transmitData(uint8_t buffer[], int length)
 
 void QUADSPI::receiveData(uint8_t buffer[], int length)
 {
-    for (auto i = 0; i < length; i++) {
+    auto i = 0;
+
+    // Reading the data register stalls until enough bytes are available,
+    // so full words can be fetched without checking the FIFO level
+    for (; i + 4 <= length; i += 4) {
+        auto data = receiveWord();
+        memcpy(&buffer[i], &data, 4);
+    }
+
+    for (; i < length; i++) {
         buffer[i] = receiveByte();
     }
 }
@@ -431,6 +456,13 @@ bool QUADSPI::hasTransferComplete()
 }
 
 
+void QUADSPI::clearTransferComplete()
+{
+    auto registers = getRegisters();
+    registers->FCR = bitSet(registers->FCR, QUADSPI_Registers::FCR::CTCF);
+}
+
+
 void QUADSPI::waitWhileBusy()
 {
     while (isBusy()) {
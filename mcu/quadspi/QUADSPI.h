@@ -24,6 +24,9 @@
 namespace mcu {
 
 
+class QUADSPI_ReadCache;
+
+
 class QUADSPI
 {
     public:
@@ -106,6 +109,11 @@ class QUADSPI
          */
         typedef void(*CallbackFunc)(QUADSPI*, void*);
 
+        /**
+         * Base address of memory-mapped region
+         */
+        static constexpr uint32_t MEMORY_MAPPED_BASE_ADDRESS = 0x90000000;
+
         /**
          * Configuration settings
          */
@@ -125,7 +133,8 @@ class QUADSPI
             uint16_t prescaler = 32;
             bool sampleShift = false;
             uint8_t fifoThreshold = 1;
-            uint8_t flashSize = 22;             // 4MB (2 ** 22 bits)
+            uint8_t flashSize = 22;             // 4MB (2 ** 22 bits) per device
+            bool dualFlash = false;             // Use both banks in parallel
             uint8_t csHighTime = 1;
             ClockPolarity clockPolarity = ClockPolarity::LOW;
             PollingMatchMode pollingMatchMode = PollingMatchMode::AND;
@@ -274,6 +283,33 @@ class QUADSPI
          */
         void selectMemory(MemorySelect memory);
 
+        /**
+         * Enable/disable dual-flash mode
+         *
+         * In dual-flash mode, both banks receive the same command and address
+         * and data is interleaved bytewise: even bytes are stored in the
+         * device on bank 1, odd bytes in the device on bank 2. Addresses and
+         * data lengths refer to the combined memory and must be even.
+         * The flash size has to be set to the combined size of both devices.
+         *
+         * @param state         Dual-flash mode state
+         */
+        void setDualFlashMode(bool state);
+
+        /**
+         * Return dual-flash mode state
+         *
+         * @return              True if dual-flash mode is enabled
+         */
+        bool isDualFlashMode();
+
+        /**
+         * Return size of addressable memory, combined size in dual-flash mode
+         *
+         * @return              Size in bytes
+         */
+        uint32_t getMemorySize();
+
         /**
          * Set address
          *
@@ -333,10 +369,21 @@ class QUADSPI
         /**
          * Initialize a transaction
          *
+         * Indirect write transactions with an address phase invalidate the
+         * affected range of a registered read cache. Without a data phase
+         * (e.g. sector erase) the whole cache is invalidated.
+         *
          * @param config        Reference to configuration struct
          */
         void initTransaction(TransactionConfig& config);
 
+        /**
+         * Register read cache for invalidation on write transactions
+         *
+         * @param cache         Pointer to cache or nullptr
+         */
+        void setReadCache(QUADSPI_ReadCache* cache);
+
         /**
          * Set transfer complete callback function and enable interrupts in NVIC
          *
@@ -361,6 +408,29 @@ class QUADSPI
          */
         void receiveData(uint8_t buffer[], int length);
 
+        /**
+         * Return address of data register, used as peripheral address for DMA
+         *
+         * @return              Data register address
+         */
+        uint32_t getDataRegisterAddress()
+        {
+            return (uint32_t)&QUADSPI_Registers::get()->DR;
+        }
+
+        /**
+         * Return pointer to memory-mapped data, valid after a transaction
+         * with FunctionalMode::MEMORY_MAPPED was initialized
+         *
+         * @param address       Address inside memory, combined address in
+         *                      dual-flash mode
+         * @return              Pointer to data
+         */
+        const uint8_t* getMemoryMappedData(uint32_t address)
+        {
+            return (const uint8_t*)(MEMORY_MAPPED_BASE_ADDRESS + address);
+        }
+
         /**
          * Enable peripheral
          */
@@ -390,6 +460,11 @@ class QUADSPI
          */
         bool hasTransferComplete();
 
+        /**
+         * Clear transfer complete flag
+         */
+        void clearTransferComplete();
+
         /**
          * Wait until all data frame are processed
          */
@@ -491,6 +566,16 @@ class QUADSPI
          */
         uint32_t receiveWord();
 
+        /**
+         * Dual-flash mode state
+         */
+        bool dualFlashMode = false;
+
+        /**
+         * Registered read cache
+         */
+        QUADSPI_ReadCache* readCache = nullptr;
+
         /**
          * Callbacks
          */
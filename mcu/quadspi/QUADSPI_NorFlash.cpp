@@ -0,0 +1,238 @@
+/**
+ * @file        QUADSPI_NorFlash.cpp
+ *
+ * NOR flash device on QUADSPI peripheral of STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "QUADSPI_NorFlash.h"
+
+// System libraries
+#include <algorithm>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+void QUADSPI_NorFlash::init(Config& config)
+{
+    this->config = config;
+
+    dualFlash = quadspi.isDualFlashMode();
+
+    auto deviceCount = dualFlash ? 2 : 1;
+
+    size = config.deviceSize * deviceCount;
+    pageSize = config.pageSize * deviceCount;
+    sectorSize = config.sectorSize * deviceCount;
+}
+
+
+void QUADSPI_NorFlash::read(uint32_t address, uint8_t buffer[], int length)
+{
+    if (length <= 0) {
+        return;
+    }
+
+    if (readCache != nullptr) {
+        readCache->read(address, buffer, length);
+        return;
+    }
+
+    if (!dualFlash) {
+        readDirect(address, buffer, length);
+        return;
+    }
+
+    // Odd edges are read as full byte pairs
+    uint8_t pair[2];
+
+    if (address & 1) {
+        readDirect(address - 1, pair, 2);
+        *buffer++ = pair[1];
+        address++;
+        length--;
+    }
+
+    auto evenLength = length & ~1;
+
+    if (evenLength > 0) {
+        readDirect(address, buffer, evenLength);
+    }
+
+    if (length & 1) {
+        readDirect(address + evenLength, pair, 2);
+        buffer[evenLength] = pair[0];
+    }
+}
+
+
+void QUADSPI_NorFlash::program(uint32_t address, uint8_t data[], int length)
+{
+    while (length > 0) {
+        auto pageOffset = address % pageSize;
+        auto chunkLength = std::min(length, (int)(pageSize - pageOffset));
+
+        programPage(address, data, chunkLength);
+
+        address += chunkLength;
+        data += chunkLength;
+        length -= chunkLength;
+    }
+}
+
+
+void QUADSPI_NorFlash::eraseSector(uint32_t address)
+{
+    writeEnable();
+
+    QUADSPI::TransactionConfig transactionConfig;
+    transactionConfig.functionalMode = QUADSPI::FunctionalMode::INDIRECT_WRITE;
+    transactionConfig.instructionMode = QUADSPI::InstructionMode::ONE_LINE;
+    transactionConfig.instruction = config.sectorEraseInstruction;
+    transactionConfig.addressMode = QUADSPI::AddressMode::ONE_LINE;
+    transactionConfig.addressSize = config.addressSize;
+    transactionConfig.address = address - address % sectorSize;
+
+    quadspi.initTransaction(transactionConfig);
+    finishTransaction();
+
+    waitWhileBusy();
+}
+
+
+QUADSPI::TransactionConfig QUADSPI_NorFlash::getReadTransactionConfig()
+{
+    QUADSPI::TransactionConfig transactionConfig;
+    transactionConfig.functionalMode = QUADSPI::FunctionalMode::INDIRECT_READ;
+    transactionConfig.instructionMode = QUADSPI::InstructionMode::ONE_LINE;
+    transactionConfig.instruction = config.readInstruction;
+    transactionConfig.addressMode = QUADSPI::AddressMode::ONE_LINE;
+    transactionConfig.addressSize = config.addressSize;
+    transactionConfig.dummyCycles = config.readDummyCycles;
+    transactionConfig.dataMode = QUADSPI::DataMode::FOUR_LINES;
+
+    return transactionConfig;
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+void QUADSPI_NorFlash::readDirect(uint32_t address, uint8_t buffer[],
+                                  int length)
+{
+    auto transactionConfig = getReadTransactionConfig();
+    transactionConfig.address = address;
+    transactionConfig.dataLength = length;
+
+    quadspi.initTransaction(transactionConfig);
+    quadspi.receiveData(buffer, length);
+    finishTransaction();
+}
+
+
+void QUADSPI_NorFlash::programPage(uint32_t address, uint8_t data[],
+                                   int length)
+{
+    // Programming erased bits is a no-op, so odd edges in dual-flash mode
+    // are padded with the erased value
+    if (dualFlash && (address & 1)) {
+        uint8_t pair[2] = {ERASED_VALUE, data[0]};
+        programPage(address - 1, pair, 2);
+
+        address++;
+        data++;
+        length--;
+    }
+
+    if (dualFlash && (length & 1)) {
+        uint8_t pair[2] = {data[length - 1], ERASED_VALUE};
+        programPage(address + length - 1, pair, 2);
+
+        length--;
+    }
+
+    if (length <= 0) {
+        return;
+    }
+
+    writeEnable();
+
+    QUADSPI::TransactionConfig transactionConfig;
+    transactionConfig.functionalMode = QUADSPI::FunctionalMode::INDIRECT_WRITE;
+    transactionConfig.instructionMode = QUADSPI::InstructionMode::ONE_LINE;
+    transactionConfig.instruction = config.programInstruction;
+    transactionConfig.addressMode = QUADSPI::AddressMode::ONE_LINE;
+    transactionConfig.addressSize = config.addressSize;
+    transactionConfig.address = address;
+    transactionConfig.dataMode = QUADSPI::DataMode::ONE_LINE;
+    transactionConfig.dataLength = length;
+
+    quadspi.initTransaction(transactionConfig);
+    quadspi.transmitData(data, length);
+    quadspi.clearTransferComplete();
+
+    waitWhileBusy();
+}
+
+
+void QUADSPI_NorFlash::writeEnable()
+{
+    QUADSPI::TransactionConfig transactionConfig;
+    transactionConfig.functionalMode = QUADSPI::FunctionalMode::INDIRECT_WRITE;
+    transactionConfig.instructionMode = QUADSPI::InstructionMode::ONE_LINE;
+    transactionConfig.instruction = config.writeEnableInstruction;
+
+    quadspi.initTransaction(transactionConfig);
+    finishTransaction();
+}
+
+
+void QUADSPI_NorFlash::waitWhileBusy()
+{
+    QUADSPI::TransactionConfig transactionConfig;
+    transactionConfig.functionalMode = QUADSPI::FunctionalMode::INDIRECT_READ;
+    transactionConfig.instructionMode = QUADSPI::InstructionMode::ONE_LINE;
+    transactionConfig.instruction = config.readStatusInstruction;
+    transactionConfig.dataMode = QUADSPI::DataMode::ONE_LINE;
+
+    // One status byte per device, interleaved in dual-flash mode
+    auto length = dualFlash ? 2 : 1;
+    transactionConfig.dataLength = length;
+
+    uint8_t busyMask = 1 << config.busyBit;
+
+    while (true) {
+        uint8_t status[2] = {0, 0};
+
+        quadspi.initTransaction(transactionConfig);
+        quadspi.receiveData(status, length);
+        finishTransaction();
+
+        if (((status[0] | status[1]) & busyMask) == 0) {
+            break;
+        }
+    }
+}
+
+
+void QUADSPI_NorFlash::finishTransaction()
+{
+    quadspi.waitUntilTransferComplete();
+    quadspi.clearTransferComplete();
+}
+
+
+}   // namespace mcu
@@ -0,0 +1,158 @@
+/**
+ * @file        QUADSPI_NorFlash.h
+ *
+ * NOR flash device on QUADSPI peripheral of STM32L4xx
+ *
+ * Uses indirect mode for all accesses. In dual-flash mode, pages and sectors
+ * of both devices are combined, so their sizes are doubled.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "QUADSPI.h"
+#include "QUADSPI_ReadCache.h"
+
+// This component
+#include "../storage/FlashDevice.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class QUADSPI_NorFlash : public FlashDevice
+{
+    public:
+        /**
+         * Configuration settings, defaults match common serial NOR flash
+         */
+        struct Config
+        {
+            uint32_t deviceSize = 0x400000;             // Size of one device
+            uint32_t pageSize = 256;                    // Page size of one device
+            uint32_t sectorSize = 4096;                 // Sector size of one device
+            QUADSPI::AddressSize addressSize = QUADSPI::AddressSize::BITS_24;
+            uint8_t readInstruction = 0x6B;             // Fast read quad output
+            uint8_t readDummyCycles = 8;
+            uint8_t programInstruction = 0x02;          // Page program
+            uint8_t sectorEraseInstruction = 0x20;      // Sector erase
+            uint8_t writeEnableInstruction = 0x06;      // Write enable
+            uint8_t readStatusInstruction = 0x05;       // Read status register
+            uint8_t busyBit = 0;                        // Busy bit in status register
+        };
+
+        /**
+         * Constructor
+         *
+         * @param quadspi       Reference to initialized peripheral
+         */
+        QUADSPI_NorFlash(QUADSPI& quadspi) : quadspi(quadspi) {}
+
+        /**
+         * Disallow copy
+         */
+        QUADSPI_NorFlash(const QUADSPI_NorFlash&) = delete;
+        QUADSPI_NorFlash& operator = (const QUADSPI_NorFlash&) = delete;
+        QUADSPI_NorFlash& operator = (QUADSPI_NorFlash&&) = delete;
+
+        /**
+         * Init with config settings, dual-flash mode must be set before
+         *
+         * @param config        Reference to configuration struct
+         */
+        void init(Config& config);
+
+        virtual uint32_t getSize() override
+        {
+            return size;
+        }
+
+        virtual uint32_t getSectorSize() override
+        {
+            return sectorSize;
+        }
+
+        virtual void read(uint32_t address, uint8_t buffer[],
+                          int length) override;
+
+        virtual void program(uint32_t address, uint8_t data[],
+                             int length) override;
+
+        virtual void eraseSector(uint32_t address) override;
+
+        /**
+         * Serve reads from a cache, it must be initialized with the
+         * configuration returned by getReadTransactionConfig()
+         *
+         * @param cache         Pointer to cache or nullptr
+         */
+        void setReadCache(QUADSPI_ReadCache* cache)
+        {
+            readCache = cache;
+        }
+
+        /**
+         * Return transaction configuration of read command, e.g. for
+         * read cache or memory-mapped mode
+         *
+         * @return              Transaction configuration
+         */
+        QUADSPI::TransactionConfig getReadTransactionConfig();
+
+    protected:
+        /**
+         * Read data without cache, address and length must be even in
+         * dual-flash mode
+         */
+        void readDirect(uint32_t address, uint8_t buffer[], int length);
+
+        /**
+         * Program data within a single page
+         */
+        void programPage(uint32_t address, uint8_t data[], int length);
+
+        /**
+         * Send write enable command
+         */
+        void writeEnable();
+
+        /**
+         * Wait until the busy bit of all devices is cleared
+         */
+        void waitWhileBusy();
+
+        /**
+         * Wait for end of an indirect transaction and clear flag
+         */
+        void finishTransaction();
+
+        /**
+         * Reference to peripheral
+         */
+        QUADSPI& quadspi;
+
+        /**
+         * Configuration
+         */
+        Config config;
+        uint32_t size = 0;
+        uint32_t pageSize = 0;
+        uint32_t sectorSize = 0;
+        bool dualFlash = false;
+
+        /**
+         * Optional read cache
+         */
+        QUADSPI_ReadCache* readCache = nullptr;
+};
+
+
+}   // namespace mcu
@@ -0,0 +1,198 @@
+/**
+ * @file        QUADSPI_ReadCache.cpp
+ *
+ * Line based read cache for QUADSPI indirect mode on STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "QUADSPI_ReadCache.h"
+
+// System libraries
+#include <algorithm>
+#include <cstring>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+void QUADSPI_ReadCache::init(QUADSPI::TransactionConfig& readConfig,
+                             int lineSize, int lineCount)
+{
+    this->readConfig = readConfig;
+    this->readConfig.functionalMode = QUADSPI::FunctionalMode::INDIRECT_READ;
+
+    allocateLines(lineSize, lineCount);
+    resetStatistics();
+
+    quadspi.setReadCache(this);
+}
+
+
+void QUADSPI_ReadCache::deinit()
+{
+    quadspi.setReadCache(nullptr);
+
+    deallocateLines();
+}
+
+
+void QUADSPI_ReadCache::read(uint32_t address, uint8_t buffer[], int length)
+{
+    auto lineMask = (uint32_t)(lineSize - 1);
+
+    while (length > 0) {
+        auto tag = address & ~lineMask;
+        auto offset = address & lineMask;
+        auto chunkLength = std::min(length, lineSize - (int)offset);
+
+        auto index = findLine(tag);
+
+        if (index >= 0) {
+            hitCount++;
+        } else {
+            missCount++;
+            index = findVictim();
+            fillLine(index, tag);
+        }
+
+        lastUsed[index] = ++useCounter;
+
+        memcpy(buffer, &data[index * lineSize + offset], chunkLength);
+
+        address += chunkLength;
+        buffer += chunkLength;
+        length -= chunkLength;
+    }
+}
+
+
+void QUADSPI_ReadCache::invalidate()
+{
+    for (auto i = 0; i < lineCount; i++) {
+        tags[i] = INVALID_TAG;
+    }
+}
+
+
+void QUADSPI_ReadCache::invalidate(uint32_t address, uint32_t length)
+{
+    if (length == 0) {
+        return;
+    }
+
+    auto lineMask = (uint32_t)(lineSize - 1);
+    auto firstTag = address & ~lineMask;
+    auto lastTag = (address + length - 1) & ~lineMask;
+
+    for (auto i = 0; i < lineCount; i++) {
+        if (tags[i] != INVALID_TAG && tags[i] >= firstTag
+                && tags[i] <= lastTag) {
+            tags[i] = INVALID_TAG;
+        }
+    }
+}
+
+
+void QUADSPI_ReadCache::resetStatistics()
+{
+    hitCount = 0;
+    missCount = 0;
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+void QUADSPI_ReadCache::allocateLines(int lineSize, int lineCount)
+{
+    deallocateLines();
+
+    data = new uint8_t[lineSize * lineCount];
+    tags = new uint32_t[lineCount];
+    lastUsed = new uint32_t[lineCount];
+
+    this->lineSize = lineSize;
+    this->lineCount = lineCount;
+
+    for (auto i = 0; i < lineCount; i++) {
+        tags[i] = INVALID_TAG;
+        lastUsed[i] = 0;
+    }
+
+    useCounter = 0;
+}
+
+
+void QUADSPI_ReadCache::deallocateLines()
+{
+    if (data != nullptr) {
+        delete[] data;
+        delete[] tags;
+        delete[] lastUsed;
+    }
+
+    data = nullptr;
+    tags = nullptr;
+    lastUsed = nullptr;
+    lineSize = 0;
+    lineCount = 0;
+}
+
+
+int QUADSPI_ReadCache::findLine(uint32_t tag)
+{
+    for (auto i = 0; i < lineCount; i++) {
+        if (tags[i] == tag) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+int QUADSPI_ReadCache::findVictim()
+{
+    auto victim = 0;
+
+    for (auto i = 0; i < lineCount; i++) {
+        if (tags[i] == INVALID_TAG) {
+            return i;
+        }
+
+        // Unsigned difference keeps ordering valid on counter overflow
+        if (useCounter - lastUsed[i] > useCounter - lastUsed[victim]) {
+            victim = i;
+        }
+    }
+
+    return victim;
+}
+
+
+void QUADSPI_ReadCache::fillLine(int index, uint32_t tag)
+{
+    readConfig.address = tag;
+    readConfig.dataLength = lineSize;
+
+    quadspi.initTransaction(readConfig);
+    quadspi.receiveData(&data[index * lineSize], lineSize);
+    quadspi.waitUntilTransferComplete();
+    quadspi.clearTransferComplete();
+
+    tags[index] = tag;
+}
+
+
+}   // namespace mcu
@@ -0,0 +1,170 @@
+/**
+ * @file        QUADSPI_ReadCache.h
+ *
+ * Line based read cache for QUADSPI indirect mode on STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+// Local includes
+#include "QUADSPI.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class QUADSPI_ReadCache
+{
+    public:
+        /**
+         * Constructor
+         */
+        QUADSPI_ReadCache(QUADSPI& quadspi) : quadspi(quadspi) {}
+
+        /**
+         * Init and register cache with the peripheral
+         *
+         * The read configuration is used as template for fetching lines,
+         * address and data length are set by the cache.
+         *
+         * @param readConfig    Transaction configuration of read command
+         * @param lineSize      Size of a cache line in bytes, power of 2
+         * @param lineCount     Number of cache lines
+         */
+        void init(QUADSPI::TransactionConfig& readConfig, int lineSize,
+                  int lineCount);
+
+        /**
+         * Shutdown
+         */
+        void deinit();
+
+        /**
+         * Read data, fetching missing lines from memory
+         *
+         * @param address       Start address
+         * @param buffer        Buffer to be filled with data
+         * @param length        Number of bytes to read
+         */
+        void read(uint32_t address, uint8_t buffer[], int length);
+
+        /**
+         * Invalidate all lines
+         */
+        void invalidate();
+
+        /**
+         * Invalidate all lines overlapping an address range
+         *
+         * @param address       Start address
+         * @param length        Length of range in bytes
+         */
+        void invalidate(uint32_t address, uint32_t length);
+
+        /**
+         * Return number of line lookups served from cache
+         *
+         * @return              Number of hits
+         */
+        uint32_t getHitCount()
+        {
+            return hitCount;
+        }
+
+        /**
+         * Return number of line lookups that required a memory access
+         *
+         * @return              Number of misses
+         */
+        uint32_t getMissCount()
+        {
+            return missCount;
+        }
+
+        /**
+         * Reset hit and miss counters
+         */
+        void resetStatistics();
+
+    protected:
+        /**
+         * Tag value of an unused line
+         */
+        static const uint32_t INVALID_TAG = 0xFFFFFFFF;
+
+        /**
+         * Allocate lines on heap
+         *
+         * @param lineSize      Size of a cache line in bytes
+         * @param lineCount     Number of cache lines
+         */
+        void allocateLines(int lineSize, int lineCount);
+
+        /**
+         * Deallocate lines on heap
+         */
+        void deallocateLines();
+
+        /**
+         * Return index of line holding a tag
+         *
+         * @param tag           Line base address
+         * @return              Line index or -1 if not cached
+         */
+        int findLine(uint32_t tag);
+
+        /**
+         * Return index of least recently used line
+         *
+         * @return              Line index
+         */
+        int findVictim();
+
+        /**
+         * Fill line with memory content
+         *
+         * @param index         Line index
+         * @param tag           Line base address
+         */
+        void fillLine(int index, uint32_t tag);
+
+        /**
+         * Reference to QUADSPI peripheral
+         */
+        QUADSPI& quadspi;
+
+        /**
+         * Template for read transactions
+         */
+        QUADSPI::TransactionConfig readConfig;
+
+        /**
+         * Line storage
+         */
+        uint8_t* data = nullptr;
+        uint32_t* tags = nullptr;
+        uint32_t* lastUsed = nullptr;
+        int lineSize = 0;
+        int lineCount = 0;
+
+        /**
+         * Access counter for LRU replacement
+         */
+        uint32_t useCounter = 0;
+
+        /**
+         * Statistics
+         */
+        uint32_t hitCount = 0;
+        uint32_t missCount = 0;
+};
+
+
+}   // namespace mcu
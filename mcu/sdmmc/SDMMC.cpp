@@ -13,6 +13,10 @@
 
 // This component
 #include "../core/NVIC.h"
+#ifndef EXCLUDE_DMA
+#include "../dma/DMA_Channel.h"
+#endif
+#include "../gpio/PinGroup.h"
 #include "../rcc/RCC.h"
 #include "../rcc/RCC_Registers.h"
 #include "../utility/bit_manipulation.h"
@@ -22,6 +26,7 @@
 // System libraries
 #include <cstdlib>
 #include <cstring>
+#include <initializer_list>
 
 
 namespace mcu {
@@ -42,18 +47,40 @@ void SDMMC::init(Config& config)
 {
     init();
 
-    initClockPin(config.ckPinId);
-    initCommandPin(config.cmdPinId);
-    initDataPins(config.d0PinId,
-                 config.d1PinId,
-                 config.d2PinId,
-                 config.d3PinId,
-                 config.d4PinId,
-                 config.d5PinId,
-                 config.d6PinId,
-                 config.d7PinId);
+    // All pins are configured with a single register write per port
+    PinGroup pins;
+
+    for (auto pinId : {config.ckPinId, config.cmdPinId,
+                       config.d0PinId, config.d1PinId,
+                       config.d2PinId, config.d3PinId,
+                       config.d4PinId, config.d5PinId,
+                       config.d6PinId, config.d7PinId}) {
+        pins.setAlternateFunctionMode(pinId, Pin::AF::AF12,
+                                      Pin::OutputSpeed::MEDIUM);
+    }
+
+    pins.apply();
 
     clockFreq = config.clockFreq;
+    highSpeedEnable = config.highSpeedEnable;
+
+    // Use all 4 data lines if they are connected, the card is switched by
+    // initCard() if it supports them
+    if (config.d1PinId != Pin::NONE && config.d2PinId != Pin::NONE
+        && config.d3PinId != Pin::NONE) {
+        requestedBusWidth = BusWidth::FOUR_LINES;
+    } else {
+        requestedBusWidth = BusWidth::ONE_LINE;
+    }
+
+    setDMAEnable(config.dmaEnable, config.dmaChannelId);
+    setTransferCompleteCallback(config.transferCompleteCallback);
+    setTransferErrorCallback(config.transferErrorCallback);
+
+    readTimeout = config.readTimeout;
+    writeTimeout = config.writeTimeout;
+    retryCount = config.retryCount;
+    reinitEnable = config.reinitEnable;
 }
 
 
@@ -65,6 +92,11 @@ void SDMMC::deinit()
 
 SDMMC::Status SDMMC::initCard()
 {
+    cardInitialised = false;
+    busWidth = BusWidth::ONE_LINE;
+    highSpeed = false;
+    programmingPending = false;
+
     setClockEdge(ClockEdge::RISING);
     setClockDividerBypass(false);
     setClockPowerSave(false);
@@ -113,7 +145,8 @@ SDMMC::Status SDMMC::initCard()
 
     bool validVoltage = false;
 
-    int retryCount = 0;
+    // Card has to finish its power up within 1s
+    auto startTime = getMilliseconds();
 
     while (!validVoltage) {
         // Signal via CMD55 - APP_CMD that next command is application specific
@@ -151,10 +184,8 @@ SDMMC::Status SDMMC::initCard()
             highCapacity = response & 0x40000000;
         }
 
-        retryCount++;
-
-        if (retryCount > 0xFFFF) {
-            return Status::CMD_RESPONSE_TIMEOUT;
+        if (!validVoltage && getMilliseconds() - startTime > INIT_TIMEOUT) {
+            return Status::TIMEOUT;
         }
     }
 
@@ -216,6 +247,7 @@ SDMMC::Status SDMMC::initCard()
         csd[2] = getCommandResponse(2);
         csd[3] = getCommandResponse(3);
         ccc = csd[1] >> 20;
+        parseCSD();
     } else {
         if (cmd9response == CommandResponseStatus::CRC_FAIL) {
             return Status::CMD_RESPONSE_CRC_FAIL;
@@ -242,7 +274,7 @@ SDMMC::Status SDMMC::initCard()
         }
     }
 
-    retryCount = 0;
+    startTime = getMilliseconds();
 
     while (true) {
         // Get card status via CMD13 - SEND_STATUS
@@ -269,14 +301,64 @@ SDMMC::Status SDMMC::initCard()
             }
         }
 
-        retryCount++;
+        if (getMilliseconds() - startTime > INIT_TIMEOUT) {
+            return Status::TIMEOUT;
+        }
+    }
 
-        if (retryCount > 0xFFFF) {
-            return Status::CMD_RESPONSE_TIMEOUT;
+    if (!highCapacity) {
+        // Set block length of SDSC cards via CMD16 - SET_BLOCKLEN, it is
+        // fixed to 512 bytes on SDHC/SDXC
+        CommandConfig cmd16config;
+        cmd16config.cmdIndex = 16;
+        cmd16config.argument = BLOCK_SIZE;
+        cmd16config.reponseType = ResponseType::SHORT;
+        cmd16config.enableCPSM = true;
+        sendCommand(cmd16config);
+
+        auto cmd16response = waitForCommandResponse();
+
+        if (cmd16response != CommandResponseStatus::OK) {
+            return getCommandStatus(cmd16response);
+        }
+    }
+
+    auto status = readSCR();
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    // SD_BUS_WIDTHS bit 2 signals 4-bit support
+    auto busWidths = (scr[0] >> 16) & 0x0F;
+
+    if (requestedBusWidth == BusWidth::FOUR_LINES && (busWidths & 0b0100)) {
+        status = switchToWideBus();
+
+        if (status != Status::OK) {
+            return status;
         }
+
+        busWidth = BusWidth::FOUR_LINES;
+    }
+
+    // CMD6 requires SD_SPEC 1.10 or later and command class 10
+    auto sdSpec = (scr[0] >> 24) & 0x0F;
+
+    if (highSpeedEnable && sdSpec >= 1 && (ccc & (1 << 10))) {
+        highSpeed = (switchToHighSpeed() == Status::OK);
+    }
+
+    // TRAN_SPEED of CSD only covers default speed mode
+    auto maxClockFreq = highSpeed ? HIGH_SPEED_MAX_CLOCK_FREQ
+                                  : DEFAULT_SPEED_MAX_CLOCK_FREQ;
+
+    if (!highSpeed && cardInfo.maxTransferRate != 0
+        && cardInfo.maxTransferRate < maxClockFreq) {
+        maxClockFreq = cardInfo.maxTransferRate;
     }
 
-    setClockFreq(clockFreq);
+    setClockFreq(clockFreq < maxClockFreq ? clockFreq : maxClockFreq);
 
     cardInitialised = true;
 
@@ -300,29 +382,19 @@ bool SDMMC::isCardInitialised()
 
 void SDMMC::initClockPin(Pin::Id ckPinId)
 {
-    auto af = Pin::AF::AF12;
-    auto speed = Pin::OutputSpeed::MEDIUM;
-
-    if (ckPinId != Pin::NONE) {
-        auto pin = Pin::get(ckPinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
+    PinGroup pins;
+    pins.setAlternateFunctionMode(ckPinId, Pin::AF::AF12,
+                                  Pin::OutputSpeed::MEDIUM);
+    pins.apply();
 }
 
 
 void SDMMC::initCommandPin(Pin::Id cmdPinId)
 {
-    auto af = Pin::AF::AF12;
-    auto speed = Pin::OutputSpeed::MEDIUM;
-
-    if (cmdPinId != Pin::NONE) {
-        auto pin = Pin::get(cmdPinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
+    PinGroup pins;
+    pins.setAlternateFunctionMode(cmdPinId, Pin::AF::AF12,
+                                  Pin::OutputSpeed::MEDIUM);
+    pins.apply();
 }
 
 
@@ -330,84 +402,31 @@ void SDMMC::initDataPins(Pin::Id d0PinId, Pin::Id d1PinId, Pin::Id d2PinId,
                          Pin::Id d3PinId, Pin::Id d4PinId, Pin::Id d5PinId,
                          Pin::Id d6PinId, Pin::Id d7PinId)
 {
-    auto af = Pin::AF::AF12;
-    auto speed = Pin::OutputSpeed::MEDIUM;
-
-    if (d0PinId != Pin::NONE) {
-        auto pin = Pin::get(d0PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
-
-    if (d1PinId != Pin::NONE) {
-        auto pin = Pin::get(d1PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
-
-    if (d2PinId != Pin::NONE) {
-        auto pin = Pin::get(d2PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
-
-    if (d3PinId != Pin::NONE) {
-        auto pin = Pin::get(d3PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
-
-    if (d4PinId != Pin::NONE) {
-        auto pin = Pin::get(d4PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
-
-    if (d5PinId != Pin::NONE) {
-        auto pin = Pin::get(d5PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
+    PinGroup pins;
 
-    if (d6PinId != Pin::NONE) {
-        auto pin = Pin::get(d6PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
+    for (auto pinId : {d0PinId, d1PinId, d2PinId, d3PinId,
+                       d4PinId, d5PinId, d6PinId, d7PinId}) {
+        pins.setAlternateFunctionMode(pinId, Pin::AF::AF12,
+                                      Pin::OutputSpeed::MEDIUM);
     }
 
-    if (d7PinId != Pin::NONE) {
-        auto pin = Pin::get(d7PinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(speed);
-        pin.setAlternateFunction(af);
-    }
+    pins.apply();
 }
 
 
 void SDMMC::deinitClockPin(Pin::Id ckPinId)
 {
-    if (ckPinId != Pin::NONE) {
-        auto pin = Pin::get(ckPinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+    PinGroup pins;
+    pins.setInputMode(ckPinId);
+    pins.apply();
 }
 
 
 void SDMMC::deinitCommandPin(Pin::Id cmdPinId)
 {
-    if (cmdPinId != Pin::NONE) {
-        auto pin = Pin::get(cmdPinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+    PinGroup pins;
+    pins.setInputMode(cmdPinId);
+    pins.apply();
 }
 
 
@@ -415,61 +434,42 @@ void SDMMC::deinitDataPins(Pin::Id d0PinId, Pin::Id d1PinId, Pin::Id d2PinId,
                            Pin::Id d3PinId, Pin::Id d4PinId, Pin::Id d5PinId,
                            Pin::Id d6PinId, Pin::Id d7PinId)
 {
-    if (d0PinId != Pin::NONE) {
-        auto pin = Pin::get(d0PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+    PinGroup pins;
 
-    if (d1PinId != Pin::NONE) {
-        auto pin = Pin::get(d1PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
+    for (auto pinId : {d0PinId, d1PinId, d2PinId, d3PinId,
+                       d4PinId, d5PinId, d6PinId, d7PinId}) {
+        pins.setInputMode(pinId);
     }
 
-    if (d2PinId != Pin::NONE) {
-        auto pin = Pin::get(d2PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+    pins.apply();
+}
 
-    if (d3PinId != Pin::NONE) {
-        auto pin = Pin::get(d3PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
 
-    if (d4PinId != Pin::NONE) {
-        auto pin = Pin::get(d4PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+void SDMMC::setClockFreq(uint32_t clockFreq)
+{
+    // Kernel clock is HSI48
+    const uint32_t SDMMC_CLOCK_FREQ = 48000000;
 
-    if (d5PinId != Pin::NONE) {
-        auto pin = Pin::get(d5PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
+    if (clockFreq >= SDMMC_CLOCK_FREQ) {
+        setClockDividerBypass(true);
+        currentClockFreq = SDMMC_CLOCK_FREQ;
+        return;
     }
 
-    if (d6PinId != Pin::NONE) {
-        auto pin = Pin::get(d6PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+    setClockDividerBypass(false);
 
-    if (d7PinId != Pin::NONE) {
-        auto pin = Pin::get(d7PinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
-}
+    // SDMMC_CK = SDMMCCLK / (CLKDIV + 2), round up the divider so the
+    // requested frequency is not exceeded
+    auto clockDiv = (SDMMC_CLOCK_FREQ + clockFreq - 1) / clockFreq;
 
+    if (clockDiv < 2) {
+        clockDiv = 2;
+    } else if (clockDiv > 255) {
+        clockDiv = 255;
+    }
 
-void SDMMC::setClockFreq(uint32_t clockFreq)
-{
-    const uint32_t SDMMC_CLOCK_FREQ = 50000000;
-    auto clockDiv = SDMMC_CLOCK_FREQ / clockFreq;
     setClockDivider(clockDiv);
+    currentClockFreq = SDMMC_CLOCK_FREQ / clockDiv;
 }
 
 
@@ -641,14 +641,23 @@ SDMMC::CommandResponseStatus SDMMC::waitForCommandResponse()
 
     volatile uint32_t status = 0;
 
+    // Hardware timeout is 64 card clocks, software timeout only matters
+    // if the clock is stopped
+    auto timestamp = getMilliseconds();
+    auto timeout = false;
+
     do {
         status = registers->STA;
+        if (getMilliseconds() - timestamp > COMMAND_TIMEOUT) {
+            timeout = true;
+        }
     } while ((bitValue(status, SDMMC_Registers::STA::CMDACT) != 0)
              && (bitValue(status, SDMMC_Registers::STA::CMDREND) == 0)
              && (bitValue(status, SDMMC_Registers::STA::CCRCFAIL) == 0)
-             && (bitValue(status, SDMMC_Registers::STA::CTIMEOUT) == 0));
+             && (bitValue(status, SDMMC_Registers::STA::CTIMEOUT) == 0)
+             && !timeout);
 
-    if (bitValue(status, SDMMC_Registers::STA::CTIMEOUT)) {
+    if (bitValue(status, SDMMC_Registers::STA::CTIMEOUT) || timeout) {
         registers->ICR
             = bitSet(registers->ICR, SDMMC_Registers::ICR::CTIMEOUTC);
         return CommandResponseStatus::TIMEOUT;
@@ -706,155 +715,267 @@ SDMMC::CardState SDMMC::getCardState()
 
 SDMMC::Status SDMMC::readBlock(uint8_t buffer[], uint32_t blockNo)
 {
-    clearDataStatusFlags();
+    return readBlocks(buffer, blockNo, 1);
+}
 
-    auto registers = getRegisters();
 
-    // Configure data path
-    registers->DTIMER = 0xFFFFFFFF;
-    registers->DLEN = bitsReplace(registers->DLEN, 512, 12, 0);
+SDMMC::Status SDMMC::writeBlock(uint8_t buffer[], uint32_t blockNo)
+{
+    return writeBlocks(buffer, blockNo, 1);
+}
 
-    uint32_t value = 0;
-    value = bitSet(value, SDMMC_Registers::DCTRL::DTDIR);
-    value = bitsReplace(value, 0b1001, 4, SDMMC_Registers::DCTRL::DBLOCKSIZE_0);
-    value = bitSet(value, SDMMC_Registers::DCTRL::DTEN);
-    registers->DCTRL = value;
 
-    // Read via CMD17 - READ_SINGLE_BLOCK
-    CommandConfig cmd17config;
-    cmd17config.cmdIndex = 17;
-    cmd17config.argument = blockNo; // Data address
-    cmd17config.reponseType = ResponseType::SHORT;
+SDMMC::Status SDMMC::readBlocks(uint8_t buffer[], uint32_t blockNo,
+                                uint32_t blockCount)
+{
+    return transferBlocks(buffer, blockNo, blockCount, true);
+}
 
-    sendCommand(cmd17config);
 
-    auto cmd17response = waitForCommandResponse();
+SDMMC::Status SDMMC::writeBlocks(uint8_t buffer[], uint32_t blockNo,
+                                 uint32_t blockCount)
+{
+    return transferBlocks(buffer, blockNo, blockCount, false);
+}
 
-    if (cmd17response != CommandResponseStatus::OK) {
-        if (cmd17response == CommandResponseStatus::CRC_FAIL) {
-            return Status::CMD_RESPONSE_CRC_FAIL;
-        } else {
-            return Status::CMD_RESPONSE_TIMEOUT;
-        }
-    }
 
-    uint32_t bufferIndex = 0;
+void SDMMC::setDMAEnable(bool state, DMA_Base::ChannelId channelId)
+{
+#ifndef EXCLUDE_DMA
+    dmaEnabled = state;
+    dmaChannelId = channelId;
 
-    volatile uint32_t status = 0;
+    if (!state) {
+        return;
+    }
 
-    do {
-        status = registers->STA;
-        if (bitValue(status, SDMMC_Registers::STA::RXFIFOHF)) {
-            // FIFO contains at least 8 values
-            for (auto i = 0; i < 8; i++) {
-                auto data = registers->FIFO;
-                buffer[bufferIndex++] = data & 0xFF;
-                buffer[bufferIndex++] = (data >> 8) & 0xFF;
-                buffer[bufferIndex++] = (data >> 16) & 0xFF;
-                buffer[bufferIndex++] = (data >> 24) & 0xFF;
-            }
-        }
-    } while ((bitValue(status, SDMMC_Registers::STA::RXOVERR) == 0)
-             && (bitValue(status, SDMMC_Registers::STA::DATAEND) == 0)
-             && (bitValue(status, SDMMC_Registers::STA::DCRCFAIL) == 0)
-             && (bitValue(status, SDMMC_Registers::STA::DTIMEOUT) == 0)
-             && (bufferIndex <= (512 - 32)));
+    DMA_Channel::Config dmaConfig;
+    dmaConfig.peripheralAddress = (uint32_t)&getRegisters()->FIFO;
+    dmaConfig.memoryIncrement = true;
+    dmaConfig.peripheralSize = DMA_Channel::TransferSize::BITS_32;
+    dmaConfig.memorySize = DMA_Channel::TransferSize::BITS_32;
+    dmaConfig.priorityLevel = DMA_Channel::PriorityLevel::VERY_HIGH;
 
-    // Empty FIFO if there is some data remaining
-    while (bitValue(registers->STA, SDMMC_Registers::STA::RXDAVL)) {
-        __attribute__((unused)) auto data = registers->FIFO;
+    if (channelId == DMA_Base::CH5) {
+        dmaConfig.requestPeripheral
+            = DMA_Channel::RequestPeripheral::DMA2_CH5_SDMMC1;
+    } else {
+        dmaConfig.requestPeripheral
+            = DMA_Channel::RequestPeripheral::DMA2_CH4_SDMMC1;
     }
 
-    if (bitValue(status, SDMMC_Registers::STA::DTIMEOUT)) {
-        return Status::DATA_TIMEOUT;
-    } else if (bitValue(status, SDMMC_Registers::STA::DCRCFAIL)) {
-        return Status::DATA_CRC_FAIL;
-    }
+    auto dma = DMA_Channel::get(DMA_Base::DMA2, channelId);
+    dma.init(dmaConfig);
+#else
+    (void)state;
+    (void)channelId;
+#endif
+}
 
-    while (getCardState() != CardState::TRANSFER) {
-        // Wait until card is in transfer state again
+
+SDMMC::Status SDMMC::startReadBlocks(uint8_t buffer[], uint32_t blockNo,
+                                     uint32_t blockCount)
+{
+    return submitRequest(buffer, blockNo, blockCount, true, false);
+}
+
+
+SDMMC::Status SDMMC::startWriteBlocks(uint8_t buffer[], uint32_t blockNo,
+                                      uint32_t blockCount)
+{
+    return submitRequest(buffer, blockNo, blockCount, false, false);
+}
+
+
+SDMMC::BusWidth SDMMC::getBusWidth()
+{
+    return busWidth;
+}
+
+
+bool SDMMC::isHighSpeed()
+{
+    return highSpeed;
+}
+
+
+uint32_t SDMMC::getBlockCount()
+{
+    if (!cardInitialised) {
+        return 0;
     }
 
-    return Status::OK;
+    return cardInfo.blockCount;
 }
 
 
-SDMMC::Status SDMMC::writeBlock(uint8_t buffer[], uint32_t blockNo)
+const SDMMC::CardInfo& SDMMC::getCardInfo()
 {
-    clearDataStatusFlags();
+    return cardInfo;
+}
 
-    auto registers = getRegisters();
 
-    // Configure data path
-    registers->DTIMER = 0xFFFFFFFF;
-    registers->DLEN = bitsReplace(registers->DLEN, 512, 12, 0);
+SDMMC::Status SDMMC::erase(uint32_t blockNo, uint32_t blockCount,
+                           EraseMode mode)
+{
+    if (transferActive) {
+        return Status::BUSY;
+    }
 
-    uint32_t value = 0;
-    value = bitsReplace(value, 0b1001, 4, SDMMC_Registers::DCTRL::DBLOCKSIZE_0);
-    value = bitSet(value, SDMMC_Registers::DCTRL::DTEN);
-    registers->DCTRL = value;
+    if (!cardInitialised) {
+        return Status::NOT_INITIALISED;
+    }
 
-    // Write via CMD24 - WRITE_BLOCK
-    CommandConfig cmd24config;
-    cmd24config.cmdIndex = 24;
-    cmd24config.argument = blockNo; // Data address
-    cmd24config.reponseType = ResponseType::SHORT;
+    if (blockCount == 0 || blockNo >= cardInfo.blockCount
+        || blockCount > cardInfo.blockCount - blockNo) {
+        return Status::INVALID_PARAMETER;
+    }
 
-    sendCommand(cmd24config);
+    // Erase commands belong to command class 5
+    if (!(ccc & (1 << 5))) {
+        return Status::NOT_SUPPORTED;
+    }
 
-    auto cmd24response = waitForCommandResponse();
+    // Discard requires SD 5.0 or later. SD_SPECX in SCR bits 41:38 is
+    // only valid with SD_SPEC 2 and SD_SPEC3 set, 1 means version 5.xx.
+    auto sdSpec = (scr[0] >> 24) & 0x0F;
+    auto sdSpec3 = (scr[0] >> 15) & 0x01;
+    auto sdSpecX = (scr[0] >> 6) & 0x0F;
 
-    if (cmd24response != CommandResponseStatus::OK) {
-        if (cmd24response == CommandResponseStatus::CRC_FAIL) {
-            return Status::CMD_RESPONSE_CRC_FAIL;
-        } else {
-            return Status::CMD_RESPONSE_TIMEOUT;
-        }
+    if (mode == EraseMode::DISCARD
+        && (sdSpec != 2 || sdSpec3 != 1 || sdSpecX < 1)) {
+        mode = EraseMode::ERASE;
     }
 
-    uint32_t bufferIndex = 0;
+    auto status = waitUntilReady();
 
-    volatile uint32_t status = 0;
+    if (status != Status::OK) {
+        return status;
+    }
 
-    do {
-        status = registers->STA;
-        if (bitValue(status, SDMMC_Registers::STA::TXFIFOHE)) {
-            // FIFO contains less than 8 values
-            for (auto i = 0; i < 8; i++) {
-                auto data = (uint32_t)buffer[bufferIndex]
-                                   | ((uint32_t)buffer[bufferIndex + 1] << 8)
-                                   | ((uint32_t)buffer[bufferIndex + 2] << 16)
-                                   | ((uint32_t)buffer[bufferIndex + 3] << 24);
-                bufferIndex += 4;
-                registers->FIFO = data;
-            }
-        }
-    } while ((bitValue(status, SDMMC_Registers::STA::TXUNDERR) == 0)
-             && (bitValue(status, SDMMC_Registers::STA::DATAEND) == 0)
-             && (bitValue(status, SDMMC_Registers::STA::DCRCFAIL) == 0)
-             && (bitValue(status, SDMMC_Registers::STA::DTIMEOUT) == 0)
-             && (bufferIndex <= (512 - 32)));
+    // Set range via CMD32 - ERASE_WR_BLK_START and CMD33 - ERASE_WR_BLK_END
+    CommandConfig cmd32config;
+    cmd32config.cmdIndex = 32;
+    cmd32config.argument = getDataAddress(blockNo);
+    cmd32config.reponseType = ResponseType::SHORT;
+    sendCommand(cmd32config);
 
-    while (bitValue(registers->STA, SDMMC_Registers::STA::TXDAVL)) {
-        // While until FIFO is empty
+    status = getCommandStatus(waitForCommandResponse());
+
+    if (status != Status::OK) {
+        return status;
     }
 
-    if (bitValue(status, SDMMC_Registers::STA::DTIMEOUT)) {
-        return Status::DATA_TIMEOUT;
-    } else if (bitValue(status, SDMMC_Registers::STA::DCRCFAIL)) {
-        return Status::DATA_CRC_FAIL;
+    CommandConfig cmd33config;
+    cmd33config.cmdIndex = 33;
+    cmd33config.argument = getDataAddress(blockNo + blockCount - 1);
+    cmd33config.reponseType = ResponseType::SHORT;
+    sendCommand(cmd33config);
+
+    status = getCommandStatus(waitForCommandResponse());
+
+    if (status != Status::OK) {
+        return status;
     }
 
-    while (getCardState() != CardState::TRANSFER) {
-        // Wait until card is in transfer state again
+    // Start erase via CMD38 - ERASE
+    CommandConfig cmd38config;
+    cmd38config.cmdIndex = 38;
+    cmd38config.argument = (uint32_t)mode;
+    cmd38config.reponseType = ResponseType::SHORT;
+    sendCommand(cmd38config);
+
+    status = getCommandStatus(waitForCommandResponse());
+
+    if (status != Status::OK) {
+        return status;
     }
 
-    return Status::OK;
+    // Card is busy until erase is finished
+    auto auCount = (blockCount + ERASE_AU_BLOCK_COUNT - 1)
+                   / ERASE_AU_BLOCK_COUNT;
+
+    return waitUntilTransferState(writeTimeout
+                                  + auCount * ERASE_TIMEOUT_PER_AU);
+}
+
+
+bool SDMMC::isTransferActive()
+{
+    return transferActive;
+}
+
+
+SDMMC::Status SDMMC::getTransferStatus()
+{
+    return transferStatus;
+}
+
+
+void SDMMC::setTransferCompleteCallback(CallbackFunc func, void* context)
+{
+    transferCompleteCallback = func;
+    transferCompleteCallbackContext = context;
+}
+
+
+void SDMMC::setTransferErrorCallback(CallbackFunc func, void* context)
+{
+    transferErrorCallback = func;
+    transferErrorCallbackContext = context;
+}
+
+
+SDMMC::CallbackFunc SDMMC::getTransferCompleteCallback(void*& context)
+{
+    context = transferCompleteCallbackContext;
+    return transferCompleteCallback;
+}
+
+
+SDMMC::CallbackFunc SDMMC::getTransferErrorCallback(void*& context)
+{
+    context = transferErrorCallbackContext;
+    return transferErrorCallback;
 }
 
 
 void SDMMC::irq()
 {
+    auto registers = getRegisters();
+
+    uint32_t status = registers->STA & registers->MASK;
+
+    if (requestState == RequestState::IDLE || status == 0) {
+        return;
+    }
+
+    // Command phase is handled first, a read may already have data pending
+    if (bitValue(status, SDMMC_Registers::STA::CMDREND)
+        || bitValue(status, SDMMC_Registers::STA::CCRCFAIL)
+        || bitValue(status, SDMMC_Registers::STA::CTIMEOUT)) {
+        auto commandStatus = Status::OK;
+
+        if (bitValue(status, SDMMC_Registers::STA::CTIMEOUT)) {
+            commandStatus = Status::CMD_RESPONSE_TIMEOUT;
+        } else if (bitValue(status, SDMMC_Registers::STA::CCRCFAIL)) {
+            commandStatus = Status::CMD_RESPONSE_CRC_FAIL;
+        }
+
+        uint32_t value = 0;
+        value = bitSet(value, SDMMC_Registers::ICR::CMDRENDC);
+        value = bitSet(value, SDMMC_Registers::ICR::CCRCFAILC);
+        value = bitSet(value, SDMMC_Registers::ICR::CTIMEOUTC);
+        registers->ICR = value;
+
+        processCommandResponse(commandStatus);
+
+        status = registers->STA & registers->MASK;
+    }
+
+    if (requestState == RequestState::DATA) {
+        processData(status);
+    }
 }
 
 
@@ -929,5 +1050,1102 @@ void SDMMC::clearDataStatusFlags()
 }
 
 
+void SDMMC::parseCSD()
+{
+    cardInfo = CardInfo();
+
+    // CSD_STRUCTURE in bits 127:126
+    auto csdStructure = csd[0] >> 30;
+
+    if (csdStructure == 1) {
+        // Version 2.0: C_SIZE in bits 69:48, units of 512 KiB
+        auto cSize = ((csd[1] & 0x3F) << 16) | (csd[2] >> 16);
+
+        cardInfo.csdVersion = 2;
+        cardInfo.blockCount = (cSize + 1) * 1024;
+    } else {
+        // Version 1.0: C_SIZE in bits 73:62, C_SIZE_MULT in bits 49:47,
+        // READ_BL_LEN in bits 83:80
+        auto cSize = ((csd[1] & 0x3FF) << 2) | (csd[2] >> 30);
+        auto cSizeMult = (csd[2] >> 15) & 0x07;
+        auto readBlockLength = (csd[1] >> 16) & 0x0F;
+
+        if (readBlockLength < 9) {
+            readBlockLength = 9;
+        }
+
+        // Block length is 512 to 2048 bytes, shift avoids overflow on
+        // 2 GB cards
+        cardInfo.csdVersion = 1;
+        cardInfo.blockCount = (cSize + 1)
+                              << (cSizeMult + 2 + readBlockLength - 9);
+    }
+
+    // TRAN_SPEED in bits 103:96, transfer rate unit in bits 2:0 and time
+    // value multiplied by 10 in bits 6:3
+    static const uint8_t timeValues[16] = {
+        0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80
+    };
+
+    static const uint32_t rateUnits[4] = {
+        10000, 100000, 1000000, 10000000
+    };
+
+    auto tranSpeed = csd[0] & 0xFF;
+    auto rateUnit = tranSpeed & 0x07;
+
+    if (rateUnit < 4) {
+        cardInfo.maxTransferRate = rateUnits[rateUnit]
+                                   * timeValues[(tranSpeed >> 3) & 0x0F];
+    }
+
+    // ERASE_BLK_EN in bit 46 allows erasing single write blocks, otherwise
+    // SECTOR_SIZE in bits 45:39 gives the erase unit in units of
+    // WRITE_BL_LEN in bits 25:22
+    auto eraseBlockEnable = (csd[2] >> 14) & 0x01;
+    auto sectorSize = ((csd[2] >> 7) & 0x7F) + 1;
+    auto writeBlockLength = (csd[3] >> 22) & 0x0F;
+
+    if (writeBlockLength < 9) {
+        writeBlockLength = 9;
+    }
+
+    if (eraseBlockEnable) {
+        cardInfo.eraseSectorSize = 1;
+    } else {
+        cardInfo.eraseSectorSize = sectorSize << (writeBlockLength - 9);
+    }
+}
+
+
+SDMMC::Status SDMMC::readSCR()
+{
+    auto status = sendAppCommand();
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    // Read 8 bytes of SCR via ACMD51 - SEND_SCR
+    CommandConfig acmd51config;
+    acmd51config.cmdIndex = 51;
+    acmd51config.reponseType = ResponseType::SHORT;
+
+    uint8_t data[8];
+
+    status = readCommandData(acmd51config, data, sizeof(data));
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    // Data is sent MSB first
+    scr[0] = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16)
+             | ((uint32_t)data[2] << 8) | data[3];
+    scr[1] = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16)
+             | ((uint32_t)data[6] << 8) | data[7];
+
+    return Status::OK;
+}
+
+
+SDMMC::Status SDMMC::switchToWideBus()
+{
+    // Disconnect pull-up on DAT3 via ACMD42 - SET_CLR_CARD_DETECT
+    auto status = sendAppCommand();
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    CommandConfig acmd42config;
+    acmd42config.cmdIndex = 42;
+    acmd42config.reponseType = ResponseType::SHORT;
+    sendCommand(acmd42config);
+
+    status = getCommandStatus(waitForCommandResponse());
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    status = sendAppCommand();
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    // Select 4-bit bus via ACMD6 - SET_BUS_WIDTH
+    CommandConfig acmd6config;
+    acmd6config.cmdIndex = 6;
+    acmd6config.argument = 0b10;
+    acmd6config.reponseType = ResponseType::SHORT;
+    sendCommand(acmd6config);
+
+    status = getCommandStatus(waitForCommandResponse());
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    setBusWidth(BusWidth::FOUR_LINES);
+
+    return Status::OK;
+}
+
+
+SDMMC::Status SDMMC::switchToHighSpeed()
+{
+    // Set function group 1 to high-speed via CMD6 - SWITCH_FUNC,
+    // all other groups keep their current function
+    CommandConfig cmd6config;
+    cmd6config.cmdIndex = 6;
+    cmd6config.argument = 0x80FFFFF1;
+    cmd6config.reponseType = ResponseType::SHORT;
+
+    uint8_t data[64];
+
+    auto status = readCommandData(cmd6config, data, sizeof(data));
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    // Bits 379:376 of status hold the function selected for group 1
+    if ((data[16] & 0x0F) != 0x01) {
+        return Status::CMD_ERROR;
+    }
+
+    // Card switches after 8 clocks, wait a bit longer at the old frequency
+    delayMicroseconds(10);
+
+    return Status::OK;
+}
+
+
+SDMMC::Status SDMMC::readCommandData(CommandConfig& config, uint8_t buffer[],
+                                     uint32_t length)
+{
+    startDataPath(length, true, false, length);
+
+    sendCommand(config);
+
+    auto cmdResponse = waitForCommandResponse();
+
+    if (cmdResponse != CommandResponseStatus::OK) {
+        getRegisters()->DCTRL = 0;
+        return getCommandStatus(cmdResponse);
+    }
+
+    return receiveData(buffer, length);
+}
+
+
+SDMMC::Status SDMMC::getCommandStatus(CommandResponseStatus response)
+{
+    switch (response) {
+        case CommandResponseStatus::OK:
+            return Status::OK;
+        case CommandResponseStatus::CRC_FAIL:
+            return Status::CMD_RESPONSE_CRC_FAIL;
+        case CommandResponseStatus::TIMEOUT:
+            return Status::CMD_RESPONSE_TIMEOUT;
+    }
+
+    return Status::CMD_ERROR;
+}
+
+
+void SDMMC::startDataPath(uint32_t length, bool receive, bool dma,
+                          uint32_t blockSize)
+{
+    clearDataStatusFlags();
+
+    auto registers = getRegisters();
+
+    // Data timeout in card clock cycles
+    auto timeout = receive ? readTimeout : writeTimeout;
+    registers->DTIMER = timeout * (currentClockFreq / 1000);
+    registers->DLEN = bitsReplace(registers->DLEN, length, 25, 0);
+
+    uint32_t value = 0;
+
+    if (receive) {
+        value = bitSet(value, SDMMC_Registers::DCTRL::DTDIR);
+    }
+
+    if (dma) {
+        value = bitSet(value, SDMMC_Registers::DCTRL::DMAEN);
+    }
+
+    // Block size is encoded as power of 2
+    uint32_t blockSizePower = 0;
+
+    while ((1U << blockSizePower) < blockSize) {
+        blockSizePower++;
+    }
+
+    value = bitsReplace(value, blockSizePower, 4,
+                        SDMMC_Registers::DCTRL::DBLOCKSIZE_0);
+    value = bitSet(value, SDMMC_Registers::DCTRL::DTEN);
+    registers->DCTRL = value;
+}
+
+
+void SDMMC::startDMA(uint8_t buffer[], uint32_t length, bool receive)
+{
+#ifndef EXCLUDE_DMA
+    auto dma = DMA_Channel::get(DMA_Base::DMA2, dmaChannelId);
+
+    dma.disable();
+    dma.clearComplete();
+    dma.clearHalfComplete();
+    dma.clearError();
+
+    dma.setDirection(receive ? DMA_Channel::Direction::PERIPHERAL_TO_MEMORY
+                             : DMA_Channel::Direction::MEMORY_TO_PERIPHERAL);
+    dma.setMemoryAddress((uint32_t)buffer);
+    dma.setTransferLength(length / 4);
+
+    dma.enable();
+#else
+    (void)buffer;
+    (void)length;
+    (void)receive;
+#endif
+}
+
+
+SDMMC::Status SDMMC::submitRequest(uint8_t buffer[], uint32_t blockNo,
+                                   uint32_t blockCount, bool receive,
+                                   bool blocking)
+{
+    if (!cardInitialised) {
+        return Status::NOT_INITIALISED;
+    }
+
+    if (transferActive) {
+        return Status::BUSY;
+    }
+
+    auto dma = dmaEnabled && ((uintptr_t)buffer & 0x3) == 0;
+    auto maxBlockCount = dma ? MAX_DMA_BLOCK_COUNT : MAX_TRANSFER_BLOCK_COUNT;
+
+    if (blockCount == 0 || blockCount > maxBlockCount) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    transferActive = true;
+    transferStatus = Status::OK;
+    transferBuffer = buffer;
+    transferBlockNo = blockNo;
+    transferBlockCount = blockCount;
+    transferLength = blockCount * BLOCK_SIZE;
+    transferIndex = 0;
+    transferReceive = receive;
+    transferDMA = dma;
+    transferBlocking = blocking;
+    requestTime = getMilliseconds();
+
+    auto& nvic = NVIC::get();
+    nvic.enableIrq(getIRQNumber(id));
+
+    if (programmingPending) {
+        // Poll card status via CMD13 - SEND_STATUS until programming is done
+        requestState = RequestState::WAIT_READY;
+        sendRequestCommand(13, (uint32_t)rca << 16);
+    } else {
+        startRequest();
+    }
+
+    return Status::OK;
+}
+
+
+void SDMMC::startRequest()
+{
+    if (!transferReceive && transferBlockCount > 1) {
+        // Announce number of blocks via ACMD23, starting with CMD55
+        requestState = RequestState::APP_COMMAND;
+        sendRequestCommand(55, (uint32_t)rca << 16);
+    } else {
+        sendTransferCommand();
+    }
+}
+
+
+void SDMMC::sendTransferCommand()
+{
+    uint32_t cmdIndex;
+
+    if (transferReceive) {
+        // Data path has to be ready before the card starts sending
+        startRequestData();
+        cmdIndex = (transferBlockCount > 1) ? 18 : 17;
+    } else {
+        cmdIndex = (transferBlockCount > 1) ? 25 : 24;
+    }
+
+    requestState = RequestState::TRANSFER_COMMAND;
+    sendRequestCommand(cmdIndex, getDataAddress(transferBlockNo));
+}
+
+
+void SDMMC::sendRequestCommand(uint32_t cmdIndex, uint32_t argument)
+{
+    auto registers = getRegisters();
+
+    auto mask = registers->MASK;
+    mask = bitSet(mask, SDMMC_Registers::MASK::CMDRENDIE);
+    mask = bitSet(mask, SDMMC_Registers::MASK::CCRCFAILIE);
+    mask = bitSet(mask, SDMMC_Registers::MASK::CTIMEOUTIE);
+    registers->MASK = mask;
+
+    CommandConfig cmdConfig;
+    cmdConfig.cmdIndex = cmdIndex;
+    cmdConfig.argument = argument;
+    cmdConfig.reponseType = ResponseType::SHORT;
+    sendCommand(cmdConfig);
+}
+
+
+void SDMMC::startRequestData()
+{
+    if (transferDMA) {
+        startDMA(transferBuffer, transferLength, transferReceive);
+    }
+
+    startDataPath(transferLength, transferReceive, transferDMA);
+
+    auto registers = getRegisters();
+
+    auto mask = registers->MASK;
+    mask = bitSet(mask, SDMMC_Registers::MASK::DCRCFAILIE);
+    mask = bitSet(mask, SDMMC_Registers::MASK::DTIMEOUTIE);
+    mask = bitSet(mask, SDMMC_Registers::MASK::DATAENDIE);
+
+    if (transferReceive) {
+        mask = bitSet(mask, SDMMC_Registers::MASK::RXOVERRIE);
+    } else {
+        mask = bitSet(mask, SDMMC_Registers::MASK::TXUNDERRIE);
+    }
+
+    if (!transferDMA) {
+        // CPU moves data in chunks of 8 words
+        mask = bitSet(mask, transferReceive
+                                ? SDMMC_Registers::MASK::RXFIFOHFIE
+                                : SDMMC_Registers::MASK::TXFIFOHEIE);
+    }
+
+    registers->MASK = mask;
+}
+
+
+void SDMMC::stopRequestData()
+{
+    auto registers = getRegisters();
+
+    auto mask = registers->MASK;
+    mask = bitReset(mask, SDMMC_Registers::MASK::DCRCFAILIE);
+    mask = bitReset(mask, SDMMC_Registers::MASK::DTIMEOUTIE);
+    mask = bitReset(mask, SDMMC_Registers::MASK::DATAENDIE);
+    mask = bitReset(mask, SDMMC_Registers::MASK::RXOVERRIE);
+    mask = bitReset(mask, SDMMC_Registers::MASK::TXUNDERRIE);
+    mask = bitReset(mask, SDMMC_Registers::MASK::RXFIFOHFIE);
+    mask = bitReset(mask, SDMMC_Registers::MASK::TXFIFOHEIE);
+    registers->MASK = mask;
+
+    registers->DCTRL = 0;
+
+#ifndef EXCLUDE_DMA
+    if (transferDMA) {
+        auto dma = DMA_Channel::get(DMA_Base::DMA2, dmaChannelId);
+        dma.disable();
+    }
+#endif
+
+    clearDataStatusFlags();
+}
+
+
+void SDMMC::processCommandResponse(Status status)
+{
+    switch (requestState) {
+        case RequestState::WAIT_READY:
+            if (status != Status::OK) {
+                finishRequest(status);
+            } else if (bitsValue(getCommandResponse(0), 4, 9)
+                       == CardState::TRANSFER) {
+                programmingPending = false;
+                startRequest();
+            } else if (getMilliseconds() - requestTime > writeTimeout) {
+                finishRequest(Status::TIMEOUT);
+            } else {
+                sendRequestCommand(13, (uint32_t)rca << 16);
+            }
+            break;
+
+        case RequestState::APP_COMMAND:
+            if (status != Status::OK) {
+                finishRequest(status);
+            } else {
+                requestState = RequestState::SET_BLOCK_COUNT;
+                sendRequestCommand(23, transferBlockCount);
+            }
+            break;
+
+        case RequestState::SET_BLOCK_COUNT:
+            if (status != Status::OK) {
+                finishRequest(status);
+            } else {
+                sendTransferCommand();
+            }
+            break;
+
+        case RequestState::TRANSFER_COMMAND:
+            if (status != Status::OK) {
+                if (transferReceive) {
+                    stopRequestData();
+                }
+                finishRequest(status);
+            } else {
+                if (!transferReceive) {
+                    startRequestData();
+                }
+                requestState = RequestState::DATA;
+            }
+            break;
+
+        case RequestState::STOP:
+            if (!transferReceive) {
+                programmingPending = true;
+            }
+            finishRequest(transferStatus != Status::OK ? transferStatus
+                                                       : status);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+void SDMMC::processData(uint32_t status)
+{
+    auto registers = getRegisters();
+
+    if (!transferDMA) {
+        if (transferReceive) {
+            while (bitValue(registers->STA, SDMMC_Registers::STA::RXFIFOHF)
+                   && transferLength - transferIndex >= 32) {
+                for (auto i = 0; i < 8; i++) {
+                    uint32_t data = registers->FIFO;
+                    memcpy(&transferBuffer[transferIndex], &data, 4);
+                    transferIndex += 4;
+                }
+            }
+        } else {
+            while (bitValue(registers->STA, SDMMC_Registers::STA::TXFIFOHE)
+                   && transferIndex < transferLength) {
+                for (auto i = 0; i < 8; i++) {
+                    uint32_t data;
+                    memcpy(&data, &transferBuffer[transferIndex], 4);
+                    registers->FIFO = data;
+                    transferIndex += 4;
+                }
+            }
+
+            if (transferIndex >= transferLength) {
+                registers->MASK = bitReset(registers->MASK,
+                                           SDMMC_Registers::MASK::TXFIFOHEIE);
+            }
+        }
+    }
+
+    auto dataStatus = Status::OK;
+
+    if (bitValue(status, SDMMC_Registers::STA::DTIMEOUT)) {
+        dataStatus = Status::DATA_TIMEOUT;
+    } else if (bitValue(status, SDMMC_Registers::STA::DCRCFAIL)
+               || bitValue(status, SDMMC_Registers::STA::RXOVERR)
+               || bitValue(status, SDMMC_Registers::STA::TXUNDERR)) {
+        dataStatus = Status::DATA_CRC_FAIL;
+    } else if (!bitValue(status, SDMMC_Registers::STA::DATAEND)) {
+        return;
+    } else if (transferReceive && !transferDMA) {
+        // Fetch words remaining in FIFO
+        while (bitValue(registers->STA, SDMMC_Registers::STA::RXDAVL)
+               && transferIndex < transferLength) {
+            uint32_t data = registers->FIFO;
+            memcpy(&transferBuffer[transferIndex], &data, 4);
+            transferIndex += 4;
+        }
+    }
+
+#ifndef EXCLUDE_DMA
+    if (transferDMA) {
+        auto dma = DMA_Channel::get(DMA_Base::DMA2, dmaChannelId);
+
+        // DATAEND is raised when the last data entered the FIFO,
+        // DMA may still have to move it to memory
+        if (dataStatus == Status::OK && transferReceive) {
+            while (!dma.isComplete() && !dma.hasError()) {
+            }
+        }
+
+        if (dma.hasError() && dataStatus == Status::OK) {
+            dataStatus = Status::DMA_ERROR;
+        }
+    }
+#endif
+
+    stopRequestData();
+
+    transferStatus = dataStatus;
+
+    if (transferBlockCount > 1 || dataStatus != Status::OK) {
+        // Stop data transfer via CMD12 - STOP_TRANSMISSION, also to abort
+        // single block transfers on errors
+        requestState = RequestState::STOP;
+        sendRequestCommand(12, 0);
+        return;
+    }
+
+    if (!transferReceive) {
+        programmingPending = true;
+    }
+
+    finishRequest(dataStatus);
+}
+
+
+void SDMMC::finishRequest(Status status)
+{
+    auto registers = getRegisters();
+    registers->MASK = 0;
+
+    requestState = RequestState::IDLE;
+    transferStatus = status;
+    transferActive = false;
+
+    // Callbacks belong to the application's non-blocking transfers
+    if (transferBlocking) {
+        return;
+    }
+
+    if (status == Status::OK) {
+        if (transferCompleteCallback != nullptr) {
+            transferCompleteCallback(this, transferCompleteCallbackContext);
+        }
+    } else {
+        if (transferErrorCallback != nullptr) {
+            transferErrorCallback(this, transferErrorCallbackContext);
+        }
+    }
+}
+
+
+SDMMC::Status SDMMC::receiveData(uint8_t buffer[], uint32_t length)
+{
+    auto registers = getRegisters();
+
+    uint32_t bufferIndex = 0;
+
+    volatile uint32_t status = 0;
+
+    // Restarted on each progress, covers a stopped clock
+    auto timestamp = getMilliseconds();
+
+    while (true) {
+        status = registers->STA;
+
+        if (getMilliseconds() - timestamp > readTimeout) {
+            break;
+        }
+
+        if (bitValue(status, SDMMC_Registers::STA::RXFIFOHF)
+                && length - bufferIndex >= 32) {
+            timestamp = getMilliseconds();
+
+            // FIFO contains at least 8 values
+            for (auto i = 0; i < 8; i++) {
+                uint32_t data = registers->FIFO;
+                memcpy(&buffer[bufferIndex], &data, 4);
+                bufferIndex += 4;
+            }
+        } else if (bitValue(status, SDMMC_Registers::STA::RXDAVL)
+                   && bufferIndex < length && length - bufferIndex < 32) {
+            // Tail of short transfers is read word by word
+            timestamp = getMilliseconds();
+            uint32_t data = registers->FIFO;
+            memcpy(&buffer[bufferIndex], &data, 4);
+            bufferIndex += 4;
+        } else if (bitValue(status, SDMMC_Registers::STA::RXOVERR)
+                   || bitValue(status, SDMMC_Registers::STA::DCRCFAIL)
+                   || bitValue(status, SDMMC_Registers::STA::DTIMEOUT)
+                   || bitValue(status, SDMMC_Registers::STA::DATAEND)) {
+            break;
+        }
+    }
+
+    // Empty FIFO if there is some data remaining
+    while (bitValue(registers->STA, SDMMC_Registers::STA::RXDAVL)) {
+        __attribute__((unused)) auto data = registers->FIFO;
+    }
+
+    if (bitValue(status, SDMMC_Registers::STA::DTIMEOUT)) {
+        return Status::DATA_TIMEOUT;
+    } else if (!bitValue(status, SDMMC_Registers::STA::DATAEND)
+               && !bitValue(status, SDMMC_Registers::STA::DCRCFAIL)
+               && !bitValue(status, SDMMC_Registers::STA::RXOVERR)) {
+        registers->DCTRL = 0;
+        return Status::TIMEOUT;
+    } else if (bitValue(status, SDMMC_Registers::STA::DCRCFAIL)
+               || bitValue(status, SDMMC_Registers::STA::RXOVERR)) {
+        return Status::DATA_CRC_FAIL;
+    }
+
+    return Status::OK;
+}
+
+
+SDMMC::Status SDMMC::transmitData(uint8_t buffer[], uint32_t length)
+{
+    auto registers = getRegisters();
+
+    uint32_t bufferIndex = 0;
+
+    volatile uint32_t status = 0;
+
+    // Restarted on each progress, covers a stopped clock
+    auto timestamp = getMilliseconds();
+
+    while (true) {
+        status = registers->STA;
+
+        if (getMilliseconds() - timestamp > writeTimeout) {
+            break;
+        }
+
+        if (bitValue(status, SDMMC_Registers::STA::TXFIFOHE)
+                && bufferIndex < length) {
+            // FIFO contains less than 8 values
+            timestamp = getMilliseconds();
+            for (auto i = 0; i < 8; i++) {
+                uint32_t data;
+                memcpy(&data, &buffer[bufferIndex], 4);
+                registers->FIFO = data;
+                bufferIndex += 4;
+            }
+        } else if (bitValue(status, SDMMC_Registers::STA::TXUNDERR)
+                   || bitValue(status, SDMMC_Registers::STA::DCRCFAIL)
+                   || bitValue(status, SDMMC_Registers::STA::DTIMEOUT)
+                   || bitValue(status, SDMMC_Registers::STA::DATAEND)) {
+            break;
+        }
+    }
+
+    if (bitValue(status, SDMMC_Registers::STA::DTIMEOUT)) {
+        return Status::DATA_TIMEOUT;
+    } else if (!bitValue(status, SDMMC_Registers::STA::DATAEND)
+               && !bitValue(status, SDMMC_Registers::STA::DCRCFAIL)
+               && !bitValue(status, SDMMC_Registers::STA::TXUNDERR)) {
+        registers->DCTRL = 0;
+        return Status::TIMEOUT;
+    } else if (bitValue(status, SDMMC_Registers::STA::DCRCFAIL)
+               || bitValue(status, SDMMC_Registers::STA::TXUNDERR)) {
+        return Status::DATA_CRC_FAIL;
+    }
+
+    return Status::OK;
+}
+
+
+SDMMC::Status SDMMC::sendAppCommand()
+{
+    // Signal via CMD55 - APP_CMD that next command is application specific
+    CommandConfig cmd55config;
+    cmd55config.cmdIndex = 55;
+    cmd55config.argument = (uint32_t)rca << 16;
+    cmd55config.reponseType = ResponseType::SHORT;
+    sendCommand(cmd55config);
+
+    return getCommandStatus(waitForCommandResponse());
+}
+
+
+SDMMC::Status SDMMC::setWriteBlockEraseCount(uint32_t blockCount)
+{
+    auto status = sendAppCommand();
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    // Announce number of blocks via ACMD23 - SET_WR_BLK_ERASE_COUNT
+    CommandConfig acmd23config;
+    acmd23config.cmdIndex = 23;
+    acmd23config.argument = blockCount;
+    acmd23config.reponseType = ResponseType::SHORT;
+    sendCommand(acmd23config);
+
+    return getCommandStatus(waitForCommandResponse());
+}
+
+
+SDMMC::Status SDMMC::stopTransmission()
+{
+    // Stop data transfer via CMD12 - STOP_TRANSMISSION
+    CommandConfig cmd12config;
+    cmd12config.cmdIndex = 12;
+    cmd12config.reponseType = ResponseType::SHORT;
+    sendCommand(cmd12config);
+
+    return getCommandStatus(waitForCommandResponse());
+}
+
+
+SDMMC::Status SDMMC::waitUntilTransferState(uint32_t timeout)
+{
+    auto timestamp = getMilliseconds();
+
+    while (getCardState() != CardState::TRANSFER) {
+        if (getMilliseconds() - timestamp > timeout) {
+            return Status::TIMEOUT;
+        }
+    }
+
+    return Status::OK;
+}
+
+
+SDMMC::Status SDMMC::waitUntilReady()
+{
+    if (programmingPending) {
+        auto status = waitUntilTransferState(writeTimeout);
+
+        if (status != Status::OK) {
+            return status;
+        }
+
+        programmingPending = false;
+    }
+
+    return Status::OK;
+}
+
+
+SDMMC::Status SDMMC::transferBlocks(uint8_t buffer[], uint32_t blockNo,
+                                    uint32_t blockCount, bool receive)
+{
+    if (!cardInitialised) {
+        return Status::NOT_INITIALISED;
+    }
+
+    if (transferActive) {
+        return Status::BUSY;
+    }
+
+    if (blockCount == 0) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    auto status = Status::OK;
+
+    for (auto attempt = 0; attempt <= retryCount; attempt++) {
+        if (attempt > 0) {
+            auto recoverStatus = recoverFromError(status);
+
+            if (recoverStatus != Status::OK) {
+                return recoverStatus;
+            }
+        }
+
+        if (receive) {
+            status = readBlocksOnce(buffer, blockNo, blockCount);
+        } else {
+            status = writeBlocksOnce(buffer, blockNo, blockCount);
+        }
+
+        if (status == Status::OK || status == Status::BUSY
+            || status == Status::INVALID_PARAMETER) {
+            break;
+        }
+    }
+
+    return status;
+}
+
+
+SDMMC::Status SDMMC::readBlocksOnce(uint8_t buffer[], uint32_t blockNo,
+                                    uint32_t blockCount)
+{
+    if (dmaEnabled && ((uintptr_t)buffer & 0x3) == 0) {
+        while (blockCount > 0) {
+            auto count = blockCount;
+
+            if (count > MAX_DMA_BLOCK_COUNT) {
+                count = MAX_DMA_BLOCK_COUNT;
+            }
+
+            auto status = submitRequest(buffer, blockNo, count, true, true);
+
+            if (status == Status::OK) {
+                status = waitForRequest(readTimeout);
+            }
+
+            if (status != Status::OK) {
+                return status;
+            }
+
+            buffer += count * BLOCK_SIZE;
+            blockNo += count;
+            blockCount -= count;
+        }
+
+        return Status::OK;
+    }
+
+    auto readyStatus = waitUntilReady();
+
+    if (readyStatus != Status::OK) {
+        return readyStatus;
+    }
+
+    while (blockCount > 0) {
+        auto count = blockCount;
+
+        if (count > MAX_TRANSFER_BLOCK_COUNT) {
+            count = MAX_TRANSFER_BLOCK_COUNT;
+        }
+
+        auto length = count * BLOCK_SIZE;
+
+        // Data path has to be ready before the card starts sending
+        startDataPath(length, true);
+
+        // Read via CMD17 - READ_SINGLE_BLOCK or CMD18 - READ_MULTIPLE_BLOCK
+        CommandConfig cmdConfig;
+        cmdConfig.cmdIndex = (count > 1) ? 18 : 17;
+        cmdConfig.argument = getDataAddress(blockNo);
+        cmdConfig.reponseType = ResponseType::SHORT;
+
+        sendCommand(cmdConfig);
+
+        auto cmdResponse = waitForCommandResponse();
+
+        if (cmdResponse != CommandResponseStatus::OK) {
+            return getCommandStatus(cmdResponse);
+        }
+
+        auto status = receiveData(buffer, length);
+
+        // Abort via CMD12 on errors, card may still be sending
+        if (count > 1 || status != Status::OK) {
+            auto stopStatus = stopTransmission();
+
+            if (status == Status::OK) {
+                status = stopStatus;
+            }
+        }
+
+        if (status != Status::OK) {
+            return status;
+        }
+
+        buffer += length;
+        blockNo += count;
+        blockCount -= count;
+    }
+
+    return Status::OK;
+}
+
+
+SDMMC::Status SDMMC::writeBlocksOnce(uint8_t buffer[], uint32_t blockNo,
+                                     uint32_t blockCount)
+{
+    if (dmaEnabled && ((uintptr_t)buffer & 0x3) == 0) {
+        while (blockCount > 0) {
+            auto count = blockCount;
+
+            if (count > MAX_DMA_BLOCK_COUNT) {
+                count = MAX_DMA_BLOCK_COUNT;
+            }
+
+            auto status = submitRequest(buffer, blockNo, count, false,
+                                        true);
+
+            if (status == Status::OK) {
+                status = waitForRequest(writeTimeout);
+            }
+
+            if (status != Status::OK) {
+                return status;
+            }
+
+            buffer += count * BLOCK_SIZE;
+            blockNo += count;
+            blockCount -= count;
+        }
+
+        return waitUntilReady();
+    }
+
+    auto readyStatus = waitUntilReady();
+
+    if (readyStatus != Status::OK) {
+        return readyStatus;
+    }
+
+    while (blockCount > 0) {
+        auto count = blockCount;
+
+        if (count > MAX_TRANSFER_BLOCK_COUNT) {
+            count = MAX_TRANSFER_BLOCK_COUNT;
+        }
+
+        auto length = count * BLOCK_SIZE;
+
+        if (count > 1) {
+            auto status = setWriteBlockEraseCount(count);
+
+            if (status != Status::OK) {
+                return status;
+            }
+        }
+
+        // Write via CMD24 - WRITE_BLOCK or CMD25 - WRITE_MULTIPLE_BLOCK
+        CommandConfig cmdConfig;
+        cmdConfig.cmdIndex = (count > 1) ? 25 : 24;
+        cmdConfig.argument = getDataAddress(blockNo);
+        cmdConfig.reponseType = ResponseType::SHORT;
+
+        sendCommand(cmdConfig);
+
+        auto cmdResponse = waitForCommandResponse();
+
+        if (cmdResponse != CommandResponseStatus::OK) {
+            return getCommandStatus(cmdResponse);
+        }
+
+        startDataPath(length, false);
+
+        auto status = transmitData(buffer, length);
+
+        // Abort via CMD12 on errors, card may still be receiving
+        if (count > 1 || status != Status::OK) {
+            auto stopStatus = stopTransmission();
+
+            if (status == Status::OK) {
+                status = stopStatus;
+            }
+        }
+
+        // Card is programming until it returns to transfer state
+        auto stateStatus = waitUntilTransferState(writeTimeout);
+
+        if (status == Status::OK) {
+            status = stateStatus;
+        }
+
+        if (status != Status::OK) {
+            return status;
+        }
+
+        buffer += length;
+        blockNo += count;
+        blockCount -= count;
+    }
+
+    return Status::OK;
+}
+
+
+SDMMC::Status SDMMC::recoverFromError(Status status)
+{
+    // CRC errors point to signal integrity problems at the current clock
+    if (status == Status::CMD_RESPONSE_CRC_FAIL
+        || status == Status::DATA_CRC_FAIL) {
+        downgradeClock();
+    }
+
+    programmingPending = false;
+
+    // Card may still be programming after a failed write
+    if (waitUntilTransferState(writeTimeout) == Status::OK) {
+        return Status::OK;
+    }
+
+    if (!reinitEnable) {
+        return status;
+    }
+
+    // Card does not respond, e.g. after a brown-out or reinsertion
+    return initCard();
+}
+
+
+void SDMMC::downgradeClock()
+{
+    auto freq = currentClockFreq / 2;
+
+    if (freq < MIN_CLOCK_FREQ) {
+        freq = MIN_CLOCK_FREQ;
+    }
+
+    // Also limits the clock after card reinitialisation
+    clockFreq = freq;
+
+    setClockFreq(freq);
+}
+
+
+SDMMC::Status SDMMC::waitForRequest(uint32_t timeout)
+{
+    auto registers = getRegisters();
+
+    auto timestamp = getMilliseconds();
+    auto lastState = requestState;
+    uint32_t lastCount = registers->DCOUNT;
+
+    while (transferActive) {
+        uint32_t count = registers->DCOUNT;
+
+        // Restart timeout on each progress
+        if (requestState != lastState || count != lastCount) {
+            lastState = requestState;
+            lastCount = count;
+            timestamp = getMilliseconds();
+        } else if (getMilliseconds() - timestamp > timeout) {
+            abortRequest();
+            return Status::TIMEOUT;
+        }
+    }
+
+    return transferStatus;
+}
+
+
+void SDMMC::abortRequest()
+{
+    auto registers = getRegisters();
+    registers->MASK = 0;
+
+    auto dataStarted = (requestState == RequestState::DATA);
+
+    stopRequestData();
+    clearAllStatusFlags();
+
+    requestState = RequestState::IDLE;
+    transferStatus = Status::TIMEOUT;
+    transferActive = false;
+
+    if (dataStarted) {
+        stopTransmission();
+    }
+}
+
+
 SDMMC SDMMC::sdmmc1 = SDMMC(SDMMC::SDMMC1);
 } // namespace mcu
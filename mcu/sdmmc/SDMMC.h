@@ -16,6 +16,7 @@
 #include "SDMMC_Registers.h"
 
 // This component
+#include "../dma/DMA_Base.h"
 #include "../gpio/Pin.h"
 
 // System libraries
@@ -41,12 +42,18 @@ class SDMMC : public SDMMC_Base
         EIGHT_LINES = 0b10
     };
 
+    /**
+     * Callback function type
+     */
+    typedef void (*CallbackFunc)(SDMMC*, void*);
+
     /**
      * Configuration settings
      */
     struct Config
     {
-        uint32_t clockFreq = 25000000; // Clock frequency in MHz
+        uint32_t clockFreq = 50000000; // Max. clock frequency in Hz
+        bool highSpeedEnable = true;   // Switch to high-speed if supported
         Pin::Id ckPinId = Pin::NONE;   // GPIO pin id of CK pin
         Pin::Id cmdPinId = Pin::NONE;  // GPIO pin id of CMD pin
         Pin::Id d0PinId = Pin::NONE;   // GPIO pin id of D0 pin
@@ -57,6 +64,14 @@ class SDMMC : public SDMMC_Base
         Pin::Id d5PinId = Pin::NONE;   // GPIO pin id of D5 pin
         Pin::Id d6PinId = Pin::NONE;   // GPIO pin id of D6 pin
         Pin::Id d7PinId = Pin::NONE;   // GPIO pin id of D7 pin
+        bool dmaEnable = false;        // Use DMA for data transfers
+        DMA_Base::ChannelId dmaChannelId = DMA_Base::CH4; // DMA2 CH4 or CH5
+        CallbackFunc transferCompleteCallback = nullptr;
+        CallbackFunc transferErrorCallback = nullptr;
+        uint32_t readTimeout = 100;    // Max. read access time in ms
+        uint32_t writeTimeout = 500;   // Max. write busy time in ms
+        uint8_t retryCount = 2;        // Retries of failed blocking transfers
+        bool reinitEnable = true;      // Reinit card if it does not recover
     };
 
     /**
@@ -109,6 +124,17 @@ class SDMMC : public SDMMC_Base
         ERROR = -1
     };
 
+    /**
+     * Card properties parsed from CSD register
+     */
+    struct CardInfo
+    {
+        uint8_t csdVersion = 0;         // 1 = SDSC, 2 = SDHC/SDXC
+        uint32_t blockCount = 0;        // Capacity in 512 byte blocks
+        uint32_t maxTransferRate = 0;   // Max. clock frequency in Hz
+        uint32_t eraseSectorSize = 0;   // Erase granularity in blocks
+    };
+
     /**
      * Status codes
      */
@@ -120,9 +146,35 @@ class SDMMC : public SDMMC_Base
         CMD_RESPONSE_TIMEOUT,
         CMD_ERROR,
         DATA_CRC_FAIL,
-        DATA_TIMEOUT
+        DATA_TIMEOUT,
+        DMA_ERROR,
+        BUSY,
+        INVALID_PARAMETER,
+        TIMEOUT,
+        NOT_INITIALISED,
+        NOT_SUPPORTED
+    };
+
+    /**
+     * Erase modes
+     */
+    enum class EraseMode
+    {
+        ERASE = 0x00000000,     // Content reads as all 0 or all 1
+        DISCARD = 0x00000001    // Content undefined, faster if supported
     };
 
+    /**
+     * Size of a data block in bytes
+     */
+    static const uint32_t BLOCK_SIZE = 512;
+
+    /**
+     * Maximum number of blocks in a single DMA transfer, limited by the
+     * 16-bit word count of the DMA channel
+     */
+    static const uint32_t MAX_DMA_BLOCK_COUNT = 511;
+
     /**
      * Return reference to peripheral
      *
@@ -234,7 +286,10 @@ class SDMMC : public SDMMC_Base
                         Pin::Id d6PinId, Pin::Id d7PinId);
 
     /**
-     * Set clock frequency
+     * Set clock frequency, rounded down to the nearest possible value
+     *
+     * The divider is bypassed for frequencies at or above the 48MHz kernel
+     * clock, which is only allowed in high-speed mode.
      *
      * @param clockFreq     Clock frequency in Hz
      */
@@ -356,6 +411,164 @@ class SDMMC : public SDMMC_Base
      */
     Status writeBlock(uint8_t buffer[], uint32_t blockNo);
 
+    /**
+     * Read consecutive blocks of data into buffer
+     *
+     * Multiple blocks are transferred with a single CMD18 - READ_MULTIPLE_BLOCK
+     * and terminated by CMD12 - STOP_TRANSMISSION.
+     *
+     * Failed transfers are retried. The clock is lowered after CRC errors,
+     * a card not returning to transfer state is initialised again.
+     *
+     * @param buffer    Buffer to be filled with data, blockCount * 512 bytes
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks
+     * @return          Status enum setting
+     */
+    Status readBlocks(uint8_t buffer[], uint32_t blockNo, uint32_t blockCount);
+
+    /**
+     * Write consecutive blocks of data to card
+     *
+     * Multiple blocks are transferred with a single CMD25 - WRITE_MULTIPLE_BLOCK
+     * after announcing the count via ACMD23 - SET_WR_BLK_ERASE_COUNT, so the
+     * card can pre-erase. The transfer is terminated by CMD12.
+     *
+     * @param buffer    Buffer containing data, blockCount * 512 bytes
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks
+     * @return          Status enum setting
+     */
+    Status writeBlocks(uint8_t buffer[], uint32_t blockNo, uint32_t blockCount);
+
+    /**
+     * Enable/disable DMA for data transfers
+     *
+     * When enabled, readBlocks() and writeBlocks() use DMA for word aligned
+     * buffers and fall back to FIFO polling otherwise.
+     *
+     * @param state     DMA state
+     * @param channelId DMA2 channel, CH4 or CH5
+     */
+    void setDMAEnable(bool state, DMA_Base::ChannelId channelId = DMA_Base::CH4);
+
+    /**
+     * Start reading consecutive blocks, non-blocking
+     *
+     * All commands and data are handled by irq(), completion is signalled
+     * via callback. Data is moved by DMA if enabled and the buffer is word
+     * aligned, otherwise by the CPU on FIFO interrupts.
+     *
+     * @param buffer    Buffer to be filled with data, blockCount * 512 bytes
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks, max. MAX_DMA_BLOCK_COUNT with DMA
+     * @return          Status enum setting
+     */
+    Status startReadBlocks(uint8_t buffer[], uint32_t blockNo,
+                           uint32_t blockCount);
+
+    /**
+     * Start writing consecutive blocks, non-blocking
+     *
+     * Works like startReadBlocks(). The card may still be programming
+     * after completion, the next transfer polls its state first.
+     *
+     * @param buffer    Buffer containing data, blockCount * 512 bytes
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks, max. MAX_DMA_BLOCK_COUNT with DMA
+     * @return          Status enum setting
+     */
+    Status startWriteBlocks(uint8_t buffer[], uint32_t blockNo,
+                            uint32_t blockCount);
+
+    /**
+     * Return if a non-blocking transfer is in progress
+     */
+    bool isTransferActive();
+
+    /**
+     * Return result of the last non-blocking transfer
+     *
+     * @return          Status enum setting
+     */
+    Status getTransferStatus();
+
+    /**
+     * Set callback function for successful end of non-blocking transfer
+     *
+     * @param func      Callback function or nullptr
+     * @param context   Pointer to callback context
+     */
+    void setTransferCompleteCallback(CallbackFunc func, void* context = nullptr);
+
+    /**
+     * Set callback function for non-blocking transfers ended by an error
+     *
+     * @param func      Callback function or nullptr
+     * @param context   Pointer to callback context
+     */
+    void setTransferErrorCallback(CallbackFunc func, void* context = nullptr);
+
+    /**
+     * Return callback function for successful end of non-blocking transfer
+     *
+     * @param context   Reference to be set to callback context
+     * @return          Callback function or nullptr
+     */
+    CallbackFunc getTransferCompleteCallback(void*& context);
+
+    /**
+     * Return callback function for non-blocking transfers ended by an error
+     *
+     * @param context   Reference to be set to callback context
+     * @return          Callback function or nullptr
+     */
+    CallbackFunc getTransferErrorCallback(void*& context);
+
+    /**
+     * Return data bus width negotiated with the card
+     *
+     * @return          BusWidth enum setting
+     */
+    BusWidth getBusWidth();
+
+    /**
+     * Return if card was switched to high-speed mode
+     *
+     * @return          True if in high-speed mode
+     */
+    bool isHighSpeed();
+
+    /**
+     * Return capacity of the card as read from CSD register
+     *
+     * @return          Number of 512 byte blocks
+     */
+    uint32_t getBlockCount();
+
+    /**
+     * Return card properties parsed from CSD register
+     *
+     * @return          Reference to card info struct
+     */
+    const CardInfo& getCardInfo();
+
+    /**
+     * Erase consecutive blocks, blocking
+     *
+     * Uses CMD32 - ERASE_WR_BLK_START, CMD33 - ERASE_WR_BLK_END and
+     * CMD38 - ERASE. Pre-erasing regions that are rewritten later avoids
+     * stalls caused by garbage collection inside the card. Discard falls
+     * back to erase on cards before SD 5.0.
+     *
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks
+     * @param mode      EraseMode enum setting
+     * @return          Status enum setting
+     */
+    Status erase(uint32_t blockNo, uint32_t blockCount,
+                 EraseMode mode = EraseMode::ERASE);
+
     /**
      * Return pointer to registers
      *
@@ -372,6 +585,20 @@ class SDMMC : public SDMMC_Base
     void irq();
 
   protected:
+    /**
+     * States of non-blocking transfer
+     */
+    enum class RequestState
+    {
+        IDLE,
+        WAIT_READY,         // CMD13 until card left programming state
+        APP_COMMAND,        // CMD55 ahead of ACMD23
+        SET_BLOCK_COUNT,    // ACMD23
+        TRANSFER_COMMAND,   // CMD17/18/24/25
+        DATA,
+        STOP                // CMD12
+    };
+
     /**
      * Private constructors because of singleton pattern, no copy allowed
      */
@@ -402,6 +629,290 @@ class SDMMC : public SDMMC_Base
      */
     void clearDataStatusFlags();
 
+    /**
+     * Maximum number of blocks in a single transfer, limited by DLEN
+     */
+    static const uint32_t MAX_TRANSFER_BLOCK_COUNT = 0xFFFF;
+
+    /**
+     * Max. clock frequencies in default and high-speed mode
+     */
+    static const uint32_t DEFAULT_SPEED_MAX_CLOCK_FREQ = 25000000;
+    static const uint32_t HIGH_SPEED_MAX_CLOCK_FREQ = 50000000;
+
+    /**
+     * Lowest clock frequency used after CRC errors
+     */
+    static const uint32_t MIN_CLOCK_FREQ = 400000;
+
+    /**
+     * Timeouts in ms for card initialisation and command responses
+     */
+    static const uint32_t INIT_TIMEOUT = 1000;
+    static const uint32_t COMMAND_TIMEOUT = 10;
+
+    /**
+     * Erase timeout in ms per allocation unit of 4 MiB
+     */
+    static const uint32_t ERASE_TIMEOUT_PER_AU = 250;
+    static const uint32_t ERASE_AU_BLOCK_COUNT = 8192;
+
+    /**
+     * Fill card info from raw CSD register data
+     */
+    void parseCSD();
+
+    /**
+     * Return data address argument of a block, SDSC cards are byte
+     * addressed
+     *
+     * @param blockNo   Block number
+     * @return          Command argument
+     */
+    uint32_t getDataAddress(uint32_t blockNo)
+    {
+        return highCapacity ? blockNo : blockNo * BLOCK_SIZE;
+    }
+
+    /**
+     * Read SD configuration register via ACMD51 - SEND_SCR
+     *
+     * @return          Status enum setting
+     */
+    Status readSCR();
+
+    /**
+     * Switch card and controller to 4-bit bus via ACMD6 - SET_BUS_WIDTH
+     *
+     * @return          Status enum setting
+     */
+    Status switchToWideBus();
+
+    /**
+     * Switch card to high-speed mode via CMD6 - SWITCH_FUNC
+     *
+     * @return          Status enum setting
+     */
+    Status switchToHighSpeed();
+
+    /**
+     * Send a command and read its data block, blocking
+     *
+     * @param config    Reference to command config
+     * @param buffer    Buffer to be filled with data
+     * @param length    Block length in bytes, power of 2
+     * @return          Status enum setting
+     */
+    Status readCommandData(CommandConfig& config, uint8_t buffer[],
+                           uint32_t length);
+
+    /**
+     * Convert command response status to status code
+     *
+     * @param response  CommandResponseStatus enum setting
+     * @return          Status enum setting
+     */
+    static Status getCommandStatus(CommandResponseStatus response);
+
+    /**
+     * Configure and enable data path state machine
+     *
+     * @param length    Data length in bytes, multiple of block size
+     * @param receive   True for card to controller direction
+     * @param dma       True to request data via DMA
+     * @param blockSize Block size in bytes, power of 2
+     */
+    void startDataPath(uint32_t length, bool receive, bool dma = false,
+                       uint32_t blockSize = BLOCK_SIZE);
+
+    /**
+     * Arm DMA channel for a transfer
+     *
+     * @param buffer    Word aligned buffer
+     * @param length    Data length in bytes
+     * @param receive   True for card to controller direction
+     */
+    void startDMA(uint8_t buffer[], uint32_t length, bool receive);
+
+    /**
+     * Setup a non-blocking transfer and send its first command
+     *
+     * @param buffer    Data buffer
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks
+     * @param receive   True for reading
+     * @param blocking  True if waited for by readBlocks() or writeBlocks(),
+     *                  no callbacks are called then
+     * @return          Status enum setting
+     */
+    Status submitRequest(uint8_t buffer[], uint32_t blockNo,
+                         uint32_t blockCount, bool receive, bool blocking);
+
+    /**
+     * Send first command of transfer once the card is ready
+     */
+    void startRequest();
+
+    /**
+     * Send read or write command of transfer
+     */
+    void sendTransferCommand();
+
+    /**
+     * Send a command with short response, completion is handled in irq()
+     *
+     * @param cmdIndex  Command index
+     * @param argument  Command argument
+     */
+    void sendRequestCommand(uint32_t cmdIndex, uint32_t argument);
+
+    /**
+     * Start data path of transfer and enable its interrupts
+     */
+    void startRequestData();
+
+    /**
+     * Stop data path of transfer and disable its interrupts
+     */
+    void stopRequestData();
+
+    /**
+     * Advance transfer state after a command response, called from irq()
+     *
+     * @param status    Status enum setting of response
+     */
+    void processCommandResponse(Status status);
+
+    /**
+     * Move FIFO data and handle end of data phase, called from irq()
+     *
+     * @param status    Masked status register value
+     */
+    void processData(uint32_t status);
+
+    /**
+     * End transfer and call callback, unless the transfer is blocking
+     *
+     * @param status    Status enum setting of transfer
+     */
+    void finishRequest(Status status);
+
+    /**
+     * Read data from FIFO until all data is received or an error occurs
+     *
+     * @param buffer    Buffer to be filled with data
+     * @param length    Data length in bytes, multiple of 4
+     * @return          Status enum setting
+     */
+    Status receiveData(uint8_t buffer[], uint32_t length);
+
+    /**
+     * Write data to FIFO until all data is transmitted or an error occurs
+     *
+     * @param buffer    Buffer containing data
+     * @param length    Data length in bytes, multiple of 32
+     * @return          Status enum setting
+     */
+    Status transmitData(uint8_t buffer[], uint32_t length);
+
+    /**
+     * Send CMD55 - APP_CMD to signal an application specific command
+     *
+     * @return          Status enum setting
+     */
+    Status sendAppCommand();
+
+    /**
+     * Send ACMD23 - SET_WR_BLK_ERASE_COUNT ahead of a multiple block write
+     *
+     * @param blockCount Number of blocks
+     * @return          Status enum setting
+     */
+    Status setWriteBlockEraseCount(uint32_t blockCount);
+
+    /**
+     * Send CMD12 - STOP_TRANSMISSION to end a multiple block transfer
+     *
+     * @return          Status enum setting
+     */
+    Status stopTransmission();
+
+    /**
+     * Wait until card is in transfer state again
+     *
+     * @param timeout   Timeout in ms
+     * @return          Status enum setting
+     */
+    Status waitUntilTransferState(uint32_t timeout);
+
+    /**
+     * Wait for pending programming of a previous non-blocking write
+     *
+     * @return          Status enum setting
+     */
+    Status waitUntilReady();
+
+    /**
+     * Transfer blocks with retries and error recovery, blocking
+     *
+     * @param buffer    Data buffer
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks
+     * @param receive   True for reading
+     * @return          Status enum setting
+     */
+    Status transferBlocks(uint8_t buffer[], uint32_t blockNo,
+                          uint32_t blockCount, bool receive);
+
+    /**
+     * Read blocks in a single attempt, blocking
+     *
+     * @param buffer    Buffer to be filled with data
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks
+     * @return          Status enum setting
+     */
+    Status readBlocksOnce(uint8_t buffer[], uint32_t blockNo,
+                          uint32_t blockCount);
+
+    /**
+     * Write blocks in a single attempt, blocking
+     *
+     * @param buffer    Buffer containing data
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks
+     * @return          Status enum setting
+     */
+    Status writeBlocksOnce(uint8_t buffer[], uint32_t blockNo,
+                           uint32_t blockCount);
+
+    /**
+     * Bring card back to transfer state after a failed transfer
+     *
+     * @param status    Status enum setting of failed transfer
+     * @return          Status enum setting
+     */
+    Status recoverFromError(Status status);
+
+    /**
+     * Halve clock frequency, down to MIN_CLOCK_FREQ
+     */
+    void downgradeClock();
+
+    /**
+     * Wait until a non-blocking transfer is finished, it is aborted if it
+     * makes no progress within the timeout
+     *
+     * @param timeout   Timeout in ms
+     * @return          Status enum setting
+     */
+    Status waitForRequest(uint32_t timeout);
+
+    /**
+     * Abort a non-blocking transfer without calling callbacks
+     */
+    void abortRequest();
+
     /**
      * Peripheral id
      */
@@ -443,9 +954,75 @@ class SDMMC : public SDMMC_Base
     uint16_t ccc = 0;
 
     /**
-     * Clock frequency in MHz
+     * Card properties parsed from CSD
+     */
+    CardInfo cardInfo;
+
+    /**
+     * SCR register data
+     */
+    uint32_t scr[2];
+
+    /**
+     * Max. clock frequency in Hz
+     */
+    uint32_t clockFreq = 50000000;
+
+    /**
+     * Current clock frequency in Hz
+     */
+    uint32_t currentClockFreq = 400000;
+
+    /**
+     * Error recovery settings
+     */
+    uint32_t readTimeout = 100;
+    uint32_t writeTimeout = 500;
+    uint8_t retryCount = 2;
+    bool reinitEnable = true;
+
+    /**
+     * Bus settings, busWidth is the width in use
+     */
+    BusWidth requestedBusWidth = BusWidth::ONE_LINE;
+    BusWidth busWidth = BusWidth::ONE_LINE;
+    bool highSpeedEnable = true;
+    bool highSpeed = false;
+
+    /**
+     * DMA settings
+     */
+    bool dmaEnabled = false;
+    DMA_Base::ChannelId dmaChannelId = DMA_Base::CH4;
+
+    /**
+     * State of current non-blocking transfer
+     */
+    volatile RequestState requestState = RequestState::IDLE;
+    volatile bool transferActive = false;
+    volatile Status transferStatus = Status::OK;
+    uint8_t* transferBuffer = nullptr;
+    uint32_t transferBlockNo = 0;
+    uint32_t transferBlockCount = 0;
+    uint32_t transferLength = 0;
+    uint32_t transferIndex = 0;
+    bool transferReceive = false;
+    bool transferDMA = false;
+    bool transferBlocking = false;
+    uint32_t requestTime = 0;
+
+    /**
+     * Set after non-blocking writes, card may still be programming
+     */
+    bool programmingPending = false;
+
+    /**
+     * Callbacks
      */
-    uint32_t clockFreq = 25000000;
+    CallbackFunc transferCompleteCallback = nullptr;
+    void* transferCompleteCallbackContext = nullptr;
+    CallbackFunc transferErrorCallback = nullptr;
+    void* transferErrorCallbackContext = nullptr;
 
     /**
      * Singleton instance
@@ -0,0 +1,407 @@
+/**
+ * @file        SDMMC_BlockCache.cpp
+ *
+ * Write-back block cache for SDMMC on STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "SDMMC_BlockCache.h"
+
+// This component
+#include "../utility/time.h"
+
+// System libraries
+#include <cstring>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+void SDMMC_BlockCache::init(Config& config)
+{
+    this->config = config;
+
+    if (this->config.maxFlushBlockCount < 1) {
+        this->config.maxFlushBlockCount = 1;
+    }
+
+    allocateSlots(this->config.slotCount, this->config.maxFlushBlockCount);
+    resetStatistics();
+}
+
+
+void SDMMC_BlockCache::deinit()
+{
+    deallocateSlots();
+}
+
+
+SDMMC::Status SDMMC_BlockCache::readBlock(uint8_t buffer[], uint32_t blockNo)
+{
+    auto slot = findSlot(blockNo);
+
+    if (slot >= 0) {
+        hitCount++;
+    } else {
+        missCount++;
+
+        auto status = allocateSlot(slot);
+
+        if (status != SDMMC::Status::OK) {
+            return status;
+        }
+
+        status = sdmmc.readBlock(getSlotData(slot), blockNo);
+
+        if (status != SDMMC::Status::OK) {
+            return status;
+        }
+
+        blockNos[slot] = blockNo;
+        dirty[slot] = false;
+    }
+
+    lastUsed[slot] = ++useCounter;
+
+    memcpy(buffer, getSlotData(slot), SDMMC::BLOCK_SIZE);
+
+    return SDMMC::Status::OK;
+}
+
+
+SDMMC::Status SDMMC_BlockCache::writeBlock(uint8_t buffer[], uint32_t blockNo)
+{
+    auto slot = findSlot(blockNo);
+
+    if (slot < 0) {
+        auto status = allocateSlot(slot);
+
+        if (status != SDMMC::Status::OK) {
+            return status;
+        }
+
+        blockNos[slot] = blockNo;
+    }
+
+    memcpy(getSlotData(slot), buffer, SDMMC::BLOCK_SIZE);
+
+    dirty[slot] = true;
+    lastUsed[slot] = ++useCounter;
+    lastWriteTime = getMilliseconds();
+
+    return SDMMC::Status::OK;
+}
+
+
+SDMMC::Status SDMMC_BlockCache::readBlocks(uint8_t buffer[], uint32_t blockNo,
+                                           uint32_t blockCount)
+{
+    if (blockCount == 1) {
+        return readBlock(buffer, blockNo);
+    }
+
+    uint32_t i = 0;
+
+    while (i < blockCount) {
+        auto slot = findSlot(blockNo + i);
+
+        if (slot >= 0) {
+            // Cached copy may be newer than card content
+            memcpy(&buffer[i * SDMMC::BLOCK_SIZE], getSlotData(slot),
+                   SDMMC::BLOCK_SIZE);
+            i++;
+            continue;
+        }
+
+        // Read run of uncached blocks directly
+        uint32_t runLength = 1;
+
+        while (i + runLength < blockCount
+               && findSlot(blockNo + i + runLength) < 0) {
+            runLength++;
+        }
+
+        auto status = sdmmc.readBlocks(&buffer[i * SDMMC::BLOCK_SIZE],
+                                       blockNo + i, runLength);
+
+        if (status != SDMMC::Status::OK) {
+            return status;
+        }
+
+        i += runLength;
+    }
+
+    return SDMMC::Status::OK;
+}
+
+
+SDMMC::Status SDMMC_BlockCache::writeBlocks(uint8_t buffer[], uint32_t blockNo,
+                                            uint32_t blockCount)
+{
+    if (blockCount == 1) {
+        return writeBlock(buffer, blockNo);
+    }
+
+    auto status = sdmmc.writeBlocks(buffer, blockNo, blockCount);
+    cardWriteCount++;
+
+    // Keep cached copies consistent, they stay dirty if the write failed
+    for (auto slot = 0; slot < config.slotCount; slot++) {
+        auto blockNoInSlot = blockNos[slot];
+
+        if (blockNoInSlot == INVALID_BLOCK || blockNoInSlot < blockNo
+            || blockNoInSlot >= blockNo + blockCount) {
+            continue;
+        }
+
+        memcpy(getSlotData(slot),
+               &buffer[(blockNoInSlot - blockNo) * SDMMC::BLOCK_SIZE],
+               SDMMC::BLOCK_SIZE);
+
+        dirty[slot] = (status != SDMMC::Status::OK);
+    }
+
+    return status;
+}
+
+
+SDMMC::Status SDMMC_BlockCache::flush()
+{
+    for (auto slot = 0; slot < config.slotCount; slot++) {
+        if (dirty[slot]) {
+            auto status = flushRun(slot);
+
+            if (status != SDMMC::Status::OK) {
+                return status;
+            }
+        }
+    }
+
+    return SDMMC::Status::OK;
+}
+
+
+SDMMC::Status SDMMC_BlockCache::process()
+{
+    if (config.idleFlushTime == 0 || sdmmc.isTransferActive()) {
+        return SDMMC::Status::OK;
+    }
+
+    if (getMilliseconds() - lastWriteTime < config.idleFlushTime) {
+        return SDMMC::Status::OK;
+    }
+
+    return flush();
+}
+
+
+void SDMMC_BlockCache::invalidate()
+{
+    for (auto slot = 0; slot < config.slotCount; slot++) {
+        blockNos[slot] = INVALID_BLOCK;
+        dirty[slot] = false;
+    }
+}
+
+
+void SDMMC_BlockCache::invalidate(uint32_t blockNo, uint32_t blockCount)
+{
+    for (auto slot = 0; slot < config.slotCount; slot++) {
+        auto blockNoInSlot = blockNos[slot];
+
+        if (blockNoInSlot == INVALID_BLOCK || blockNoInSlot < blockNo
+            || blockNoInSlot - blockNo >= blockCount) {
+            continue;
+        }
+
+        blockNos[slot] = INVALID_BLOCK;
+        dirty[slot] = false;
+    }
+}
+
+
+int SDMMC_BlockCache::getDirtyCount()
+{
+    auto count = 0;
+
+    for (auto slot = 0; slot < config.slotCount; slot++) {
+        if (dirty[slot]) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+void SDMMC_BlockCache::resetStatistics()
+{
+    hitCount = 0;
+    missCount = 0;
+    cardWriteCount = 0;
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+void SDMMC_BlockCache::allocateSlots(int slotCount, int maxFlushBlockCount)
+{
+    deallocateSlots();
+
+    data = new uint32_t[slotCount * SDMMC::BLOCK_SIZE / 4];
+    blockNos = new uint32_t[slotCount];
+    lastUsed = new uint32_t[slotCount];
+    dirty = new bool[slotCount];
+
+    if (maxFlushBlockCount > 1) {
+        flushBuffer = new uint32_t[maxFlushBlockCount * SDMMC::BLOCK_SIZE / 4];
+    }
+
+    for (auto slot = 0; slot < slotCount; slot++) {
+        blockNos[slot] = INVALID_BLOCK;
+        lastUsed[slot] = 0;
+        dirty[slot] = false;
+    }
+
+    useCounter = 0;
+}
+
+
+void SDMMC_BlockCache::deallocateSlots()
+{
+    if (data != nullptr) {
+        delete[] data;
+        delete[] blockNos;
+        delete[] lastUsed;
+        delete[] dirty;
+    }
+
+    if (flushBuffer != nullptr) {
+        delete[] flushBuffer;
+    }
+
+    data = nullptr;
+    blockNos = nullptr;
+    lastUsed = nullptr;
+    dirty = nullptr;
+    flushBuffer = nullptr;
+}
+
+
+int SDMMC_BlockCache::findSlot(uint32_t blockNo)
+{
+    for (auto slot = 0; slot < config.slotCount; slot++) {
+        if (blockNos[slot] == blockNo) {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+
+SDMMC::Status SDMMC_BlockCache::allocateSlot(int& slot)
+{
+    auto victim = 0;
+
+    for (auto i = 0; i < config.slotCount; i++) {
+        if (blockNos[i] == INVALID_BLOCK) {
+            slot = i;
+            return SDMMC::Status::OK;
+        }
+
+        // Unsigned difference keeps ordering valid on counter overflow
+        if (useCounter - lastUsed[i] > useCounter - lastUsed[victim]) {
+            victim = i;
+        }
+    }
+
+    if (dirty[victim]) {
+        auto status = flushRun(victim);
+
+        if (status != SDMMC::Status::OK) {
+            return status;
+        }
+    }
+
+    blockNos[victim] = INVALID_BLOCK;
+    slot = victim;
+
+    return SDMMC::Status::OK;
+}
+
+
+SDMMC::Status SDMMC_BlockCache::flushRun(int slot)
+{
+    while (dirty[slot]) {
+        // Find first block of the run of dirty blocks
+        auto firstBlockNo = blockNos[slot];
+
+        while (firstBlockNo > 0) {
+            auto previous = findSlot(firstBlockNo - 1);
+
+            if (previous < 0 || !dirty[previous]) {
+                break;
+            }
+
+            firstBlockNo--;
+        }
+
+        auto firstSlot = findSlot(firstBlockNo);
+        auto blockCount = 1;
+
+        // Collect following dirty blocks
+        while (blockCount < config.maxFlushBlockCount) {
+            auto next = findSlot(firstBlockNo + blockCount);
+
+            if (next < 0 || !dirty[next]) {
+                break;
+            }
+
+            if (blockCount == 1) {
+                memcpy(flushBuffer, getSlotData(firstSlot), SDMMC::BLOCK_SIZE);
+            }
+
+            memcpy((uint8_t*)flushBuffer + blockCount * SDMMC::BLOCK_SIZE,
+                   getSlotData(next), SDMMC::BLOCK_SIZE);
+
+            blockCount++;
+        }
+
+        SDMMC::Status status;
+
+        if (blockCount == 1) {
+            status = sdmmc.writeBlock(getSlotData(firstSlot), firstBlockNo);
+        } else {
+            status = sdmmc.writeBlocks((uint8_t*)flushBuffer, firstBlockNo,
+                                       blockCount);
+        }
+
+        cardWriteCount++;
+
+        if (status != SDMMC::Status::OK) {
+            return status;
+        }
+
+        for (auto i = 0; i < blockCount; i++) {
+            dirty[findSlot(firstBlockNo + i)] = false;
+        }
+    }
+
+    return SDMMC::Status::OK;
+}
+
+
+} // namespace mcu
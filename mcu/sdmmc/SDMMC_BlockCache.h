@@ -0,0 +1,275 @@
+/**
+ * @file        SDMMC_BlockCache.h
+ *
+ * Write-back block cache for SDMMC on STM32L4xx
+ *
+ * Single block accesses, typically filesystem metadata, are served from
+ * a small set of slots with LRU replacement. Written blocks are kept dirty
+ * until flushed, adjacent dirty blocks are combined to one multiple block
+ * write. Multiple block accesses bypass the cache to not evict metadata.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "SDMMC.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class SDMMC_BlockCache
+{
+  public:
+    /**
+     * Configuration settings
+     */
+    struct Config
+    {
+        int slotCount = 8;              // Number of cached blocks
+        int maxFlushBlockCount = 8;     // Max. blocks combined in one write
+        uint32_t idleFlushTime = 100;   // Flush after ms without writes, 0=off
+    };
+
+    /**
+     * Constructor
+     *
+     * @param sdmmc     Reference to SDMMC peripheral with initialised card
+     */
+    SDMMC_BlockCache(SDMMC& sdmmc) : sdmmc(sdmmc)
+    {
+    }
+
+    /**
+     * Disallow copy
+     */
+    SDMMC_BlockCache(const SDMMC_BlockCache&) = delete;
+    SDMMC_BlockCache& operator=(const SDMMC_BlockCache&) = delete;
+    SDMMC_BlockCache& operator=(SDMMC_BlockCache&&) = delete;
+
+    /**
+     * Init with config settings
+     *
+     * @param config    Reference to configuration struct
+     */
+    void init(Config& config);
+
+    /**
+     * Shutdown, dirty blocks must be flushed before
+     */
+    void deinit();
+
+    /**
+     * Read a block, fetching it from card if not cached
+     *
+     * @param buffer    Buffer to be filled with data, 512 bytes
+     * @param blockNo   Block number
+     * @return          SDMMC::Status enum setting
+     */
+    SDMMC::Status readBlock(uint8_t buffer[], uint32_t blockNo);
+
+    /**
+     * Write a block into cache, card is updated on flush
+     *
+     * @param buffer    Buffer containing data, 512 bytes
+     * @param blockNo   Block number
+     * @return          SDMMC::Status enum setting
+     */
+    SDMMC::Status writeBlock(uint8_t buffer[], uint32_t blockNo);
+
+    /**
+     * Read consecutive blocks, cached blocks are taken from cache
+     *
+     * @param buffer    Buffer to be filled with data, blockCount * 512 bytes
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks
+     * @return          SDMMC::Status enum setting
+     */
+    SDMMC::Status readBlocks(uint8_t buffer[], uint32_t blockNo,
+                             uint32_t blockCount);
+
+    /**
+     * Write consecutive blocks directly to card, cached copies are updated
+     *
+     * @param buffer    Buffer containing data, blockCount * 512 bytes
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks
+     * @return          SDMMC::Status enum setting
+     */
+    SDMMC::Status writeBlocks(uint8_t buffer[], uint32_t blockNo,
+                              uint32_t blockCount);
+
+    /**
+     * Write all dirty blocks to card
+     *
+     * @return          SDMMC::Status enum setting
+     */
+    SDMMC::Status flush();
+
+    /**
+     * Flush if no block was written for the configured idle time,
+     * call periodically from main loop
+     *
+     * @return          SDMMC::Status enum setting
+     */
+    SDMMC::Status process();
+
+    /**
+     * Drop all cached blocks without writing dirty ones, e.g. after card
+     * removal
+     */
+    void invalidate();
+
+    /**
+     * Drop cached copies of a range of blocks without writing them, e.g.
+     * after erasing them on card
+     *
+     * @param blockNo   Number of first block
+     * @param blockCount Number of blocks
+     */
+    void invalidate(uint32_t blockNo, uint32_t blockCount);
+
+    /**
+     * Return number of dirty blocks
+     *
+     * @return          Number of blocks
+     */
+    int getDirtyCount();
+
+    /**
+     * Return number of single block reads served from cache
+     *
+     * @return          Number of hits
+     */
+    uint32_t getHitCount()
+    {
+        return hitCount;
+    }
+
+    /**
+     * Return number of single block reads that required a card read
+     *
+     * @return          Number of misses
+     */
+    uint32_t getMissCount()
+    {
+        return missCount;
+    }
+
+    /**
+     * Return number of write commands issued to card
+     *
+     * @return          Number of writes
+     */
+    uint32_t getCardWriteCount()
+    {
+        return cardWriteCount;
+    }
+
+    /**
+     * Reset statistics counters
+     */
+    void resetStatistics();
+
+  protected:
+    /**
+     * Block number of an unused slot
+     */
+    static const uint32_t INVALID_BLOCK = 0xFFFFFFFF;
+
+    /**
+     * Allocate slots on heap
+     *
+     * @param slotCount Number of slots
+     * @param maxFlushBlockCount Size of flush buffer in blocks
+     */
+    void allocateSlots(int slotCount, int maxFlushBlockCount);
+
+    /**
+     * Deallocate slots on heap
+     */
+    void deallocateSlots();
+
+    /**
+     * Return index of slot holding a block
+     *
+     * @param blockNo   Block number
+     * @return          Slot index or -1 if not cached
+     */
+    int findSlot(uint32_t blockNo);
+
+    /**
+     * Return index of a free slot, evicting the least recently used one
+     *
+     * @param slot      Reference to slot index
+     * @return          SDMMC::Status enum setting
+     */
+    SDMMC::Status allocateSlot(int& slot);
+
+    /**
+     * Write a dirty slot together with adjacent dirty slots
+     *
+     * @param slot      Slot index
+     * @return          SDMMC::Status enum setting
+     */
+    SDMMC::Status flushRun(int slot);
+
+    /**
+     * Return pointer to data of a slot
+     */
+    uint8_t* getSlotData(int slot)
+    {
+        return (uint8_t*)&data[slot * SDMMC::BLOCK_SIZE / 4];
+    }
+
+    /**
+     * Reference to SDMMC peripheral
+     */
+    SDMMC& sdmmc;
+
+    /**
+     * Configuration
+     */
+    Config config;
+
+    /**
+     * Slot storage, word aligned for DMA
+     */
+    uint32_t* data = nullptr;
+    uint32_t* blockNos = nullptr;
+    uint32_t* lastUsed = nullptr;
+    bool* dirty = nullptr;
+
+    /**
+     * Buffer to combine adjacent blocks, word aligned for DMA
+     */
+    uint32_t* flushBuffer = nullptr;
+
+    /**
+     * Access counter for LRU replacement
+     */
+    uint32_t useCounter = 0;
+
+    /**
+     * Time of last write in ms
+     */
+    uint32_t lastWriteTime = 0;
+
+    /**
+     * Statistics
+     */
+    uint32_t hitCount = 0;
+    uint32_t missCount = 0;
+    uint32_t cardWriteCount = 0;
+};
+
+
+} // namespace mcu
@@ -0,0 +1,296 @@
+/**
+ * @file        SDMMC_BlockDevice.cpp
+ *
+ * Block device on SD card via SDMMC peripheral of STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "SDMMC_BlockDevice.h"
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+BlockDevice::Status SDMMC_BlockDevice::read(uint8_t buffer[], uint32_t blockNo,
+                                            uint32_t blockCount)
+{
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    if (transferActive) {
+        return Status::BUSY;
+    }
+
+    if (cache != nullptr) {
+        return getStatus(cache->readBlocks(buffer, blockNo, blockCount));
+    }
+
+    return getStatus(sdmmc.readBlocks(buffer, blockNo, blockCount));
+}
+
+
+BlockDevice::Status SDMMC_BlockDevice::write(uint8_t buffer[],
+                                             uint32_t blockNo,
+                                             uint32_t blockCount)
+{
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    if (transferActive) {
+        return Status::BUSY;
+    }
+
+    if (cache != nullptr) {
+        return getStatus(cache->writeBlocks(buffer, blockNo, blockCount));
+    }
+
+    return getStatus(sdmmc.writeBlocks(buffer, blockNo, blockCount));
+}
+
+
+BlockDevice::Status SDMMC_BlockDevice::erase(uint32_t blockNo,
+                                             uint32_t blockCount)
+{
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    if (transferActive) {
+        return Status::BUSY;
+    }
+
+    if (cache != nullptr) {
+        cache->invalidate(blockNo, blockCount);
+    }
+
+    auto status = sdmmc.erase(blockNo, blockCount,
+                              SDMMC::EraseMode::DISCARD);
+
+    // Erase is only a hint, so cards without erase support are fine
+    if (status == SDMMC::Status::NOT_SUPPORTED) {
+        return Status::OK;
+    }
+
+    return getStatus(status);
+}
+
+
+BlockDevice::Status SDMMC_BlockDevice::sync()
+{
+    while (transferActive) {
+        // Wait until pending non-blocking operation is finished
+    }
+
+    if (cache != nullptr) {
+        return getStatus(cache->flush());
+    }
+
+    return Status::OK;
+}
+
+
+BlockDevice::Status SDMMC_BlockDevice::startRead(uint8_t buffer[],
+                                                 uint32_t blockNo,
+                                                 uint32_t blockCount,
+                                                 CallbackFunc callback,
+                                                 void* context)
+{
+    if (cache != nullptr) {
+        return BlockDevice::startRead(buffer, blockNo, blockCount, callback,
+                                      context);
+    }
+
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    if (transferActive || sdmmc.isTransferActive()) {
+        return Status::BUSY;
+    }
+
+    transferActive = true;
+    transferBuffer = buffer;
+    transferBlockNo = blockNo;
+    transferBlockCount = blockCount;
+    transferReceive = true;
+    this->callback = callback;
+    callbackContext = context;
+
+    takeCallbacks();
+
+    auto status = startChunk();
+
+    if (status != SDMMC::Status::OK) {
+        restoreCallbacks();
+        transferActive = false;
+    }
+
+    return getStatus(status);
+}
+
+
+BlockDevice::Status SDMMC_BlockDevice::startWrite(uint8_t buffer[],
+                                                  uint32_t blockNo,
+                                                  uint32_t blockCount,
+                                                  CallbackFunc callback,
+                                                  void* context)
+{
+    if (cache != nullptr) {
+        return BlockDevice::startWrite(buffer, blockNo, blockCount, callback,
+                                       context);
+    }
+
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    if (transferActive || sdmmc.isTransferActive()) {
+        return Status::BUSY;
+    }
+
+    transferActive = true;
+    transferBuffer = buffer;
+    transferBlockNo = blockNo;
+    transferBlockCount = blockCount;
+    transferReceive = false;
+    this->callback = callback;
+    callbackContext = context;
+
+    takeCallbacks();
+
+    auto status = startChunk();
+
+    if (status != SDMMC::Status::OK) {
+        restoreCallbacks();
+        transferActive = false;
+    }
+
+    return getStatus(status);
+}
+
+
+bool SDMMC_BlockDevice::isBusy()
+{
+    return transferActive;
+}
+
+
+BlockDevice::Status SDMMC_BlockDevice::getStatus(SDMMC::Status status)
+{
+    switch (status) {
+        case SDMMC::Status::OK:
+            return Status::OK;
+
+        case SDMMC::Status::BUSY:
+            return Status::BUSY;
+
+        case SDMMC::Status::INVALID_PARAMETER:
+            return Status::INVALID_PARAMETER;
+
+        case SDMMC::Status::NOT_INITIALISED:
+            return Status::NOT_READY;
+
+        default:
+            return Status::IO_ERROR;
+    }
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+void SDMMC_BlockDevice::takeCallbacks()
+{
+    savedCompleteCallback
+        = sdmmc.getTransferCompleteCallback(savedCompleteCallbackContext);
+    savedErrorCallback
+        = sdmmc.getTransferErrorCallback(savedErrorCallbackContext);
+
+    sdmmc.setTransferCompleteCallback(transferCompleteCallback, this);
+    sdmmc.setTransferErrorCallback(transferErrorCallback, this);
+}
+
+
+void SDMMC_BlockDevice::restoreCallbacks()
+{
+    sdmmc.setTransferCompleteCallback(savedCompleteCallback,
+                                      savedCompleteCallbackContext);
+    sdmmc.setTransferErrorCallback(savedErrorCallback,
+                                   savedErrorCallbackContext);
+}
+
+
+SDMMC::Status SDMMC_BlockDevice::startChunk()
+{
+    // DMA transfers are limited in length, so split into chunks
+    chunkBlockCount = transferBlockCount;
+
+    if (chunkBlockCount > SDMMC::MAX_DMA_BLOCK_COUNT) {
+        chunkBlockCount = SDMMC::MAX_DMA_BLOCK_COUNT;
+    }
+
+    if (transferReceive) {
+        return sdmmc.startReadBlocks(transferBuffer, transferBlockNo,
+                                     chunkBlockCount);
+    }
+
+    return sdmmc.startWriteBlocks(transferBuffer, transferBlockNo,
+                                  chunkBlockCount);
+}
+
+
+void SDMMC_BlockDevice::finishTransfer(Status status)
+{
+    restoreCallbacks();
+    transferActive = false;
+
+    if (callback != nullptr) {
+        callback(this, status, callbackContext);
+    }
+}
+
+
+void SDMMC_BlockDevice::transferCompleteCallback(SDMMC*, void* context)
+{
+    auto blockDevice = (SDMMC_BlockDevice*)context;
+
+    blockDevice->transferBuffer += blockDevice->chunkBlockCount
+                                   * SDMMC::BLOCK_SIZE;
+    blockDevice->transferBlockNo += blockDevice->chunkBlockCount;
+    blockDevice->transferBlockCount -= blockDevice->chunkBlockCount;
+
+    if (blockDevice->transferBlockCount == 0) {
+        blockDevice->finishTransfer(Status::OK);
+        return;
+    }
+
+    auto status = blockDevice->startChunk();
+
+    if (status != SDMMC::Status::OK) {
+        blockDevice->finishTransfer(getStatus(status));
+    }
+}
+
+
+void SDMMC_BlockDevice::transferErrorCallback(SDMMC* sdmmc, void* context)
+{
+    auto blockDevice = (SDMMC_BlockDevice*)context;
+
+    blockDevice->finishTransfer(getStatus(sdmmc->getTransferStatus()));
+}
+
+
+} // namespace mcu
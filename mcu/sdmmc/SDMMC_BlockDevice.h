@@ -0,0 +1,155 @@
+/**
+ * @file        SDMMC_BlockDevice.h
+ *
+ * Block device on SD card via SDMMC peripheral of STM32L4xx
+ *
+ * Non-blocking operations take over the transfer callbacks of the SDMMC
+ * peripheral while they run and restore the previous ones when finished.
+ * If a block cache is attached, all accesses go through it and
+ * non-blocking operations fall back to blocking ones.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "SDMMC.h"
+#include "SDMMC_BlockCache.h"
+
+// This component
+#include "../storage/BlockDevice.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class SDMMC_BlockDevice : public BlockDevice
+{
+  public:
+    /**
+     * Constructor
+     *
+     * @param sdmmc     Reference to SDMMC peripheral with initialised card
+     * @param cache     Pointer to initialised block cache or nullptr
+     */
+    SDMMC_BlockDevice(SDMMC& sdmmc, SDMMC_BlockCache* cache = nullptr)
+        : sdmmc(sdmmc), cache(cache)
+    {
+    }
+
+    /**
+     * Disallow copy
+     */
+    SDMMC_BlockDevice(const SDMMC_BlockDevice&) = delete;
+    SDMMC_BlockDevice& operator=(const SDMMC_BlockDevice&) = delete;
+    SDMMC_BlockDevice& operator=(SDMMC_BlockDevice&&) = delete;
+
+    virtual uint32_t getBlockSize() override
+    {
+        return SDMMC::BLOCK_SIZE;
+    }
+
+    virtual uint32_t getBlockCount() override
+    {
+        return sdmmc.getBlockCount();
+    }
+
+    virtual Status read(uint8_t buffer[], uint32_t blockNo,
+                        uint32_t blockCount) override;
+
+    virtual Status write(uint8_t buffer[], uint32_t blockNo,
+                         uint32_t blockCount) override;
+
+    virtual Status erase(uint32_t blockNo, uint32_t blockCount) override;
+
+    virtual Status sync() override;
+
+    virtual Status startRead(uint8_t buffer[], uint32_t blockNo,
+                             uint32_t blockCount, CallbackFunc callback,
+                             void* context = nullptr) override;
+
+    virtual Status startWrite(uint8_t buffer[], uint32_t blockNo,
+                              uint32_t blockCount, CallbackFunc callback,
+                              void* context = nullptr) override;
+
+    virtual bool isBusy() override;
+
+    /**
+     * Convert SDMMC status to block device status
+     *
+     * @param status    SDMMC::Status enum setting
+     * @return          Status enum setting
+     */
+    static Status getStatus(SDMMC::Status status);
+
+  protected:
+    /**
+     * Save the transfer callbacks of the SDMMC peripheral and set own ones
+     */
+    void takeCallbacks();
+
+    /**
+     * Restore the saved transfer callbacks of the SDMMC peripheral
+     */
+    void restoreCallbacks();
+
+    /**
+     * Start transfer of next chunk of a non-blocking operation
+     *
+     * @return          SDMMC::Status enum setting
+     */
+    SDMMC::Status startChunk();
+
+    /**
+     * Finish a non-blocking operation and call user callback
+     *
+     * @param status    Status enum setting
+     */
+    void finishTransfer(Status status);
+
+    /**
+     * Callbacks of SDMMC peripheral
+     */
+    static void transferCompleteCallback(SDMMC* sdmmc, void* context);
+    static void transferErrorCallback(SDMMC* sdmmc, void* context);
+
+    /**
+     * Reference to SDMMC peripheral
+     */
+    SDMMC& sdmmc;
+
+    /**
+     * Optional block cache
+     */
+    SDMMC_BlockCache* cache;
+
+    /**
+     * State of current non-blocking operation
+     */
+    volatile bool transferActive = false;
+    uint8_t* transferBuffer = nullptr;
+    uint32_t transferBlockNo = 0;
+    uint32_t transferBlockCount = 0;
+    uint32_t chunkBlockCount = 0;
+    bool transferReceive = false;
+    CallbackFunc callback = nullptr;
+    void* callbackContext = nullptr;
+
+    /**
+     * Callbacks of SDMMC peripheral saved during non-blocking operation
+     */
+    SDMMC::CallbackFunc savedCompleteCallback = nullptr;
+    void* savedCompleteCallbackContext = nullptr;
+    SDMMC::CallbackFunc savedErrorCallback = nullptr;
+    void* savedErrorCallbackContext = nullptr;
+};
+
+
+} // namespace mcu
@@ -13,6 +13,7 @@
 
 // This component
 #include "../core/NVIC.h"
+#include "../gpio/PinGroup.h"
 #include "../rcc/RCC_Registers.h"
 #include "../utility/register.h"
 #include "../utility/bit_manipulation.h"
@@ -20,6 +21,7 @@
 // System libraries
 #include <cstdlib>
 #include <cstring>
+#include <initializer_list>
 
 
 namespace mcu {
@@ -76,71 +78,35 @@ void SPI::initPins(Pin::Id clkPinId, Pin::Id mosiPinId, Pin::Id misoPinId,
             af = Pin::AF::AF6;
             break;
         default:
-            break;
+            return;
     }
 
-    // CLK pin
-    if (clkPinId != Pin::NONE) {
-        auto pin = Pin::get(clkPinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(Pin::OutputSpeed::MEDIUM);
-        pin.setAlternateFunction(af);
-    }
+    PinGroup pins;
 
-    // MOSI pin
-    if (mosiPinId != Pin::NONE) {
-        auto pin = Pin::get(mosiPinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setOutputSpeed(Pin::OutputSpeed::MEDIUM);
-        pin.setAlternateFunction(af);
+    for (auto pinId : {clkPinId, mosiPinId}) {
+        pins.setAlternateFunctionMode(pinId, af, Pin::OutputSpeed::MEDIUM);
     }
 
-    // MISO pin
-    if (misoPinId != Pin::NONE) {
-        auto pin = Pin::get(misoPinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setAlternateFunction(af);
+    // Input and chip select pins keep their output speed
+    for (auto pinId : {misoPinId, nssPinId}) {
+        pins.setAlternateFunction(pinId, af);
+        pins.setMode(pinId, Pin::Mode::AF);
     }
 
-    // NSS pin
-    if (nssPinId != Pin::NONE) {
-        auto pin = Pin::get(nssPinId);
-        pin.setMode(Pin::Mode::AF);
-        pin.setAlternateFunction(af);
-    }
+    pins.apply();
 };
 
 
 void SPI::deinitPins(Pin::Id clkPinId, Pin::Id mosiPinId, Pin::Id misoPinId,
                      Pin::Id nssPinId)
 {
-    // CLK pin
-    if (clkPinId != Pin::NONE) {
-        auto pin = Pin::get(clkPinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+    PinGroup pins;
 
-    // MOSI pin
-    if (mosiPinId != Pin::NONE) {
-        auto pin = Pin::get(mosiPinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
+    for (auto pinId : {clkPinId, mosiPinId, misoPinId, nssPinId}) {
+        pins.setInputMode(pinId);
     }
 
-    // MISO pin
-    if (misoPinId != Pin::NONE) {
-        auto pin = Pin::get(misoPinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
-
-    // NSS pin
-    if (nssPinId != Pin::NONE) {
-        auto pin = Pin::get(nssPinId);
-        pin.setMode(Pin::Mode::INPUT);
-        pin.setAlternateFunction(Pin::AF::AF0);
-    }
+    pins.apply();
 }
 
 
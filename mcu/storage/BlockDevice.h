@@ -0,0 +1,185 @@
+/**
+ * @file        BlockDevice.h
+ *
+ * Abstract interface for block oriented storage, e.g. as backend of
+ * filesystems like FatFs or littlefs
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class BlockDevice
+{
+    public:
+        /**
+         * Status codes
+         */
+        enum Status
+        {
+            OK,
+            IO_ERROR,
+            BUSY,
+            INVALID_PARAMETER,
+            NOT_READY
+        };
+
+        /**
+         * Callback for completion of non-blocking operations
+         */
+        typedef void (*CallbackFunc)(BlockDevice*, Status, void*);
+
+        /**
+         * Return size of a block, the unit of all read and write operations
+         *
+         * @return              Block size in bytes
+         */
+        virtual uint32_t getBlockSize() = 0;
+
+        /**
+         * Return total number of blocks
+         *
+         * @return              Number of blocks
+         */
+        virtual uint32_t getBlockCount() = 0;
+
+        /**
+         * Read consecutive blocks, blocking
+         *
+         * @param buffer        Buffer to be filled with data
+         * @param blockNo       Number of first block
+         * @param blockCount    Number of blocks
+         * @return              Status enum setting
+         */
+        virtual Status read(uint8_t buffer[], uint32_t blockNo,
+                            uint32_t blockCount) = 0;
+
+        /**
+         * Write consecutive blocks, blocking
+         *
+         * Previous content is replaced, no erase is required before.
+         *
+         * @param buffer        Buffer containing data
+         * @param blockNo       Number of first block
+         * @param blockCount    Number of blocks
+         * @return              Status enum setting
+         */
+        virtual Status write(uint8_t buffer[], uint32_t blockNo,
+                             uint32_t blockCount) = 0;
+
+        /**
+         * Mark blocks as unused, content is undefined afterwards
+         *
+         * The default implementation does nothing, which is valid since
+         * erase is only a hint to the device.
+         *
+         * @param blockNo       Number of first block
+         * @param blockCount    Number of blocks
+         * @return              Status enum setting
+         */
+        virtual Status erase(uint32_t blockNo, uint32_t blockCount)
+        {
+            return isValidRange(blockNo, blockCount) ? OK : INVALID_PARAMETER;
+        }
+
+        /**
+         * Write back buffered data and wait for pending operations
+         *
+         * @return              Status enum setting
+         */
+        virtual Status sync()
+        {
+            return OK;
+        }
+
+        /**
+         * Start reading consecutive blocks
+         *
+         * The callback is called on completion, possibly from interrupt
+         * context. The default implementation reads blocking and calls
+         * the callback before returning.
+         *
+         * @param buffer        Buffer to be filled with data, must stay
+         *                      valid until completion
+         * @param blockNo       Number of first block
+         * @param blockCount    Number of blocks
+         * @param callback      Completion callback or nullptr
+         * @param context       Pointer passed to callback
+         * @return              Status enum setting of start
+         */
+        virtual Status startRead(uint8_t buffer[], uint32_t blockNo,
+                                 uint32_t blockCount, CallbackFunc callback,
+                                 void* context = nullptr)
+        {
+            auto status = read(buffer, blockNo, blockCount);
+
+            if (callback != nullptr) {
+                callback(this, status, context);
+            }
+
+            return status;
+        }
+
+        /**
+         * Start writing consecutive blocks
+         *
+         * The callback is called on completion, possibly from interrupt
+         * context. The default implementation writes blocking and calls
+         * the callback before returning.
+         *
+         * @param buffer        Buffer containing data, must stay valid
+         *                      until completion
+         * @param blockNo       Number of first block
+         * @param blockCount    Number of blocks
+         * @param callback      Completion callback or nullptr
+         * @param context       Pointer passed to callback
+         * @return              Status enum setting of start
+         */
+        virtual Status startWrite(uint8_t buffer[], uint32_t blockNo,
+                                  uint32_t blockCount, CallbackFunc callback,
+                                  void* context = nullptr)
+        {
+            auto status = write(buffer, blockNo, blockCount);
+
+            if (callback != nullptr) {
+                callback(this, status, context);
+            }
+
+            return status;
+        }
+
+        /**
+         * Return if a non-blocking operation is in progress
+         *
+         * @return              True if busy
+         */
+        virtual bool isBusy()
+        {
+            return false;
+        }
+
+    protected:
+        /**
+         * Return if a range of blocks is within the device
+         */
+        bool isValidRange(uint32_t blockNo, uint32_t blockCount)
+        {
+            auto count = getBlockCount();
+
+            return blockCount > 0 && blockNo < count
+                   && blockCount <= count - blockNo;
+        }
+};
+
+
+}   // namespace mcu
@@ -0,0 +1,245 @@
+/**
+ * @file        BlockDevice_Benchmark.cpp
+ *
+ * Throughput and latency benchmark for block devices
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "BlockDevice_Benchmark.h"
+
+// System libraries
+#include <cstdio>
+#include <cstring>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+BlockDevice_Benchmark::~BlockDevice_Benchmark()
+{
+    deinit();
+}
+
+
+bool BlockDevice_Benchmark::init(Config& config)
+{
+    this->config = config;
+
+    if (config.cycleCounterFunc == nullptr || config.transferBlockCount == 0
+        || config.regionBlockCount < config.transferBlockCount) {
+        return false;
+    }
+
+    deinit();
+
+    auto length = config.transferBlockCount * device.getBlockSize();
+    buffer = new uint32_t[(length + 3) / 4];
+
+    // Recognizable fill pattern for write tests
+    for (uint32_t i = 0; i < (length + 3) / 4; i++) {
+        buffer[i] = 0xA5000000 | i;
+    }
+
+    return true;
+}
+
+
+void BlockDevice_Benchmark::deinit()
+{
+    if (buffer != nullptr) {
+        delete[] buffer;
+    }
+
+    buffer = nullptr;
+}
+
+
+void BlockDevice_Benchmark::measure(Pattern pattern, Result& result)
+{
+    result = Result();
+    memset(result.histogram, 0, sizeof(result.histogram));
+
+    randomState = config.randomSeed != 0 ? config.randomSeed : 1;
+
+    auto write = (pattern == Pattern::SEQUENTIAL_WRITE
+                  || pattern == Pattern::RANDOM_WRITE);
+    auto random = (pattern == Pattern::RANDOM_READ
+                   || pattern == Pattern::RANDOM_WRITE);
+
+    // Operations are aligned to the transfer size
+    auto slotCount = config.regionBlockCount / config.transferBlockCount;
+    auto length = config.transferBlockCount * device.getBlockSize();
+
+    for (uint32_t i = 0; i < config.operationCount; i++) {
+        auto slot = random ? getRandom() % slotCount : i % slotCount;
+        auto blockNo = config.startBlockNo + slot * config.transferBlockCount;
+
+        auto startCycles = config.cycleCounterFunc();
+
+        BlockDevice::Status status;
+
+        if (write) {
+            status = device.write((uint8_t*)buffer, blockNo,
+                                  config.transferBlockCount);
+        } else {
+            status = device.read((uint8_t*)buffer, blockNo,
+                                 config.transferBlockCount);
+        }
+
+        // Unsigned difference is valid across a counter wrap
+        uint32_t cycles = config.cycleCounterFunc() - startCycles;
+
+        if (status != BlockDevice::Status::OK) {
+            result.status = status;
+            break;
+        }
+
+        if (result.operationCount == 0 || cycles < result.minCycles) {
+            result.minCycles = cycles;
+        }
+
+        if (cycles > result.maxCycles) {
+            result.maxCycles = cycles;
+        }
+
+        auto microseconds = getMicroseconds(cycles);
+        auto bucket = 0;
+
+        while (bucket < HISTOGRAM_BUCKET_COUNT - 1
+               && (microseconds >> (bucket + 1)) != 0) {
+            bucket++;
+        }
+
+        result.histogram[bucket]++;
+        result.operationCount++;
+        result.byteCount += length;
+        result.totalCycles += cycles;
+    }
+
+    // Include pending writes of buffering devices
+    if (write && result.status == BlockDevice::Status::OK) {
+        auto startCycles = config.cycleCounterFunc();
+        result.status = device.sync();
+        result.totalCycles += (uint32_t)(config.cycleCounterFunc()
+                                         - startCycles);
+    }
+}
+
+
+bool BlockDevice_Benchmark::run(const char* label)
+{
+    static const Pattern patterns[] = {
+        Pattern::SEQUENTIAL_READ,
+        Pattern::SEQUENTIAL_WRITE,
+        Pattern::RANDOM_READ,
+        Pattern::RANDOM_WRITE
+    };
+
+    auto success = true;
+
+    for (auto pattern : patterns) {
+        Result result;
+        measure(pattern, result);
+        print(label, pattern, result);
+
+        if (result.status != BlockDevice::Status::OK) {
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+
+void BlockDevice_Benchmark::print(const char* label, Pattern pattern,
+                                  Result& result)
+{
+    if (config.printFunc == nullptr) {
+        return;
+    }
+
+    static const char* patternNames[] = {
+        "seq read", "seq write", "rnd read", "rnd write"
+    };
+
+    char text[96];
+
+    snprintf(text, sizeof(text), "%s, %s, %lu blocks/op:\r\n", label,
+             patternNames[(int)pattern],
+             (unsigned long)config.transferBlockCount);
+    config.printFunc(text);
+
+    if (result.status != BlockDevice::Status::OK) {
+        snprintf(text, sizeof(text), "  failed with status %d after %lu ops\r\n",
+                 (int)result.status, (unsigned long)result.operationCount);
+        config.printFunc(text);
+        return;
+    }
+
+    if (result.operationCount == 0) {
+        return;
+    }
+
+    snprintf(text, sizeof(text),
+             "  %lu KiB/s, latency min %lu us, avg %lu us, max %lu us\r\n",
+             (unsigned long)getThroughput(result),
+             (unsigned long)getMicroseconds(result.minCycles),
+             (unsigned long)getMicroseconds(result.totalCycles
+                                            / result.operationCount),
+             (unsigned long)getMicroseconds(result.maxCycles));
+    config.printFunc(text);
+
+    for (auto bucket = 0; bucket < HISTOGRAM_BUCKET_COUNT; bucket++) {
+        if (result.histogram[bucket] == 0) {
+            continue;
+        }
+
+        snprintf(text, sizeof(text), "  < %lu us: %lu\r\n",
+                 (unsigned long)(2UL << bucket),
+                 (unsigned long)result.histogram[bucket]);
+        config.printFunc(text);
+    }
+}
+
+
+uint32_t BlockDevice_Benchmark::getThroughput(Result& result)
+{
+    if (result.totalCycles == 0) {
+        return 0;
+    }
+
+    return result.byteCount * config.cycleFreq / 1024 / result.totalCycles;
+}
+
+
+uint32_t BlockDevice_Benchmark::getMicroseconds(uint64_t cycles)
+{
+    return cycles * 1000000 / config.cycleFreq;
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+uint32_t BlockDevice_Benchmark::getRandom()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+
+    return randomState;
+}
+
+
+}   // namespace mcu
@@ -0,0 +1,186 @@
+/**
+ * @file        BlockDevice_Benchmark.h
+ *
+ * Throughput and latency benchmark for block devices
+ *
+ * Measures sequential and random reads and writes with a cycle counter,
+ * e.g. DWT::getCycleCount() on target or a clock based counter on host.
+ * Results are formatted as text and passed to a print function, e.g.
+ * writing to UART. Write tests overwrite the configured region.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "BlockDevice.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class BlockDevice_Benchmark
+{
+    public:
+        /**
+         * Function types
+         */
+        typedef uint32_t (*CycleCounterFunc)(void);
+        typedef void (*PrintFunc)(const char*);
+
+        /**
+         * Access patterns
+         */
+        enum class Pattern
+        {
+            SEQUENTIAL_READ,
+            SEQUENTIAL_WRITE,
+            RANDOM_READ,
+            RANDOM_WRITE
+        };
+
+        /**
+         * Number of latency histogram buckets, bucket n counts operations
+         * taking less than 2^(n+1) µs that are not in a lower bucket
+         */
+        static const int HISTOGRAM_BUCKET_COUNT = 20;
+
+        /**
+         * Configuration settings
+         */
+        struct Config
+        {
+            CycleCounterFunc cycleCounterFunc = nullptr;
+            uint32_t cycleFreq = 80000000;      // Counter frequency in Hz
+            PrintFunc printFunc = nullptr;
+            uint32_t startBlockNo = 0;          // First block of test region
+            uint32_t regionBlockCount = 2048;   // Size of test region
+            uint32_t transferBlockCount = 1;    // Blocks per operation
+            uint32_t operationCount = 256;      // Operations per pattern
+            uint32_t randomSeed = 1;
+        };
+
+        /**
+         * Results of one pattern
+         */
+        struct Result
+        {
+            BlockDevice::Status status = BlockDevice::Status::OK;
+            uint32_t operationCount = 0;
+            uint64_t byteCount = 0;
+            uint64_t totalCycles = 0;
+            uint32_t minCycles = 0;
+            uint32_t maxCycles = 0;
+            uint32_t histogram[HISTOGRAM_BUCKET_COUNT];
+        };
+
+        /**
+         * Constructor
+         *
+         * @param device        Reference to block device under test
+         */
+        BlockDevice_Benchmark(BlockDevice& device) : device(device) {}
+
+        /**
+         * Destructor
+         */
+        ~BlockDevice_Benchmark();
+
+        /**
+         * Disallow copy
+         */
+        BlockDevice_Benchmark(const BlockDevice_Benchmark&) = delete;
+        BlockDevice_Benchmark& operator = (const BlockDevice_Benchmark&) = delete;
+        BlockDevice_Benchmark& operator = (BlockDevice_Benchmark&&) = delete;
+
+        /**
+         * Init with config settings, allocates the transfer buffer
+         *
+         * @param config        Reference to configuration struct
+         * @return              True on success
+         */
+        bool init(Config& config);
+
+        /**
+         * Release transfer buffer
+         */
+        void deinit();
+
+        /**
+         * Measure a single access pattern
+         *
+         * @param pattern       Pattern enum setting
+         * @param result        Reference to result struct to be filled
+         */
+        void measure(Pattern pattern, Result& result);
+
+        /**
+         * Measure all patterns and print results
+         *
+         * @param label         Name of configuration under test, e.g.
+         *                      "DMA 4-bit"
+         * @return              True if all operations succeeded
+         */
+        bool run(const char* label);
+
+        /**
+         * Print a result
+         *
+         * @param label         Name of configuration under test
+         * @param pattern       Pattern enum setting
+         * @param result        Reference to result struct
+         */
+        void print(const char* label, Pattern pattern, Result& result);
+
+        /**
+         * Return throughput of a result
+         *
+         * @param result        Reference to result struct
+         * @return              Throughput in KiB/s
+         */
+        uint32_t getThroughput(Result& result);
+
+        /**
+         * Convert cycles to microseconds
+         *
+         * @param cycles        Number of cycles
+         * @return              Time in µs
+         */
+        uint32_t getMicroseconds(uint64_t cycles);
+
+    protected:
+        /**
+         * Return next pseudo random number, xorshift32
+         */
+        uint32_t getRandom();
+
+        /**
+         * Reference to device under test
+         */
+        BlockDevice& device;
+
+        /**
+         * Configuration
+         */
+        Config config;
+
+        /**
+         * Transfer buffer, word aligned for DMA
+         */
+        uint32_t* buffer = nullptr;
+
+        /**
+         * State of random generator
+         */
+        uint32_t randomState = 1;
+};
+
+
+}   // namespace mcu
@@ -0,0 +1,83 @@
+/**
+ * @file        FlashBlockDevice.cpp
+ *
+ * Block device on top of a NOR flash device, e.g. QUADSPI_NorFlash
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "FlashBlockDevice.h"
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+FlashBlockDevice::FlashBlockDevice(FlashDevice& flash, uint32_t startAddress,
+                                   uint32_t blockCount)
+    : flash(flash), startAddress(startAddress), blockCount(blockCount)
+{
+    if (this->blockCount == 0) {
+        this->blockCount = (flash.getSize() - startAddress)
+                           / flash.getSectorSize();
+    }
+}
+
+
+BlockDevice::Status FlashBlockDevice::read(uint8_t buffer[], uint32_t blockNo,
+                                           uint32_t blockCount)
+{
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    flash.read(getBlockAddress(blockNo), buffer,
+               blockCount * flash.getSectorSize());
+
+    return Status::OK;
+}
+
+
+BlockDevice::Status FlashBlockDevice::write(uint8_t buffer[], uint32_t blockNo,
+                                            uint32_t blockCount)
+{
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    auto sectorSize = flash.getSectorSize();
+
+    for (uint32_t i = 0; i < blockCount; i++) {
+        auto address = getBlockAddress(blockNo + i);
+
+        flash.eraseSector(address);
+        flash.program(address, &buffer[i * sectorSize], sectorSize);
+    }
+
+    return Status::OK;
+}
+
+
+BlockDevice::Status FlashBlockDevice::erase(uint32_t blockNo,
+                                            uint32_t blockCount)
+{
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    for (uint32_t i = 0; i < blockCount; i++) {
+        flash.eraseSector(getBlockAddress(blockNo + i));
+    }
+
+    return Status::OK;
+}
+
+
+}   // namespace mcu
@@ -0,0 +1,88 @@
+/**
+ * @file        FlashBlockDevice.h
+ *
+ * Block device on top of a NOR flash device, e.g. QUADSPI_NorFlash
+ *
+ * Each block maps to one flash sector. Writing a block erases its sector
+ * before programming, so no read-modify-write buffer is required.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "BlockDevice.h"
+#include "FlashDevice.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class FlashBlockDevice : public BlockDevice
+{
+    public:
+        /**
+         * Constructor
+         *
+         * @param flash         Reference to initialized flash device
+         * @param startAddress  Address of first block, must be sector aligned
+         * @param blockCount    Number of blocks, 0 to use rest of device
+         */
+        FlashBlockDevice(FlashDevice& flash, uint32_t startAddress = 0,
+                         uint32_t blockCount = 0);
+
+        /**
+         * Disallow copy
+         */
+        FlashBlockDevice(const FlashBlockDevice&) = delete;
+        FlashBlockDevice& operator = (const FlashBlockDevice&) = delete;
+        FlashBlockDevice& operator = (FlashBlockDevice&&) = delete;
+
+        virtual uint32_t getBlockSize() override
+        {
+            return flash.getSectorSize();
+        }
+
+        virtual uint32_t getBlockCount() override
+        {
+            return blockCount;
+        }
+
+        virtual Status read(uint8_t buffer[], uint32_t blockNo,
+                            uint32_t blockCount) override;
+
+        virtual Status write(uint8_t buffer[], uint32_t blockNo,
+                             uint32_t blockCount) override;
+
+        virtual Status erase(uint32_t blockNo, uint32_t blockCount) override;
+
+    protected:
+        /**
+         * Return flash address of a block
+         */
+        uint32_t getBlockAddress(uint32_t blockNo)
+        {
+            return startAddress + blockNo * flash.getSectorSize();
+        }
+
+        /**
+         * Reference to flash device
+         */
+        FlashDevice& flash;
+
+        /**
+         * Partition settings
+         */
+        const uint32_t startAddress;
+        uint32_t blockCount;
+};
+
+
+}   // namespace mcu
@@ -0,0 +1,73 @@
+/**
+ * @file        FlashDevice.h
+ *
+ * Abstract interface for NOR flash memories
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class FlashDevice
+{
+    public:
+        /**
+         * Value of erased bytes
+         */
+        static const uint8_t ERASED_VALUE = 0xFF;
+
+        /**
+         * Return total size
+         *
+         * @return              Size in bytes
+         */
+        virtual uint32_t getSize() = 0;
+
+        /**
+         * Return size of the smallest erasable unit
+         *
+         * @return              Sector size in bytes
+         */
+        virtual uint32_t getSectorSize() = 0;
+
+        /**
+         * Read data, blocking
+         *
+         * @param address       Start address
+         * @param buffer        Buffer to be filled with data
+         * @param length        Number of bytes to read
+         */
+        virtual void read(uint32_t address, uint8_t buffer[], int length) = 0;
+
+        /**
+         * Program data, blocking
+         *
+         * Programming can only clear bits. Page boundaries are handled by
+         * the implementation.
+         *
+         * @param address       Start address
+         * @param data          Buffer containing data
+         * @param length        Number of bytes to program
+         */
+        virtual void program(uint32_t address, uint8_t data[], int length) = 0;
+
+        /**
+         * Erase a sector, blocking
+         *
+         * @param address       Sector base address
+         */
+        virtual void eraseSector(uint32_t address) = 0;
+};
+
+
+}   // namespace mcu
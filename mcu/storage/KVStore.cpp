@@ -0,0 +1,647 @@
+/**
+ * @file        KVStore.cpp
+ *
+ * Log-structured key/value store on NOR flash
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "KVStore.h"
+
+// This component
+#include "../utility/crc32.h"
+
+// System libraries
+#include <algorithm>
+#include <cstring>
+
+
+namespace mcu {
+
+
+/**
+ * Return hash of a key for index lookup
+ */
+static inline uint32_t hashKey(uint32_t key)
+{
+    return key * 0x9E3779B1;
+}
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+KVStore::Status KVStore::init(Config& config)
+{
+    sectorSize = flash.getSectorSize();
+
+    auto capacity = config.indexCapacity;
+
+    if (config.sectorCount < 2 || capacity < 2
+            || (capacity & (capacity - 1)) != 0
+            || config.maxValueLength < 0 || config.maxValueLength > 0xFFFF
+            || config.startAddress % sectorSize != 0
+            || (uint32_t)getRecordSize(config.maxValueLength)
+                > sectorSize - sizeof(SectorHeader)) {
+        return Status::INVALID_CONFIG;
+    }
+
+    this->config = config;
+
+    allocate();
+
+    // Collect valid sectors, blank all others
+    for (auto i = 0; i < config.sectorCount; i++) {
+        SectorHeader header;
+        flash.read(getSectorAddress(i), (uint8_t*)&header, sizeof(header));
+
+        if (header.magic == SECTOR_MAGIC
+                && header.crc == crc32(0, (uint8_t*)&header, 8)) {
+            sectorSequences[i] = header.sequence;
+        } else {
+            prepareSector(i);
+            freeSectorCount++;
+        }
+    }
+
+    auto status = mountSectors();
+
+    if (status != Status::OK || freeSectorCount > 0) {
+        return status;
+    }
+
+    // No free sector is left only if power was lost while collection used
+    // the reserved sector. Resume it, or if the copies in the newest sector
+    // are torn, discard them, as the oldest sector still holds all records.
+    if (collectOldestSector()) {
+        return Status::OK;
+    }
+
+    flash.eraseSector(getSectorAddress(activeSector));
+    sectorSequences[activeSector] = FREE_SECTOR;
+    freeSectorCount++;
+
+    status = mountSectors();
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    return collectOldestSector() ? Status::OK : Status::NO_SPACE;
+}
+
+
+void KVStore::deinit()
+{
+    deallocate();
+}
+
+
+KVStore::Status KVStore::format()
+{
+    if (index == nullptr) {
+        return Status::INVALID_CONFIG;
+    }
+
+    for (auto i = 0; i < config.sectorCount; i++) {
+        prepareSector(i);
+        sectorSequences[i] = FREE_SECTOR;
+    }
+
+    for (auto i = 0; i < config.indexCapacity; i++) {
+        index[i].key = INVALID_KEY_VALUE;
+    }
+
+    keyCount = 0;
+    freeSectorCount = config.sectorCount;
+    nextSequence = 0;
+    activeSector = -1;
+    writeOffset = 0;
+
+    return Status::OK;
+}
+
+
+KVStore::Status KVStore::write(uint32_t key, uint8_t data[], int length)
+{
+    if (key == INVALID_KEY_VALUE) {
+        return Status::INVALID_KEY;
+    }
+
+    if (length < 0 || length > config.maxValueLength) {
+        return Status::INVALID_LENGTH;
+    }
+
+    if (findEntry(key) == nullptr && keyCount >= config.indexCapacity - 1) {
+        return Status::INDEX_FULL;
+    }
+
+    auto status = reserve(getRecordSize(length), false);
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    auto address = appendRecord(key, RecordType::VALUE, data, length);
+    putEntry(key, address);
+
+    return Status::OK;
+}
+
+
+KVStore::Status KVStore::read(uint32_t key, uint8_t buffer[], int size)
+{
+    auto entry = findEntry(key);
+
+    if (entry == nullptr) {
+        return Status::NOT_FOUND;
+    }
+
+    RecordHeader header;
+    flash.read(entry->address, (uint8_t*)&header, sizeof(header));
+
+    auto length = std::min(size, (int)header.length);
+    flash.read(entry->address + sizeof(header), buffer, length);
+
+    return Status::OK;
+}
+
+
+int KVStore::getLength(uint32_t key)
+{
+    auto entry = findEntry(key);
+
+    if (entry == nullptr) {
+        return -1;
+    }
+
+    RecordHeader header;
+    flash.read(entry->address, (uint8_t*)&header, sizeof(header));
+
+    return header.length;
+}
+
+
+KVStore::Status KVStore::remove(uint32_t key)
+{
+    if (findEntry(key) == nullptr) {
+        return Status::NOT_FOUND;
+    }
+
+    auto status = reserve(getRecordSize(0), false);
+
+    if (status != Status::OK) {
+        return status;
+    }
+
+    appendRecord(key, RecordType::DELETED, nullptr, 0);
+    removeEntry(key);
+
+    return Status::OK;
+}
+
+
+bool KVStore::contains(uint32_t key)
+{
+    return findEntry(key) != nullptr;
+}
+
+
+bool KVStore::collectGarbage()
+{
+    if (freeSectorCount >= config.gcThreshold) {
+        return false;
+    }
+
+    return collectOldestSector();
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+void KVStore::allocate()
+{
+    deallocate();
+
+    index = new IndexEntry[config.indexCapacity];
+    sectorSequences = new uint32_t[config.sectorCount];
+
+    for (auto i = 0; i < config.indexCapacity; i++) {
+        index[i].key = INVALID_KEY_VALUE;
+    }
+
+    for (auto i = 0; i < config.sectorCount; i++) {
+        sectorSequences[i] = FREE_SECTOR;
+    }
+}
+
+
+void KVStore::deallocate()
+{
+    if (index != nullptr) {
+        delete[] index;
+        delete[] sectorSequences;
+    }
+
+    index = nullptr;
+    sectorSequences = nullptr;
+    keyCount = 0;
+    freeSectorCount = 0;
+    nextSequence = 0;
+    activeSector = -1;
+    writeOffset = 0;
+}
+
+
+KVStore::Status KVStore::mountSectors()
+{
+    for (auto i = 0; i < config.indexCapacity; i++) {
+        index[i].key = INVALID_KEY_VALUE;
+    }
+
+    keyCount = 0;
+    nextSequence = 0;
+    activeSector = -1;
+    writeOffset = 0;
+
+    // Replay sectors from oldest to newest, so newer records win
+    auto mountedCount = 0;
+    auto usedCount = config.sectorCount - freeSectorCount;
+
+    while (mountedCount < usedCount) {
+        auto sector = -1;
+
+        for (auto i = 0; i < config.sectorCount; i++) {
+            auto sequence = sectorSequences[i];
+
+            if (sequence == FREE_SECTOR
+                    || (mountedCount > 0 && sequence < nextSequence)) {
+                continue;
+            }
+
+            if (sector < 0 || sequence < sectorSequences[sector]) {
+                sector = i;
+            }
+        }
+
+        auto status = mountSector(sector);
+
+        if (status != Status::OK) {
+            return status;
+        }
+
+        activeSector = sector;
+        nextSequence = sectorSequences[sector] + 1;
+        mountedCount++;
+    }
+
+    return Status::OK;
+}
+
+
+KVStore::Status KVStore::mountSector(int sector)
+{
+    auto baseAddress = getSectorAddress(sector);
+    uint32_t offset = sizeof(SectorHeader);
+
+    while (offset + sizeof(RecordHeader) <= sectorSize) {
+        RecordHeader header;
+        flash.read(baseAddress + offset, (uint8_t*)&header, sizeof(header));
+
+        if (isErased(header)) {
+            writeOffset = offset;
+            return Status::OK;
+        }
+
+        auto recordSize = (uint32_t)getRecordSize(header.length);
+
+        if (header.length > config.maxValueLength
+                || offset + recordSize > sectorSize
+                || (header.type != RecordType::VALUE
+                    && header.type != RecordType::DELETED)
+                || header.crc != calculateRecordCRC(baseAddress + offset,
+                                                    header)) {
+            // Torn write, no valid records can follow in this sector
+            break;
+        }
+
+        if (header.type == RecordType::VALUE) {
+            if (!putEntry(header.key, baseAddress + offset)) {
+                return Status::INDEX_FULL;
+            }
+        } else {
+            removeEntry(header.key);
+        }
+
+        offset += recordSize;
+    }
+
+    writeOffset = sectorSize;
+
+    return Status::OK;
+}
+
+
+KVStore::Status KVStore::reserve(int size, bool collecting)
+{
+    if (activeSector >= 0 && writeOffset + size <= sectorSize) {
+        return Status::OK;
+    }
+
+    // One sector is held back for garbage collection
+    auto reservedCount = collecting ? 0 : 1;
+    auto attempts = config.sectorCount;
+
+    while (freeSectorCount <= reservedCount) {
+        if (collecting || attempts-- == 0 || !collectOldestSector()) {
+            return Status::NO_SPACE;
+        }
+
+        if (activeSector >= 0 && writeOffset + size <= sectorSize) {
+            return Status::OK;
+        }
+    }
+
+    for (auto i = 0; i < config.sectorCount; i++) {
+        if (sectorSequences[i] == FREE_SECTOR) {
+            openSector(i);
+            break;
+        }
+    }
+
+    return Status::OK;
+}
+
+
+void KVStore::prepareSector(int sector)
+{
+    auto baseAddress = getSectorAddress(sector);
+
+    uint8_t buffer[CHUNK_SIZE];
+
+    for (uint32_t offset = 0; offset < sectorSize; offset += CHUNK_SIZE) {
+        auto length = std::min((uint32_t)CHUNK_SIZE, sectorSize - offset);
+        flash.read(baseAddress + offset, buffer, length);
+
+        for (uint32_t i = 0; i < length; i++) {
+            if (buffer[i] != FlashDevice::ERASED_VALUE) {
+                flash.eraseSector(baseAddress);
+                return;
+            }
+        }
+    }
+}
+
+
+void KVStore::openSector(int sector)
+{
+    SectorHeader header;
+    header.magic = SECTOR_MAGIC;
+    header.sequence = nextSequence++;
+    header.crc = crc32(0, (uint8_t*)&header, 8);
+
+    flash.program(getSectorAddress(sector), (uint8_t*)&header,
+                  sizeof(header));
+
+    sectorSequences[sector] = header.sequence;
+    freeSectorCount--;
+
+    activeSector = sector;
+    writeOffset = sizeof(SectorHeader);
+}
+
+
+bool KVStore::collectOldestSector()
+{
+    auto victim = -1;
+
+    for (auto i = 0; i < config.sectorCount; i++) {
+        if (i == activeSector || sectorSequences[i] == FREE_SECTOR) {
+            continue;
+        }
+
+        if (victim < 0 || sectorSequences[i] < sectorSequences[victim]) {
+            victim = i;
+        }
+    }
+
+    if (victim < 0) {
+        return false;
+    }
+
+    auto baseAddress = getSectorAddress(victim);
+    uint32_t offset = sizeof(SectorHeader);
+
+    // Records not referenced by the index are outdated or deleted
+    while (offset + sizeof(RecordHeader) <= sectorSize) {
+        RecordHeader header;
+        flash.read(baseAddress + offset, (uint8_t*)&header, sizeof(header));
+
+        if (isErased(header) || header.length > config.maxValueLength) {
+            break;
+        }
+
+        auto recordSize = getRecordSize(header.length);
+
+        if (offset + recordSize > sectorSize) {
+            break;
+        }
+
+        auto entry = findEntry(header.key);
+
+        if (entry != nullptr && entry->address == baseAddress + offset) {
+            if (reserve(recordSize, true) != Status::OK) {
+                return false;
+            }
+
+            entry->address = copyRecord(baseAddress + offset, header);
+        }
+
+        offset += recordSize;
+    }
+
+    // Invalidate the header first, so an interrupted erase can't bring
+    // back records, e.g. ones shadowed by deletions in the erased part
+    uint32_t magic = 0;
+    flash.program(baseAddress, (uint8_t*)&magic, sizeof(magic));
+
+    flash.eraseSector(baseAddress);
+    sectorSequences[victim] = FREE_SECTOR;
+    freeSectorCount++;
+
+    return true;
+}
+
+
+uint32_t KVStore::appendRecord(uint32_t key, RecordType type, uint8_t data[],
+                               int length)
+{
+    RecordHeader header;
+    header.key = key;
+    header.length = length;
+    header.type = type;
+    header.crc = crc32(crc32(0, (uint8_t*)&header, 8), data, length);
+
+    auto address = getSectorAddress(activeSector) + writeOffset;
+
+    flash.program(address, (uint8_t*)&header, sizeof(header));
+
+    if (length > 0) {
+        flash.program(address + sizeof(header), data, length);
+    }
+
+    writeOffset += getRecordSize(length);
+
+    return address;
+}
+
+
+uint32_t KVStore::copyRecord(uint32_t address, RecordHeader& header)
+{
+    auto destination = getSectorAddress(activeSector) + writeOffset;
+
+    flash.program(destination, (uint8_t*)&header, sizeof(header));
+
+    uint8_t buffer[CHUNK_SIZE];
+
+    for (auto offset = 0; offset < header.length; offset += CHUNK_SIZE) {
+        auto length = std::min((int)CHUNK_SIZE, header.length - offset);
+        flash.read(address + sizeof(header) + offset, buffer, length);
+        flash.program(destination + sizeof(header) + offset, buffer, length);
+    }
+
+    writeOffset += getRecordSize(header.length);
+
+    return destination;
+}
+
+
+bool KVStore::isErased(RecordHeader& header)
+{
+    auto data = (uint8_t*)&header;
+
+    for (size_t i = 0; i < sizeof(header); i++) {
+        if (data[i] != FlashDevice::ERASED_VALUE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+uint32_t KVStore::calculateRecordCRC(uint32_t address, RecordHeader& header)
+{
+    auto crc = crc32(0, (uint8_t*)&header, 8);
+
+    uint8_t buffer[CHUNK_SIZE];
+
+    for (auto offset = 0; offset < header.length; offset += CHUNK_SIZE) {
+        auto length = std::min((int)CHUNK_SIZE, header.length - offset);
+        flash.read(address + sizeof(header) + offset, buffer, length);
+        crc = crc32(crc, buffer, length);
+    }
+
+    return crc;
+}
+
+
+KVStore::IndexEntry* KVStore::findEntry(uint32_t key)
+{
+    auto mask = (uint32_t)config.indexCapacity - 1;
+    auto slot = hashKey(key) & mask;
+
+    for (auto i = 0; i < config.indexCapacity; i++) {
+        auto& entry = index[slot];
+
+        if (entry.key == key) {
+            return &entry;
+        }
+
+        if (entry.key == INVALID_KEY_VALUE) {
+            return nullptr;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return nullptr;
+}
+
+
+bool KVStore::putEntry(uint32_t key, uint32_t address)
+{
+    auto entry = findEntry(key);
+
+    if (entry != nullptr) {
+        entry->address = address;
+        return true;
+    }
+
+    // Keep one slot empty to terminate probing
+    if (keyCount >= config.indexCapacity - 1) {
+        return false;
+    }
+
+    auto mask = (uint32_t)config.indexCapacity - 1;
+    auto slot = hashKey(key) & mask;
+
+    while (index[slot].key != INVALID_KEY_VALUE) {
+        slot = (slot + 1) & mask;
+    }
+
+    index[slot].key = key;
+    index[slot].address = address;
+    keyCount++;
+
+    return true;
+}
+
+
+void KVStore::removeEntry(uint32_t key)
+{
+    auto entry = findEntry(key);
+
+    if (entry == nullptr) {
+        return;
+    }
+
+    auto mask = (uint32_t)config.indexCapacity - 1;
+    auto hole = (uint32_t)(entry - index);
+
+    entry->key = INVALID_KEY_VALUE;
+    keyCount--;
+
+    // Shift following entries back so probing sequences stay unbroken
+    auto slot = hole;
+
+    while (true) {
+        slot = (slot + 1) & mask;
+
+        if (index[slot].key == INVALID_KEY_VALUE) {
+            break;
+        }
+
+        auto home = hashKey(index[slot].key) & mask;
+
+        bool inPlace = (hole <= slot) ? (hole < home && home <= slot)
+                                      : (hole < home || home <= slot);
+
+        if (!inPlace) {
+            index[hole] = index[slot];
+            index[slot].key = INVALID_KEY_VALUE;
+            hole = slot;
+        }
+    }
+}
+
+
+}   // namespace mcu
@@ -0,0 +1,366 @@
+/**
+ * @file        KVStore.h
+ *
+ * Log-structured key/value store on NOR flash
+ *
+ * Records are appended to erased space, so updates only cost page programs.
+ * The newest record of a key wins, a RAM hash index points to it. Sectors
+ * are reclaimed oldest first by copying their live records to the head.
+ * Every record carries a CRC, so records torn by a power loss are
+ * detected and skipped when the store is mounted.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "FlashDevice.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class KVStore
+{
+    public:
+        /**
+         * Status codes
+         */
+        enum Status
+        {
+            OK,
+            NOT_FOUND,
+            NO_SPACE,
+            INDEX_FULL,
+            INVALID_KEY,
+            INVALID_LENGTH,
+            INVALID_CONFIG
+        };
+
+        /**
+         * Configuration settings
+         */
+        struct Config
+        {
+            uint32_t startAddress = 0;      // Must be sector aligned
+            int sectorCount = 0;            // Number of sectors, min. 2
+            int indexCapacity = 64;         // Max. number of keys, power of 2
+            int maxValueLength = 256;       // Max. value length in bytes
+            int gcThreshold = 2;            // Free sectors kept by collectGarbage()
+        };
+
+        /**
+         * Key value reserved for erased flash
+         */
+        static const uint32_t INVALID_KEY_VALUE = 0xFFFFFFFF;
+
+        /**
+         * Constructor
+         *
+         * @param flash         Reference to flash device
+         */
+        KVStore(FlashDevice& flash) : flash(flash) {}
+
+        /**
+         * Destructor
+         */
+        ~KVStore()
+        {
+            deinit();
+        }
+
+        /**
+         * Disallow copy
+         */
+        KVStore(const KVStore&) = delete;
+        KVStore& operator = (const KVStore&) = delete;
+        KVStore& operator = (KVStore&&) = delete;
+
+        /**
+         * Mount the store, building the index from flash content
+         *
+         * @param config        Reference to configuration struct
+         * @return              Status enum setting
+         */
+        Status init(Config& config);
+
+        /**
+         * Release memory
+         */
+        void deinit();
+
+        /**
+         * Erase all sectors and clear index, requires successful init()
+         *
+         * @return              Status enum setting, INVALID_CONFIG if not
+         *                      initialised
+         */
+        Status format();
+
+        /**
+         * Write a value, replacing the previous one
+         *
+         * @param key           Key, any value except INVALID_KEY_VALUE
+         * @param data          Buffer containing value
+         * @param length        Value length in bytes
+         * @return              Status enum setting
+         */
+        Status write(uint32_t key, uint8_t data[], int length);
+
+        /**
+         * Read a value
+         *
+         * @param key           Key
+         * @param buffer        Buffer to be filled with value
+         * @param size          Size of buffer, value is truncated if larger
+         * @return              Status enum setting
+         */
+        Status read(uint32_t key, uint8_t buffer[], int size);
+
+        /**
+         * Return length of a value
+         *
+         * @param key           Key
+         * @return              Length in bytes or -1 if key doesn't exist
+         */
+        int getLength(uint32_t key);
+
+        /**
+         * Remove a key
+         *
+         * @param key           Key
+         * @return              Status enum setting
+         */
+        Status remove(uint32_t key);
+
+        /**
+         * Return if a key exists
+         *
+         * @param key           Key
+         * @return              True if key exists
+         */
+        bool contains(uint32_t key);
+
+        /**
+         * Return number of keys
+         *
+         * @return              Number of keys
+         */
+        int getKeyCount()
+        {
+            return keyCount;
+        }
+
+        /**
+         * Return number of erased sectors
+         *
+         * @return              Number of sectors
+         */
+        int getFreeSectorCount()
+        {
+            return freeSectorCount;
+        }
+
+        /**
+         * Reclaim one sector if less than gcThreshold sectors are free,
+         * call periodically from idle context
+         *
+         * @return              True if a sector was reclaimed
+         */
+        bool collectGarbage();
+
+    protected:
+        /**
+         * Header at start of each used sector
+         */
+        struct SectorHeader
+        {
+            uint32_t magic;
+            uint32_t sequence;
+            uint32_t crc;
+        } __attribute__((packed));
+
+        /**
+         * Header in front of each record
+         */
+        struct RecordHeader
+        {
+            uint32_t key;
+            uint16_t length;
+            uint16_t type;
+            uint32_t crc;           // Over key, length, type and value
+        } __attribute__((packed));
+
+        /**
+         * Record types, chosen to differ from erased state
+         */
+        enum RecordType
+        {
+            VALUE   = 0x5A5A,
+            DELETED = 0x0000
+        };
+
+        /**
+         * Index entry, key INVALID_KEY_VALUE marks an empty slot
+         */
+        struct IndexEntry
+        {
+            uint32_t key;
+            uint32_t address;
+        };
+
+        static const uint32_t SECTOR_MAGIC = 0x3153564B;   // "KVS1"
+        static const uint32_t FREE_SECTOR = 0xFFFFFFFF;
+        static const int CHUNK_SIZE = 32;
+
+        /**
+         * Allocate index and sector table on heap
+         */
+        void allocate();
+
+        /**
+         * Deallocate index and sector table on heap
+         */
+        void deallocate();
+
+        /**
+         * Rebuild the index from all used sectors and find the write
+         * position
+         *
+         * @return              Status enum setting
+         */
+        Status mountSectors();
+
+        /**
+         * Scan a sector and apply its records to the index
+         *
+         * @param sector        Sector number
+         * @return              Status enum setting
+         */
+        Status mountSector(int sector);
+
+        /**
+         * Make room for a record in the active sector
+         *
+         * @param size          Record size in bytes
+         * @param collecting    True if called during garbage collection,
+         *                      which may use the reserved sector
+         * @return              Status enum setting
+         */
+        Status reserve(int size, bool collecting);
+
+        /**
+         * Erase a sector if it is not blank
+         *
+         * @param sector        Sector number
+         */
+        void prepareSector(int sector);
+
+        /**
+         * Start a new active sector
+         *
+         * @param sector        Sector number
+         */
+        void openSector(int sector);
+
+        /**
+         * Copy live records of the oldest sector to the head and erase it
+         *
+         * @return              True if a sector was reclaimed
+         */
+        bool collectOldestSector();
+
+        /**
+         * Append a record at the write position
+         *
+         * @param key           Key
+         * @param type          RecordType enum setting
+         * @param data          Buffer containing value or nullptr
+         * @param length        Value length in bytes
+         * @return              Flash address of record
+         */
+        uint32_t appendRecord(uint32_t key, RecordType type, uint8_t data[],
+                              int length);
+
+        /**
+         * Copy a record to the write position
+         *
+         * @param address       Flash address of source record
+         * @param header        Reference to header of source record
+         * @return              Flash address of copy
+         */
+        uint32_t copyRecord(uint32_t address, RecordHeader& header);
+
+        /**
+         * Return if a record header is in erased state
+         */
+        bool isErased(RecordHeader& header);
+
+        /**
+         * Return CRC of a record stored in flash
+         */
+        uint32_t calculateRecordCRC(uint32_t address, RecordHeader& header);
+
+        /**
+         * Return size of record including header and padding
+         */
+        static int getRecordSize(int length)
+        {
+            return (sizeof(RecordHeader) + length + 3) & ~3;
+        }
+
+        /**
+         * Return flash address of a sector
+         */
+        uint32_t getSectorAddress(int sector)
+        {
+            return config.startAddress + sector * sectorSize;
+        }
+
+        /**
+         * Index operations
+         */
+        IndexEntry* findEntry(uint32_t key);
+        bool putEntry(uint32_t key, uint32_t address);
+        void removeEntry(uint32_t key);
+
+        /**
+         * Reference to flash device
+         */
+        FlashDevice& flash;
+
+        /**
+         * Configuration
+         */
+        Config config;
+        uint32_t sectorSize = 0;
+
+        /**
+         * Hash index of live keys
+         */
+        IndexEntry* index = nullptr;
+        int keyCount = 0;
+
+        /**
+         * Sequence numbers of sectors, FREE_SECTOR if erased
+         */
+        uint32_t* sectorSequences = nullptr;
+        int freeSectorCount = 0;
+        uint32_t nextSequence = 0;
+
+        /**
+         * Write position
+         */
+        int activeSector = -1;
+        uint32_t writeOffset = 0;
+};
+
+
+}   // namespace mcu
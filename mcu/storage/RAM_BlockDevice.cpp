@@ -0,0 +1,83 @@
+/**
+ * @file        RAM_BlockDevice.cpp
+ *
+ * RAM based block device, e.g. for testing on host or as reference in
+ * benchmarks
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "RAM_BlockDevice.h"
+
+// System libraries
+#include <cstring>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+RAM_BlockDevice::RAM_BlockDevice(uint32_t blockSize, uint32_t blockCount)
+    : blockSize(blockSize), blockCount(blockCount)
+{
+    memory = new uint8_t[blockSize * blockCount];
+    memset(memory, ERASED_VALUE, blockSize * blockCount);
+}
+
+
+RAM_BlockDevice::~RAM_BlockDevice()
+{
+    delete[] memory;
+}
+
+
+BlockDevice::Status RAM_BlockDevice::read(uint8_t buffer[], uint32_t blockNo,
+                                          uint32_t blockCount)
+{
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    memcpy(buffer, &memory[blockNo * blockSize], blockCount * blockSize);
+    readBlockCount += blockCount;
+
+    return Status::OK;
+}
+
+
+BlockDevice::Status RAM_BlockDevice::write(uint8_t buffer[], uint32_t blockNo,
+                                           uint32_t blockCount)
+{
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    memcpy(&memory[blockNo * blockSize], buffer, blockCount * blockSize);
+    writeBlockCount += blockCount;
+
+    return Status::OK;
+}
+
+
+BlockDevice::Status RAM_BlockDevice::erase(uint32_t blockNo,
+                                           uint32_t blockCount)
+{
+    if (!isValidRange(blockNo, blockCount)) {
+        return Status::INVALID_PARAMETER;
+    }
+
+    memset(&memory[blockNo * blockSize], ERASED_VALUE, blockCount * blockSize);
+    eraseBlockCount += blockCount;
+
+    return Status::OK;
+}
+
+
+}   // namespace mcu
@@ -0,0 +1,115 @@
+/**
+ * @file        RAM_BlockDevice.h
+ *
+ * RAM based block device, e.g. for testing on host or as reference in
+ * benchmarks
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "BlockDevice.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class RAM_BlockDevice : public BlockDevice
+{
+    public:
+        /**
+         * Value of erased bytes
+         */
+        static const uint8_t ERASED_VALUE = 0xFF;
+
+        /**
+         * Constructor, memory is allocated on heap in erased state
+         *
+         * @param blockSize     Block size in bytes
+         * @param blockCount    Number of blocks
+         */
+        RAM_BlockDevice(uint32_t blockSize, uint32_t blockCount);
+
+        /**
+         * Destructor
+         */
+        ~RAM_BlockDevice();
+
+        /**
+         * Disallow copy
+         */
+        RAM_BlockDevice(const RAM_BlockDevice&) = delete;
+        RAM_BlockDevice& operator = (const RAM_BlockDevice&) = delete;
+        RAM_BlockDevice& operator = (RAM_BlockDevice&&) = delete;
+
+        virtual uint32_t getBlockSize() override
+        {
+            return blockSize;
+        }
+
+        virtual uint32_t getBlockCount() override
+        {
+            return blockCount;
+        }
+
+        virtual Status read(uint8_t buffer[], uint32_t blockNo,
+                            uint32_t blockCount) override;
+
+        virtual Status write(uint8_t buffer[], uint32_t blockNo,
+                             uint32_t blockCount) override;
+
+        virtual Status erase(uint32_t blockNo, uint32_t blockCount) override;
+
+        /**
+         * Return pointer to memory content for inspection
+         *
+         * @return              Pointer to memory
+         */
+        uint8_t* getMemory()
+        {
+            return memory;
+        }
+
+        /**
+         * Return number of blocks read since construction
+         */
+        uint32_t getReadBlockCount()
+        {
+            return readBlockCount;
+        }
+
+        /**
+         * Return number of blocks written since construction
+         */
+        uint32_t getWriteBlockCount()
+        {
+            return writeBlockCount;
+        }
+
+        /**
+         * Return number of blocks erased since construction
+         */
+        uint32_t getEraseBlockCount()
+        {
+            return eraseBlockCount;
+        }
+
+    protected:
+        uint8_t* memory;
+        const uint32_t blockSize;
+        const uint32_t blockCount;
+        uint32_t readBlockCount = 0;
+        uint32_t writeBlockCount = 0;
+        uint32_t eraseBlockCount = 0;
+};
+
+
+}   // namespace mcu
@@ -0,0 +1,108 @@
+/**
+ * @file        RAM_FlashDevice.cpp
+ *
+ * RAM based NOR flash model, e.g. for testing on host
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "RAM_FlashDevice.h"
+
+// System libraries
+#include <cstring>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+RAM_FlashDevice::RAM_FlashDevice(uint32_t size, uint32_t sectorSize)
+    : size(size), sectorSize(sectorSize)
+{
+    memory = new uint8_t[size];
+    memset(memory, ERASED_VALUE, size);
+}
+
+
+RAM_FlashDevice::~RAM_FlashDevice()
+{
+    delete[] memory;
+}
+
+
+void RAM_FlashDevice::read(uint32_t address, uint8_t buffer[], int length)
+{
+    memcpy(buffer, &memory[address], length);
+}
+
+
+void RAM_FlashDevice::program(uint32_t address, uint8_t data[], int length)
+{
+    auto result = countOperation();
+
+    if (result < 0) {
+        return;
+    } else if (result == 0) {
+        length /= 2;
+    }
+
+    // Like real NOR flash, bits can only be cleared
+    for (auto i = 0; i < length; i++) {
+        memory[address + i] &= data[i];
+    }
+
+    programCount++;
+}
+
+
+void RAM_FlashDevice::eraseSector(uint32_t address)
+{
+    auto result = countOperation();
+
+    if (result < 0) {
+        return;
+    }
+
+    address -= address % sectorSize;
+
+    if (result == 0) {
+        // Start of sector, e.g. a header, may survive an interrupted erase
+        memset(&memory[address + sectorSize / 2], ERASED_VALUE,
+               sectorSize - sectorSize / 2);
+    } else {
+        memset(&memory[address], ERASED_VALUE, sectorSize);
+    }
+
+    eraseCount++;
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+int RAM_FlashDevice::countOperation()
+{
+    if (powerCutCountdown < 0) {
+        return 1;
+    }
+
+    if (powerCutCountdown == 0) {
+        return -1;
+    }
+
+    powerCutCountdown--;
+
+    return powerCutCountdown == 0 ? 0 : 1;
+}
+
+
+}   // namespace mcu
@@ -0,0 +1,140 @@
+/**
+ * @file        RAM_FlashDevice.h
+ *
+ * RAM based NOR flash model, e.g. for testing on host
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "FlashDevice.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class RAM_FlashDevice : public FlashDevice
+{
+    public:
+        /**
+         * Constructor, memory is allocated on heap in erased state
+         *
+         * @param size          Total size in bytes
+         * @param sectorSize    Sector size in bytes
+         */
+        RAM_FlashDevice(uint32_t size, uint32_t sectorSize);
+
+        /**
+         * Destructor
+         */
+        ~RAM_FlashDevice();
+
+        /**
+         * Disallow copy
+         */
+        RAM_FlashDevice(const RAM_FlashDevice&) = delete;
+        RAM_FlashDevice& operator = (const RAM_FlashDevice&) = delete;
+        RAM_FlashDevice& operator = (RAM_FlashDevice&&) = delete;
+
+        virtual uint32_t getSize() override
+        {
+            return size;
+        }
+
+        virtual uint32_t getSectorSize() override
+        {
+            return sectorSize;
+        }
+
+        virtual void read(uint32_t address, uint8_t buffer[],
+                          int length) override;
+
+        virtual void program(uint32_t address, uint8_t data[],
+                             int length) override;
+
+        virtual void eraseSector(uint32_t address) override;
+
+        /**
+         * Return pointer to memory content for inspection
+         *
+         * @return              Pointer to memory
+         */
+        uint8_t* getMemory()
+        {
+            return memory;
+        }
+
+        /**
+         * Simulate a power loss after a number of program and erase
+         * operations. The last operation is torn: a program only writes
+         * the first half of its data, an erase only the second half of the
+         * sector. All following operations are dropped until power is
+         * restored.
+         *
+         * @param operationCount    Number of operations, min. 1
+         */
+        void cutPowerAfter(int operationCount)
+        {
+            powerCutCountdown = operationCount;
+        }
+
+        /**
+         * Restore power after cutPowerAfter()
+         */
+        void restorePower()
+        {
+            powerCutCountdown = -1;
+        }
+
+        /**
+         * Return if power was cut
+         *
+         * @return              True if operations are dropped
+         */
+        bool isPowerCut()
+        {
+            return powerCutCountdown == 0;
+        }
+
+        /**
+         * Return number of program calls since construction
+         */
+        uint32_t getProgramCount()
+        {
+            return programCount;
+        }
+
+        /**
+         * Return number of sector erases since construction
+         */
+        uint32_t getEraseCount()
+        {
+            return eraseCount;
+        }
+
+    protected:
+        uint8_t* memory;
+        const uint32_t size;
+        const uint32_t sectorSize;
+        uint32_t programCount = 0;
+        uint32_t eraseCount = 0;
+        int powerCutCountdown = -1;     // -1 if disabled, 0 if cut
+
+        /**
+         * Count down an operation for a simulated power loss
+         *
+         * @return              1 if complete, 0 if torn, -1 if dropped
+         */
+        int countOperation();
+};
+
+
+}   // namespace mcu
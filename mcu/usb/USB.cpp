@@ -18,12 +18,15 @@
 // This component
 #include "../gpio/Pin.h"
 #include "../core/NVIC.h"
+#include "../core/SCB.h"
+#include "../core/cortex_m4.h"
 #include "../pwr/PWR_Registers.h"
 #include "../rcc/RCC_Registers.h"
 #include "../utility/bit_manipulation.h"
 #include "../utility/time.h"
 
 // System libraries
+#include <atomic>
 #include <cstring>
 
 
@@ -67,6 +70,10 @@ void USB::init(Config& config)
     setSuspendCallback(config.suspendCallback);
     setResumeCallback(config.resumeCallback);
     setDescriptorCallback(config.descriptorCallback);
+    setRequestCallback(config.requestCallback, config.requestCallbackContext);
+    setVendorRequestCallback(config.vendorRequestCallback,
+                             config.vendorRequestCallbackContext);
+    setEventMode(config.eventMode);
 }
 
 
@@ -124,9 +131,70 @@ void USB::disconnect()
 }
 
 
-void USB::setEndpoint(int number, USB_Endpoint* endpoint)
+bool USB::setEndpoint(int number, USB_Endpoint* endpoint)
 {
+    if (number < 0 || number >= NUM_ENDPOINTS) {
+        return false;
+    }
+
+    // Default buffers would overlap the allocated ones
+    if (endpoint != nullptr && !hasBufferLayout(number)) {
+        return false;
+    }
+
     endpoints[number] = endpoint;
+
+    applyBufferLayout(endpoint);
+
+    return true;
+}
+
+
+bool USB::setBufferLayout(const USB_SRAM_Allocator::BufferDescriptor descriptors[],
+                          int count)
+{
+    if (count < 1 || count > NUM_ENDPOINTS) {
+        return false;
+    }
+
+    for (auto i = count; i < NUM_ENDPOINTS; i++) {
+        if (endpoints[i] != nullptr) {
+            return false;
+        }
+    }
+
+    bufferLayout = descriptors;
+    bufferLayoutCount = count;
+
+    for (auto endpoint : endpoints) {
+        applyBufferLayout(endpoint);
+    }
+
+    return true;
+}
+
+
+void USB::enableStartOfFrameInterrupt()
+{
+    auto registers = USB_Registers::get();
+
+    registers->CNTR |= (1 << USB_Registers::CNTR::SOFM);
+}
+
+
+void USB::disableStartOfFrameInterrupt()
+{
+    auto registers = USB_Registers::get();
+
+    registers->CNTR &= ~(1 << USB_Registers::CNTR::SOFM);
+}
+
+
+int USB::getFrameNumber()
+{
+    auto registers = USB_Registers::get();
+
+    return bitsValue(registers->FNR, 11, USB_Registers::FNR::FN_0);
 }
 
 
@@ -148,6 +216,50 @@ void USB::setResumeCallback(CallbackFunc func)
 }
 
 
+void USB::setEventMode(EventMode mode)
+{
+    eventMode = mode;
+
+    // Handlers of events queued before a switch to IMMEDIATE still run
+    if (mode == EventMode::DEFERRED_PENDSV) {
+        SCB::get().triggerPendSV();
+    }
+}
+
+
+void USB::processEvents()
+{
+    auto& nvic = NVIC::get();
+    auto irqNumber = getIRQNumber();
+
+    while (eventReadIndex != eventWriteIndex) {
+        auto readIndex = eventReadIndex;
+
+        // Event must not be read before the ISR has stored it
+        std::atomic_signal_fence(std::memory_order_acquire);
+        auto event = eventQueue[readIndex];
+
+        // Handlers use endpoint buffers like the ISR, so it is masked
+        // while they run. Other interrupts stay enabled.
+        auto irqEnabled = nvic.isIrqEnabled(irqNumber);
+
+        if (irqEnabled) {
+            nvic.disableIrq(irqNumber);
+            dataSynchronizationBarrier();
+            instructionSynchronizationBarrier();
+        }
+
+        dispatchEvent(event);
+
+        if (irqEnabled) {
+            nvic.enableIrq(irqNumber);
+        }
+
+        eventReadIndex = (readIndex + 1) % EVENT_QUEUE_LENGTH;
+    }
+}
+
+
 int USB::getIRQNumber()
 {
     return IrqId::USBFS;
@@ -163,64 +275,114 @@ void USB::irq()
     // Clear all bits at once as recommended in reference manual
     registers->ISTR = 0;
 
-    if (istr & (1 << USB_Registers::ISTR::RESET)) {
-        onReset();
-        return;
-    }
-
-    if (istr & (1 << USB_Registers::ISTR::CTR)) {
-        // Correct transfer
-        auto endpointNo = bitsValue(istr, 4, USB_Registers::ISTR::EP_ID_0);
-        auto endpoint = endpoints[endpointNo];
-
-        if (endpoint != nullptr) {
-            auto endpointRegisterValue = *endpoint->getRegister();
+    auto deferred = eventMode != EventMode::IMMEDIATE;
 
-            endpoint->clearTxRxFlags();
+    if (istr & (1 << USB_Registers::ISTR::RESET)) {
+        if (deferred) {
+            pushEvent(EventType::RESET);
+        } else {
+            onReset();
+        }
+    } else {
+        if (istr & (1 << USB_Registers::ISTR::CTR)) {
+            // Correct transfer
+            auto endpointNo = bitsValue(istr, 4, USB_Registers::ISTR::EP_ID_0);
+            auto endpoint = endpoints[endpointNo];
+
+            if (endpoint != nullptr) {
+                auto endpointRegisterValue = *endpoint->getRegister();
+
+                endpoint->clearTxRxFlags();
+
+                auto direction = (bool)bitValue(istr, USB_Registers::ISTR::DIR);
+
+                if (direction && bitValue(endpointRegisterValue,
+                                          USB_Registers::EPnR::CTR_RX)) {
+                    // OUT or SETUP transfer
+                    auto setup = (bool)bitValue(endpointRegisterValue,
+                            USB_Registers::EPnR::SETUP);
+                    if (setup) {
+                        if (deferred) {
+                            pushEvent(EventType::SETUP, endpointNo);
+                        } else {
+                            endpoint->onSetupReceptionComplete();
+                        }
+                    } else {
+                        // Buffers are passed in any mode to keep the
+                        // peripheral busy
+                        endpoint->updateReceptionState();
+
+                        if (deferred) {
+                            pushEvent(EventType::RECEPTION, endpointNo);
+                        } else {
+                            endpoint->onReceptionComplete();
+                        }
+                    }
+                }
 
-            auto direction = (bool)bitValue(istr, USB_Registers::ISTR::DIR);
+                if (bitValue(endpointRegisterValue, USB_Registers::EPnR::CTR_TX)) {
+                    // IN transfer
+                    endpoint->updateTransmissionState();
 
-            if (direction && bitValue(endpointRegisterValue,
-                                      USB_Registers::EPnR::CTR_RX)) {
-                // OUT or SETUP transfer
-                auto setup = (bool)bitValue(endpointRegisterValue,
-                        USB_Registers::EPnR::SETUP);
-                if (setup) {
-                    endpoint->onSetupReceptionComplete();
-                } else {
-                    endpoint->onReceptionComplete();
+                    if (deferred) {
+                        pushEvent(EventType::TRANSMISSION, endpointNo);
+                    } else {
+                        endpoint->onTransmissionComplete();
+                    }
                 }
             }
+        }
 
-            if (bitValue(endpointRegisterValue, USB_Registers::EPnR::CTR_TX)) {
-                // IN transfer
-                endpoint->onTransmissionComplete();
+        if (istr & (1 << USB_Registers::ISTR::SOF)) {
+            // Isochronous endpoints prepare the packet of the next frame
+            if (!deferred) {
+                dispatchStartOfFrame();
+            } else if (!startOfFramePending) {
+                // Frames not handled in time are merged
+                startOfFramePending = pushEvent(EventType::START_OF_FRAME);
             }
         }
-    }
 
-    if (istr & (1 << USB_Registers::ISTR::SUSP)) {
-        registers->CNTR = bitSet(registers->CNTR, USB_Registers::CNTR::FSUSP);
+        if (istr & (1 << USB_Registers::ISTR::SUSP)) {
+            registers->CNTR = bitSet(registers->CNTR, USB_Registers::CNTR::FSUSP);
 
-        preSuspendStatus = status;
-        status = Status::SUSPENDED;
+            preSuspendStatus = status;
+            status = Status::SUSPENDED;
 
-        if (suspendCallback != nullptr) {
-            suspendCallback();
+            if (deferred) {
+                pushEvent(EventType::SUSPEND);
+            } else if (suspendCallback != nullptr) {
+                suspendCallback();
+            }
         }
-    }
 
-    if (istr & (1 << USB_Registers::ISTR::WKUP)) {
-        registers->CNTR = bitReset(registers->CNTR, USB_Registers::CNTR::FSUSP);
+        if (istr & (1 << USB_Registers::ISTR::WKUP)) {
+            registers->CNTR = bitReset(registers->CNTR, USB_Registers::CNTR::FSUSP);
 
-        if (status == Status::SUSPENDED) {
-            status = preSuspendStatus;
+            if (status == Status::SUSPENDED) {
+                status = preSuspendStatus;
 
-            if (resumeCallback != nullptr) {
-                resumeCallback();
+                if (deferred) {
+                    pushEvent(EventType::RESUME);
+                } else if (resumeCallback != nullptr) {
+                    resumeCallback();
+                }
             }
         }
     }
+
+    if (eventMode == EventMode::DEFERRED_PENDSV
+            && eventReadIndex != eventWriteIndex) {
+        SCB::get().triggerPendSV();
+    }
+}
+
+
+void USB::pendSVIrq()
+{
+    if (eventMode == EventMode::DEFERRED_PENDSV) {
+        processEvents();
+    }
 }
 
 
@@ -239,6 +401,83 @@ USB::USB()
 }
 
 
+bool USB::pushEvent(EventType type, int endpointNo)
+{
+    auto writeIndex = eventWriteIndex;
+    auto nextIndex = (writeIndex + 1) % EVENT_QUEUE_LENGTH;
+
+    if (nextIndex == eventReadIndex) {
+        eventOverflowCount++;
+        return false;
+    }
+
+    eventQueue[writeIndex] = (uint8_t)type | endpointNo;
+
+    std::atomic_signal_fence(std::memory_order_release);
+    eventWriteIndex = nextIndex;
+
+    return true;
+}
+
+
+void USB::dispatchEvent(uint8_t event)
+{
+    auto type = (EventType)(event & 0xF0);
+    auto endpoint = endpoints[event & 0x0F];
+
+    switch (type) {
+        case EventType::RESET:
+            onReset();
+            break;
+
+        case EventType::SETUP:
+            if (endpoint != nullptr) {
+                endpoint->onSetupReceptionComplete();
+            }
+            break;
+
+        case EventType::RECEPTION:
+            if (endpoint != nullptr) {
+                endpoint->onReceptionComplete();
+            }
+            break;
+
+        case EventType::TRANSMISSION:
+            if (endpoint != nullptr) {
+                endpoint->onTransmissionComplete();
+            }
+            break;
+
+        case EventType::START_OF_FRAME:
+            startOfFramePending = false;
+            dispatchStartOfFrame();
+            break;
+
+        case EventType::SUSPEND:
+            if (suspendCallback != nullptr) {
+                suspendCallback();
+            }
+            break;
+
+        case EventType::RESUME:
+            if (resumeCallback != nullptr) {
+                resumeCallback();
+            }
+            break;
+    }
+}
+
+
+void USB::dispatchStartOfFrame()
+{
+    for (auto endpoint : endpoints) {
+        if (endpoint != nullptr) {
+            endpoint->onStartOfFrame();
+        }
+    }
+}
+
+
 void USB::enableClock()
 {
     auto rccRegisters = RCC_Registers::get();
@@ -355,6 +594,31 @@ void USB::onReset()
 }
 
 
+void USB::onSetConfiguration(int value)
+{
+    for (auto i = 1; i < NUM_ENDPOINTS; i++) {
+        if (endpoints[i] != nullptr) {
+            endpoints[i]->reset();
+        }
+    }
+
+    status = value != 0 ? Status::CONFIGURED : Status::ADDRESSED;
+}
+
+
+void USB::applyBufferLayout(USB_Endpoint* endpoint)
+{
+    if (endpoint == nullptr || bufferLayout == nullptr) {
+        return;
+    }
+
+    auto& descriptor = bufferLayout[endpoint->getNumber()];
+
+    endpoint->setBufferDescriptor(descriptor.txAddress, descriptor.txSize,
+                                  descriptor.rxAddress, descriptor.rxSize);
+}
+
+
 USB USB::instance;
 
 
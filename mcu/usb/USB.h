@@ -14,6 +14,7 @@
 // Local includes
 #include "USB_Endpoint.h"
 #include "USB_ControlEndpoint.h"
+#include "USB_SRAM_Allocator.h"
 
 // System libraries
 #include <cstdint>
@@ -41,6 +42,23 @@ class USB
             ATTACHED
         };
 
+        /**
+         * Event handling
+         *
+         * IMMEDIATE runs endpoint handlers and callbacks in the USB
+         * interrupt. The deferred modes only update buffer states in the
+         * interrupt and queue the events, which are dispatched by
+         * processEvents() from PendSV or from the main loop. The USB
+         * interrupt is masked while a handler runs, other interrupts are
+         * not.
+         */
+        enum class EventMode
+        {
+            IMMEDIATE,
+            DEFERRED_PENDSV,
+            DEFERRED_POLLED
+        };
+
         /**
          * Callback function type
          */
@@ -55,6 +73,11 @@ class USB
             CallbackFunc suspendCallback = nullptr;
             CallbackFunc resumeCallback = nullptr;
             USB_ControlEndpoint::DescriptorCallbackFunc descriptorCallback;
+            USB_ControlEndpoint::RequestCallbackFunc requestCallback = nullptr;
+            void* requestCallbackContext = nullptr;
+            USB_ControlEndpoint::RequestCallbackFunc vendorRequestCallback = nullptr;
+            void* vendorRequestCallbackContext = nullptr;
+            EventMode eventMode = EventMode::IMMEDIATE;
         };
 
         /**
@@ -129,8 +152,58 @@ class USB
          *
          * @param number        Endpoint number
          * @param endpoint      Pointer to endpoint instance or nullptr
+         * @return              False if rejected, because the number is out
+         *                      of range or the buffer layout has no entry
+         *                      for it
+         */
+        bool setEndpoint(int number, USB_Endpoint* endpoint);
+
+        /**
+         * Set buffer addresses and sizes of endpoints from a layout, call
+         * before init(). Endpoints set later are assigned their entry
+         * when set.
+         *
+         * @param layout        Reference to layout, must stay valid
+         * @return              False if rejected, because a set endpoint
+         *                      has no entry
+         */
+        template<size_t N>
+        bool setBufferLayout(const USB_SRAM_Allocator::Layout<N>& layout)
+        {
+            static_assert(N <= NUM_ENDPOINTS, "Layout has too many endpoints");
+
+            return setBufferLayout(layout.descriptors, N);
+        }
+
+        /**
+         * Set buffer addresses and sizes of endpoints from a table
+         *
+         * @param descriptors   Table indexed by endpoint number, must
+         *                      stay valid
+         * @param count         Number of entries
+         * @return              False if rejected, because count is out of
+         *                      range or a set endpoint has no entry
+         */
+        bool setBufferLayout(const USB_SRAM_Allocator::BufferDescriptor descriptors[],
+                             int count);
+
+        /**
+         * Enable start of frame interrupt, calls onStartOfFrame() of all
+         * endpoints once per millisecond
+         */
+        void enableStartOfFrameInterrupt();
+
+        /**
+         * Disable start of frame interrupt
+         */
+        void disableStartOfFrameInterrupt();
+
+        /**
+         * Return number of last received frame
+         *
+         * @return              Frame number 0..2047
          */
-        void setEndpoint(int number, USB_Endpoint* endpoint);
+        int getFrameNumber();
 
         /**
          * Set a callback function for reset
@@ -158,6 +231,78 @@ class USB
             controlEndpoint.setDescriptorCallback(func, context);
         }
 
+        /**
+         * Sets a function to be called on class and vendor requests
+         *
+         * @param func          Callback function
+         * @param context       Pointer passed to callback
+         */
+        void setRequestCallback(USB_ControlEndpoint::RequestCallbackFunc func,
+                                void* context=nullptr)
+        {
+            controlEndpoint.setRequestCallback(func, context);
+        }
+
+        /**
+         * Sets a function to be called on vendor requests
+         *
+         * @param func          Callback function
+         * @param context       Pointer passed to callback
+         */
+        void setVendorRequestCallback(USB_ControlEndpoint::RequestCallbackFunc func,
+                                      void* context=nullptr)
+        {
+            controlEndpoint.setVendorRequestCallback(func, context);
+        }
+
+        /**
+         * Set the data stage buffer of class and vendor requests
+         *
+         * @param buffer        Buffer or nullptr for the internal buffer
+         * @param length        Length of buffer in bytes
+         */
+        void setRequestBuffer(uint8_t buffer[], int length)
+        {
+            controlEndpoint.setRequestBuffer(buffer, length);
+        }
+
+        /**
+         * Set event mode
+         *
+         * With DEFERRED_PENDSV, the PendSV handler calls pendSVIrq() and
+         * its priority should be set to the lowest level. The handler of
+         * this library is only built with PENDSV in MCU_INCLUDES, an
+         * application or RTOS handler has to call pendSVIrq() otherwise.
+         *
+         * @param mode          Mode according to enum class
+         */
+        void setEventMode(EventMode mode);
+
+        /**
+         * Return event mode
+         *
+         * @return              Mode according to enum class
+         */
+        EventMode getEventMode()
+        {
+            return eventMode;
+        }
+
+        /**
+         * Dispatch queued events, call from main loop with DEFERRED_POLLED
+         */
+        void processEvents();
+
+        /**
+         * Return number of events dropped because the queue was full
+         *
+         * @return              Number of events
+         */
+        uint32_t getEventOverflowCount()
+        {
+            return eventOverflowCount;
+        }
+
         /**
          * Return IRQ number
          */
@@ -168,9 +313,30 @@ class USB
          */
         void irq();
 
+        /**
+         * Dispatch queued events with DEFERRED_PENDSV, called from PendSV
+         * handler
+         */
+        void pendSVIrq();
+
     protected:
         static const int NUM_ENDPOINTS = 8;
         static const int TRANSCEIVER_STARTUP_DELAY = 10;        // In µs
+        static const int EVENT_QUEUE_LENGTH = 64;
+
+        /**
+         * Queued event types, endpoint number is stored in the low nibble
+         */
+        enum class EventType : uint8_t
+        {
+            RESET           = 0x00,
+            SETUP           = 0x10,
+            RECEPTION       = 0x20,
+            TRANSMISSION    = 0x30,
+            START_OF_FRAME  = 0x40,
+            SUSPEND         = 0x50,
+            RESUME          = 0x60
+        };
 
         /**
          * Private constructors because of singleton pattern, no copy allowed
@@ -232,6 +398,51 @@ class USB
          */
         void onReset();
 
+        /**
+         * Called from control endpoint on SET_CONFIGURATION, restarts
+         * all other endpoints with DATA0 and empty buffers
+         *
+         * @param value         Configuration value, 0 for unconfigured
+         */
+        void onSetConfiguration(int value);
+
+        /**
+         * Queue an event, called from ISR
+         *
+         * @param type          Type according to enum class
+         * @param endpointNo    Endpoint number
+         * @return              False if the queue was full
+         */
+        bool pushEvent(EventType type, int endpointNo=0);
+
+        /**
+         * Run handlers of an event
+         *
+         * @param event         Queued event value
+         */
+        void dispatchEvent(uint8_t event);
+
+        /**
+         * Call onStartOfFrame() of all endpoints
+         */
+        void dispatchStartOfFrame();
+
+        /**
+         * Return if the buffer layout has an entry for an endpoint number,
+         * always true without layout
+         */
+        bool hasBufferLayout(int number)
+        {
+            return bufferLayout == nullptr || number < bufferLayoutCount;
+        }
+
+        /**
+         * Assign buffers from layout to an endpoint
+         *
+         * @param endpoint      Pointer to endpoint
+         */
+        void applyBufferLayout(USB_Endpoint* endpoint);
+
         /**
          * Status
          */
@@ -244,6 +455,22 @@ class USB
         USB_Endpoint* endpoints[NUM_ENDPOINTS];
         USB_ControlEndpoint controlEndpoint;
 
+        /**
+         * Buffer layout, nullptr to keep endpoint defaults
+         */
+        const USB_SRAM_Allocator::BufferDescriptor* bufferLayout = nullptr;
+        int bufferLayoutCount = 0;
+
+        /**
+         * Event queue, written by ISR and read by processEvents()
+         */
+        EventMode eventMode = EventMode::IMMEDIATE;
+        uint8_t eventQueue[EVENT_QUEUE_LENGTH];
+        volatile int eventReadIndex = 0;
+        volatile int eventWriteIndex = 0;
+        volatile uint32_t eventOverflowCount = 0;
+        volatile bool startOfFramePending = false;
+
         /**
          * Callbacks
          */
@@ -0,0 +1,404 @@
+/**
+ * @file        USB_Audio.cpp
+ *
+ * USB audio class 1.0 input device on STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "USB_Audio.h"
+
+// Local includes
+#include "USB.h"
+
+// System libraries
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+USB_Audio::~USB_Audio()
+{
+    deinit();
+}
+
+
+bool USB_Audio::init(Config& config)
+{
+    deinit();
+
+    if (!usbDevice.addFunction(this)) {
+        return false;
+    }
+
+    this->config = config;
+    this->config.channelCount = std::min(std::max(config.channelCount, 1), 2);
+
+    nominalFrameCount = (config.sampleRate + 500) / 1000;
+
+    allocateFifo();
+
+    streaming = false;
+    priming = false;
+    frameAccumulator = 0;
+    underrunCount = 0;
+    overrunCount = 0;
+
+    auto& usb = USB::get();
+
+    usb.setEndpoint(dataInEndpoint.getNumber(), &dataInEndpoint);
+
+    // USB::init() has already cleared the packet memory
+    dataInEndpoint.initBufferDescriptor();
+
+    usb.enableStartOfFrameInterrupt();
+
+    return true;
+}
+
+
+void USB_Audio::deinit()
+{
+    if (fifo.data == nullptr) {
+        return;
+    }
+
+    usbDevice.removeFunction(this);
+
+    auto& usb = USB::get();
+
+    usb.disableStartOfFrameInterrupt();
+    usb.setEndpoint(dataInEndpoint.getNumber(), nullptr);
+
+    streaming = false;
+
+    deallocateFifo();
+}
+
+
+int USB_Audio::write(int16_t samples[], int frameCount)
+{
+    if (fifo.data == nullptr) {
+        return 0;
+    }
+
+    if (!streaming) {
+        // Nobody listens, samples are dropped
+        return frameCount;
+    }
+
+    auto count = std::min(frameCount, fifo.getFree());
+
+    if (count < frameCount) {
+        overrunCount++;
+    }
+
+    auto channelCount = config.channelCount;
+    auto writeIndex = fifo.writeIndex;
+    auto firstCount = std::min(count, fifo.length - writeIndex);
+
+    memcpy(&fifo.data[writeIndex * channelCount], samples,
+           firstCount * channelCount * sizeof(int16_t));
+    memcpy(fifo.data, samples + firstCount * channelCount,
+           (count - firstCount) * channelCount * sizeof(int16_t));
+
+    writeIndex += count;
+
+    if (writeIndex >= fifo.length) {
+        writeIndex -= fifo.length;
+    }
+
+    // Samples must be in FIFO before the ISR can see the new index
+    std::atomic_signal_fence(std::memory_order_release);
+    fifo.writeIndex = writeIndex;
+
+    return count;
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+void USB_Audio::StreamingEndpoint::onReset()
+{
+    setType(Type::ISOCHRONOUS);
+
+    // Enabled when the host selects the streaming alternate setting
+    setTransmissionStatus(Status::DISABLED);
+    setReceptionStatus(Status::DISABLED);
+
+    audio.onReset();
+}
+
+
+void USB_Audio::StreamingEndpoint::onTransmissionComplete()
+{
+    audio.transmitPacket();
+}
+
+
+void USB_Audio::StreamingEndpoint::onStartOfFrame()
+{
+    // Catches up if a frame passed without IN token
+    audio.transmitPacket();
+}
+
+
+void USB_Audio::allocateFifo()
+{
+    deallocateFifo();
+
+    // FIFO must absorb the level correction band around half full
+    auto length = std::max(config.fifoLength, 4 * nominalFrameCount) + 1;
+
+    fifo.data = new int16_t[length * config.channelCount];
+    fifo.length = length;
+}
+
+
+void USB_Audio::deallocateFifo()
+{
+    if (fifo.data != nullptr) {
+        delete[] fifo.data;
+    }
+
+    fifo = Fifo();
+}
+
+
+void USB_Audio::onGetDescriptorData(uint8_t data[])
+{
+    auto controlInterface = (uint8_t)(firstInterface + CONTROL_INTERFACE);
+    auto streamingInterface = (uint8_t)(firstInterface + STREAMING_INTERFACE);
+    auto dataInEndpointNo = dataInEndpoint.getNumber();
+    auto channelCount = (uint8_t)config.channelCount;
+    auto channelConfig = channelCount == 2 ? 0x03 : 0x00;   // Left/right
+    auto maxPacketSize = getMaxPacketSize(config.sampleRate, channelCount);
+    auto sampleRate = config.sampleRate;
+
+    const uint8_t descriptor[DESCRIPTOR_LENGTH] = {
+        // Audio control interface
+        9, (uint8_t)USB_Descriptor::Type::INTERFACE,
+        controlInterface,                       // Interface number
+        0,                                      // Alternate setting
+        0,                                      // Number of endpoints
+        0x01,                                   // Class audio
+        0x01,                                   // Subclass audio control
+        0x00,                                   // Protocol
+        0,                                      // Interface string
+
+        // Header, ADC 1.00, total length of class-specific descriptors
+        9, 0x24, 0x01, 0x00, 0x01, 30, 0,
+        1,                                      // Number of streaming interfaces
+        streamingInterface,
+
+        // Input terminal, microphone
+        12, 0x24, 0x02,
+        1,                                      // Terminal ID
+        0x01, 0x02,                             // Microphone
+        0,                                      // Associated terminal
+        channelCount,
+        (uint8_t)channelConfig, 0,
+        0,                                      // Channel names
+        0,                                      // Terminal string
+
+        // Output terminal, USB streaming
+        9, 0x24, 0x03,
+        2,                                      // Terminal ID
+        0x01, 0x01,                             // USB streaming
+        0,                                      // Associated terminal
+        1,                                      // Source ID
+        0,                                      // Terminal string
+
+        // Audio streaming interface, zero bandwidth
+        9, (uint8_t)USB_Descriptor::Type::INTERFACE,
+        streamingInterface,                     // Interface number
+        0,                                      // Alternate setting
+        0,                                      // Number of endpoints
+        0x01,                                   // Class audio
+        0x02,                                   // Subclass audio streaming
+        0x00,                                   // Protocol
+        0,                                      // Interface string
+
+        // Audio streaming interface, streaming
+        9, (uint8_t)USB_Descriptor::Type::INTERFACE,
+        streamingInterface,                     // Interface number
+        1,                                      // Alternate setting
+        1,                                      // Number of endpoints
+        0x01,                                   // Class audio
+        0x02,                                   // Subclass audio streaming
+        0x00,                                   // Protocol
+        0,                                      // Interface string
+
+        // General streaming descriptor
+        7, 0x24, 0x01,
+        2,                                      // Terminal link
+        1,                                      // Delay in frames
+        0x01, 0x00,                             // PCM
+
+        // Format type I, 16 bit, one discrete sample rate
+        11, 0x24, 0x02, 0x01,
+        channelCount,
+        2,                                      // Subframe size
+        16,                                     // Bit resolution
+        1,                                      // Number of sample rates
+        (uint8_t)(sampleRate & 0xFF),
+        (uint8_t)((sampleRate >> 8) & 0xFF),
+        (uint8_t)((sampleRate >> 16) & 0xFF),
+
+        // Data IN endpoint
+        9, (uint8_t)USB_Descriptor::Type::ENDPOINT,
+        (uint8_t)(0x80 | dataInEndpointNo),
+        0x05,                                   // Isochronous, asynchronous
+        (uint8_t)(maxPacketSize & 0xFF),
+        (uint8_t)(maxPacketSize >> 8),
+        1,                                      // Interval in ms
+        0,                                      // Refresh
+        0,                                      // Synch address
+
+        // Class-specific endpoint descriptor, no controls
+        7, 0x25, 0x01, 0x00, 0, 0, 0
+    };
+
+    memcpy(data, descriptor, sizeof(descriptor));
+}
+
+
+int USB_Audio::onRequest(USB_ControlEndpoint::Request& request, uint8_t data[])
+{
+    // Standard requests to interfaces only, there are no class controls
+    if ((request.bmRequestType & 0x7F) != 0x01) {
+        return -1;
+    }
+
+    auto interface = (request.wIndex & 0xFF) - firstInterface;
+
+    switch (request.bRequest) {
+        case SET_INTERFACE:
+            if (interface == CONTROL_INTERFACE) {
+                return request.wValue == 0 ? 0 : -1;
+            }
+
+            if (interface != STREAMING_INTERFACE || request.wValue > 1) {
+                return -1;
+            }
+
+            // Drops queued packets and restarts with empty buffers, calls
+            // onReset()
+            dataInEndpoint.reset();
+            dataInEndpoint.initBufferDescriptor();
+
+            if (request.wValue == 1) {
+                dataInEndpoint.setTransmissionStatus(USB_Endpoint::Status::VALID);
+                setStreaming(true);
+                transmitPacket();
+            }
+
+            return 0;
+
+        case GET_INTERFACE:
+            data[0] = (interface == STREAMING_INTERFACE && streaming) ? 1 : 0;
+            return 1;
+
+        default:
+            return -1;
+    }
+}
+
+
+void USB_Audio::onReset()
+{
+    setStreaming(false);
+}
+
+
+void USB_Audio::setStreaming(bool state)
+{
+    if (state == streaming) {
+        return;
+    }
+
+    if (state) {
+        // Start with an empty FIFO, filled to half before sending
+        fifo.readIndex = fifo.writeIndex;
+        frameAccumulator = 0;
+        priming = true;
+    }
+
+    streaming = state;
+
+    if (config.streamingCallback != nullptr) {
+        config.streamingCallback(this, config.callbackContext);
+    }
+}
+
+
+void USB_Audio::transmitPacket()
+{
+    if (!streaming || dataInEndpoint.getFreeTransmissionBuffers() == 0) {
+        return;
+    }
+
+    auto level = fifo.getUsed();
+    auto target = fifo.length / 2;
+
+    if (priming) {
+        if (level < target) {
+            dataInEndpoint.transmit(nullptr, 0);
+            return;
+        }
+
+        priming = false;
+    }
+
+    // Fractional rates like 44.1 kHz are spread over frames
+    frameAccumulator += config.sampleRate;
+
+    int frameCount = frameAccumulator / 1000;
+    frameAccumulator %= 1000;
+
+    // Drift between sample clock and USB frames changes the FIFO level,
+    // one frame more or less per packet pulls it back to half full
+    if (level > target + nominalFrameCount) {
+        frameCount++;
+    } else if (level < target - nominalFrameCount) {
+        frameCount--;
+    }
+
+    if (frameCount > level) {
+        frameCount = level;
+        underrunCount++;
+    }
+
+    auto frameSize = config.channelCount * (int)sizeof(int16_t);
+    auto readIndex = fifo.readIndex;
+
+    // Copies to packet memory directly from FIFO
+    dataInEndpoint.transmit((uint8_t*)fifo.data, fifo.length * frameSize,
+                            readIndex * frameSize, frameCount * frameSize);
+
+    readIndex += frameCount;
+
+    if (readIndex >= fifo.length) {
+        readIndex -= fifo.length;
+    }
+
+    std::atomic_signal_fence(std::memory_order_release);
+    fifo.readIndex = readIndex;
+}
+
+
+}   // namespace mcu
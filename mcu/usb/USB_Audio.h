@@ -0,0 +1,322 @@
+/**
+ * @file        USB_Audio.h
+ *
+ * USB audio class 1.0 input device on STM32L4xx
+ *
+ * Streams 16 bit PCM samples, e.g. from an ADC, to the host over an
+ * asynchronous isochronous IN endpoint. Standard host drivers are used.
+ *
+ * Samples are written into a FIFO by the application and sent with one
+ * packet per 1 ms frame. The device clock is the reference, so packets
+ * carry the nominal number of frames, adjusted by one when the FIFO level
+ * drifts away from half full. This matches the rate to the actual sample
+ * clock without a feedback endpoint, which UAC1 only uses for OUT streams.
+ *
+ * Packets are larger than the 64 byte default buffers, so a buffer layout
+ * is required, e.g. USB_SRAM_Allocator::doubleTx(getMaxPacketSize(...)).
+ *
+ * Usage: call USB::init(), then init() of the USB_Device, then init() of
+ * this class, then USB::connect().
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "USB_Endpoint.h"
+#include "USB_ControlEndpoint.h"
+#include "USB_Device.h"
+#include "USB_Function.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class USB_Audio : public USB_Function
+{
+    public:
+        /**
+         * Callback function type
+         */
+        typedef void (*CallbackFunc)(USB_Audio*, void*);
+
+        /**
+         * Configuration settings
+         */
+        struct Config
+        {
+            uint32_t sampleRate = 48000;        // In Hz
+            int channelCount = 1;               // 1 or 2
+            int fifoLength = 480;               // In sample frames
+            CallbackFunc streamingCallback = nullptr;   // Start and stop
+            void* callbackContext = nullptr;
+        };
+
+        /**
+         * Return max. packet size, one sample frame more than nominal
+         *
+         * @param sampleRate    Sample rate in Hz
+         * @param channelCount  Number of channels
+         * @return              Size in bytes
+         */
+        static constexpr uint16_t getMaxPacketSize(uint32_t sampleRate,
+                                                   int channelCount)
+        {
+            return ((sampleRate + 999) / 1000 + 1) * channelCount * 2;
+        }
+
+        /**
+         * Constructor
+         *
+         * @param usbDevice         Reference to device
+         * @param dataInEndpointNo  Number of isochronous IN endpoint
+         */
+        USB_Audio(USB_Device& usbDevice, int dataInEndpointNo=1)
+            : USB_Function(usbDevice),
+              dataInEndpoint(*this, dataInEndpointNo) {}
+
+        /**
+         * Destructor
+         */
+        ~USB_Audio();
+
+        /**
+         * Disallow copy
+         */
+        USB_Audio(const USB_Audio&) = delete;
+        USB_Audio& operator = (const USB_Audio&) = delete;
+        USB_Audio& operator = (USB_Audio&&) = delete;
+
+        /**
+         * Init with config settings, adds the function to the device,
+         * allocates the FIFO and registers the endpoint at the USB
+         * peripheral
+         *
+         * @param config        Reference to configuration struct
+         * @return              False if the device has no room for the
+         *                      function
+         */
+        bool init(Config& config);
+
+        /**
+         * Shutdown
+         */
+        void deinit();
+
+        /**
+         * Write interleaved samples into FIFO, non-blocking, e.g. from
+         * a DMA interrupt. Samples are dropped while the host doesn't
+         * stream.
+         *
+         * @param samples       Buffer containing samples
+         * @param frameCount    Number of sample frames
+         * @return              Number of written frames
+         */
+        int write(int16_t samples[], int frameCount);
+
+        /**
+         * Return number of sample frames that can be written
+         *
+         * @return              Number of frames
+         */
+        int getWriteAvailable()
+        {
+            return fifo.getFree();
+        }
+
+        /**
+         * Return number of sample frames in FIFO
+         *
+         * @return              Number of frames
+         */
+        int getFifoLevel()
+        {
+            return fifo.getUsed();
+        }
+
+        /**
+         * Return if the host has selected the streaming alternate setting
+         *
+         * @return              True if streaming
+         */
+        bool isStreaming()
+        {
+            return streaming;
+        }
+
+        /**
+         * Return number of packets sent with less than the nominal number
+         * of frames because the FIFO ran empty
+         *
+         * @return              Number of underruns
+         */
+        uint32_t getUnderrunCount()
+        {
+            return underrunCount;
+        }
+
+        /**
+         * Return number of write() calls that didn't fit into the FIFO
+         *
+         * @return              Number of overruns
+         */
+        uint32_t getOverrunCount()
+        {
+            return overrunCount;
+        }
+
+    protected:
+        /**
+         * Standard requests to interfaces
+         */
+        static const uint8_t GET_INTERFACE = 0x0A;
+        static const uint8_t SET_INTERFACE = 0x0B;
+
+        /**
+         * Interfaces, relative to first interface
+         */
+        static const int CONTROL_INTERFACE = 0;
+        static const int STREAMING_INTERFACE = 1;
+
+        /**
+         * Length of interface descriptors
+         */
+        static const int DESCRIPTOR_LENGTH = 91;
+
+        /**
+         * Isochronous IN endpoint, forwards events to class
+         */
+        class StreamingEndpoint : public USB_Endpoint
+        {
+            friend class USB_Audio;
+
+            public:
+                StreamingEndpoint(USB_Audio& audio, int number)
+                    : USB_Endpoint(number), audio(audio)
+                {
+                    setBufferMode(BufferMode::DOUBLE_TX);
+                }
+
+            protected:
+                virtual void onReset() override;
+                virtual void onTransmissionComplete() override;
+                virtual void onStartOfFrame() override;
+
+                USB_Audio& audio;
+        };
+
+        /**
+         * Sample FIFO, indices count sample frames, safe for one writer
+         * and one reader in different contexts, one frame is kept free to
+         * distinguish full from empty
+         */
+        struct Fifo
+        {
+            int16_t* data = nullptr;
+            int length = 0;
+            volatile int readIndex = 0;
+            volatile int writeIndex = 0;
+
+            int getUsed()
+            {
+                auto used = writeIndex - readIndex;
+                return used < 0 ? used + length : used;
+            }
+
+            int getFree()
+            {
+                return length > 0 ? length - 1 - getUsed() : 0;
+            }
+        };
+
+        /**
+         * Allocate FIFO on heap
+         */
+        void allocateFifo();
+
+        /**
+         * Deallocate FIFO on heap
+         */
+        void deallocateFifo();
+
+        /**
+         * Return number of interfaces
+         */
+        virtual int onGetInterfaceCount() override
+        {
+            return 2;
+        }
+
+        /**
+         * Return length of interface descriptors
+         */
+        virtual int onGetDescriptorLength() override
+        {
+            return DESCRIPTOR_LENGTH;
+        }
+
+        /**
+         * Write interface descriptors
+         */
+        virtual void onGetDescriptorData(uint8_t data[]) override;
+
+        /**
+         * Handle interface request
+         */
+        virtual int onRequest(USB_ControlEndpoint::Request& request,
+                              uint8_t data[]) override;
+
+        /**
+         * Called from endpoint on bus reset
+         */
+        void onReset();
+
+        /**
+         * Start or stop streaming and notify application
+         */
+        void setStreaming(bool state);
+
+        /**
+         * Queue the packet for the next frame if a buffer is free
+         */
+        void transmitPacket();
+
+        /**
+         * Endpoint
+         */
+        StreamingEndpoint dataInEndpoint;
+
+        /**
+         * Configuration
+         */
+        Config config;
+
+        /**
+         * Sample FIFO
+         */
+        Fifo fifo;
+
+        /**
+         * Streaming state
+         */
+        volatile bool streaming = false;
+        bool priming = false;               // Waiting for half full FIFO
+        uint32_t frameAccumulator = 0;      // Fractional frames * 1000
+        int nominalFrameCount = 0;          // Frames per packet, rounded
+
+        /**
+         * Statistics
+         */
+        volatile uint32_t underrunCount = 0;
+        volatile uint32_t overrunCount = 0;
+};
+
+
+}   // namespace mcu
@@ -0,0 +1,494 @@
+/**
+ * @file        USB_CDC.cpp
+ *
+ * CDC-ACM virtual serial port class for USB on STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "USB_CDC.h"
+
+// Local includes
+#include "USB.h"
+
+// This component
+#include "../core/cortex_m4.h"
+
+// System libraries
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+USB_CDC::~USB_CDC()
+{
+    deinit();
+}
+
+
+bool USB_CDC::init(Config& config)
+{
+    deinit();
+
+    if (!usbDevice.addFunction(this)) {
+        return false;
+    }
+
+    this->config = config;
+
+    allocateBuffers(config.txBufferLength, config.rxBufferLength);
+
+    lineCoding = LineCoding();
+    dtr = false;
+    rts = false;
+    lastPacketLength = 0;
+
+    auto& usb = USB::get();
+
+    usb.setEndpoint(dataInEndpoint.getNumber(), &dataInEndpoint);
+    usb.setEndpoint(dataOutEndpoint.getNumber(), &dataOutEndpoint);
+    usb.setEndpoint(notificationEndpoint.getNumber(), &notificationEndpoint);
+
+    // USB::init() has already cleared the packet memory
+    dataInEndpoint.initBufferDescriptor();
+    dataOutEndpoint.initBufferDescriptor();
+    notificationEndpoint.initBufferDescriptor();
+
+    return true;
+}
+
+
+void USB_CDC::deinit()
+{
+    if (txBuffer.data == nullptr) {
+        return;
+    }
+
+    usbDevice.removeFunction(this);
+
+    auto& usb = USB::get();
+
+    usb.setEndpoint(dataInEndpoint.getNumber(), nullptr);
+    usb.setEndpoint(dataOutEndpoint.getNumber(), nullptr);
+    usb.setEndpoint(notificationEndpoint.getNumber(), nullptr);
+
+    deallocateBuffers();
+}
+
+
+int USB_CDC::write(uint8_t data[], int size)
+{
+    if (txBuffer.data == nullptr) {
+        return 0;
+    }
+
+    auto count = std::min(size, txBuffer.getFree());
+    auto writeIndex = txBuffer.writeIndex;
+    auto firstCount = std::min(count, txBuffer.length - writeIndex);
+
+    memcpy(&txBuffer.data[writeIndex], data, firstCount);
+    memcpy(txBuffer.data, data + firstCount, count - firstCount);
+
+    writeIndex += count;
+
+    if (writeIndex >= txBuffer.length) {
+        writeIndex -= txBuffer.length;
+    }
+
+    // Data must be in buffer before the ISR can see the new index
+    std::atomic_signal_fence(std::memory_order_release);
+    txBuffer.writeIndex = writeIndex;
+
+    if (count > 0 && USB::get().isReady()) {
+        disableInterrupts();
+        fillTransmissionBuffers();
+        enableInterrupts();
+    }
+
+    return count;
+}
+
+
+int USB_CDC::read(uint8_t data[], int size)
+{
+    if (rxBuffer.data == nullptr) {
+        return 0;
+    }
+
+    auto count = std::min(size, rxBuffer.getUsed());
+    auto readIndex = rxBuffer.readIndex;
+    auto firstCount = std::min(count, rxBuffer.length - readIndex);
+
+    memcpy(data, &rxBuffer.data[readIndex], firstCount);
+    memcpy(data + firstCount, rxBuffer.data, count - firstCount);
+
+    readIndex += count;
+
+    if (readIndex >= rxBuffer.length) {
+        readIndex -= rxBuffer.length;
+    }
+
+    std::atomic_signal_fence(std::memory_order_release);
+    rxBuffer.readIndex = readIndex;
+
+    if (dataOutEndpoint.getReceivedPacketCount() > 0) {
+        // Packets were held back because of a full buffer
+        disableInterrupts();
+        takeReceivedPackets();
+        enableInterrupts();
+    }
+
+    return count;
+}
+
+
+int USB_CDC::getReadAvailable()
+{
+    return rxBuffer.getUsed();
+}
+
+
+int USB_CDC::getWriteAvailable()
+{
+    return txBuffer.getFree();
+}
+
+
+void USB_CDC::flush()
+{
+    auto& usb = USB::get();
+
+    while (usb.isReady() && (isTransmitting() || txBuffer.getUsed() > 0)) {
+        disableInterrupts();
+        fillTransmissionBuffers();
+        enableInterrupts();
+    }
+}
+
+
+void USB_CDC::clear()
+{
+    disableInterrupts();
+
+    txBuffer.readIndex = txBuffer.writeIndex;
+    rxBuffer.readIndex = rxBuffer.writeIndex;
+
+    // Drop held back packets
+    while (dataOutEndpoint.getReceivedPacketCount() > 0) {
+        dataOutEndpoint.releaseReceptionBuffer();
+    }
+
+    enableInterrupts();
+}
+
+
+bool USB_CDC::isConnected()
+{
+    return USB::get().isReady() && dtr;
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+void USB_CDC::DataEndpoint::onReset()
+{
+    setType(Type::BULK);
+
+    // Double-buffered endpoints stay valid, flow control is done by
+    // passing buffers
+    if (bufferMode == BufferMode::DOUBLE_TX) {
+        setTransmissionStatus(Status::VALID);
+        setReceptionStatus(Status::DISABLED);
+    } else {
+        setTransmissionStatus(Status::DISABLED);
+        setReceptionStatus(Status::VALID);
+    }
+
+    cdc.onReset();
+}
+
+
+void USB_CDC::DataEndpoint::onReceptionComplete()
+{
+    cdc.onReceptionComplete();
+}
+
+
+void USB_CDC::DataEndpoint::onTransmissionComplete()
+{
+    cdc.onTransmissionComplete();
+}
+
+
+void USB_CDC::NotificationEndpoint::onReset()
+{
+    setType(Type::INTERRUPT);
+    setTransmissionStatus(Status::NAK);
+    setReceptionStatus(Status::DISABLED);
+}
+
+
+void USB_CDC::allocateBuffers(int txBufferLength, int rxBufferLength)
+{
+    deallocateBuffers();
+
+    // Receive buffer must hold at least one packet
+    rxBufferLength = std::max(rxBufferLength, MAX_PACKET_SIZE + 1);
+    txBufferLength = std::max(txBufferLength, 2);
+
+    txBuffer.data = new uint8_t[txBufferLength];
+    txBuffer.length = txBufferLength;
+    rxBuffer.data = new uint8_t[rxBufferLength];
+    rxBuffer.length = rxBufferLength;
+}
+
+
+void USB_CDC::deallocateBuffers()
+{
+    if (txBuffer.data != nullptr) {
+        delete[] txBuffer.data;
+    }
+
+    if (rxBuffer.data != nullptr) {
+        delete[] rxBuffer.data;
+    }
+
+    txBuffer = RingBuffer();
+    rxBuffer = RingBuffer();
+}
+
+
+void USB_CDC::onGetDescriptorData(uint8_t data[])
+{
+    auto communicationInterface = (uint8_t)firstInterface;
+    auto dataInterface = (uint8_t)(firstInterface + 1);
+    auto dataInEndpointNo = dataInEndpoint.getNumber();
+    auto dataOutEndpointNo = dataOutEndpoint.getNumber();
+    auto notificationEndpointNo = notificationEndpoint.getNumber();
+
+    const uint8_t descriptor[DESCRIPTOR_LENGTH] = {
+        // Communication interface
+        9, (uint8_t)USB_Descriptor::Type::INTERFACE,
+        communicationInterface,                 // Interface number
+        0,                                      // Alternate setting
+        1,                                      // Number of endpoints
+        0x02,                                   // Class CDC
+        0x02,                                   // Subclass ACM
+        0x01,                                   // Protocol AT commands
+        0,                                      // Interface string
+
+        // Header functional descriptor, CDC 1.10
+        5, 0x24, 0x00, 0x10, 0x01,
+
+        // Call management functional descriptor, no call management
+        5, 0x24, 0x01, 0x00, 1,
+
+        // ACM functional descriptor, line coding and control line state
+        4, 0x24, 0x02, 0x02,
+
+        // Union functional descriptor
+        5, 0x24, 0x06, communicationInterface, dataInterface,
+
+        // Notification endpoint
+        7, (uint8_t)USB_Descriptor::Type::ENDPOINT,
+        (uint8_t)(0x80 | notificationEndpointNo),
+        0x03,                                   // Interrupt
+        8, 0,                                   // Max. packet size
+        16,                                     // Interval in ms
+
+        // Data interface
+        9, (uint8_t)USB_Descriptor::Type::INTERFACE,
+        dataInterface,                          // Interface number
+        0,                                      // Alternate setting
+        2,                                      // Number of endpoints
+        0x0A,                                   // Class CDC data
+        0x00,                                   // Subclass
+        0x00,                                   // Protocol
+        0,                                      // Interface string
+
+        // Data OUT endpoint
+        7, (uint8_t)USB_Descriptor::Type::ENDPOINT,
+        (uint8_t)dataOutEndpointNo,
+        0x02,                                   // Bulk
+        MAX_PACKET_SIZE, 0,
+        0,
+
+        // Data IN endpoint
+        7, (uint8_t)USB_Descriptor::Type::ENDPOINT,
+        (uint8_t)(0x80 | dataInEndpointNo),
+        0x02,                                   // Bulk
+        MAX_PACKET_SIZE, 0,
+        0
+    };
+
+    memcpy(data, descriptor, sizeof(descriptor));
+}
+
+
+int USB_CDC::onRequest(USB_ControlEndpoint::Request& request, uint8_t data[])
+{
+    // Class requests to communication interface only
+    if ((request.bmRequestType & 0x7F) != 0x21
+            || request.wIndex != firstInterface) {
+        return -1;
+    }
+
+    switch (request.bRequest) {
+        case SET_LINE_CODING:
+            if (request.wLength < sizeof(LineCoding)) {
+                return -1;
+            }
+
+            memcpy(&lineCoding, data, sizeof(LineCoding));
+
+            if (config.lineCodingCallback != nullptr) {
+                config.lineCodingCallback(this, config.callbackContext);
+            }
+
+            return 0;
+
+        case GET_LINE_CODING:
+            memcpy(data, &lineCoding, sizeof(LineCoding));
+            return sizeof(LineCoding);
+
+        case SET_CONTROL_LINE_STATE:
+            dtr = request.wValue & 0x01;
+            rts = request.wValue & 0x02;
+
+            if (config.controlLineStateCallback != nullptr) {
+                config.controlLineStateCallback(this, config.callbackContext);
+            }
+
+            // Start transmission of data queued before connection
+            fillTransmissionBuffers();
+
+            return 0;
+
+        case SEND_BREAK:
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+
+void USB_CDC::onReset()
+{
+    lastPacketLength = 0;
+    dtr = false;
+    rts = false;
+
+    txBuffer.readIndex = txBuffer.writeIndex;
+    rxBuffer.readIndex = rxBuffer.writeIndex;
+}
+
+
+void USB_CDC::onReceptionComplete()
+{
+    // Packets that don't fit stay with the endpoint, which NAKs until
+    // read() makes room
+    if (takeReceivedPackets() && config.receiveCallback != nullptr) {
+        config.receiveCallback(this, config.callbackContext);
+    }
+}
+
+
+void USB_CDC::onTransmissionComplete()
+{
+    fillTransmissionBuffers();
+}
+
+
+bool USB_CDC::takeReceivedPackets()
+{
+    if (rxBuffer.data == nullptr) {
+        return false;
+    }
+
+    auto taken = false;
+
+    while (dataOutEndpoint.getReceivedPacketCount() > 0) {
+        auto length = dataOutEndpoint.getReceivedLength();
+
+        if (length > rxBuffer.getFree()) {
+            break;
+        }
+
+        auto writeIndex = rxBuffer.writeIndex;
+
+        // Copies from packet memory and releases the packet buffer
+        dataOutEndpoint.receive(rxBuffer.data, rxBuffer.length, writeIndex,
+                                length);
+
+        writeIndex += length;
+
+        if (writeIndex >= rxBuffer.length) {
+            writeIndex -= rxBuffer.length;
+        }
+
+        std::atomic_signal_fence(std::memory_order_release);
+        rxBuffer.writeIndex = writeIndex;
+
+        taken = true;
+    }
+
+    return taken;
+}
+
+
+void USB_CDC::fillTransmissionBuffers()
+{
+    if (txBuffer.data == nullptr) {
+        return;
+    }
+
+    // Next packet is prepared while the current one is on the bus
+    while (dataInEndpoint.getFreeTransmissionBuffers() > 0) {
+        auto count = std::min(txBuffer.getUsed(), MAX_PACKET_SIZE);
+
+        if (count == 0) {
+            if (lastPacketLength == MAX_PACKET_SIZE) {
+                // Terminate transfer with a zero-length packet
+                lastPacketLength = 0;
+                dataInEndpoint.transmit(nullptr, 0);
+            }
+
+            return;
+        }
+
+        auto readIndex = txBuffer.readIndex;
+
+        // Copies to packet memory directly from transmit buffer
+        dataInEndpoint.transmit(txBuffer.data, txBuffer.length, readIndex,
+                                count);
+
+        readIndex += count;
+
+        if (readIndex >= txBuffer.length) {
+            readIndex -= txBuffer.length;
+        }
+
+        std::atomic_signal_fence(std::memory_order_release);
+        txBuffer.readIndex = readIndex;
+
+        lastPacketLength = count;
+    }
+}
+
+
+}   // namespace mcu
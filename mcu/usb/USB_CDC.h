@@ -0,0 +1,375 @@
+/**
+ * @file        USB_CDC.h
+ *
+ * CDC-ACM virtual serial port class for USB on STM32L4xx
+ *
+ * Provides the interface descriptors of a USB_Device function, handles
+ * the ACM class requests and streams data through ring buffers over double-buffered
+ * bulk IN and OUT endpoints with 64 byte full-speed packets. Transfers
+ * ending with a full packet are terminated by a zero-length packet. When
+ * the receive buffer is full, the OUT endpoint NAKs until data is read.
+ *
+ * Usage: call USB::init(), then init() of the USB_Device, then init() of
+ * this class, then USB::connect().
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "USB_Endpoint.h"
+#include "USB_ControlEndpoint.h"
+#include "USB_Device.h"
+#include "USB_Function.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class USB_CDC : public USB_Function
+{
+    public:
+        /**
+         * Max. packet size of bulk endpoints
+         */
+        static const int MAX_PACKET_SIZE = 64;
+
+        /**
+         * Callback function type
+         */
+        typedef void (*CallbackFunc)(USB_CDC*, void*);
+
+        /**
+         * Line coding as sent by SET_LINE_CODING
+         */
+        struct LineCoding
+        {
+            uint32_t dwDTERate = 115200;    // Baudrate
+            uint8_t bCharFormat = 0;        // Stop bits: 0=1, 1=1.5, 2=2
+            uint8_t bParityType = 0;        // 0=none, 1=odd, 2=even
+            uint8_t bDataBits = 8;
+        } __attribute__((packed));
+
+        /**
+         * Configuration settings
+         */
+        struct Config
+        {
+            int txBufferLength = 2048;
+            int rxBufferLength = 1024;
+            CallbackFunc lineCodingCallback = nullptr;
+            CallbackFunc controlLineStateCallback = nullptr;
+            CallbackFunc receiveCallback = nullptr;
+            void* callbackContext = nullptr;
+        };
+
+        /**
+         * Constructor
+         *
+         * @param usbDevice                 Reference to device
+         * @param dataInEndpointNo          Number of bulk IN endpoint
+         * @param dataOutEndpointNo         Number of bulk OUT endpoint
+         * @param notificationEndpointNo    Number of interrupt IN endpoint
+         */
+        USB_CDC(USB_Device& usbDevice, int dataInEndpointNo=1,
+                int dataOutEndpointNo=2, int notificationEndpointNo=3)
+            : USB_Function(usbDevice),
+              dataInEndpoint(*this, dataInEndpointNo, BufferMode::DOUBLE_TX),
+              dataOutEndpoint(*this, dataOutEndpointNo, BufferMode::DOUBLE_RX),
+              notificationEndpoint(notificationEndpointNo) {}
+
+        /**
+         * Destructor
+         */
+        ~USB_CDC();
+
+        /**
+         * Disallow copy
+         */
+        USB_CDC(const USB_CDC&) = delete;
+        USB_CDC& operator = (const USB_CDC&) = delete;
+        USB_CDC& operator = (USB_CDC&&) = delete;
+
+        /**
+         * Init with config settings, adds the function to the device and
+         * registers endpoints at the USB peripheral
+         *
+         * @param config        Reference to configuration struct
+         * @return              False if the device has no room for the
+         *                      function
+         */
+        bool init(Config& config);
+
+        /**
+         * Shutdown
+         */
+        void deinit();
+
+        /**
+         * Queue data for transmission, non-blocking
+         *
+         * @param data          Buffer containing data
+         * @param size          Data size in bytes
+         * @return              Number of queued bytes
+         */
+        int write(uint8_t data[], int size);
+
+        /**
+         * Read received data, non-blocking
+         *
+         * @param data          Buffer to be filled with data
+         * @param size          Buffer size in bytes
+         * @return              Number of read bytes
+         */
+        int read(uint8_t data[], int size);
+
+        /**
+         * Return number of bytes that can be read
+         *
+         * @return              Number of bytes
+         */
+        int getReadAvailable();
+
+        /**
+         * Return number of bytes that can be queued for transmission
+         *
+         * @return              Number of bytes
+         */
+        int getWriteAvailable();
+
+        /**
+         * Wait until all queued data is transmitted or the device is
+         * no longer configured
+         */
+        void flush();
+
+        /**
+         * Discard received and queued data
+         */
+        void clear();
+
+        /**
+         * Return if the device is configured and a terminal has set DTR
+         *
+         * @return              True if connected
+         */
+        bool isConnected();
+
+        /**
+         * Return line coding
+         *
+         * @return              Reference to line coding
+         */
+        LineCoding& getLineCoding()
+        {
+            return lineCoding;
+        }
+
+        /**
+         * Return state of DTR signal
+         *
+         * @return              True if active
+         */
+        bool getDTR()
+        {
+            return dtr;
+        }
+
+        /**
+         * Return state of RTS signal
+         *
+         * @return              True if active
+         */
+        bool getRTS()
+        {
+            return rts;
+        }
+
+    protected:
+        /**
+         * Class requests
+         */
+        static const uint8_t SET_LINE_CODING = 0x20;
+        static const uint8_t GET_LINE_CODING = 0x21;
+        static const uint8_t SET_CONTROL_LINE_STATE = 0x22;
+        static const uint8_t SEND_BREAK = 0x23;
+
+        /**
+         * Length of interface descriptors
+         */
+        static const int DESCRIPTOR_LENGTH = 58;
+
+        typedef USB_Endpoint::BufferMode BufferMode;
+
+        /**
+         * Double-buffered bulk IN or OUT endpoint, forwards events to class
+         */
+        class DataEndpoint : public USB_Endpoint
+        {
+            friend class USB_CDC;
+
+            public:
+                DataEndpoint(USB_CDC& cdc, int number, BufferMode mode)
+                    : USB_Endpoint(number), cdc(cdc)
+                {
+                    setBufferMode(mode);
+                }
+
+            protected:
+                virtual void onReset() override;
+                virtual void onReceptionComplete() override;
+                virtual void onTransmissionComplete() override;
+
+                USB_CDC& cdc;
+        };
+
+        /**
+         * Interrupt IN endpoint for notifications, currently unused
+         */
+        class NotificationEndpoint : public USB_Endpoint
+        {
+            public:
+                NotificationEndpoint(int number) : USB_Endpoint(number) {}
+
+            protected:
+                virtual void onReset() override;
+        };
+
+        /**
+         * Ring buffer, safe for one writer and one reader in different
+         * contexts, one byte is kept free to distinguish full from empty
+         */
+        struct RingBuffer
+        {
+            uint8_t* data = nullptr;
+            int length = 0;
+            volatile int readIndex = 0;
+            volatile int writeIndex = 0;
+
+            int getUsed()
+            {
+                auto used = writeIndex - readIndex;
+                return used < 0 ? used + length : used;
+            }
+
+            int getFree()
+            {
+                return length > 0 ? length - 1 - getUsed() : 0;
+            }
+        };
+
+        /**
+         * Allocate ring buffers on heap
+         *
+         * @param txBufferLength    Length of transmit buffer in bytes
+         * @param rxBufferLength    Length of receive buffer in bytes
+         */
+        void allocateBuffers(int txBufferLength, int rxBufferLength);
+
+        /**
+         * Deallocate ring buffers on heap
+         */
+        void deallocateBuffers();
+
+        /**
+         * Return number of interfaces
+         */
+        virtual int onGetInterfaceCount() override
+        {
+            return 2;
+        }
+
+        /**
+         * Return length of interface descriptors
+         */
+        virtual int onGetDescriptorLength() override
+        {
+            return DESCRIPTOR_LENGTH;
+        }
+
+        /**
+         * Write interface descriptors
+         */
+        virtual void onGetDescriptorData(uint8_t data[]) override;
+
+        /**
+         * Handle class request
+         */
+        virtual int onRequest(USB_ControlEndpoint::Request& request,
+                              uint8_t data[]) override;
+
+        /**
+         * Called from data endpoint on bus reset
+         */
+        void onReset();
+
+        /**
+         * Called from data endpoint when a packet was received
+         */
+        void onReceptionComplete();
+
+        /**
+         * Called from data endpoint when a packet was transmitted
+         */
+        void onTransmissionComplete();
+
+        /**
+         * Copy received packets into receive buffer as long as they fit
+         *
+         * @return              True if at least one packet was taken
+         */
+        bool takeReceivedPackets();
+
+        /**
+         * Fill free packet buffers of IN endpoint from transmit buffer
+         */
+        void fillTransmissionBuffers();
+
+        /**
+         * Return if packets are queued at the IN endpoint
+         */
+        bool isTransmitting()
+        {
+            return dataInEndpoint.getFreeTransmissionBuffers() < 2;
+        }
+
+        /**
+         * Endpoints
+         */
+        DataEndpoint dataInEndpoint;
+        DataEndpoint dataOutEndpoint;
+        NotificationEndpoint notificationEndpoint;
+
+        /**
+         * Configuration
+         */
+        Config config;
+
+        /**
+         * Ring buffers
+         */
+        RingBuffer txBuffer;
+        RingBuffer rxBuffer;
+
+        /**
+         * Length of last queued packet, used to send zero-length packets
+         */
+        int lastPacketLength = 0;
+
+        /**
+         * Line state
+         */
+        LineCoding lineCoding;
+        volatile bool dtr = false;
+        volatile bool rts = false;
+};
+
+
+}   // namespace mcu
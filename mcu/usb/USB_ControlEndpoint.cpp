@@ -36,22 +36,53 @@ void USB_ControlEndpoint::onReset()
     setType(Type::CONTROL);
     setTransmissionStatus(Status::NAK);
     setReceptionStatus(Status::VALID);
+
+    if (pendingDescriptor != nullptr) {
+        pendingDescriptor->onDeinit();
+        pendingDescriptor = nullptr;
+    }
+
+    pendingZeroLengthPacket = false;
+    dataStage = DataStage::NONE;
+    dataStageLength = 0;
+    addressTemp = 0;
+    configuration = 0;
+    remoteWakeupEnabled = false;
 }
 
 
 void USB_ControlEndpoint::onSetupReceptionComplete()
 {
+    if (pendingDescriptor != nullptr) {
+        // Previous data stage was aborted by the host
+        pendingDescriptor->onDeinit();
+        pendingDescriptor = nullptr;
+    }
+
+    pendingZeroLengthPacket = false;
     dataStage = DataStage::NONE;
     dataStageLength = 0;
     onSetupStage();
-    setReceptionStatus(Status::VALID);
+
+    // Reception is NAKed after a setup packet, unless stall() was called
+    if (!isHalted(false)) {
+        setReceptionStatus(Status::VALID);
+    }
 }
 
 
 void USB_ControlEndpoint::onReceptionComplete()
 {
     if (dataStage == DataStage::IN) {
-        onDataStageIN();
+        // Status stage, may end the data stage early
+        if (pendingDescriptor != nullptr) {
+            pendingDescriptor->onDeinit();
+            pendingDescriptor = nullptr;
+        }
+
+        pendingZeroLengthPacket = false;
+        dataStage = DataStage::NONE;
+        dataStageLength = 0;
     } else if (dataStage == DataStage::OUT) {
         onDataStageOUT();
     }
@@ -60,7 +91,9 @@ void USB_ControlEndpoint::onReceptionComplete()
         onStatusStage();
     }
 
-    setReceptionStatus(Status::VALID);
+    if (!isHalted(false)) {
+        setReceptionStatus(Status::VALID);
+    }
 }
 
 
@@ -84,15 +117,6 @@ void USB_ControlEndpoint::onTransmissionComplete()
 void USB_ControlEndpoint::onSetupStage()
 {
     // Packet received
-    struct Request
-    {
-        uint8_t bmRequestType;
-        uint8_t bRequest;
-        uint16_t wValue;
-        uint16_t wIndex;
-        uint16_t wLength;
-    } __attribute__((packed));
-
     uint8_t requestBuffer[sizeof(Request)];
     auto request = (Request*)requestBuffer;
 
@@ -106,125 +130,400 @@ void USB_ControlEndpoint::onSetupStage()
         dataStageLength = 0;
     }
 
-    if (request->bRequest == 0x00 && request->bmRequestType == 0x80) {
-        // GET_STATUS
-        // Todo: implement correct response
-        uint8_t statusData[] = { 0, 0 };
-        transmit(statusData, 2);
-    } else if (request->bRequest == 0x01 && request->bmRequestType == 0x00) {
-        // CLEAR_FEATURE
-        transmit(nullptr, 0);
-    } else if (request->bRequest == 0x03 && request->bmRequestType == 0x00) {
-        // SET_FEATURE
-        transmit(nullptr, 0);
-    } else if (request->bRequest == 0x05 && request->bmRequestType == 0x00) {
-        // SET_ADDRESS
-        addressTemp = request->wValue & 0x7F;
+    if (request->bmRequestType & 0x60) {
+        // Class or vendor request
+        onClassRequest(*request);
+    } else {
+        onStandardRequest(*request);
+    }
+}
+
+
+void USB_ControlEndpoint::onDataStageIN()
+{
+    transmitNextPacket();
+}
+
+
+void USB_ControlEndpoint::onDataStageOUT()
+{
+    void* context;
+    auto callback = getRequestCallback(pendingRequest, context);
+
+    auto rxLength = getReceivedLength();
+    auto readLength = std::min(rxLength, dataStageLength - requestDataIndex);
+
+    // Reception status is set to valid by onReceptionComplete()
+    USB_SRAM::read(rxBufferAddress, requestBuffer + requestDataIndex,
+                   readLength);
+    requestDataIndex += readLength;
+
+    if (requestDataIndex < dataStageLength && rxLength == getMaxPacketSize()) {
+        // More packets to come
+        return;
+    }
+
+    dataStage = DataStage::NONE;
+    dataStageLength = 0;
+
+    if (callback == nullptr
+            || callback(pendingRequest, requestBuffer, context) < 0) {
+        stall();
+    } else {
+        // Status stage
         transmit(nullptr, 0);
-    } else if (request->bRequest == 0x06 && request->bmRequestType == 0x80) {
-        // GET_DESCRIPTOR
-        auto type = request->wValue >> 8;
-        auto index = request->wValue & 0xFF;
-
-        if (descriptorCallbackFunc != nullptr) {
-            auto descriptor = descriptorCallbackFunc(
-                (USB_Descriptor::Type)type,
-                index,
-                descriptorCallbackContext
-            );
-            if (descriptor != nullptr) {
-                descriptor->onInit();
-
-                auto descriptorLength = descriptor->onGetLength();
-
-                auto transmitSize = std::min((int)request->wLength,
-                                             (int)descriptorLength);
-                transmitSize = std::min(transmitSize, (int)txBufferSize);
-
-                uint8_t descriptorBuffer[transmitSize];
-
-                for (auto i = 0; i < transmitSize; i++) {
-                    descriptorBuffer[i] = descriptor->onGetData(i);
-                }
-
-                transmit(descriptorBuffer, transmitSize);
-
-                if (request->wLength > transmitSize
-                        && descriptorLength > transmitSize) {
-                    pendingDescriptor = descriptor;
-                    pendingDescriptorDataIndex = transmitSize;
-                } else {
-                    descriptor->onDeinit();
-                }
+    }
+}
+
+
+void USB_ControlEndpoint::onStatusStage()
+{
+    if (addressTemp != 0) {
+        auto registers = USB_Registers::get();
+        registers->DADDR = addressTemp | (1 << USB_Registers::DADDR::EF);
+
+        auto& usb = USB::get();
+        usb.status = USB::Status::ADDRESSED;
+
+        addressTemp = 0;
+    }
+}
+
+
+void USB_ControlEndpoint::onStandardRequest(Request& request)
+{
+    auto direction = request.bmRequestType & 0x80;
+    auto recipient = request.bmRequestType & 0x1F;
+
+    switch (request.bRequest) {
+        case GET_STATUS:
+            if (direction) {
+                onGetStatus(request);
+                return;
+            }
+            break;
+
+        case CLEAR_FEATURE:
+            if (!direction) {
+                onFeatureRequest(request, false);
+                return;
+            }
+            break;
+
+        case SET_FEATURE:
+            if (!direction) {
+                onFeatureRequest(request, true);
+                return;
+            }
+            break;
+
+        case SET_ADDRESS:
+            if (request.bmRequestType == RECIPIENT_DEVICE) {
+                // Applied after the status stage
+                addressTemp = request.wValue & 0x7F;
+                transmit(nullptr, 0);
+                return;
+            }
+            break;
+
+        case GET_DESCRIPTOR:
+            if (direction && (recipient == RECIPIENT_DEVICE
+                              || recipient == RECIPIENT_INTERFACE)) {
+                // From interfaces for class descriptors, e.g. HID
+                onGetDescriptor(request);
+                return;
+            }
+            break;
+
+        case GET_CONFIGURATION:
+            if (request.bmRequestType == (0x80 | RECIPIENT_DEVICE)) {
+                requestData[0] = configuration;
+                transmit(requestData, std::min(1, (int)request.wLength));
+                return;
+            }
+            break;
+
+        case SET_CONFIGURATION:
+            // Devices of this driver have a single configuration
+            if (request.bmRequestType == RECIPIENT_DEVICE
+                    && request.wValue <= 1) {
+                configuration = request.wValue;
+                USB::get().onSetConfiguration(configuration);
+                transmit(nullptr, 0);
+                return;
+            }
+            break;
+
+        case GET_INTERFACE:
+            if (request.bmRequestType == (0x80 | RECIPIENT_INTERFACE)
+                    && configuration != 0) {
+                onInterfaceRequest(request);
+                return;
+            }
+            break;
+
+        case SET_INTERFACE:
+            if (request.bmRequestType == RECIPIENT_INTERFACE
+                    && configuration != 0) {
+                onInterfaceRequest(request);
+                return;
             }
+            break;
+
+        default:
+            // SET_DESCRIPTOR and SYNCH_FRAME are not supported
+            break;
+    }
+
+    stall();
+}
+
+
+void USB_ControlEndpoint::onGetStatus(Request& request)
+{
+    auto recipient = request.bmRequestType & 0x1F;
+    uint16_t status = 0;
+
+    if (recipient == RECIPIENT_DEVICE) {
+        // Bus powered, as in the configuration descriptors
+        status = remoteWakeupEnabled ? 0x02 : 0x00;
+    } else if (recipient == RECIPIENT_ENDPOINT) {
+        auto endpoint = getRequestEndpoint(request);
+
+        if (endpoint == nullptr) {
+            stall();
+            return;
         }
-    } else if (request->bRequest == 0x07 && request->bmRequestType == 0x00) {
-        // SET_DESCRIPTOR
-        transmit(nullptr, 0);
-    } else if (request->bRequest == 0x08 && request->bmRequestType == 0x80) {
-        // GET_CONFIGURATION
-        uint8_t configurationData[] = { 0 };
-        transmit(configurationData, 1);
-    } else if (request->bRequest == 0x09 && request->bmRequestType == 0x00) {
-        // SET_CONFIGURATION
-        auto& usb = USB::get();
-        usb.status = USB::Status::CONFIGURED;
-        transmit(nullptr, 0);
+
+        status = endpoint->isHalted(request.wIndex & 0x80) ? 0x01 : 0x00;
+    } else if (recipient != RECIPIENT_INTERFACE) {
+        stall();
+        return;
     }
+
+    requestData[0] = status & 0xFF;
+    requestData[1] = status >> 8;
+
+    transmit(requestData, std::min(2, (int)request.wLength));
 }
 
 
-void USB_ControlEndpoint::onDataStageIN()
+void USB_ControlEndpoint::onFeatureRequest(Request& request, bool state)
 {
-    auto rxLength = getReceivedLength();
+    auto recipient = request.bmRequestType & 0x1F;
 
-    if (rxLength == 0) {
-        dataStage = DataStage::NONE;
-        dataStageLength = 0;
+    if (recipient == RECIPIENT_DEVICE && request.wValue == DEVICE_REMOTE_WAKEUP) {
+        remoteWakeupEnabled = state;
+        transmit(nullptr, 0);
+        return;
     }
 
-    if (pendingDescriptor != nullptr) {
-        auto descriptorLength = pendingDescriptor->onGetLength();
-        auto remainingLength = descriptorLength - pendingDescriptorDataIndex;
+    if (recipient == RECIPIENT_ENDPOINT && request.wValue == ENDPOINT_HALT) {
+        auto endpoint = getRequestEndpoint(request);
 
-        auto transmitSize = std::min((int)txBufferSize, remainingLength);
+        if (endpoint != nullptr) {
+            auto in = (request.wIndex & 0x80) != 0;
 
-        uint8_t descriptorBuffer[transmitSize];
+            // Endpoint 0 clears a stall itself on the next setup packet,
+            // a class may keep its endpoints halted, but the request
+            // succeeds anyway
+            if (endpoint != this && (state || endpoint->onClearHalt(in))) {
+                endpoint->setHalt(in, state);
+            }
 
-        for (auto i = 0; i < transmitSize; i++) {
-            descriptorBuffer[i] = pendingDescriptor->onGetData(i + pendingDescriptorDataIndex);
+            transmit(nullptr, 0);
+            return;
         }
+    }
 
-        transmit(descriptorBuffer, transmitSize);
+    // Test mode and interface features are not supported
+    stall();
+}
 
-        pendingDescriptorDataIndex += transmitSize;
 
-        if (pendingDescriptorDataIndex >= descriptorLength) {
-            // Transfer complete
-            pendingDescriptor->onDeinit();
-            pendingDescriptor = nullptr;
-            pendingDescriptorDataIndex = 0;
+void USB_ControlEndpoint::onGetDescriptor(Request& request)
+{
+    auto type = request.wValue >> 8;
+    auto index = request.wValue & 0xFF;
+    auto recipient = request.bmRequestType & 0x1F;
+
+    // wIndex holds the language ID for strings from the device
+    auto interface = recipient == RECIPIENT_INTERFACE ? request.wIndex & 0xFF
+                                                      : -1;
+
+    USB_Descriptor* descriptor = nullptr;
+
+    if (descriptorCallbackFunc != nullptr) {
+        descriptor = descriptorCallbackFunc((USB_Descriptor::Type)type, index,
+                                            interface,
+                                            descriptorCallbackContext);
+    }
+
+    if (descriptor == nullptr) {
+        // E.g. DEVICE_QUALIFIER of a full-speed only device
+        stall();
+        return;
+    }
+
+    startDataStageIN(descriptor, request.wLength);
+}
+
+
+void USB_ControlEndpoint::onClassRequest(Request& request)
+{
+    void* context;
+    auto callback = getRequestCallback(request, context);
+
+    if (callback == nullptr || request.wLength > requestBufferLength) {
+        stall();
+        return;
+    }
+
+    if (dataStage == DataStage::OUT) {
+        // Callback is invoked when data stage is complete
+        pendingRequest = request;
+        requestDataIndex = 0;
+        return;
+    }
+
+    // Callback may select another buffer for the next request
+    auto buffer = requestBuffer;
+    auto bufferLength = requestBufferLength;
+
+    auto length = callback(request, buffer, context);
+
+    if (length < 0) {
+        stall();
+        return;
+    }
+
+    if (dataStage == DataStage::NONE) {
+        // Status stage
+        transmit(nullptr, 0);
+        return;
+    }
+
+    length = std::min(length, bufferLength);
+    responseDescriptor = USB_StaticDescriptor(buffer, length);
+
+    startDataStageIN(&responseDescriptor, request.wLength);
+}
+
+
+void USB_ControlEndpoint::onInterfaceRequest(Request& request)
+{
+    auto length = -1;
+
+    if (requestCallbackFunc != nullptr) {
+        length = requestCallbackFunc(request, requestData,
+                                     requestCallbackContext);
+    }
+
+    if (length < 0) {
+        if (request.bRequest == GET_INTERFACE) {
+            // Only alternate setting 0
+            requestData[0] = 0;
+            length = 1;
+        } else if (request.wValue == 0) {
+            length = 0;
+        } else {
+            stall();
+            return;
         }
     }
+
+    length = std::min(length, (int)request.wLength);
+
+    transmit(requestData, length);
 }
 
 
-void USB_ControlEndpoint::onDataStageOUT()
+USB_Endpoint* USB_ControlEndpoint::getRequestEndpoint(Request& request)
 {
+    auto number = request.wIndex & 0x0F;
+
+    if (number >= USB::NUM_ENDPOINTS) {
+        return nullptr;
+    }
+
+    return USB::get().endpoints[number];
 }
 
 
-void USB_ControlEndpoint::onStatusStage()
+USB_ControlEndpoint::RequestCallbackFunc
+USB_ControlEndpoint::getRequestCallback(Request& request, void*& context)
 {
-    if (addressTemp != 0) {
-        auto registers = USB_Registers::get();
-        registers->DADDR = addressTemp | (1 << USB_Registers::DADDR::EF);
+    if ((request.bmRequestType & 0x60) == 0x40
+            && vendorRequestCallbackFunc != nullptr) {
+        context = vendorRequestCallbackContext;
+        return vendorRequestCallbackFunc;
+    }
 
-        auto& usb = USB::get();
-        usb.status = USB::Status::ADDRESSED;
+    context = requestCallbackContext;
+    return requestCallbackFunc;
+}
 
-        addressTemp = 0;
+
+void USB_ControlEndpoint::startDataStageIN(USB_Descriptor* descriptor,
+                                           int requestLength)
+{
+    descriptor->onInit();
+
+    // Host may request less than the full descriptor
+    auto length = std::min(requestLength, (int)descriptor->onGetLength());
+
+    pendingDescriptor = descriptor;
+    pendingDescriptorLength = length;
+    pendingDescriptorDataIndex = 0;
+
+    // Host expects more data after a full packet unless wLength is reached
+    pendingZeroLengthPacket = length > 0 && length < requestLength
+                              && length % getMaxPacketSize() == 0;
+
+    transmitNextPacket();
+}
+
+
+void USB_ControlEndpoint::transmitNextPacket()
+{
+    if (pendingDescriptor == nullptr) {
+        if (pendingZeroLengthPacket) {
+            pendingZeroLengthPacket = false;
+            transmit(nullptr, 0);
+        }
+
+        return;
     }
+
+    auto remainingLength = pendingDescriptorLength - pendingDescriptorDataIndex;
+    auto transmitSize = std::min(getMaxPacketSize(), remainingLength);
+
+    uint8_t descriptorBuffer[MAX_PACKET_SIZE];
+    pendingDescriptor->getData(pendingDescriptorDataIndex, descriptorBuffer,
+                               transmitSize);
+
+    transmit(descriptorBuffer, transmitSize);
+
+    pendingDescriptorDataIndex += transmitSize;
+
+    if (pendingDescriptorDataIndex >= pendingDescriptorLength) {
+        // Transfer complete
+        pendingDescriptor->onDeinit();
+        pendingDescriptor = nullptr;
+        pendingDescriptorLength = 0;
+        pendingDescriptorDataIndex = 0;
+    }
+}
+
+
+void USB_ControlEndpoint::stall()
+{
+    dataStage = DataStage::NONE;
+    dataStageLength = 0;
+
+    // Both directions, cleared by the peripheral on the next setup packet
+    setTransmissionStatus(Status::STALL);
+    setReceptionStatus(Status::STALL);
 }
 
 
@@ -14,8 +14,10 @@
 // Local includes
 #include "USB_Endpoint.h"
 #include "USB_Descriptor.h"
+#include "USB_StaticDescriptor.h"
 
 // System libraries
+#include <algorithm>
 #include <cstdint>
 
 
@@ -38,10 +40,41 @@ class USB_ControlEndpoint : public USB_Endpoint
         USB_ControlEndpoint& operator = (USB_ControlEndpoint&&) = delete;
 
         /**
-         * Descriptor callback function type
+         * Setup packet
+         */
+        struct Request
+        {
+            uint8_t bmRequestType;
+            uint8_t bRequest;
+            uint16_t wValue;
+            uint16_t wIndex;
+            uint16_t wLength;
+        } __attribute__((packed));
+
+        /**
+         * Length of the internal data stage buffer for class and vendor
+         * requests, larger data stages need setRequestBuffer()
+         */
+        static const int MAX_REQUEST_DATA_LENGTH = 64;
+
+        /**
+         * Descriptor callback function type, called with type, index and
+         * the interface number for class descriptors requested from an
+         * interface, -1 for requests to the device
          */
         typedef USB_Descriptor*(*DescriptorCallbackFunc)(USB_Descriptor::Type,
-                int, void*);
+                int, int, void*);
+
+        /**
+         * Request callback function type for class and vendor requests
+         *
+         * For device-to-host requests, the callback fills the data buffer
+         * and returns the number of bytes to send, which may span several
+         * packets. For host-to-device requests, it is called after the
+         * complete data stage with the received data and returns 0. A
+         * negative return value stalls the request.
+         */
+        typedef int(*RequestCallbackFunc)(Request&, uint8_t[], void*);
 
         /**
          * Sets a function to be called to get descriptors
@@ -55,6 +88,75 @@ class USB_ControlEndpoint : public USB_Endpoint
             descriptorCallbackContext = context;
         }
 
+        /**
+         * Sets a function to be called on class and vendor requests
+         *
+         * @param func          Callback function
+         * @param context       Pointer passed to callback
+         */
+        void setRequestCallback(RequestCallbackFunc func,
+                                void* context=nullptr)
+        {
+            requestCallbackFunc = func;
+            requestCallbackContext = context;
+        }
+
+        /**
+         * Sets a function to be called on vendor requests, e.g. for
+         * configuration transfers next to a class. Without it, vendor
+         * requests are passed to the request callback.
+         *
+         * @param func          Callback function
+         * @param context       Pointer passed to callback
+         */
+        void setVendorRequestCallback(RequestCallbackFunc func,
+                                      void* context=nullptr)
+        {
+            vendorRequestCallbackFunc = func;
+            vendorRequestCallbackContext = context;
+        }
+
+        /**
+         * Set the data stage buffer of class and vendor requests, which
+         * limits their wLength. Requests with longer data stages are
+         * stalled. May be called from a request callback, which still
+         * uses the previous buffer, to select it for the next request.
+         *
+         * @param buffer        Buffer of at least MAX_REQUEST_DATA_LENGTH
+         *                      bytes or nullptr for the internal buffer
+         * @param length        Length of buffer in bytes
+         */
+        void setRequestBuffer(uint8_t buffer[], int length)
+        {
+            if (buffer == nullptr || length < MAX_REQUEST_DATA_LENGTH) {
+                buffer = requestData;
+                length = MAX_REQUEST_DATA_LENGTH;
+            }
+
+            requestBuffer = buffer;
+            requestBufferLength = length;
+        }
+
+        /**
+         * Return configuration value set by the host
+         *
+         * @return              Configuration value, 0 if not configured
+         */
+        int getConfiguration()
+        {
+            return configuration;
+        }
+
+        /**
+         * Return if the host has enabled remote wakeup
+         *
+         * @return              True if enabled
+         */
+        bool isRemoteWakeupEnabled()
+        {
+            return remoteWakeupEnabled;
+        }
+
     protected:
         /**
          * Called from USB::irq() on reset
@@ -77,13 +179,42 @@ class USB_ControlEndpoint : public USB_Endpoint
         virtual void onTransmissionComplete() override;
 
     private:
+        static const int MAX_PACKET_SIZE = 64;
+
+        /**
+         * Standard requests
+         */
+        static const uint8_t GET_STATUS = 0x00;
+        static const uint8_t CLEAR_FEATURE = 0x01;
+        static const uint8_t SET_FEATURE = 0x03;
+        static const uint8_t SET_ADDRESS = 0x05;
+        static const uint8_t GET_DESCRIPTOR = 0x06;
+        static const uint8_t SET_DESCRIPTOR = 0x07;
+        static const uint8_t GET_CONFIGURATION = 0x08;
+        static const uint8_t SET_CONFIGURATION = 0x09;
+        static const uint8_t GET_INTERFACE = 0x0A;
+        static const uint8_t SET_INTERFACE = 0x0B;
+
+        /**
+         * Recipients in bmRequestType
+         */
+        static const uint8_t RECIPIENT_DEVICE = 0x00;
+        static const uint8_t RECIPIENT_INTERFACE = 0x01;
+        static const uint8_t RECIPIENT_ENDPOINT = 0x02;
+
+        /**
+         * Feature selectors
+         */
+        static const uint16_t ENDPOINT_HALT = 0;
+        static const uint16_t DEVICE_REMOTE_WAKEUP = 1;
+
         /**
          * Setup stage, called from onReceptionCompleted()
          */
         void onSetupStage();
 
         /**
-         * Data stage IN, called from onReceptionCompleted()
+         * Data stage IN, called from onTransmissionComplete()
          */
         void onDataStageIN();
 
@@ -97,6 +228,97 @@ class USB_ControlEndpoint : public USB_Endpoint
          */
         void onStatusStage();
 
+        /**
+         * Return max. packet size, limited by transmit buffer size
+         */
+        int getMaxPacketSize()
+        {
+            return std::min((int)txBufferSize, MAX_PACKET_SIZE);
+        }
+
+        /**
+         * Handle standard request, called from onSetupStage()
+         *
+         * @param request       Reference to setup packet
+         */
+        void onStandardRequest(Request& request);
+
+        /**
+         * Handle GET_STATUS
+         *
+         * @param request       Reference to setup packet
+         */
+        void onGetStatus(Request& request);
+
+        /**
+         * Handle CLEAR_FEATURE and SET_FEATURE
+         *
+         * @param request       Reference to setup packet
+         * @param state         True for SET_FEATURE
+         */
+        void onFeatureRequest(Request& request, bool state);
+
+        /**
+         * Handle GET_DESCRIPTOR
+         *
+         * @param request       Reference to setup packet
+         */
+        void onGetDescriptor(Request& request);
+
+        /**
+         * Handle class or vendor request, called from onSetupStage()
+         *
+         * @param request       Reference to setup packet
+         */
+        void onClassRequest(Request& request);
+
+        /**
+         * Return endpoint addressed by wIndex of a request
+         *
+         * @param request       Reference to setup packet
+         * @return              Pointer to endpoint or nullptr
+         */
+        USB_Endpoint* getRequestEndpoint(Request& request);
+
+        /**
+         * Return callback for a class or vendor request
+         *
+         * @param request       Reference to setup packet
+         * @param context       Set to context of callback
+         * @return              Callback function or nullptr
+         */
+        RequestCallbackFunc getRequestCallback(Request& request,
+                                               void*& context);
+
+        /**
+         * Start data stage IN, sends up to wLength bytes of a descriptor
+         * packet by packet and ends short transfers with a short or
+         * zero-length packet
+         *
+         * @param descriptor    Pointer to descriptor
+         * @param requestLength wLength of request
+         */
+        void startDataStageIN(USB_Descriptor* descriptor, int requestLength);
+
+        /**
+         * Send next packet of data stage IN
+         */
+        void transmitNextPacket();
+
+        /**
+         * Handle SET_INTERFACE or GET_INTERFACE by passing it to the
+         * request callback, interfaces without alternate settings are
+         * handled if the callback doesn't
+         *
+         * @param request       Reference to setup packet
+         */
+        void onInterfaceRequest(Request& request);
+
+        /**
+         * Stall data or status stage of current request
+         */
+        void stall();
+
         /**
          * Data stage
          */
@@ -121,11 +343,45 @@ class USB_ControlEndpoint : public USB_Endpoint
         DescriptorCallbackFunc descriptorCallbackFunc = nullptr;
         void* descriptorCallbackContext = nullptr;
 
+        /**
+         * Callback functions for class and vendor requests
+         */
+        RequestCallbackFunc requestCallbackFunc = nullptr;
+        void* requestCallbackContext = nullptr;
+        RequestCallbackFunc vendorRequestCallbackFunc = nullptr;
+        void* vendorRequestCallbackContext = nullptr;
+
+        /**
+         * Class or vendor request waiting for its OUT data stage
+         */
+        Request pendingRequest;
+        int requestDataIndex = 0;
+        uint8_t requestData[MAX_REQUEST_DATA_LENGTH];
+
+        /**
+         * Data stage buffer of class and vendor requests
+         */
+        uint8_t* requestBuffer = requestData;
+        int requestBufferLength = MAX_REQUEST_DATA_LENGTH;
+
+        /**
+         * Response of class or vendor request, sent like a descriptor
+         */
+        USB_StaticDescriptor responseDescriptor{nullptr, 0};
+
         /**
          * Descriptor in transmission
          */
         USB_Descriptor* pendingDescriptor = nullptr;
+        int pendingDescriptorLength = 0;
         int pendingDescriptorDataIndex = 0;
+        bool pendingZeroLengthPacket = false;
+
+        /**
+         * State set by standard requests
+         */
+        uint8_t configuration = 0;
+        bool remoteWakeupEnabled = false;
 };
 
 }   // namespace mcu
@@ -0,0 +1,428 @@
+/**
+ * @file        USB_DFU.cpp
+ *
+ * Device firmware upgrade class for USB on STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "USB_DFU.h"
+
+// Local includes
+#include "USB.h"
+
+// System libraries
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+USB_DFU::~USB_DFU()
+{
+    deinit();
+}
+
+
+bool USB_DFU::init(Config& config)
+{
+    deinit();
+
+    if (!usbDevice.addFunction(this)) {
+        return false;
+    }
+
+    // Blocks are programmed in double words
+    auto transferSize = std::min(std::max(config.transferSize, 64), 4096);
+
+    this->config = config;
+    this->config.transferSize = transferSize & ~7;
+
+    allocateBuffers();
+    buildFunctionalDescriptor();
+
+    state = State::IDLE;
+    status = Status::OK;
+    writeStatus = Status::OK;
+    nextOffset = 0;
+
+    selectReceptionBuffer();
+
+    return true;
+}
+
+
+void USB_DFU::deinit()
+{
+    if (buffers[0].data == nullptr) {
+        return;
+    }
+
+    usbDevice.removeFunction(this);
+    USB::get().setRequestBuffer(nullptr, 0);
+
+    deallocateBuffers();
+}
+
+
+void USB_DFU::process()
+{
+    auto& buffer = buffers[writeIndex];
+
+    if (buffer.data == nullptr || !buffer.full) {
+        return;
+    }
+
+    // Blocks following an error are dropped until the host clears it
+    if (writeStatus == Status::OK) {
+        auto result = writeBlock(buffer);
+
+        if (result != Status::OK) {
+            writeStatus = result;
+        }
+    }
+
+    writeIndex = getNextBuffer(writeIndex);
+
+    // Block must be written before the ISR can reuse the buffer
+    std::atomic_signal_fence(std::memory_order_release);
+    buffer.full = false;
+}
+
+
+bool USB_DFU::isBusy()
+{
+    for (auto& buffer : buffers) {
+        if (buffer.full) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+void USB_DFU::allocateBuffers()
+{
+    deallocateBuffers();
+
+    for (auto& buffer : buffers) {
+        buffer.data = new uint32_t[config.transferSize / 4];
+    }
+
+    receptionIndex = 0;
+    writeIndex = 0;
+}
+
+
+void USB_DFU::deallocateBuffers()
+{
+    for (auto& buffer : buffers) {
+        if (buffer.data != nullptr) {
+            delete[] buffer.data;
+        }
+
+        buffer = Buffer();
+    }
+}
+
+
+void USB_DFU::buildFunctionalDescriptor()
+{
+    auto transferSize = config.transferSize;
+
+    const uint8_t descriptor[FUNCTIONAL_DESCRIPTOR_LENGTH] = {
+        FUNCTIONAL_DESCRIPTOR_LENGTH,
+        (uint8_t)USB_Descriptor::Type::DFU_FUNCTIONAL,
+        0x07,                                   // Download, upload,
+                                                // manifestation tolerant
+        0xE8, 0x03,                             // Detach timeout 1000 ms
+        (uint8_t)(transferSize & 0xFF),
+        (uint8_t)(transferSize >> 8),
+        0x10, 0x01                              // DFU 1.1
+    };
+
+    memcpy(functionalDescriptorData, descriptor, sizeof(descriptor));
+}
+
+
+void USB_DFU::onGetDescriptorData(uint8_t data[])
+{
+    const uint8_t interfaceDescriptor[] = {
+        9, (uint8_t)USB_Descriptor::Type::INTERFACE,
+        (uint8_t)firstInterface,                // Interface number
+        0,                                      // Alternate setting
+        0,                                      // Number of endpoints
+        0xFE,                                   // Class application specific
+        0x01,                                   // Subclass DFU
+        0x02,                                   // Protocol DFU mode
+        0                                       // Interface string
+    };
+
+    static_assert(sizeof(interfaceDescriptor) + FUNCTIONAL_DESCRIPTOR_LENGTH
+                  == DESCRIPTOR_LENGTH, "Descriptor length mismatch");
+
+    // Functional descriptor follows the interface
+    memcpy(data, interfaceDescriptor, sizeof(interfaceDescriptor));
+    memcpy(data + sizeof(interfaceDescriptor), functionalDescriptorData,
+           FUNCTIONAL_DESCRIPTOR_LENGTH);
+}
+
+
+USB_Descriptor* USB_DFU::onGetClassDescriptor(USB_Descriptor::Type type,
+                                              int index, int interface)
+{
+    (void)index;
+    (void)interface;
+
+    if (type != USB_Descriptor::Type::DFU_FUNCTIONAL) {
+        return nullptr;
+    }
+
+    return &functionalDescriptor;
+}
+
+
+int USB_DFU::onRequest(USB_ControlEndpoint::Request& request, uint8_t data[])
+{
+    // Class requests to the interface only
+    if ((request.bmRequestType & 0x7F) != 0x21
+            || (request.wIndex & 0xFF) != firstInterface) {
+        return -1;
+    }
+
+    switch (request.bRequest) {
+        case DOWNLOAD:
+            return onDownload(request, data);
+
+        case UPLOAD:
+            return onUpload(request, data);
+
+        case GET_STATUS:
+            return onGetStatus(data);
+
+        case CLEAR_STATUS:
+            if (state != State::ERROR) {
+                return fail(Status::ERR_STALLEDPKT);
+            }
+
+            state = State::IDLE;
+            status = Status::OK;
+            writeStatus = Status::OK;
+            return 0;
+
+        case GET_STATE:
+            data[0] = (uint8_t)state;
+            return 1;
+
+        case ABORT:
+            if (state != State::IDLE && state != State::DOWNLOAD_SYNC
+                    && state != State::DOWNLOAD_IDLE
+                    && state != State::MANIFEST_SYNC
+                    && state != State::UPLOAD_IDLE) {
+                return fail(Status::ERR_STALLEDPKT);
+            }
+
+            // Received blocks are still written
+            state = State::IDLE;
+            return 0;
+
+        default:
+            // DETACH is only valid in run-time mode
+            return fail(Status::ERR_STALLEDPKT);
+    }
+}
+
+
+int USB_DFU::onDownload(USB_ControlEndpoint::Request& request, uint8_t data[])
+{
+    if (request.wLength == 0) {
+        // End of download, manifestation is completed by GETSTATUS
+        if (state != State::DOWNLOAD_IDLE) {
+            return fail(Status::ERR_STALLEDPKT);
+        }
+
+        state = State::MANIFEST_SYNC;
+        return 0;
+    }
+
+    if (state != State::IDLE && state != State::DOWNLOAD_IDLE) {
+        return fail(Status::ERR_STALLEDPKT);
+    }
+
+    auto& buffer = buffers[receptionIndex];
+
+    // Host didn't wait for a free buffer, data is in the internal one
+    if (buffer.full || data != (uint8_t*)buffer.data) {
+        return fail(Status::ERR_UNKNOWN);
+    }
+
+    // A new download starts from IDLE or with block 0 after a bus reset
+    auto offset = (uint32_t)request.wValue * config.transferSize;
+    auto first = state == State::IDLE || request.wValue == 0;
+
+    if (offset + request.wLength > config.size
+            || (!first && offset < nextOffset)) {
+        return fail(Status::ERR_ADDRESS);
+    }
+
+    buffer.address = config.startAddress + offset;
+    buffer.length = request.wLength;
+    buffer.first = first;
+
+    std::atomic_signal_fence(std::memory_order_release);
+    buffer.full = true;
+
+    nextOffset = offset + request.wLength;
+    receptionIndex = getNextBuffer(receptionIndex);
+
+    // The full buffer must not receive the status response
+    selectReceptionBuffer();
+
+    state = State::DOWNLOAD_SYNC;
+
+    return 0;
+}
+
+
+int USB_DFU::onUpload(USB_ControlEndpoint::Request& request, uint8_t data[])
+{
+    if (state != State::IDLE && state != State::UPLOAD_IDLE) {
+        return fail(Status::ERR_STALLEDPKT);
+    }
+
+    auto offset = (uint32_t)request.wValue * config.transferSize;
+    uint32_t length = 0;
+
+    if (offset < config.size) {
+        length = std::min((uint32_t)request.wLength, config.size - offset);
+    }
+
+    memcpy(data, (void*)(config.startAddress + offset), length);
+
+    // Short block ends the upload
+    state = length < request.wLength ? State::IDLE : State::UPLOAD_IDLE;
+
+    return length;
+}
+
+
+int USB_DFU::onGetStatus(uint8_t data[])
+{
+    uint32_t pollTimeout = 0;
+
+    if (writeStatus != Status::OK && state != State::ERROR) {
+        status = writeStatus;
+        state = State::ERROR;
+    }
+
+    switch (state) {
+        case State::DOWNLOAD_SYNC:
+        case State::DOWNLOAD_BUSY:
+            // Next block can be sent while the previous one is written
+            if (!buffers[receptionIndex].full) {
+                selectReceptionBuffer();
+                state = State::DOWNLOAD_IDLE;
+            } else {
+                pollTimeout = BUSY_POLL_TIMEOUT;
+                state = State::DOWNLOAD_BUSY;
+            }
+            break;
+
+        case State::MANIFEST_SYNC:
+        case State::MANIFEST:
+            if (isBusy()) {
+                pollTimeout = BUSY_POLL_TIMEOUT;
+                state = State::MANIFEST;
+            } else {
+                selectReceptionBuffer();
+                state = State::IDLE;
+
+                if (config.manifestCallback != nullptr) {
+                    config.manifestCallback(this, config.callbackContext);
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    data[0] = (uint8_t)status;
+    data[1] = pollTimeout & 0xFF;
+    data[2] = (pollTimeout >> 8) & 0xFF;
+    data[3] = (pollTimeout >> 16) & 0xFF;
+    data[4] = (uint8_t)state;
+    data[5] = 0;                            // Status string
+
+    return 6;
+}
+
+
+void USB_DFU::selectReceptionBuffer()
+{
+    auto& buffer = buffers[receptionIndex];
+    auto& usb = USB::get();
+
+    if (buffer.data != nullptr && !buffer.full) {
+        usb.setRequestBuffer((uint8_t*)buffer.data, config.transferSize);
+    } else {
+        usb.setRequestBuffer(nullptr, 0);
+    }
+}
+
+
+USB_DFU::Status USB_DFU::writeBlock(Buffer& buffer)
+{
+    auto data = (uint8_t*)buffer.data;
+    auto address = buffer.address;
+    auto endAddress = address + buffer.length;
+
+    if (buffer.first) {
+        erasedEndAddress = 0;
+    }
+
+    // Blocks arrive in order, so each page is erased once
+    for (auto page = address & ~(Flash::PAGE_SIZE - 1); page < endAddress;
+            page += Flash::PAGE_SIZE) {
+        if (page >= erasedEndAddress) {
+            flash.erasePage(page);
+            erasedEndAddress = page + Flash::PAGE_SIZE;
+        }
+    }
+
+    flash.program(address, data, buffer.length);
+
+    if (memcmp((void*)address, data, buffer.length) != 0) {
+        return Status::ERR_VERIFY;
+    }
+
+    return Status::OK;
+}
+
+
+int USB_DFU::fail(Status status)
+{
+    this->status = status;
+    state = State::ERROR;
+
+    return -1;
+}
+
+
+}   // namespace mcu
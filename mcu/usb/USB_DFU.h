@@ -0,0 +1,343 @@
+/**
+ * @file        USB_DFU.h
+ *
+ * Device firmware upgrade class for USB on STM32L4xx
+ *
+ * Implements DFU 1.1 in DFU mode, e.g. for a bootloader, so firmware can
+ * be written to the embedded flash with standard host tools like
+ * dfu-util. Block n of a download is written to startAddress + n *
+ * transferSize. Pages are erased when the first block reaches them.
+ *
+ * Blocks are received by control transfers directly into one of two
+ * buffers and written by process(), which must be called frequently from
+ * the main loop. While a block is erased and programmed, the host is told
+ * to continue and sends the next block into the other buffer, so the
+ * transfer only waits for the flash when both buffers are in use. Write
+ * errors are reported with the next status request.
+ *
+ * Usage: call USB::init(), then init() of the USB_Device, then init() of
+ * this class, then USB::connect().
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "USB_ControlEndpoint.h"
+#include "USB_Descriptor.h"
+#include "USB_Device.h"
+#include "USB_Function.h"
+#include "USB_StaticDescriptor.h"
+
+// This component
+#include "../flash/Flash.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class USB_DFU : public USB_Function
+{
+    public:
+        /**
+         * Number of block buffers
+         */
+        static const int BUFFER_COUNT = 2;
+
+        /**
+         * Device states as reported to the host
+         */
+        enum class State : uint8_t
+        {
+            APP_IDLE                = 0,
+            APP_DETACH              = 1,
+            IDLE                    = 2,
+            DOWNLOAD_SYNC           = 3,
+            DOWNLOAD_BUSY           = 4,
+            DOWNLOAD_IDLE           = 5,
+            MANIFEST_SYNC           = 6,
+            MANIFEST                = 7,
+            MANIFEST_WAIT_RESET     = 8,
+            UPLOAD_IDLE             = 9,
+            ERROR                   = 10
+        };
+
+        /**
+         * Status codes as reported to the host
+         */
+        enum class Status : uint8_t
+        {
+            OK                      = 0x00,
+            ERR_TARGET              = 0x01,
+            ERR_FILE                = 0x02,
+            ERR_WRITE               = 0x03,
+            ERR_ERASE               = 0x04,
+            ERR_CHECK_ERASED        = 0x05,
+            ERR_PROG                = 0x06,
+            ERR_VERIFY              = 0x07,
+            ERR_ADDRESS             = 0x08,
+            ERR_NOTDONE             = 0x09,
+            ERR_FIRMWARE            = 0x0A,
+            ERR_VENDOR              = 0x0B,
+            ERR_USBR                = 0x0C,
+            ERR_POR                 = 0x0D,
+            ERR_UNKNOWN             = 0x0E,
+            ERR_STALLEDPKT          = 0x0F
+        };
+
+        /**
+         * Callback function type
+         */
+        typedef void (*CallbackFunc)(USB_DFU*, void*);
+
+        /**
+         * Configuration settings
+         */
+        struct Config
+        {
+            uint32_t startAddress = 0x08008000; // Page aligned
+            uint32_t size = 0x78000;            // Writable bytes
+            int transferSize = Flash::PAGE_SIZE;    // Block size, 64..4096
+            CallbackFunc manifestCallback = nullptr;    // Download complete
+            void* callbackContext = nullptr;
+        };
+
+        /**
+         * Constructor
+         *
+         * @param usbDevice     Reference to device
+         */
+        USB_DFU(USB_Device& usbDevice) : USB_Function(usbDevice) {}
+
+        /**
+         * Destructor
+         */
+        ~USB_DFU();
+
+        /**
+         * Disallow copy
+         */
+        USB_DFU(const USB_DFU&) = delete;
+        USB_DFU& operator = (const USB_DFU&) = delete;
+        USB_DFU& operator = (USB_DFU&&) = delete;
+
+        /**
+         * Init with config settings, adds the function to the device,
+         * allocates block buffers and registers the request buffer at the
+         * USB peripheral
+         *
+         * @param config        Reference to configuration struct
+         * @return              False if the device has no room for the
+         *                      function
+         */
+        bool init(Config& config);
+
+        /**
+         * Shutdown, blocks not yet written are dropped
+         */
+        void deinit();
+
+        /**
+         * Erase and program received blocks, call from main loop
+         */
+        void process();
+
+        /**
+         * Return state
+         *
+         * @return              State according to enum class
+         */
+        State getState()
+        {
+            return state;
+        }
+
+        /**
+         * Return status
+         *
+         * @return              Status according to enum class
+         */
+        Status getStatus()
+        {
+            return status;
+        }
+
+        /**
+         * Return if received blocks are waiting to be written
+         *
+         * @return              True if busy
+         */
+        bool isBusy();
+
+    protected:
+        /**
+         * Class requests
+         */
+        static const uint8_t DETACH = 0x00;
+        static const uint8_t DOWNLOAD = 0x01;
+        static const uint8_t UPLOAD = 0x02;
+        static const uint8_t GET_STATUS = 0x03;
+        static const uint8_t CLEAR_STATUS = 0x04;
+        static const uint8_t GET_STATE = 0x05;
+        static const uint8_t ABORT = 0x06;
+
+        /**
+         * Poll timeout reported while both buffers are in use, in ms
+         */
+        static const uint32_t BUSY_POLL_TIMEOUT = 5;
+
+        /**
+         * Descriptor lengths
+         */
+        static const int DESCRIPTOR_LENGTH = 18;
+        static const int FUNCTIONAL_DESCRIPTOR_LENGTH = 9;
+
+        /**
+         * Block buffer, word aligned, passed from the USB interrupt to
+         * process() by setting full and back by clearing it
+         */
+        struct Buffer
+        {
+            uint32_t* data = nullptr;
+            volatile bool full = false;
+            uint32_t address = 0;
+            int length = 0;
+            bool first = false;         // First block of a download
+        };
+
+        /**
+         * Allocate block buffers on heap
+         */
+        void allocateBuffers();
+
+        /**
+         * Deallocate block buffers on heap
+         */
+        void deallocateBuffers();
+
+        /**
+         * Build functional descriptor from config
+         */
+        void buildFunctionalDescriptor();
+
+        /**
+         * Return number of interfaces
+         */
+        virtual int onGetInterfaceCount() override
+        {
+            return 1;
+        }
+
+        /**
+         * Return length of interface descriptors
+         */
+        virtual int onGetDescriptorLength() override
+        {
+            return DESCRIPTOR_LENGTH;
+        }
+
+        /**
+         * Write interface descriptors
+         */
+        virtual void onGetDescriptorData(uint8_t data[]) override;
+
+        /**
+         * Return functional descriptor
+         */
+        virtual USB_Descriptor* onGetClassDescriptor(USB_Descriptor::Type type,
+                                                     int index,
+                                                     int interface) override;
+
+        /**
+         * Handle class request
+         */
+        virtual int onRequest(USB_ControlEndpoint::Request& request,
+                              uint8_t data[]) override;
+
+        /**
+         * Handle DNLOAD after its data stage
+         */
+        int onDownload(USB_ControlEndpoint::Request& request, uint8_t data[]);
+
+        /**
+         * Handle UPLOAD
+         */
+        int onUpload(USB_ControlEndpoint::Request& request, uint8_t data[]);
+
+        /**
+         * Handle GETSTATUS, advances the download state
+         */
+        int onGetStatus(uint8_t data[]);
+
+        /**
+         * Set next buffer as request buffer if it is free, the internal
+         * buffer of the control endpoint otherwise
+         */
+        void selectReceptionBuffer();
+
+        /**
+         * Erase pages as needed, program and verify a block
+         *
+         * @param buffer        Reference to buffer
+         * @return              Status according to enum class
+         */
+        Status writeBlock(Buffer& buffer);
+
+        /**
+         * Enter error state and stall request
+         *
+         * @param status        Status according to enum class
+         * @return              -1
+         */
+        int fail(Status status);
+
+        /**
+         * Return index of next buffer
+         */
+        static int getNextBuffer(int index)
+        {
+            return (index + 1) % BUFFER_COUNT;
+        }
+
+        /**
+         * Configuration
+         */
+        Config config;
+
+        /**
+         * Functional descriptor, also a part of the configuration
+         */
+        uint8_t functionalDescriptorData[FUNCTIONAL_DESCRIPTOR_LENGTH];
+        USB_StaticDescriptor functionalDescriptor{functionalDescriptorData};
+
+        /**
+         * Block buffers
+         */
+        Buffer buffers[BUFFER_COUNT];
+        int receptionIndex = 0;             // Buffer used by USB
+        int writeIndex = 0;                 // Buffer used by process()
+
+        /**
+         * Download state
+         */
+        volatile State state = State::IDLE;
+        volatile Status status = Status::OK;
+        volatile Status writeStatus = Status::OK;   // Set by process()
+        uint32_t nextOffset = 0;            // Lowest offset of next block
+
+        /**
+         * Flash state, only used by process()
+         */
+        Flash flash;
+        uint32_t erasedEndAddress = 0;
+};
+
+
+}   // namespace mcu
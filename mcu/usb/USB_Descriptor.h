@@ -33,7 +33,12 @@ class USB_Descriptor
             ENDPOINT                    = 5,
             DEVICE_QUALIFIER            = 6,
             OTHER_SPEED_CONFIGURATION   = 7,
-            NTERFACE_POWER              = 8
+            NTERFACE_POWER              = 8,
+
+            // Class-specific, requested from interfaces
+            HID                         = 0x21,
+            HID_REPORT                  = 0x22,
+            DFU_FUNCTIONAL              = 0x21
         };
 
         /**
@@ -58,6 +63,23 @@ class USB_Descriptor
          * @return              Data byte
          */
         virtual uint8_t onGetData(int index) = 0;
+
+        /**
+         * Copy a range of data bytes
+         *
+         * The default implementation calls onGetData() for each byte,
+         * descriptors held in memory should override it with a block copy.
+         *
+         * @param offset        Index of first byte 0..getLength()-1
+         * @param buffer        Buffer to be filled with data
+         * @param length        Number of bytes
+         */
+        virtual void getData(int offset, uint8_t buffer[], int length)
+        {
+            for (auto i = 0; i < length; i++) {
+                buffer[i] = onGetData(offset + i);
+            }
+        }
 };
 
 
@@ -0,0 +1,332 @@
+/**
+ * @file        USB_Device.cpp
+ *
+ * Device with one or more class functions for USB on STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "USB_Device.h"
+
+// Local includes
+#include "USB.h"
+
+// System libraries
+#include <cstring>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+USB_Device::~USB_Device()
+{
+    deinit();
+}
+
+
+void USB_Device::init(Config& config)
+{
+    deinit();
+
+    this->config = config;
+
+    auto& usb = USB::get();
+
+    usb.setDescriptorCallback(descriptorCallback, this);
+    usb.setRequestCallback(requestCallback, this);
+
+    initialised = true;
+}
+
+
+void USB_Device::deinit()
+{
+    if (!initialised) {
+        return;
+    }
+
+    auto& usb = USB::get();
+
+    usb.setDescriptorCallback(nullptr);
+    usb.setRequestCallback(nullptr);
+
+    initialised = false;
+}
+
+
+bool USB_Device::addFunction(USB_Function* function)
+{
+    if (function == nullptr || functionCount >= MAX_FUNCTIONS) {
+        return false;
+    }
+
+    functions[functionCount] = function;
+
+    if (getConfigurationLength(functionCount + 1)
+            > MAX_CONFIGURATION_DESCRIPTOR_LENGTH) {
+        functions[functionCount] = nullptr;
+        return false;
+    }
+
+    functionCount++;
+    numberInterfaces();
+
+    return true;
+}
+
+
+void USB_Device::removeFunction(USB_Function* function)
+{
+    auto index = 0;
+
+    while (index < functionCount && functions[index] != function) {
+        index++;
+    }
+
+    if (index == functionCount) {
+        return;
+    }
+
+    for (; index < functionCount - 1; index++) {
+        functions[index] = functions[index + 1];
+    }
+
+    functions[--functionCount] = nullptr;
+    function->firstInterface = -1;
+
+    numberInterfaces();
+}
+
+
+USB_Descriptor* USB_Device::descriptorCallback(USB_Descriptor::Type type,
+                                               int index, int interface,
+                                               void* context)
+{
+    static const uint8_t languageIdDescriptorData[] = {
+        4, (uint8_t)USB_Descriptor::Type::STRING, 0x09, 0x04     // English (US)
+    };
+
+    static USB_StaticDescriptor languageIdDescriptor(languageIdDescriptorData);
+
+    auto device = (USB_Device*)context;
+
+    if (interface >= 0) {
+        // Class-specific descriptors, e.g. HID report
+        auto function = device->getFunction(interface);
+
+        if (function == nullptr) {
+            return nullptr;
+        }
+
+        return function->onGetClassDescriptor(type, index, interface);
+    }
+
+    switch (type) {
+        case USB_Descriptor::Type::DEVICE:
+            device->buildDeviceDescriptor();
+            return &device->deviceDescriptor;
+
+        case USB_Descriptor::Type::CONFIGURATION:
+            device->buildConfigurationDescriptor();
+            return &device->configurationDescriptor;
+
+        case USB_Descriptor::Type::STRING:
+            if (index == 0) {
+                return &languageIdDescriptor;
+            } else if (index == 1) {
+                device->stringDescriptor.text = device->config.manufacturer;
+            } else if (index == 2) {
+                device->stringDescriptor.text = device->config.product;
+            } else if (index == 3) {
+                device->stringDescriptor.text = device->config.serialNumber;
+            } else {
+                return nullptr;
+            }
+
+            if (device->stringDescriptor.text == nullptr) {
+                return nullptr;
+            }
+
+            return &device->stringDescriptor;
+
+        default:
+            return nullptr;
+    }
+}
+
+
+int USB_Device::requestCallback(USB_ControlEndpoint::Request& request,
+                                uint8_t data[], void* context)
+{
+    auto device = (USB_Device*)context;
+
+    // Requests to interfaces only, vendor requests to the device are
+    // handled by the vendor request callback
+    if ((request.bmRequestType & 0x1F) != 0x01) {
+        return -1;
+    }
+
+    auto function = device->getFunction(request.wIndex & 0xFF);
+
+    if (function == nullptr) {
+        return -1;
+    }
+
+    return function->onRequest(request, data);
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+int USB_Device::getConfigurationLength(int functionCount)
+{
+    auto length = CONFIGURATION_HEADER_LENGTH;
+
+    for (auto i = 0; i < functionCount; i++) {
+        if (functions[i]->onGetInterfaceCount() > 1) {
+            length += ASSOCIATION_DESCRIPTOR_LENGTH;
+        }
+
+        length += functions[i]->onGetDescriptorLength();
+    }
+
+    return length;
+}
+
+
+bool USB_Device::hasAssociations()
+{
+    for (auto i = 0; i < functionCount; i++) {
+        if (functions[i]->onGetInterfaceCount() > 1) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void USB_Device::buildDeviceDescriptor()
+{
+    // Association descriptors require the IAD class codes
+    auto associations = hasAssociations();
+
+    const uint8_t deviceDescriptor[DEVICE_DESCRIPTOR_LENGTH] = {
+        DEVICE_DESCRIPTOR_LENGTH,
+        (uint8_t)USB_Descriptor::Type::DEVICE,
+        0x00, 0x02,                             // USB 2.0
+        (uint8_t)(associations ? 0xEF : 0x00),  // Miscellaneous or per
+        (uint8_t)(associations ? 0x02 : 0x00),  // interface
+        (uint8_t)(associations ? 0x01 : 0x00),
+        64,                                     // Max. packet size EP0
+        (uint8_t)(config.vendorId & 0xFF),
+        (uint8_t)(config.vendorId >> 8),
+        (uint8_t)(config.productId & 0xFF),
+        (uint8_t)(config.productId >> 8),
+        (uint8_t)(config.deviceRelease & 0xFF),
+        (uint8_t)(config.deviceRelease >> 8),
+        (uint8_t)(config.manufacturer != nullptr ? 1 : 0),
+        (uint8_t)(config.product != nullptr ? 2 : 0),
+        (uint8_t)(config.serialNumber != nullptr ? 3 : 0),
+        1                                       // Number of configurations
+    };
+
+    memcpy(deviceDescriptorData, deviceDescriptor, sizeof(deviceDescriptor));
+}
+
+
+void USB_Device::buildConfigurationDescriptor()
+{
+    auto length = getConfigurationLength(functionCount);
+    auto interfaceCount = 0;
+
+    for (auto i = 0; i < functionCount; i++) {
+        interfaceCount += functions[i]->onGetInterfaceCount();
+    }
+
+    const uint8_t header[CONFIGURATION_HEADER_LENGTH] = {
+        CONFIGURATION_HEADER_LENGTH,
+        (uint8_t)USB_Descriptor::Type::CONFIGURATION,
+        (uint8_t)(length & 0xFF),
+        (uint8_t)(length >> 8),
+        (uint8_t)interfaceCount,
+        1,                                      // Configuration value
+        0,                                      // Configuration string
+        0x80,                                   // Bus powered
+        (uint8_t)(config.maxPower / 2)
+    };
+
+    memcpy(configurationDescriptorData, header, sizeof(header));
+
+    auto data = configurationDescriptorData + sizeof(header);
+
+    for (auto i = 0; i < functionCount; i++) {
+        auto function = functions[i];
+        auto count = function->onGetInterfaceCount();
+        auto association = data;
+
+        if (count > 1) {
+            data += ASSOCIATION_DESCRIPTOR_LENGTH;
+        }
+
+        function->onGetDescriptorData(data);
+
+        if (count > 1) {
+            // Function class codes as in its first interface descriptor
+            association[0] = ASSOCIATION_DESCRIPTOR_LENGTH;
+            association[1] = 0x0B;              // Interface association
+            association[2] = function->firstInterface;
+            association[3] = count;
+            association[4] = data[5];           // Class
+            association[5] = data[6];           // Subclass
+            association[6] = data[7];           // Protocol
+            association[7] = 0;                 // Function string
+        }
+
+        data += function->onGetDescriptorLength();
+    }
+
+    configurationDescriptor = USB_StaticDescriptor(configurationDescriptorData,
+                                                   length);
+}
+
+
+USB_Function* USB_Device::getFunction(int interface)
+{
+    for (auto i = 0; i < functionCount; i++) {
+        auto function = functions[i];
+
+        if (interface >= function->firstInterface
+                && interface < function->firstInterface
+                               + function->onGetInterfaceCount()) {
+            return function;
+        }
+    }
+
+    return nullptr;
+}
+
+
+void USB_Device::numberInterfaces()
+{
+    auto interface = 0;
+
+    for (auto i = 0; i < functionCount; i++) {
+        functions[i]->firstInterface = interface;
+        interface += functions[i]->onGetInterfaceCount();
+    }
+}
+
+
+}   // namespace mcu
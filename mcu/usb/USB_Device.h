@@ -0,0 +1,192 @@
+/**
+ * @file        USB_Device.h
+ *
+ * Device with one or more class functions for USB on STM32L4xx
+ *
+ * Provides the device, configuration and string descriptors and passes
+ * requests addressed to interfaces to the function owning them, so
+ * classes like USB_CDC and USB_MSC can be combined into a composite
+ * device. The configuration is assembled from the functions in the order
+ * they were added, functions with several interfaces are grouped by an
+ * interface association descriptor.
+ *
+ * Usage: call USB::init(), then init() of this class, then init() of all
+ * functions, then USB::connect(). Functions must not be added or removed
+ * while the device is connected.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "USB_ControlEndpoint.h"
+#include "USB_Descriptor.h"
+#include "USB_Function.h"
+#include "USB_StaticDescriptor.h"
+#include "USB_StringDescriptor.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class USB_Device
+{
+    public:
+        /**
+         * Max. number of functions
+         */
+        static const int MAX_FUNCTIONS = 4;
+
+        /**
+         * Max. length of configuration descriptor
+         */
+        static const int MAX_CONFIGURATION_DESCRIPTOR_LENGTH = 256;
+
+        /**
+         * Configuration settings
+         */
+        struct Config
+        {
+            uint16_t vendorId = 0x0483;
+            uint16_t productId = 0x5740;
+            uint16_t deviceRelease = 0x0100;
+            const char* manufacturer = nullptr;
+            const char* product = nullptr;
+            const char* serialNumber = nullptr;     // Required by USB_MSC
+            int maxPower = 100;                     // In mA
+        };
+
+        /**
+         * Constructor
+         */
+        USB_Device() {}
+
+        /**
+         * Destructor
+         */
+        ~USB_Device();
+
+        /**
+         * Disallow copy
+         */
+        USB_Device(const USB_Device&) = delete;
+        USB_Device& operator = (const USB_Device&) = delete;
+        USB_Device& operator = (USB_Device&&) = delete;
+
+        /**
+         * Init with config settings, registers callbacks at the USB
+         * peripheral
+         *
+         * @param config        Reference to configuration struct
+         */
+        void init(Config& config);
+
+        /**
+         * Shutdown, functions stay added
+         */
+        void deinit();
+
+        /**
+         * Add a function, called by init() of the function
+         *
+         * @param function      Pointer to function
+         * @return              False if the configuration is full
+         */
+        bool addFunction(USB_Function* function);
+
+        /**
+         * Remove a function, called by deinit() of the function. Functions
+         * added later get new interface numbers.
+         *
+         * @param function      Pointer to function
+         */
+        void removeFunction(USB_Function* function);
+
+        /**
+         * Descriptor callback, registered by init()
+         */
+        static USB_Descriptor* descriptorCallback(USB_Descriptor::Type type,
+                                                  int index, int interface,
+                                                  void* context);
+
+        /**
+         * Request callback, registered by init()
+         */
+        static int requestCallback(USB_ControlEndpoint::Request& request,
+                                   uint8_t data[], void* context);
+
+    protected:
+        /**
+         * Descriptor lengths
+         */
+        static const int DEVICE_DESCRIPTOR_LENGTH = 18;
+        static const int CONFIGURATION_HEADER_LENGTH = 9;
+        static const int ASSOCIATION_DESCRIPTOR_LENGTH = 8;
+
+        /**
+         * Return length of configuration descriptor
+         *
+         * @param functionCount Number of functions to include
+         * @return              Length in bytes
+         */
+        int getConfigurationLength(int functionCount);
+
+        /**
+         * Return if functions are grouped by association descriptors
+         */
+        bool hasAssociations();
+
+        /**
+         * Build device descriptor from config
+         */
+        void buildDeviceDescriptor();
+
+        /**
+         * Build configuration descriptor from functions
+         */
+        void buildConfigurationDescriptor();
+
+        /**
+         * Return function owning an interface
+         *
+         * @param interface     Interface number
+         * @return              Pointer to function or nullptr
+         */
+        USB_Function* getFunction(int interface);
+
+        /**
+         * Assign interface numbers in order of functions
+         */
+        void numberInterfaces();
+
+        /**
+         * Configuration
+         */
+        Config config;
+        bool initialised = false;
+
+        /**
+         * Functions in order of interface numbers
+         */
+        USB_Function* functions[MAX_FUNCTIONS] = {};
+        int functionCount = 0;
+
+        /**
+         * Descriptors
+         */
+        uint8_t deviceDescriptorData[DEVICE_DESCRIPTOR_LENGTH];
+        uint8_t configurationDescriptorData[MAX_CONFIGURATION_DESCRIPTOR_LENGTH];
+        USB_StaticDescriptor deviceDescriptor{deviceDescriptorData};
+        USB_StaticDescriptor configurationDescriptor{nullptr, 0};
+        USB_StringDescriptor stringDescriptor;
+};
+
+
+}   // namespace mcu
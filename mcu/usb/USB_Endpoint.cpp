@@ -28,22 +28,66 @@ namespace mcu {
 
 void USB_Endpoint::transmit(uint8_t data[], int size)
 {
+    transmit(data, size, 0, size);
+}
+
+
+void USB_Endpoint::transmit(uint8_t ring[], int ringLength, int index,
+                            int size)
+{
+    if (bufferMode == BufferMode::DOUBLE_TX) {
+        // Isochronous buffers are passed by the peripheral on each frame
+        if (txQueued >= (isIsochronous() ? 1 : 2)) {
+            return;
+        }
+
+        // Buffer 1 uses the RX fields of the descriptor
+        auto buffer = getSoftwareBuffer();
+        auto address = buffer == 0 ? txBufferAddress : rxBufferAddress;
+        auto bufferSize = buffer == 0 ? txBufferSize : rxBufferSize;
+        auto writeSize = std::min(size, (int)bufferSize);
+
+        USB_SRAM::writeFromRing(address, ring, ringLength, index, writeSize);
+        USB_SRAM::writeHalfword(bufferDescriptorAddress + (buffer == 0 ? 2 : 6),
+                                writeSize);
+
+        txQueued++;
+
+        if (txQueued == 1 && !isIsochronous()) {
+            // Peripheral is idle, pass buffer immediately. Otherwise it is
+            // passed when the current packet is transmitted.
+            toggleSoftwareBuffer();
+        }
+
+        return;
+    }
+
     auto writeSize = std::min(size, (int)txBufferSize);
 
-    USB_SRAM::write(txBufferAddress, data, writeSize);
+    USB_SRAM::writeFromRing(txBufferAddress, ring, ringLength, index,
+                            writeSize);
     USB_SRAM::writeHalfword(bufferDescriptorAddress + 2, writeSize);
 
+    txQueued = 1;
+
     setTransmissionStatus(Status::VALID);
 }
 
 
 int USB_Endpoint::receive(uint8_t data[], int size)
+{
+    return receive(data, size, 0, size);
+}
+
+
+int USB_Endpoint::receive(uint8_t ring[], int ringLength, int index, int size)
 {
     auto readLength = std::min(size, getReceivedLength());
 
-    USB_SRAM::read(rxBufferAddress, data, readLength);
+    USB_SRAM::readToRing(getReceptionBufferAddress(), ring, ringLength, index,
+                         readLength);
 
-    setReceptionStatus(Status::VALID);
+    releaseReceptionBuffer();
 
     return readLength;
 }
@@ -51,7 +95,111 @@ int USB_Endpoint::receive(uint8_t data[], int size)
 
 int USB_Endpoint::getReceivedLength()
 {
-    return USB_SRAM::readHalfword(bufferDescriptorAddress + 6) & 0x3FF;
+    auto offset = 6;
+
+    if (bufferMode == BufferMode::DOUBLE_RX && getSoftwareBuffer() == 0) {
+        // Buffer 0 uses the TX fields of the descriptor
+        offset = 2;
+    }
+
+    return USB_SRAM::readHalfword(bufferDescriptorAddress + offset) & 0x3FF;
+}
+
+
+void USB_Endpoint::releaseReceptionBuffer()
+{
+    if (isIsochronous()) {
+        // Reception stays valid, next packet overwrites the other buffer
+        rxQueued = 0;
+        return;
+    }
+
+    if (bufferMode == BufferMode::DOUBLE_RX) {
+        if (rxQueued == 0) {
+            return;
+        }
+
+        rxQueued--;
+
+        if (rxQueued > 0) {
+            // Take the next packet and pass the released buffer
+            toggleSoftwareBuffer();
+        }
+
+        return;
+    }
+
+    rxQueued = 0;
+
+    setReceptionStatus(Status::VALID);
+}
+
+
+int USB_Endpoint::getFreeTransmissionBuffers()
+{
+    auto bufferCount = bufferMode == BufferMode::DOUBLE_TX
+                       && !isIsochronous() ? 2 : 1;
+
+    return bufferCount - txQueued;
+}
+
+
+void USB_Endpoint::setHalt(bool in, bool state)
+{
+    if (state) {
+        if (in) {
+            setTransmissionStatus(Status::STALL);
+        } else {
+            setReceptionStatus(Status::STALL);
+        }
+
+        return;
+    }
+
+    if (!isHalted(in)) {
+        return;
+    }
+
+    if (bufferMode != BufferMode::SINGLE) {
+        // DTOG also selects the buffer, both restart from buffer 0
+        initBufferMode();
+
+        if (in) {
+            setTransmissionStatus(Status::VALID);
+        } else {
+            setReceptionStatus(Status::VALID);
+        }
+
+        return;
+    }
+
+    auto bit = in ? USB_Registers::EPnR::DTOG_TX : USB_Registers::EPnR::DTOG_RX;
+
+    volatile uint32_t value = *EPnR;
+
+    // Toggle bit is inverted by writing 1, so this resets it to DATA0
+    auto dtog = value & (1 << bit);
+
+    value &= ~USB_Registers::EPnR::TOGGLE_MASK;
+    value |= USB_Registers::EPnR::RC_W0_MASK;
+    value |= dtog;
+
+    *EPnR = value;
+
+    if (in) {
+        setTransmissionStatus(txQueued > 0 ? Status::VALID : Status::NAK);
+    } else {
+        setReceptionStatus(rxQueued > 0 ? Status::NAK : Status::VALID);
+    }
+}
+
+
+bool USB_Endpoint::isHalted(bool in)
+{
+    auto offset = in ? USB_Registers::EPnR::STAT_TX_0
+                     : USB_Registers::EPnR::STAT_RX_0;
+
+    return bitsValue(*EPnR, 2, offset) == (unsigned int)Status::STALL;
 }
 
 
@@ -76,6 +224,8 @@ void USB_Endpoint::setType(Type type)
     value |= USB_Registers::EPnR::RC_W0_MASK;
 
     *EPnR = value;
+
+    this->type = type;
 }
 
 
@@ -122,18 +272,13 @@ void USB_Endpoint::initBufferDescriptor()
 {
     USB_SRAM::Registers::Block bufferDescriptor;
 
+    // Double-buffered endpoints use both fields for the same direction
     bufferDescriptor.ADDRn_TX = txBufferAddress;
-    bufferDescriptor.COUNTn_TX = 0;
+    bufferDescriptor.COUNTn_TX = bufferMode == BufferMode::DOUBLE_RX
+                                 ? getReceptionCountValue(txBufferSize) : 0;
     bufferDescriptor.ADDRn_RX = rxBufferAddress;
-
-    if (rxBufferSize >= 2 && rxBufferSize <= 62) {
-        bufferDescriptor.COUNTn_RX = bitsReplace(0, rxBufferSize / 2, 5,
-                USB_SRAM::Registers::COUNTn_RX::NUM_BLOCK_0);
-    } else if (rxBufferSize >= 64) {
-        bufferDescriptor.COUNTn_RX = bitsReplace(0, rxBufferSize / 32 - 1, 5,
-                USB_SRAM::Registers::COUNTn_RX::NUM_BLOCK_0)
-                | (1 << USB_SRAM::Registers::COUNTn_RX::BL_SIZE);
-    }
+    bufferDescriptor.COUNTn_RX = bufferMode == BufferMode::DOUBLE_TX
+                                 ? 0 : getReceptionCountValue(rxBufferSize);
 
     USB_SRAM::write(bufferDescriptorAddress, (uint8_t*)&bufferDescriptor,
                     sizeof(bufferDescriptor));
@@ -155,10 +300,141 @@ void USB_Endpoint::init()
 void USB_Endpoint::reset()
 {
     setAddress(number);
+    initBufferMode();
     onReset();
 }
 
 
+void USB_Endpoint::updateReceptionState()
+{
+    if (isIsochronous()) {
+        // Peripheral has already switched to the other buffer
+        rxQueued = 1;
+    } else if (bufferMode == BufferMode::DOUBLE_RX) {
+        rxQueued++;
+
+        if (rxQueued == 1) {
+            // Take the packet and pass the other buffer to the peripheral
+            toggleSoftwareBuffer();
+        }
+    } else {
+        rxQueued = 1;
+    }
+}
+
+
+void USB_Endpoint::updateTransmissionState()
+{
+    if (isIsochronous()) {
+        txQueued = 0;
+    } else if (bufferMode == BufferMode::DOUBLE_TX) {
+        if (txQueued > 0) {
+            txQueued--;
+        }
+
+        if (txQueued > 0) {
+            // Pass the packet prepared during transmission
+            toggleSoftwareBuffer();
+        }
+    } else {
+        txQueued = 0;
+    }
+}
+
+
+void USB_Endpoint::initBufferMode()
+{
+    txQueued = 0;
+    rxQueued = 0;
+
+    volatile uint32_t value = *EPnR;
+
+    // Toggle bits are inverted by writing 1, so this clears both, also
+    // for single buffers, which start with DATA0 after SET_CONFIGURATION
+    auto dtog = value & ((1 << USB_Registers::EPnR::DTOG_TX)
+                         | (1 << USB_Registers::EPnR::DTOG_RX));
+
+    value &= ~USB_Registers::EPnR::TOGGLE_MASK;
+    value |= USB_Registers::EPnR::RC_W0_MASK;
+    value |= dtog;
+
+    if (bufferMode == BufferMode::SINGLE) {
+        value = bitReset(value, USB_Registers::EPnR::EP_KIND);
+    } else {
+        value = bitSet(value, USB_Registers::EPnR::EP_KIND);
+    }
+
+    *EPnR = value;
+
+    if (bufferMode == BufferMode::DOUBLE_RX) {
+        // Application holds buffer 1, reception starts with buffer 0
+        toggleSoftwareBuffer();
+    }
+}
+
+
+void USB_Endpoint::toggleSoftwareBuffer()
+{
+    if (isIsochronous()) {
+        return;
+    }
+
+    // SW_BUF is the DTOG bit of the unused direction
+    auto bit = bufferMode == BufferMode::DOUBLE_TX
+               ? USB_Registers::EPnR::DTOG_RX : USB_Registers::EPnR::DTOG_TX;
+
+    volatile uint32_t value = *EPnR;
+
+    value &= ~USB_Registers::EPnR::TOGGLE_MASK;
+    value |= USB_Registers::EPnR::RC_W0_MASK;
+    value |= (1 << bit);
+
+    *EPnR = value;
+}
+
+
+int USB_Endpoint::getSoftwareBuffer()
+{
+    if (isIsochronous()) {
+        // Application uses the buffer not selected by DTOG
+        auto bit = bufferMode == BufferMode::DOUBLE_TX
+                   ? USB_Registers::EPnR::DTOG_TX : USB_Registers::EPnR::DTOG_RX;
+
+        return !bitValue(*EPnR, bit);
+    }
+
+    auto bit = bufferMode == BufferMode::DOUBLE_TX
+               ? USB_Registers::EPnR::DTOG_RX : USB_Registers::EPnR::DTOG_TX;
+
+    return bitValue(*EPnR, bit);
+}
+
+
+uint16_t USB_Endpoint::getReceptionBufferAddress()
+{
+    if (bufferMode == BufferMode::DOUBLE_RX && getSoftwareBuffer() == 0) {
+        return txBufferAddress;
+    }
+
+    return rxBufferAddress;
+}
+
+
+uint16_t USB_Endpoint::getReceptionCountValue(int size)
+{
+    if (size >= 2 && size <= 62) {
+        return bitsReplace(0, size / 2, 5,
+                USB_SRAM::Registers::COUNTn_RX::NUM_BLOCK_0);
+    } else if (size >= 64) {
+        return bitsReplace(0, size / 32 - 1, 5,
+                USB_SRAM::Registers::COUNTn_RX::NUM_BLOCK_0)
+                | (1 << USB_SRAM::Registers::COUNTn_RX::BL_SIZE);
+    }
+
+    return 0;
+}
+
+
 bool USB_Endpoint::getTxFlag()
 {
     return bitValue(*EPnR, USB_Registers::EPnR::CTR_TX);
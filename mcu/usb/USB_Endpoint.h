@@ -25,6 +25,7 @@ namespace mcu {
 class USB_Endpoint
 {
     friend class USB;
+    friend class USB_ControlEndpoint;
 
     public:
         /**
@@ -49,6 +50,24 @@ class USB_Endpoint
             VALID       = 0b11
         };
 
+        /**
+         * Buffer mode
+         *
+         * Double-buffered endpoints are unidirectional and use both packet
+         * buffers of the descriptor for one direction, so the next packet
+         * can be prepared while the current one is on the bus.
+         *
+         * Isochronous endpoints are always double-buffered. The peripheral
+         * switches buffers after each transaction by itself, so only one
+         * packet can be queued or held by the application.
+         */
+        enum class BufferMode
+        {
+            SINGLE,
+            DOUBLE_TX,
+            DOUBLE_RX
+        };
+
         /**
          * Constructor
          *
@@ -66,13 +85,26 @@ class USB_Endpoint
         /**
          * Transmit data
          *
+         * On double-buffered endpoints, the packet is queued into a free
+         * buffer and ignored if none is free.
+         *
          * @param data          Buffer containing data
          * @param size          Data size in bytes
          */
         void transmit(uint8_t data[], int size);
 
         /**
-         * Receive data
+         * Transmit data from a ring buffer without intermediate copy
+         *
+         * @param ring          Ring buffer
+         * @param ringLength    Length of ring buffer in bytes
+         * @param index         Index of first byte in ring buffer
+         * @param size          Data size in bytes
+         */
+        void transmit(uint8_t ring[], int ringLength, int index, int size);
+
+        /**
+         * Receive data and release the packet buffer
          *
          * @param data          Buffer to be filled with data
          * @param size          Buffer size in bytes
@@ -80,6 +112,18 @@ class USB_Endpoint
          */
         int receive(uint8_t data[], int size);
 
+        /**
+         * Receive data into a ring buffer without intermediate copy and
+         * release the packet buffer
+         *
+         * @param ring          Ring buffer
+         * @param ringLength    Length of ring buffer in bytes
+         * @param index         Index of first byte to be written
+         * @param size          Max. number of bytes
+         * @return              Number of received bytes
+         */
+        int receive(uint8_t ring[], int ringLength, int index, int size);
+
         /**
          * Return length of received data
          *
@@ -87,6 +131,57 @@ class USB_Endpoint
          */
         int getReceivedLength();
 
+        /**
+         * Release the buffer of the received packet for the next reception
+         * without reading it, e.g. after reading it with USB_SRAM directly
+         */
+        void releaseReceptionBuffer();
+
+        /**
+         * Return number of packet buffers that can be filled by transmit()
+         *
+         * @return              Number of buffers, 0..2
+         */
+        int getFreeTransmissionBuffers();
+
+        /**
+         * Return number of received packets not yet released
+         *
+         * @return              Number of packets, 0..2
+         */
+        int getReceivedPacketCount()
+        {
+            return rxQueued;
+        }
+
+        /**
+         * Halt or resume a direction, e.g. on SET_FEATURE and CLEAR_FEATURE
+         * ENDPOINT_HALT. Resuming resets the data toggle, double-buffered
+         * endpoints also drop their queued packets.
+         *
+         * @param in            True for IN, false for OUT direction
+         * @param state         True to halt
+         */
+        void setHalt(bool in, bool state);
+
+        /**
+         * Return if a direction is halted
+         *
+         * @param in            True for IN, false for OUT direction
+         * @return              True if halted
+         */
+        bool isHalted(bool in);
+
+        /**
+         * Set buffer mode, call before USB::init()
+         *
+         * @param mode          Mode according to enum class
+         */
+        void setBufferMode(BufferMode mode)
+        {
+            bufferMode = mode;
+        }
+
         /**
          * Set endpoint address
          *
@@ -174,6 +269,24 @@ class USB_Endpoint
          */
         virtual void onTransmissionComplete() {}
 
+        /**
+         * Called from USB::irq() on start of frame, if enabled by
+         * USB::enableStartOfFrameInterrupt()
+         */
+        virtual void onStartOfFrame() {}
+
+        /**
+         * Called from USB_ControlEndpoint on CLEAR_FEATURE ENDPOINT_HALT
+         *
+         * @param in            True for IN, false for OUT direction
+         * @return              False to keep the direction halted
+         */
+        virtual bool onClearHalt(bool in)
+        {
+            (void)in;
+            return true;
+        }
+
         /**
          * Init, called from USB::init()
          */
@@ -184,6 +297,60 @@ class USB_Endpoint
          */
         void reset();
 
+        /**
+         * Update buffer state after reception, called from USB::irq()
+         * before onReceptionComplete() is called or queued
+         */
+        void updateReceptionState();
+
+        /**
+         * Update buffer state after transmission, called from USB::irq()
+         * before onTransmissionComplete() is called or queued
+         */
+        void updateTransmissionState();
+
+        /**
+         * Set EP_KIND and initial buffer ownership, called from reset()
+         */
+        void initBufferMode();
+
+        /**
+         * Toggle SW_BUF bit of a double-buffered endpoint, passing a
+         * buffer between application and peripheral
+         */
+        void toggleSoftwareBuffer();
+
+        /**
+         * Return index of buffer owned by the application on
+         * double-buffered endpoints
+         *
+         * @return              Buffer index 0 or 1
+         */
+        int getSoftwareBuffer();
+
+        /**
+         * Return address of buffer holding the received packet
+         *
+         * @return              Address in SRAM
+         */
+        uint16_t getReceptionBufferAddress();
+
+        /**
+         * Return if the endpoint type is isochronous
+         */
+        bool isIsochronous()
+        {
+            return type == Type::ISOCHRONOUS;
+        }
+
+        /**
+         * Return COUNTn_RX value for a reception buffer size
+         *
+         * @param size          Buffer size in bytes
+         * @return              Register value
+         */
+        static uint16_t getReceptionCountValue(int size);
+
         /**
          * Return the value of the CTR_TX bit in the endpoint register
          *
@@ -231,6 +398,15 @@ class USB_Endpoint
         uint16_t txBufferSize = 64;
         uint16_t rxBufferAddress = 128 + number * 128;
         uint16_t rxBufferSize = 64;
+
+        /**
+         * Buffer mode and number of packets owned by the peripheral (TX)
+         * or the application (RX)
+         */
+        BufferMode bufferMode = BufferMode::SINGLE;
+        Type type = Type::BULK;
+        volatile uint8_t txQueued = 0;
+        volatile uint8_t rxQueued = 0;
 };
 
 
@@ -0,0 +1,123 @@
+/**
+ * @file        USB_Function.h
+ *
+ * Base class for USB device classes on STM32L4xx
+ *
+ * A function contributes one or more consecutive interfaces with their
+ * endpoint and class-specific descriptors to the configuration of a
+ * USB_Device and handles the requests addressed to them. Interface
+ * numbers are assigned by the device when the function is added.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "USB_ControlEndpoint.h"
+#include "USB_Descriptor.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class USB_Device;
+
+
+class USB_Function
+{
+    friend class USB_Device;
+
+    public:
+        /**
+         * Constructor
+         *
+         * @param usbDevice     Reference to device the function is added to
+         */
+        USB_Function(USB_Device& usbDevice) : usbDevice(usbDevice) {}
+
+        /**
+         * Disallow copy
+         */
+        USB_Function(const USB_Function&) = delete;
+        USB_Function& operator = (const USB_Function&) = delete;
+        USB_Function& operator = (USB_Function&&) = delete;
+
+        /**
+         * Return number of first interface
+         *
+         * @return              Interface number
+         */
+        int getFirstInterface()
+        {
+            return firstInterface;
+        }
+
+    protected:
+        /**
+         * Return number of interfaces
+         */
+        virtual int onGetInterfaceCount() = 0;
+
+        /**
+         * Return length of interface descriptors, including endpoint and
+         * class-specific descriptors
+         */
+        virtual int onGetDescriptorLength() = 0;
+
+        /**
+         * Write interface descriptors, numbered from getFirstInterface(),
+         * starting with the descriptor of the first interface
+         *
+         * @param data          Buffer of onGetDescriptorLength() bytes
+         */
+        virtual void onGetDescriptorData(uint8_t data[]) = 0;
+
+        /**
+         * Return class-specific descriptor requested from an interface
+         *
+         * @param type          Descriptor type
+         * @param index         Descriptor index
+         * @param interface     Interface number
+         * @return              Pointer to descriptor or nullptr
+         */
+        virtual USB_Descriptor* onGetClassDescriptor(USB_Descriptor::Type type,
+                                                     int index, int interface)
+        {
+            (void)type;
+            (void)index;
+            (void)interface;
+
+            return nullptr;
+        }
+
+        /**
+         * Handle class request or SET_INTERFACE/GET_INTERFACE addressed to
+         * one of the interfaces, see USB_ControlEndpoint::RequestCallbackFunc
+         *
+         * @param request       Reference to setup packet
+         * @param data          Data stage buffer
+         * @return              Length of data IN, 0 or -1 to stall
+         */
+        virtual int onRequest(USB_ControlEndpoint::Request& request,
+                              uint8_t data[]) = 0;
+
+        /**
+         * Device the function is added to
+         */
+        USB_Device& usbDevice;
+
+        /**
+         * Number of first interface, -1 while not added
+         */
+        int firstInterface = -1;
+};
+
+
+}   // namespace mcu
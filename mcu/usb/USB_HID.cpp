@@ -0,0 +1,378 @@
+/**
+ * @file        USB_HID.cpp
+ *
+ * Human interface device class for USB on STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "USB_HID.h"
+
+// Local includes
+#include "USB.h"
+
+// This component
+#include "../core/cortex_m4.h"
+
+// System libraries
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+
+namespace mcu {
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+USB_HID::~USB_HID()
+{
+    deinit();
+}
+
+
+bool USB_HID::init(Config& config)
+{
+    deinit();
+
+    if (!usbDevice.addFunction(this)) {
+        return false;
+    }
+
+    this->config = config;
+    this->config.inReportSize = std::min(std::max(config.inReportSize, 1),
+                                         MAX_REPORT_SIZE);
+    this->config.outReportSize = std::min(std::max(config.outReportSize, 1),
+                                          MAX_REPORT_SIZE);
+    this->config.interval = std::min(std::max(config.interval, 1), 255);
+
+    reportDescriptor = USB_StaticDescriptor(config.reportDescriptor,
+                                            config.reportDescriptorLength);
+
+    allocateQueue();
+    buildHidDescriptor();
+
+    idleRate = 0;
+    protocol = 1;
+
+    auto& usb = USB::get();
+
+    usb.setEndpoint(reportInEndpoint.getNumber(), &reportInEndpoint);
+    usb.setEndpoint(reportOutEndpoint.getNumber(), &reportOutEndpoint);
+
+    // USB::init() has already cleared the packet memory
+    reportInEndpoint.initBufferDescriptor();
+    reportOutEndpoint.initBufferDescriptor();
+
+    return true;
+}
+
+
+void USB_HID::deinit()
+{
+    if (queue.data == nullptr) {
+        return;
+    }
+
+    usbDevice.removeFunction(this);
+
+    auto& usb = USB::get();
+
+    usb.setEndpoint(reportInEndpoint.getNumber(), nullptr);
+    usb.setEndpoint(reportOutEndpoint.getNumber(), nullptr);
+
+    deallocateQueue();
+}
+
+
+bool USB_HID::sendReport(uint8_t data[], int size)
+{
+    if (queue.data == nullptr || size > queue.slotSize) {
+        return false;
+    }
+
+    // Reports queued before enumeration would be stale when sent
+    if (!USB::get().isReady() || queue.getFree() == 0) {
+        return false;
+    }
+
+    auto writeIndex = queue.writeIndex;
+
+    memcpy(&queue.data[writeIndex * queue.slotSize], data, size);
+    queue.sizes[writeIndex] = size;
+
+    if (++writeIndex >= queue.length) {
+        writeIndex = 0;
+    }
+
+    // Report must be in queue before the ISR can see the new index
+    std::atomic_signal_fence(std::memory_order_release);
+    queue.writeIndex = writeIndex;
+
+    disableInterrupts();
+    fillTransmissionBuffer();
+    enableInterrupts();
+
+    return true;
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+void USB_HID::ReportEndpoint::onReset()
+{
+    setType(Type::INTERRUPT);
+
+    if (this == &hid.reportInEndpoint) {
+        // Set to valid by transmit() when a report is queued
+        setTransmissionStatus(Status::NAK);
+        setReceptionStatus(Status::DISABLED);
+        hid.onReset();
+    } else {
+        setTransmissionStatus(Status::DISABLED);
+        setReceptionStatus(Status::VALID);
+    }
+}
+
+
+void USB_HID::ReportEndpoint::onReceptionComplete()
+{
+    hid.onReceptionComplete();
+}
+
+
+void USB_HID::ReportEndpoint::onTransmissionComplete()
+{
+    hid.fillTransmissionBuffer();
+}
+
+
+void USB_HID::allocateQueue()
+{
+    deallocateQueue();
+
+    auto length = std::max(config.queueLength, 1) + 1;
+
+    queue.data = new uint8_t[length * config.inReportSize];
+    queue.sizes = new uint8_t[length];
+    queue.length = length;
+    queue.slotSize = config.inReportSize;
+}
+
+
+void USB_HID::deallocateQueue()
+{
+    if (queue.data != nullptr) {
+        delete[] queue.data;
+    }
+
+    if (queue.sizes != nullptr) {
+        delete[] queue.sizes;
+    }
+
+    queue = Queue();
+}
+
+
+void USB_HID::buildHidDescriptor()
+{
+    auto reportDescriptorLength = reportDescriptor.onGetLength();
+
+    const uint8_t descriptor[HID_DESCRIPTOR_LENGTH] = {
+        HID_DESCRIPTOR_LENGTH, (uint8_t)USB_Descriptor::Type::HID,
+        0x11, 0x01,                             // HID 1.11
+        0x00,                                   // Not localized
+        1,                                      // Number of class descriptors
+        (uint8_t)USB_Descriptor::Type::HID_REPORT,
+        (uint8_t)(reportDescriptorLength & 0xFF),
+        (uint8_t)(reportDescriptorLength >> 8)
+    };
+
+    memcpy(hidDescriptorData, descriptor, sizeof(descriptor));
+}
+
+
+void USB_HID::onGetDescriptorData(uint8_t data[])
+{
+    auto reportInEndpointNo = reportInEndpoint.getNumber();
+    auto reportOutEndpointNo = reportOutEndpoint.getNumber();
+
+    const uint8_t interfaceDescriptor[] = {
+        9, (uint8_t)USB_Descriptor::Type::INTERFACE,
+        (uint8_t)firstInterface,                // Interface number
+        0,                                      // Alternate setting
+        2,                                      // Number of endpoints
+        0x03,                                   // Class HID
+        0x00,                                   // No boot interface
+        0x00,                                   // Protocol
+        0                                       // Interface string
+    };
+
+    const uint8_t endpointDescriptors[] = {
+        // Report IN endpoint
+        7, (uint8_t)USB_Descriptor::Type::ENDPOINT,
+        (uint8_t)(0x80 | reportInEndpointNo),
+        0x03,                                   // Interrupt
+        (uint8_t)config.inReportSize, 0,
+        (uint8_t)config.interval,
+
+        // Report OUT endpoint
+        7, (uint8_t)USB_Descriptor::Type::ENDPOINT,
+        (uint8_t)reportOutEndpointNo,
+        0x03,                                   // Interrupt
+        (uint8_t)config.outReportSize, 0,
+        (uint8_t)config.interval
+    };
+
+    static_assert(sizeof(interfaceDescriptor) + HID_DESCRIPTOR_LENGTH
+                  + sizeof(endpointDescriptors) == DESCRIPTOR_LENGTH,
+                  "Descriptor length mismatch");
+
+    // HID descriptor follows the interface
+    memcpy(data, interfaceDescriptor, sizeof(interfaceDescriptor));
+    data += sizeof(interfaceDescriptor);
+    memcpy(data, hidDescriptorData, HID_DESCRIPTOR_LENGTH);
+    data += HID_DESCRIPTOR_LENGTH;
+    memcpy(data, endpointDescriptors, sizeof(endpointDescriptors));
+}
+
+
+USB_Descriptor* USB_HID::onGetClassDescriptor(USB_Descriptor::Type type,
+                                              int index, int interface)
+{
+    (void)index;
+    (void)interface;
+
+    switch (type) {
+        case USB_Descriptor::Type::HID:
+            return &hidDescriptor;
+
+        case USB_Descriptor::Type::HID_REPORT:
+            if (reportDescriptor.onGetLength() == 0) {
+                return nullptr;
+            }
+
+            return &reportDescriptor;
+
+        default:
+            return nullptr;
+    }
+}
+
+
+int USB_HID::onRequest(USB_ControlEndpoint::Request& request, uint8_t data[])
+{
+    // Class requests to the interface only
+    if ((request.bmRequestType & 0x7F) != 0x21
+            || (request.wIndex & 0xFF) != firstInterface) {
+        return -1;
+    }
+
+    auto reportType = (ReportType)(request.wValue >> 8);
+    auto reportId = request.wValue & 0xFF;
+
+    switch (request.bRequest) {
+        case GET_REPORT:
+            if (config.getReportCallback == nullptr) {
+                return -1;
+            }
+
+            return config.getReportCallback(
+                this, reportType, reportId, data,
+                std::min((int)request.wLength,
+                         USB_ControlEndpoint::MAX_REQUEST_DATA_LENGTH),
+                config.callbackContext
+            );
+
+        case SET_REPORT:
+            // Called after the data stage
+            if (config.reportCallback == nullptr) {
+                return -1;
+            }
+
+            config.reportCallback(this, reportType, data, request.wLength,
+                                  config.callbackContext);
+            return 0;
+
+        case GET_IDLE:
+            data[0] = idleRate;
+            return 1;
+
+        case SET_IDLE:
+            // Repeating unchanged reports is left to the application
+            idleRate = request.wValue >> 8;
+            return 0;
+
+        case GET_PROTOCOL:
+            data[0] = protocol;
+            return 1;
+
+        case SET_PROTOCOL:
+            protocol = request.wValue & 0xFF;
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+
+void USB_HID::onReset()
+{
+    // Reports queued before the reset are dropped
+    queue.readIndex = queue.writeIndex;
+
+    idleRate = 0;
+    protocol = 1;
+}
+
+
+void USB_HID::onReceptionComplete()
+{
+    uint8_t report[MAX_REPORT_SIZE];
+
+    // Copies from packet memory and releases the packet buffer
+    auto length = reportOutEndpoint.receive(report, sizeof(report));
+
+    if (config.reportCallback != nullptr) {
+        config.reportCallback(this, ReportType::OUTPUT, report, length,
+                              config.callbackContext);
+    }
+}
+
+
+void USB_HID::fillTransmissionBuffer()
+{
+    if (queue.data == nullptr || queue.getUsed() == 0) {
+        return;
+    }
+
+    // Single buffer, next report is passed when the host has polled
+    if (reportInEndpoint.getFreeTransmissionBuffers() == 0) {
+        return;
+    }
+
+    auto readIndex = queue.readIndex;
+
+    reportInEndpoint.transmit(&queue.data[readIndex * queue.slotSize],
+                              queue.sizes[readIndex]);
+
+    if (++readIndex >= queue.length) {
+        readIndex = 0;
+    }
+
+    std::atomic_signal_fence(std::memory_order_release);
+    queue.readIndex = readIndex;
+}
+
+
+}   // namespace mcu
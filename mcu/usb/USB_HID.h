@@ -0,0 +1,338 @@
+/**
+ * @file        USB_HID.h
+ *
+ * Human interface device class for USB on STM32L4xx
+ *
+ * Serves an application-defined report descriptor and exchanges reports
+ * over interrupt IN and OUT endpoints, polled by the host every interval
+ * ms, so reports are delivered with up to 1 kHz without custom drivers.
+ *
+ * Input reports are queued by sendReport() without blocking and sent one
+ * per poll by the USB interrupt. Output reports from the OUT endpoint and
+ * SET_REPORT, as well as GET_REPORT, are passed to callbacks. Reports
+ * include the report ID as first byte if the descriptor uses IDs.
+ *
+ * Usage: call USB::init(), then init() of the USB_Device, then init() of
+ * this class, then USB::connect().
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "USB_Endpoint.h"
+#include "USB_ControlEndpoint.h"
+#include "USB_Descriptor.h"
+#include "USB_Device.h"
+#include "USB_Function.h"
+#include "USB_StaticDescriptor.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class USB_HID : public USB_Function
+{
+    public:
+        /**
+         * Max. report size, limited by full-speed interrupt packets
+         */
+        static const int MAX_REPORT_SIZE = 64;
+
+        /**
+         * Report types as used by GET_REPORT and SET_REPORT
+         */
+        enum class ReportType
+        {
+            INPUT       = 1,
+            OUTPUT      = 2,
+            FEATURE     = 3
+        };
+
+        /**
+         * Callback function type for received output and feature reports
+         */
+        typedef void (*ReportCallbackFunc)(USB_HID*, ReportType, uint8_t[],
+                                           int, void*);
+
+        /**
+         * Callback function type for GET_REPORT, fills the data buffer and
+         * returns the report length or -1 to stall the request
+         */
+        typedef int (*GetReportCallbackFunc)(USB_HID*, ReportType, uint8_t,
+                                             uint8_t[], int, void*);
+
+        /**
+         * Configuration settings
+         */
+        struct Config
+        {
+            const uint8_t* reportDescriptor = nullptr;  // Must stay valid
+            int reportDescriptorLength = 0;
+            int inReportSize = MAX_REPORT_SIZE;     // Largest input report
+            int outReportSize = MAX_REPORT_SIZE;    // Largest output report
+            int interval = 1;                   // Polling interval in ms
+            int queueLength = 8;                // In reports
+            ReportCallbackFunc reportCallback = nullptr;
+            GetReportCallbackFunc getReportCallback = nullptr;
+            void* callbackContext = nullptr;
+        };
+
+        /**
+         * Constructor
+         *
+         * @param usbDevice             Reference to device
+         * @param reportInEndpointNo    Number of interrupt IN endpoint
+         * @param reportOutEndpointNo   Number of interrupt OUT endpoint
+         */
+        USB_HID(USB_Device& usbDevice, int reportInEndpointNo=1,
+                int reportOutEndpointNo=2)
+            : USB_Function(usbDevice),
+              reportInEndpoint(*this, reportInEndpointNo),
+              reportOutEndpoint(*this, reportOutEndpointNo) {}
+
+        /**
+         * Destructor
+         */
+        ~USB_HID();
+
+        /**
+         * Disallow copy
+         */
+        USB_HID(const USB_HID&) = delete;
+        USB_HID& operator = (const USB_HID&) = delete;
+        USB_HID& operator = (USB_HID&&) = delete;
+
+        /**
+         * Init with config settings, adds the function to the device,
+         * allocates the report queue and registers endpoints at the USB
+         * peripheral
+         *
+         * @param config        Reference to configuration struct
+         * @return              False if the device has no room for the
+         *                      function
+         */
+        bool init(Config& config);
+
+        /**
+         * Shutdown
+         */
+        void deinit();
+
+        /**
+         * Queue an input report for transmission, non-blocking. Reports
+         * are dropped while the device is not configured.
+         *
+         * @param data          Buffer containing report
+         * @param size          Report size in bytes, max. inReportSize
+         * @return              True if queued
+         */
+        bool sendReport(uint8_t data[], int size);
+
+        /**
+         * Return number of reports that can be queued
+         *
+         * @return              Number of reports
+         */
+        int getQueueAvailable()
+        {
+            return queue.getFree();
+        }
+
+        /**
+         * Return if all queued reports have been sent
+         *
+         * @return              True if sent
+         */
+        bool isIdle()
+        {
+            return queue.getUsed() == 0
+                   && reportInEndpoint.getFreeTransmissionBuffers() > 0;
+        }
+
+        /**
+         * Return idle rate set by the host
+         *
+         * @return              Rate in 4 ms units, 0 for reports on change only
+         */
+        uint8_t getIdleRate()
+        {
+            return idleRate;
+        }
+
+        /**
+         * Return protocol set by the host
+         *
+         * @return              0 for boot protocol, 1 for report protocol
+         */
+        uint8_t getProtocol()
+        {
+            return protocol;
+        }
+
+    protected:
+        /**
+         * Class requests
+         */
+        static const uint8_t GET_REPORT = 0x01;
+        static const uint8_t GET_IDLE = 0x02;
+        static const uint8_t GET_PROTOCOL = 0x03;
+        static const uint8_t SET_REPORT = 0x09;
+        static const uint8_t SET_IDLE = 0x0A;
+        static const uint8_t SET_PROTOCOL = 0x0B;
+
+        /**
+         * Descriptor lengths
+         */
+        static const int DESCRIPTOR_LENGTH = 32;
+        static const int HID_DESCRIPTOR_LENGTH = 9;
+
+        /**
+         * Interrupt IN or OUT endpoint, forwards events to class
+         */
+        class ReportEndpoint : public USB_Endpoint
+        {
+            friend class USB_HID;
+
+            public:
+                ReportEndpoint(USB_HID& hid, int number)
+                    : USB_Endpoint(number), hid(hid) {}
+
+            protected:
+                virtual void onReset() override;
+                virtual void onReceptionComplete() override;
+                virtual void onTransmissionComplete() override;
+
+                USB_HID& hid;
+        };
+
+        /**
+         * Report queue of fixed size slots, safe for one writer and one
+         * reader in different contexts, one slot is kept free to
+         * distinguish full from empty
+         */
+        struct Queue
+        {
+            uint8_t* data = nullptr;
+            uint8_t* sizes = nullptr;
+            int length = 0;                 // In slots
+            int slotSize = 0;
+            volatile int readIndex = 0;
+            volatile int writeIndex = 0;
+
+            int getUsed()
+            {
+                auto used = writeIndex - readIndex;
+                return used < 0 ? used + length : used;
+            }
+
+            int getFree()
+            {
+                return length > 0 ? length - 1 - getUsed() : 0;
+            }
+        };
+
+        /**
+         * Allocate report queue on heap
+         */
+        void allocateQueue();
+
+        /**
+         * Deallocate report queue on heap
+         */
+        void deallocateQueue();
+
+        /**
+         * Build HID descriptor from config
+         */
+        void buildHidDescriptor();
+
+        /**
+         * Return number of interfaces
+         */
+        virtual int onGetInterfaceCount() override
+        {
+            return 1;
+        }
+
+        /**
+         * Return length of interface descriptors
+         */
+        virtual int onGetDescriptorLength() override
+        {
+            return DESCRIPTOR_LENGTH;
+        }
+
+        /**
+         * Write interface descriptors
+         */
+        virtual void onGetDescriptorData(uint8_t data[]) override;
+
+        /**
+         * Return HID or report descriptor
+         */
+        virtual USB_Descriptor* onGetClassDescriptor(USB_Descriptor::Type type,
+                                                     int index,
+                                                     int interface) override;
+
+        /**
+         * Handle class request
+         */
+        virtual int onRequest(USB_ControlEndpoint::Request& request,
+                              uint8_t data[]) override;
+
+        /**
+         * Called from IN endpoint on bus reset
+         */
+        void onReset();
+
+        /**
+         * Called from OUT endpoint when an output report was received
+         */
+        void onReceptionComplete();
+
+        /**
+         * Pass the next queued report to the IN endpoint if it is free
+         */
+        void fillTransmissionBuffer();
+
+        /**
+         * Endpoints
+         */
+        ReportEndpoint reportInEndpoint;
+        ReportEndpoint reportOutEndpoint;
+
+        /**
+         * Configuration
+         */
+        Config config;
+
+        /**
+         * Descriptors, the HID descriptor is also a part of the
+         * configuration
+         */
+        uint8_t hidDescriptorData[HID_DESCRIPTOR_LENGTH];
+        USB_StaticDescriptor hidDescriptor{hidDescriptorData};
+        USB_StaticDescriptor reportDescriptor{nullptr, 0};
+
+        /**
+         * Input report queue
+         */
+        Queue queue;
+
+        /**
+         * State set by class requests
+         */
+        uint8_t idleRate = 0;
+        uint8_t protocol = 1;
+};
+
+
+}   // namespace mcu
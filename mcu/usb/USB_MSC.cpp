@@ -0,0 +1,791 @@
+/**
+ * @file        USB_MSC.cpp
+ *
+ * Mass storage class for USB on STM32L4xx
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "USB_MSC.h"
+
+// Local includes
+#include "USB.h"
+
+// This component
+#include "../core/cortex_m4.h"
+
+// System libraries
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+
+namespace mcu {
+
+
+/**
+ * Return big-endian value from command block
+ */
+static inline uint32_t getBigEndian32(uint8_t data[])
+{
+    return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+
+static inline uint16_t getBigEndian16(uint8_t data[])
+{
+    return (data[0] << 8) | data[1];
+}
+
+
+/**
+ * Store big-endian value in response
+ */
+static inline void setBigEndian32(uint8_t data[], uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+
+/**
+ * Copy string padded with spaces, as used by INQUIRY
+ */
+static void copyPadded(uint8_t data[], const char* text, int length)
+{
+    auto textLength = text != nullptr ? std::min((int)strlen(text), length) : 0;
+
+    memcpy(data, text, textLength);
+    memset(data + textLength, ' ', length - textLength);
+}
+
+
+// ============================================================================
+// Public members
+// ============================================================================
+
+
+USB_MSC::~USB_MSC()
+{
+    deinit();
+}
+
+
+bool USB_MSC::init(Config& config)
+{
+    deinit();
+
+    if (!usbDevice.addFunction(this)) {
+        return false;
+    }
+
+    this->config = config;
+
+    allocateBuffers();
+
+    ejected = false;
+    senseKey = NO_SENSE;
+    senseCode = 0;
+    senseQualifier = 0;
+    resetTransport();
+
+    auto& usb = USB::get();
+
+    usb.setEndpoint(dataInEndpoint.getNumber(), &dataInEndpoint);
+    usb.setEndpoint(dataOutEndpoint.getNumber(), &dataOutEndpoint);
+
+    // USB::init() has already cleared the packet memory
+    dataInEndpoint.initBufferDescriptor();
+    dataOutEndpoint.initBufferDescriptor();
+
+    return true;
+}
+
+
+void USB_MSC::deinit()
+{
+    if (buffers[0].data == nullptr) {
+        return;
+    }
+
+    usbDevice.removeFunction(this);
+
+    auto& usb = USB::get();
+
+    usb.setEndpoint(dataInEndpoint.getNumber(), nullptr);
+    usb.setEndpoint(dataOutEndpoint.getNumber(), nullptr);
+
+    // Device may still be transferring from or to a buffer
+    while (cardBusy) {}
+
+    deallocateBuffers();
+}
+
+
+void USB_MSC::process()
+{
+    if (buffers[0].data == nullptr) {
+        return;
+    }
+
+    if (state == State::RESET) {
+        // Buffers can't be reused while the device accesses them
+        if (cardBusy) {
+            return;
+        }
+
+        disableInterrupts();
+        resetTransport();
+        enableInterrupts();
+    }
+
+    if (state == State::COMMAND_RECEIVED && !cardBusy) {
+        handleCommand();
+    }
+
+    startCardOperation();
+
+    if (state == State::DATA_OUT && usbBytes >= transferLength
+            && cardBlockCount == 0 && !cardBusy) {
+        // All data received and written, host may detach after CSW
+        if (dataLength > 0 && device.sync() != BlockDevice::OK) {
+            cardError = true;
+        }
+
+        changeState(State::DATA_OUT, State::STATUS);
+    }
+
+    // Take packets held back while buffers were busy and send data read
+    // since the last interrupt
+    disableInterrupts();
+    takeReceivedPackets();
+    fillTransmissionBuffers();
+    enableInterrupts();
+}
+
+
+// ============================================================================
+// Protected members
+// ============================================================================
+
+
+void USB_MSC::DataEndpoint::onReset()
+{
+    setType(Type::BULK);
+
+    // Double-buffered endpoints stay valid, flow control is done by
+    // passing buffers
+    if (bufferMode == BufferMode::DOUBLE_TX) {
+        setTransmissionStatus(Status::VALID);
+        setReceptionStatus(Status::DISABLED);
+    } else {
+        setTransmissionStatus(Status::DISABLED);
+        setReceptionStatus(Status::VALID);
+    }
+
+    msc.onReset();
+}
+
+
+bool USB_MSC::DataEndpoint::onClearHalt(bool in)
+{
+    (void)in;
+
+    // Invalid CBW, only BULK_ONLY_RESET ends the stall
+    return !msc.resetRecoveryPending;
+}
+
+
+void USB_MSC::DataEndpoint::onReceptionComplete()
+{
+    msc.takeReceivedPackets();
+}
+
+
+void USB_MSC::DataEndpoint::onTransmissionComplete()
+{
+    msc.fillTransmissionBuffers();
+}
+
+
+void USB_MSC::allocateBuffers()
+{
+    deallocateBuffers();
+
+    blockSize = device.getBlockSize();
+    bufferSize = std::max(config.bufferBlockCount, 1) * blockSize;
+
+    for (auto& buffer : buffers) {
+        buffer.data = new uint32_t[(bufferSize + 3) / 4];
+    }
+}
+
+
+void USB_MSC::deallocateBuffers()
+{
+    for (auto& buffer : buffers) {
+        if (buffer.data != nullptr) {
+            delete[] buffer.data;
+        }
+
+        buffer = Buffer();
+    }
+}
+
+
+void USB_MSC::onGetDescriptorData(uint8_t data[])
+{
+    auto dataInEndpointNo = dataInEndpoint.getNumber();
+    auto dataOutEndpointNo = dataOutEndpoint.getNumber();
+
+    const uint8_t descriptor[DESCRIPTOR_LENGTH] = {
+        // Mass storage interface
+        9, (uint8_t)USB_Descriptor::Type::INTERFACE,
+        (uint8_t)firstInterface,                // Interface number
+        0,                                      // Alternate setting
+        2,                                      // Number of endpoints
+        0x08,                                   // Class mass storage
+        0x06,                                   // Subclass SCSI transparent
+        0x50,                                   // Protocol bulk-only
+        0,                                      // Interface string
+
+        // Data IN endpoint
+        7, (uint8_t)USB_Descriptor::Type::ENDPOINT,
+        (uint8_t)(0x80 | dataInEndpointNo),
+        0x02,                                   // Bulk
+        MAX_PACKET_SIZE, 0,
+        0,
+
+        // Data OUT endpoint
+        7, (uint8_t)USB_Descriptor::Type::ENDPOINT,
+        (uint8_t)dataOutEndpointNo,
+        0x02,                                   // Bulk
+        MAX_PACKET_SIZE, 0,
+        0
+    };
+
+    memcpy(data, descriptor, sizeof(descriptor));
+}
+
+
+int USB_MSC::onRequest(USB_ControlEndpoint::Request& request, uint8_t data[])
+{
+    // Class requests to mass storage interface only
+    if ((request.bmRequestType & 0x7F) != 0x21
+            || request.wIndex != firstInterface) {
+        return -1;
+    }
+
+    switch (request.bRequest) {
+        case BULK_ONLY_RESET:
+            onBulkOnlyReset();
+            return 0;
+
+        case GET_MAX_LUN:
+            data[0] = 0;
+            return 1;
+
+        default:
+            return -1;
+    }
+}
+
+
+void USB_MSC::onReset()
+{
+    // Actual reset is done by process() once the device is idle
+    state = State::RESET;
+    resetRecoveryPending = false;
+}
+
+
+void USB_MSC::onBulkOnlyReset()
+{
+    // Stalls are kept until the host clears them, BOT 5.3.4
+    auto inHalted = dataInEndpoint.isHalted(true);
+    auto outHalted = dataOutEndpoint.isHalted(false);
+
+    // Drops queued and held packets, endpoints call onReset()
+    dataInEndpoint.reset();
+    dataOutEndpoint.reset();
+
+    dataInEndpoint.setHalt(true, inHalted);
+    dataOutEndpoint.setHalt(false, outHalted);
+}
+
+
+void USB_MSC::haltDataEndpoints()
+{
+    resetRecoveryPending = true;
+    dataInEndpoint.setHalt(true, true);
+    dataOutEndpoint.setHalt(false, true);
+}
+
+
+void USB_MSC::resetTransport()
+{
+    for (auto& buffer : buffers) {
+        buffer.state = BufferState::FREE;
+        buffer.length = 0;
+        buffer.index = 0;
+    }
+
+    usbIndex = 0;
+    usbBytes = 0;
+    cardIndex = 0;
+    cardBlockCount = 0;
+    cardError = false;
+    transferLength = 0;
+    dataLength = 0;
+    residue = 0;
+
+    state = State::COMMAND;
+}
+
+
+bool USB_MSC::changeState(State from, State to)
+{
+    auto changed = false;
+
+    disableInterrupts();
+
+    if (state == from) {
+        state = to;
+        changed = true;
+    }
+
+    enableInterrupts();
+
+    return changed;
+}
+
+
+void USB_MSC::handleCommand()
+{
+    for (auto& buffer : buffers) {
+        buffer.state = BufferState::FREE;
+        buffer.index = 0;
+    }
+
+    usbIndex = 0;
+    usbBytes = 0;
+    cardIndex = 0;
+    cardBlockCount = 0;
+    cardError = false;
+    dataLength = 0;
+    status = COMMAND_PASSED;
+
+    if (cbw.dCBWSignature != CBW_SIGNATURE) {
+        // Not a valid CBW, no CSW is sent, BOT 6.6.1
+        disableInterrupts();
+
+        if (state == State::COMMAND_RECEIVED) {
+            haltDataEndpoints();
+            state = State::COMMAND;
+        }
+
+        enableInterrupts();
+        return;
+    }
+
+    transferLength = cbw.dCBWDataTransferLength;
+
+    auto dataIn = (cbw.bmCBWFlags & 0x80) != 0;
+    auto command = cbw.CBWCB;
+
+    if (cbw.bCBWLUN != 0) {
+        fail(ILLEGAL_REQUEST, 0x25);        // Logical unit not supported
+        residue = transferLength;
+    } else if (command[0] == READ_10 || command[0] == WRITE_10) {
+        prepareBlockTransfer(command, command[0] == WRITE_10);
+        residue = transferLength - dataLength;
+    } else {
+        auto length = std::min((uint32_t)prepareResponse(command),
+                               transferLength);
+
+        residue = transferLength - length;
+
+        if (dataIn) {
+            // Response is padded with zeros to the expected length, so the
+            // stage doesn't end with a short packet before the padding
+            auto& buffer = buffers[0];
+
+            dataLength = std::min(transferLength, bufferSize);
+            memset((uint8_t*)buffer.data + length, 0, dataLength - length);
+            buffer.length = dataLength;
+            buffer.state = BufferState::READY;
+        }
+    }
+
+    auto next = State::STATUS;
+
+    if (transferLength > 0) {
+        next = dataIn ? State::DATA_IN : State::DATA_OUT;
+    }
+
+    // Buffers must be set up before the interrupt sees the new state
+    std::atomic_signal_fence(std::memory_order_release);
+    changeState(State::COMMAND_RECEIVED, next);
+}
+
+
+int USB_MSC::prepareResponse(uint8_t command[])
+{
+    auto data = (uint8_t*)buffers[0].data;
+    auto writeProtect = config.writeProtected ? 0x80 : 0x00;
+
+    switch (command[0]) {
+        case TEST_UNIT_READY:
+        case VERIFY_10:
+            if (!isReady()) {
+                fail(NOT_READY, 0x3A);      // Medium not present
+            }
+
+            return 0;
+
+        case REQUEST_SENSE:
+            memset(data, 0, 18);
+            data[0] = 0x70;                 // Current errors
+            data[2] = senseKey;
+            data[7] = 10;                   // Additional length
+            data[12] = senseCode;
+            data[13] = senseQualifier;
+
+            senseKey = NO_SENSE;
+            senseCode = 0;
+            senseQualifier = 0;
+
+            return std::min(18, (int)command[4]);
+
+        case INQUIRY:
+            if (command[1] & 0x01) {
+                // Vital product data pages are not supported
+                fail(ILLEGAL_REQUEST, 0x24);    // Invalid field in CDB
+                return 0;
+            }
+
+            data[0] = 0x00;                 // Direct access block device
+            data[1] = 0x80;                 // Removable
+            data[2] = 0x04;                 // SPC-2
+            data[3] = 0x02;                 // Response data format
+            data[4] = 36 - 5;               // Additional length
+            data[5] = 0;
+            data[6] = 0;
+            data[7] = 0;
+            copyPadded(&data[8], config.vendorName, 8);
+            copyPadded(&data[16], config.productName, 16);
+            copyPadded(&data[32], config.productRevision, 4);
+
+            return std::min(36, (int)getBigEndian16(&command[3]));
+
+        case MODE_SENSE_6:
+            data[0] = 3;                    // Mode data length
+            data[1] = 0;                    // Medium type
+            data[2] = writeProtect;
+            data[3] = 0;                    // Block descriptor length
+
+            return std::min(4, (int)command[4]);
+
+        case MODE_SENSE_10:
+            memset(data, 0, 8);
+            data[1] = 6;                    // Mode data length
+            data[3] = writeProtect;
+
+            return std::min(8, (int)getBigEndian16(&command[7]));
+
+        case START_STOP_UNIT:
+            switch (command[4] & 0x03) {
+                case 0x02:                  // Eject
+                    device.sync();
+                    ejected = true;
+                    break;
+
+                case 0x03:                  // Load
+                    ejected = false;
+                    break;
+            }
+
+            return 0;
+
+        case PREVENT_ALLOW_MEDIUM_REMOVAL:
+            return 0;
+
+        case READ_FORMAT_CAPACITIES:
+            if (!isReady()) {
+                fail(NOT_READY, 0x3A);
+                return 0;
+            }
+
+            memset(data, 0, 4);
+            data[3] = 8;                    // Capacity list length
+            setBigEndian32(&data[4], device.getBlockCount());
+            setBigEndian32(&data[8], blockSize);
+            data[8] = 0x02;                 // Formatted media
+
+            return std::min(12, (int)getBigEndian16(&command[7]));
+
+        case READ_CAPACITY_10:
+            if (!isReady()) {
+                fail(NOT_READY, 0x3A);
+                return 0;
+            }
+
+            setBigEndian32(&data[0], device.getBlockCount() - 1);
+            setBigEndian32(&data[4], blockSize);
+
+            return 8;
+
+        case SYNCHRONIZE_CACHE_10:
+            if (device.sync() != BlockDevice::OK) {
+                fail(MEDIUM_ERROR, 0x0C);   // Write error
+            }
+
+            return 0;
+
+        default:
+            fail(ILLEGAL_REQUEST, 0x20);    // Invalid operation code
+            return 0;
+    }
+}
+
+
+void USB_MSC::prepareBlockTransfer(uint8_t command[], bool write)
+{
+    auto dataIn = (cbw.bmCBWFlags & 0x80) != 0;
+    auto blockNo = getBigEndian32(&command[2]);
+    uint32_t blockCount = getBigEndian16(&command[7]);
+
+    if (!isReady()) {
+        fail(NOT_READY, 0x3A);              // Medium not present
+        return;
+    }
+
+    if ((uint64_t)blockNo + blockCount > device.getBlockCount()) {
+        fail(ILLEGAL_REQUEST, 0x21);        // LBA out of range
+        return;
+    }
+
+    if (write && config.writeProtected) {
+        fail(DATA_PROTECT, 0x27);           // Write protected
+        return;
+    }
+
+    if (blockCount > 0 && (transferLength == 0 || dataIn == write)) {
+        // Host expects no data or data in the other direction
+        status = PHASE_ERROR;
+        return;
+    }
+
+    // Never transfer more than the host expects, the rest is padded or
+    // discarded and reported as residue
+    blockCount = std::min(blockCount, transferLength / blockSize);
+
+    cardBlockNo = blockNo;
+    cardBlockCount = blockCount;
+    dataLength = blockCount * blockSize;
+}
+
+
+void USB_MSC::startCardOperation()
+{
+    if (cardBusy || cardBlockCount == 0) {
+        return;
+    }
+
+    auto& buffer = buffers[cardIndex];
+    auto blockNo = cardBlockNo;
+    auto blockCount = std::min(cardBlockCount, bufferSize / blockSize);
+    auto read = state == State::DATA_IN;
+
+    if (read && buffer.state == BufferState::FREE) {
+        buffer.length = blockCount * blockSize;
+        buffer.index = 0;
+    } else if (!read && buffer.state == BufferState::FULL) {
+        blockCount = buffer.length / blockSize;
+    } else {
+        return;
+    }
+
+    buffer.state = BufferState::CARD;
+    cardBlockNo += blockCount;
+    cardBlockCount -= blockCount;
+    cardBusy = true;
+
+    // Callback may run before the start functions return
+    BlockDevice::Status result;
+
+    if (read) {
+        result = device.startRead((uint8_t*)buffer.data, blockNo, blockCount,
+                                  cardCallback, this);
+    } else {
+        result = device.startWrite((uint8_t*)buffer.data, blockNo,
+                                   blockCount, cardCallback, this);
+    }
+
+    if (result != BlockDevice::OK && cardBusy) {
+        // Operation didn't start, so there will be no callback
+        onCardOperationComplete(result);
+    }
+}
+
+
+void USB_MSC::onCardOperationComplete(BlockDevice::Status result)
+{
+    if (result != BlockDevice::OK) {
+        // Data stage continues, failure is reported in CSW
+        cardError = true;
+    }
+
+    auto& buffer = buffers[cardIndex];
+
+    buffer.state = (state == State::DATA_IN) ? BufferState::READY
+                                             : BufferState::FREE;
+    cardIndex = getNextBuffer(cardIndex);
+
+    std::atomic_signal_fence(std::memory_order_release);
+    cardBusy = false;
+}
+
+
+void USB_MSC::cardCallback(BlockDevice*, BlockDevice::Status status,
+                           void* context)
+{
+    ((USB_MSC*)context)->onCardOperationComplete(status);
+}
+
+
+void USB_MSC::fillTransmissionBuffers()
+{
+    static uint8_t padding[MAX_PACKET_SIZE];
+
+    // Next packet is prepared while the current one is on the bus
+    while (dataInEndpoint.getFreeTransmissionBuffers() > 0) {
+        if (state == State::DATA_IN) {
+            if (usbBytes >= transferLength) {
+                state = State::STATUS;
+                continue;
+            }
+
+            if (usbBytes >= dataLength) {
+                auto count = std::min((uint32_t)MAX_PACKET_SIZE,
+                                      transferLength - usbBytes);
+
+                dataInEndpoint.transmit(padding, count);
+                usbBytes += count;
+                continue;
+            }
+
+            auto& buffer = buffers[usbIndex];
+
+            if (buffer.state != BufferState::READY) {
+                // Waiting for device
+                return;
+            }
+
+            auto count = std::min((uint32_t)MAX_PACKET_SIZE,
+                                  buffer.length - buffer.index);
+
+            dataInEndpoint.transmit((uint8_t*)buffer.data + buffer.index,
+                                    count);
+
+            buffer.index += count;
+            usbBytes += count;
+
+            if (buffer.index >= buffer.length) {
+                // Data is in packet memory, buffer can be read again
+                buffer.state = BufferState::FREE;
+                usbIndex = getNextBuffer(usbIndex);
+            }
+        } else if (state == State::STATUS) {
+            if (cardError && status == COMMAND_PASSED) {
+                auto write = cbw.CBWCB[0] == WRITE_10;
+
+                // Write error or unrecovered read error
+                fail(MEDIUM_ERROR, write ? 0x0C : 0x11);
+            }
+
+            CommandStatusWrapper csw;
+            csw.dCSWSignature = CSW_SIGNATURE;
+            csw.dCSWTag = cbw.dCBWTag;
+            csw.dCSWDataResidue = residue;
+            csw.bCSWStatus = status;
+
+            dataInEndpoint.transmit((uint8_t*)&csw, sizeof(csw));
+
+            state = State::COMMAND;
+            return;
+        } else {
+            return;
+        }
+    }
+}
+
+
+void USB_MSC::takeReceivedPackets()
+{
+    while (dataOutEndpoint.getReceivedPacketCount() > 0) {
+        auto length = dataOutEndpoint.getReceivedLength();
+
+        if (state == State::COMMAND) {
+            if (length == sizeof(CommandBlockWrapper)) {
+                dataOutEndpoint.receive((uint8_t*)&cbw, sizeof(cbw));
+                state = State::COMMAND_RECEIVED;
+            } else {
+                // Not a valid CBW, BOT 6.6.1
+                dataOutEndpoint.releaseReceptionBuffer();
+                haltDataEndpoints();
+                return;
+            }
+        } else if (state == State::DATA_OUT) {
+            if (usbBytes >= dataLength) {
+                // Data not accepted by the command is discarded
+                dataOutEndpoint.releaseReceptionBuffer();
+                usbBytes += length;
+                continue;
+            }
+
+            auto& buffer = buffers[usbIndex];
+
+            if (buffer.state == BufferState::FREE) {
+                buffer.state = BufferState::FILLING;
+                buffer.index = 0;
+                buffer.length = std::min(bufferSize, dataLength - usbBytes);
+            } else if (buffer.state != BufferState::FILLING) {
+                // Packet stays with the endpoint, which NAKs until the
+                // device has written a buffer
+                return;
+            }
+
+            auto count = dataOutEndpoint.receive(
+                (uint8_t*)buffer.data + buffer.index,
+                buffer.length - buffer.index);
+
+            buffer.index += count;
+            usbBytes += length;
+
+            if (buffer.index >= buffer.length) {
+                buffer.state = BufferState::FULL;
+                usbIndex = getNextBuffer(usbIndex);
+            }
+        } else {
+            return;
+        }
+    }
+}
+
+
+void USB_MSC::fail(uint8_t senseKey, uint8_t asc, uint8_t ascq)
+{
+    this->senseKey = senseKey;
+    senseCode = asc;
+    senseQualifier = ascq;
+    status = COMMAND_FAILED;
+}
+
+
+}   // namespace mcu
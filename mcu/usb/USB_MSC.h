@@ -0,0 +1,467 @@
+/**
+ * @file        USB_MSC.h
+ *
+ * Mass storage class for USB on STM32L4xx
+ *
+ * Bulk-only transport with the SCSI transparent command set, serving the
+ * blocks of a BlockDevice, e.g. SDMMC_BlockDevice, as a single LUN.
+ *
+ * Block data passes through two buffers of bufferBlockCount blocks each.
+ * While one buffer is streamed over the double-buffered bulk endpoints,
+ * the device reads or writes the other one with its non-blocking
+ * operations, so card and bus work concurrently. Packets are moved by the
+ * USB interrupt, commands and card operations are run by process(), which
+ * must be called frequently from the main loop.
+ *
+ * Usage: init the block device, call USB::init(), then init() of the
+ * USB_Device, which must have a serial number, then init() of this class,
+ * then USB::connect().
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "USB_Endpoint.h"
+#include "USB_ControlEndpoint.h"
+#include "USB_Device.h"
+#include "USB_Function.h"
+
+// This component
+#include "../storage/BlockDevice.h"
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class USB_MSC : public USB_Function
+{
+    public:
+        /**
+         * Max. packet size of bulk endpoints
+         */
+        static const int MAX_PACKET_SIZE = 64;
+
+        /**
+         * Number of block buffers
+         */
+        static const int BUFFER_COUNT = 2;
+
+        /**
+         * Configuration settings
+         */
+        struct Config
+        {
+            const char* vendorName = "STM32";   // INQUIRY, max. 8 chars
+            const char* productName = "Mass Storage";   // Max. 16 chars
+            const char* productRevision = "1.00";       // Max. 4 chars
+            int bufferBlockCount = 8;           // Blocks per buffer
+            bool writeProtected = false;
+        };
+
+        /**
+         * Constructor
+         *
+         * @param usbDevice         Reference to USB device
+         * @param device            Reference to block device
+         * @param dataInEndpointNo  Number of bulk IN endpoint
+         * @param dataOutEndpointNo Number of bulk OUT endpoint
+         */
+        USB_MSC(USB_Device& usbDevice, BlockDevice& device,
+                int dataInEndpointNo=1, int dataOutEndpointNo=2)
+            : USB_Function(usbDevice),
+              device(device),
+              dataInEndpoint(*this, dataInEndpointNo, BufferMode::DOUBLE_TX),
+              dataOutEndpoint(*this, dataOutEndpointNo, BufferMode::DOUBLE_RX) {}
+
+        /**
+         * Destructor
+         */
+        ~USB_MSC();
+
+        /**
+         * Disallow copy
+         */
+        USB_MSC(const USB_MSC&) = delete;
+        USB_MSC& operator = (const USB_MSC&) = delete;
+        USB_MSC& operator = (USB_MSC&&) = delete;
+
+        /**
+         * Init with config settings, adds the function to the USB device,
+         * allocates block buffers and registers endpoints at the USB
+         * peripheral
+         *
+         * @param config        Reference to configuration struct
+         * @return              False if the USB device has no room for the
+         *                      function
+         */
+        bool init(Config& config);
+
+        /**
+         * Shutdown, waits for a pending device operation
+         */
+        void deinit();
+
+        /**
+         * Run received commands and device operations, call from main loop
+         */
+        void process();
+
+        /**
+         * Return if a command is in progress
+         *
+         * @return              True if busy
+         */
+        bool isBusy()
+        {
+            return state != State::COMMAND || cardBusy;
+        }
+
+        /**
+         * Return if the host has ejected the medium
+         *
+         * @return              True if ejected
+         */
+        bool isEjected()
+        {
+            return ejected;
+        }
+
+    protected:
+        /**
+         * Class requests
+         */
+        static const uint8_t BULK_ONLY_RESET = 0xFF;
+        static const uint8_t GET_MAX_LUN = 0xFE;
+
+        /**
+         * SCSI operation codes
+         */
+        static const uint8_t TEST_UNIT_READY = 0x00;
+        static const uint8_t REQUEST_SENSE = 0x03;
+        static const uint8_t INQUIRY = 0x12;
+        static const uint8_t MODE_SENSE_6 = 0x1A;
+        static const uint8_t START_STOP_UNIT = 0x1B;
+        static const uint8_t PREVENT_ALLOW_MEDIUM_REMOVAL = 0x1E;
+        static const uint8_t READ_FORMAT_CAPACITIES = 0x23;
+        static const uint8_t READ_CAPACITY_10 = 0x25;
+        static const uint8_t READ_10 = 0x28;
+        static const uint8_t WRITE_10 = 0x2A;
+        static const uint8_t VERIFY_10 = 0x2F;
+        static const uint8_t SYNCHRONIZE_CACHE_10 = 0x35;
+        static const uint8_t MODE_SENSE_10 = 0x5A;
+
+        /**
+         * SCSI sense keys
+         */
+        static const uint8_t NO_SENSE = 0x00;
+        static const uint8_t NOT_READY = 0x02;
+        static const uint8_t MEDIUM_ERROR = 0x03;
+        static const uint8_t ILLEGAL_REQUEST = 0x05;
+        static const uint8_t DATA_PROTECT = 0x07;
+
+        /**
+         * Wrapper signatures and status values
+         */
+        static const uint32_t CBW_SIGNATURE = 0x43425355;
+        static const uint32_t CSW_SIGNATURE = 0x53425355;
+        static const uint8_t COMMAND_PASSED = 0x00;
+        static const uint8_t COMMAND_FAILED = 0x01;
+        static const uint8_t PHASE_ERROR = 0x02;
+
+        /**
+         * Length of interface descriptors
+         */
+        static const int DESCRIPTOR_LENGTH = 23;
+
+        typedef USB_Endpoint::BufferMode BufferMode;
+
+        /**
+         * Command block wrapper as received from host
+         */
+        struct CommandBlockWrapper
+        {
+            uint32_t dCBWSignature;
+            uint32_t dCBWTag;
+            uint32_t dCBWDataTransferLength;
+            uint8_t bmCBWFlags;             // Bit 7: direction, 1=IN
+            uint8_t bCBWLUN;
+            uint8_t bCBWCBLength;
+            uint8_t CBWCB[16];
+        } __attribute__((packed));
+
+        /**
+         * Command status wrapper as sent to host
+         */
+        struct CommandStatusWrapper
+        {
+            uint32_t dCSWSignature;
+            uint32_t dCSWTag;
+            uint32_t dCSWDataResidue;
+            uint8_t bCSWStatus;
+        } __attribute__((packed));
+
+        /**
+         * Transport state
+         */
+        enum class State
+        {
+            RESET,              // Waiting for device before reset
+            COMMAND,            // Waiting for CBW
+            COMMAND_RECEIVED,   // CBW waiting for process()
+            DATA_IN,
+            DATA_OUT,
+            STATUS              // CSW waiting for free packet buffer
+        };
+
+        /**
+         * Block buffer state, buffers pass through the states in order
+         * FREE, CARD, READY for data IN and FREE, FILLING, FULL, CARD for
+         * data OUT
+         */
+        enum class BufferState
+        {
+            FREE,
+            CARD,               // Device operation in progress
+            READY,              // Read by device, being sent to host
+            FILLING,            // Being received from host
+            FULL                // Received, waiting for device
+        };
+
+        /**
+         * Block buffer, word aligned for DMA
+         */
+        struct Buffer
+        {
+            uint32_t* data = nullptr;
+            volatile BufferState state = BufferState::FREE;
+            uint32_t length = 0;        // Valid bytes
+            uint32_t index = 0;         // Bytes transferred over USB
+        };
+
+        /**
+         * Double-buffered bulk IN or OUT endpoint, forwards events to class
+         */
+        class DataEndpoint : public USB_Endpoint
+        {
+            friend class USB_MSC;
+
+            public:
+                DataEndpoint(USB_MSC& msc, int number, BufferMode mode)
+                    : USB_Endpoint(number), msc(msc)
+                {
+                    setBufferMode(mode);
+                }
+
+            protected:
+                virtual void onReset() override;
+                virtual void onReceptionComplete() override;
+                virtual void onTransmissionComplete() override;
+                virtual bool onClearHalt(bool in) override;
+
+                USB_MSC& msc;
+        };
+
+        /**
+         * Allocate block buffers on heap
+         */
+        void allocateBuffers();
+
+        /**
+         * Deallocate block buffers on heap
+         */
+        void deallocateBuffers();
+
+        /**
+         * Return number of interfaces
+         */
+        virtual int onGetInterfaceCount() override
+        {
+            return 1;
+        }
+
+        /**
+         * Return length of interface descriptors
+         */
+        virtual int onGetDescriptorLength() override
+        {
+            return DESCRIPTOR_LENGTH;
+        }
+
+        /**
+         * Write interface descriptors
+         */
+        virtual void onGetDescriptorData(uint8_t data[]) override;
+
+        /**
+         * Handle class request
+         */
+        virtual int onRequest(USB_ControlEndpoint::Request& request,
+                              uint8_t data[]) override;
+
+        /**
+         * Called from data endpoint on bus reset
+         */
+        void onReset();
+
+        /**
+         * Handle BULK_ONLY_RESET, drops the transfer in progress
+         */
+        void onBulkOnlyReset();
+
+        /**
+         * Stall both data endpoints after an invalid CBW, they stay halted
+         * until reset recovery, call with interrupts disabled
+         */
+        void haltDataEndpoints();
+
+        /**
+         * Return to waiting for a CBW, drops held back packets
+         */
+        void resetTransport();
+
+        /**
+         * Change state unless it was changed by the interrupt meanwhile
+         *
+         * @param from          Expected current state
+         * @param to            New state
+         * @return              True if changed
+         */
+        bool changeState(State from, State to);
+
+        /**
+         * Decode CBW and prepare data stage
+         */
+        void handleCommand();
+
+        /**
+         * Prepare response data of a command in the first buffer
+         *
+         * @param command       Pointer to command block
+         * @return              Length of response, -1 if no data stage
+         *                      or command failed
+         */
+        int prepareResponse(uint8_t command[]);
+
+        /**
+         * Prepare a READ (10) or WRITE (10) data stage
+         *
+         * @param command       Pointer to command block
+         * @param write         True for WRITE (10)
+         */
+        void prepareBlockTransfer(uint8_t command[], bool write);
+
+        /**
+         * Start next device operation if a buffer is due
+         */
+        void startCardOperation();
+
+        /**
+         * Called on completion of a device operation
+         */
+        void onCardOperationComplete(BlockDevice::Status status);
+
+        /**
+         * Device callback, forwards to onCardOperationComplete()
+         */
+        static void cardCallback(BlockDevice* device,
+                                 BlockDevice::Status status, void* context);
+
+        /**
+         * Fill free packet buffers of IN endpoint with data or CSW
+         */
+        void fillTransmissionBuffers();
+
+        /**
+         * Take received CBW or data packets as long as buffers are free
+         */
+        void takeReceivedPackets();
+
+        /**
+         * Record sense data and fail command
+         */
+        void fail(uint8_t senseKey, uint8_t asc, uint8_t ascq=0);
+
+        /**
+         * Return if medium is accessible
+         */
+        bool isReady()
+        {
+            return !ejected && device.getBlockCount() > 0;
+        }
+
+        /**
+         * Return index of next buffer
+         */
+        static int getNextBuffer(int index)
+        {
+            return (index + 1) % BUFFER_COUNT;
+        }
+
+        /**
+         * Block device
+         */
+        BlockDevice& device;
+
+        /**
+         * Endpoints
+         */
+        DataEndpoint dataInEndpoint;
+        DataEndpoint dataOutEndpoint;
+
+        /**
+         * Configuration
+         */
+        Config config;
+
+        /**
+         * Block buffers
+         */
+        Buffer buffers[BUFFER_COUNT];
+        uint32_t bufferSize = 0;
+        uint32_t blockSize = 0;
+
+        /**
+         * Transport state
+         */
+        volatile State state = State::RESET;
+        volatile bool resetRecoveryPending = false;
+        CommandBlockWrapper cbw;
+        uint8_t status = COMMAND_PASSED;
+        uint32_t transferLength = 0;        // Expected by host
+        uint32_t dataLength = 0;            // Data from or to buffers
+        uint32_t residue = 0;               // Reported in CSW
+        volatile uint32_t usbBytes = 0;     // Transferred over USB
+        int usbIndex = 0;                   // Buffer used by USB
+
+        /**
+         * Device state
+         */
+        volatile bool cardBusy = false;
+        volatile bool cardError = false;
+        int cardIndex = 0;                  // Buffer used by device
+        uint32_t cardBlockNo = 0;           // Next block to transfer
+        uint32_t cardBlockCount = 0;        // Blocks not yet started
+
+        /**
+         * Sense data reported by REQUEST SENSE
+         */
+        uint8_t senseKey = NO_SENSE;
+        uint8_t senseCode = 0;
+        uint8_t senseQualifier = 0;
+
+        /**
+         * Medium ejected by START STOP UNIT
+         */
+        bool ejected = false;
+};
+
+
+}   // namespace mcu
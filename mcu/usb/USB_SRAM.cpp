@@ -12,12 +12,19 @@
 #include "USB_SRAM.h"
 
 // System libraries
+#include <algorithm>
 #include <cstring>
 
 
 namespace mcu {
 
 
+/**
+ * Halfword type for accessing byte buffers, exempt from strict aliasing
+ */
+typedef uint16_t __attribute__((may_alias)) AliasedHalfword;
+
+
 // ============================================================================
 // Public members
 // ============================================================================
@@ -25,11 +32,62 @@ namespace mcu {
 
 void USB_SRAM::read(uint32_t address, uint8_t buffer[], size_t size)
 {
-    auto memory = (uint8_t*)BASE_ADDRESS;
+    if (size == 0) {
+        return;
+    }
+
+    auto memory = (volatile uint16_t*)BASE_ADDRESS + (address >> 1);
 
-    for (size_t i = 0; i < size; i++) {
-        buffer[i] = memory[address + i];
+    if (address & 1) {
+        // Odd start address is the upper byte of a halfword
+        *buffer++ = *memory++ >> 8;
+        size--;
     }
+
+    auto halfwordCount = size >> 1;
+
+    if (((uintptr_t)buffer & 1) == 0) {
+        auto destination = (AliasedHalfword*)buffer;
+
+        while (halfwordCount >= 4) {
+            destination[0] = memory[0];
+            destination[1] = memory[1];
+            destination[2] = memory[2];
+            destination[3] = memory[3];
+            destination += 4;
+            memory += 4;
+            halfwordCount -= 4;
+        }
+
+        while (halfwordCount > 0) {
+            *destination++ = *memory++;
+            halfwordCount--;
+        }
+
+        buffer = (uint8_t*)destination;
+    } else {
+        while (halfwordCount > 0) {
+            uint16_t value = *memory++;
+            buffer[0] = value & 0xFF;
+            buffer[1] = value >> 8;
+            buffer += 2;
+            halfwordCount--;
+        }
+    }
+
+    if (size & 1) {
+        *buffer = *memory & 0xFF;
+    }
+}
+
+
+void USB_SRAM::readToRing(uint32_t address, uint8_t ring[], size_t ringLength,
+                          size_t index, size_t size)
+{
+    auto firstSize = std::min(size, ringLength - index);
+
+    read(address, &ring[index], firstSize);
+    read(address + firstSize, ring, size - firstSize);
 }
 
 
@@ -63,12 +121,63 @@ uint32_t USB_SRAM::readWord(uint32_t address)
 
 void USB_SRAM::write(uint32_t address, uint8_t buffer[], size_t size)
 {
-    auto memory = (uint16_t*)BASE_ADDRESS;
+    if (size == 0) {
+        return;
+    }
+
+    auto memory = (volatile uint16_t*)BASE_ADDRESS + (address >> 1);
+
+    if (address & 1) {
+        // Odd start address, keep lower byte of first halfword
+        *memory = (*memory & 0xFF) | (*buffer++ << 8);
+        memory++;
+        size--;
+    }
 
-    for (size_t i = 0; i < size; i += 2) {
-        auto index = (address + i) >> 1;
-        memory[index] = buffer[i] | (buffer[i + 1] << 8);
+    auto halfwordCount = size >> 1;
+
+    if (((uintptr_t)buffer & 1) == 0) {
+        auto source = (AliasedHalfword*)buffer;
+
+        while (halfwordCount >= 4) {
+            memory[0] = source[0];
+            memory[1] = source[1];
+            memory[2] = source[2];
+            memory[3] = source[3];
+            memory += 4;
+            source += 4;
+            halfwordCount -= 4;
+        }
+
+        while (halfwordCount > 0) {
+            *memory++ = *source++;
+            halfwordCount--;
+        }
+
+        buffer = (uint8_t*)source;
+    } else {
+        while (halfwordCount > 0) {
+            *memory++ = buffer[0] | (buffer[1] << 8);
+            buffer += 2;
+            halfwordCount--;
+        }
     }
+
+    if (size & 1) {
+        // Don't read past the end of buffer
+        *memory = *buffer;
+    }
+}
+
+
+void USB_SRAM::writeFromRing(uint32_t address, uint8_t ring[],
+                             size_t ringLength, size_t index, size_t size)
+{
+    auto firstSize = std::min(size, ringLength - index);
+
+    // Second part may start at an odd address, which write() handles
+    write(address, &ring[index], firstSize);
+    write(address + firstSize, ring, size - firstSize);
 }
 
 
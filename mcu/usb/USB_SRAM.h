@@ -112,12 +112,27 @@ class USB_SRAM
         /**
          * Read data into buffer
          *
+         * Memory is accessed by halfwords only, buffer and address may
+         * have any alignment.
+         *
          * @param address   Relative start address inside block 0..SIZE-1
          * @param buffer    Buffer to be filled with data
          * @param size      Number of bytes to be read
          */
         static void read(uint32_t address, uint8_t buffer[], size_t size);
 
+        /**
+         * Read data into a ring buffer, wrapping at its end
+         *
+         * @param address   Relative start address inside block 0..SIZE-1
+         * @param ring      Ring buffer
+         * @param ringLength Length of ring buffer in bytes
+         * @param index     Index of first byte to be written in ring buffer
+         * @param size      Number of bytes to be read
+         */
+        static void readToRing(uint32_t address, uint8_t ring[],
+                               size_t ringLength, size_t index, size_t size);
+
         /**
          * Read a single byte from memory
          *
@@ -145,12 +160,29 @@ class USB_SRAM
         /**
          * Write data from buffer
          *
+         * Memory is accessed by halfwords only, buffer and address may
+         * have any alignment. The upper byte of the last halfword is
+         * cleared on odd end addresses.
+         *
          * @param address   Relative start address inside block 0..SIZE-1
          * @param buffer    Buffer containing data
          * @param size      Number of bytes to be written
          */
         static void write(uint32_t address, uint8_t buffer[], size_t size);
 
+        /**
+         * Write data from a ring buffer, wrapping at its end
+         *
+         * @param address   Relative start address inside block 0..SIZE-1
+         * @param ring      Ring buffer
+         * @param ringLength Length of ring buffer in bytes
+         * @param index     Index of first byte to be read in ring buffer
+         * @param size      Number of bytes to be written
+         */
+        static void writeFromRing(uint32_t address, uint8_t ring[],
+                                  size_t ringLength, size_t index,
+                                  size_t size);
+
         /**
          * Write a single byte into memory
          *
@@ -180,9 +212,13 @@ class USB_SRAM
          */
         static void clear();
 
+        /**
+         * Memory size in bytes
+         */
+        static constexpr uint32_t SIZE = 1024;
+
     protected:
         static constexpr uint32_t BASE_ADDRESS = APB1_BASE_ADDRESS + 0x00006C00;
-        static constexpr uint32_t SIZE = 1024;
 };
 
 
@@ -0,0 +1,220 @@
+/**
+ * @file        USB_SRAM_Allocator.h
+ *
+ * Compile time allocation of USB SRAM for endpoint buffers on STM32L4xx
+ *
+ * The buffer description table is placed at address 0, followed by the
+ * packet buffers of all endpoints in order. Buffer sizes are rounded to
+ * values the hardware can represent. If the buffers don't fit into the
+ * SRAM, evaluation of allocate() fails and a constexpr layout doesn't
+ * compile:
+ *
+ *     static constexpr USB_SRAM_Allocator::Endpoint usbEndpoints[] = {
+ *         USB_SRAM_Allocator::single(64, 64),     // EP0, control
+ *         USB_SRAM_Allocator::doubleTx(64),       // EP1, bulk IN
+ *         USB_SRAM_Allocator::doubleRx(64),       // EP2, bulk OUT
+ *         USB_SRAM_Allocator::single(8, 0)        // EP3, interrupt IN
+ *     };
+ *
+ *     static constexpr auto usbLayout =
+ *         USB_SRAM_Allocator::allocate(usbEndpoints);
+ *
+ *     USB::get().setBufferLayout(usbLayout);
+ *
+ * Isochronous endpoints are always double-buffered and are declared with
+ * doubleTx() or doubleRx().
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "USB_Endpoint.h"
+#include "USB_SRAM.h"
+
+// System libraries
+#include <cstddef>
+#include <cstdint>
+
+
+namespace mcu {
+
+
+class USB_SRAM_Allocator
+{
+    public:
+        /**
+         * Size of a buffer descriptor in the table
+         */
+        static const int DESCRIPTOR_SIZE = 8;
+
+        /**
+         * Max. size of a packet buffer
+         */
+        static const int MAX_BUFFER_SIZE = 1024;
+
+        /**
+         * Buffer requirements of an endpoint
+         */
+        struct Endpoint
+        {
+            USB_Endpoint::BufferMode mode;
+            uint16_t txSize;
+            uint16_t rxSize;
+        };
+
+        /**
+         * Allocated buffers of an endpoint, double-buffered endpoints use
+         * both entries for the same direction
+         */
+        struct BufferDescriptor
+        {
+            uint16_t txAddress;
+            uint16_t txSize;
+            uint16_t rxAddress;
+            uint16_t rxSize;
+        };
+
+        /**
+         * Allocated buffers of all endpoints, indexed by endpoint number
+         */
+        template<size_t N>
+        struct Layout
+        {
+            BufferDescriptor descriptors[N];
+            uint16_t usedSize;
+        };
+
+        /**
+         * Declare a single-buffered endpoint
+         *
+         * @param txSize        Transmit buffer size, 0 if unused
+         * @param rxSize        Receive buffer size, 0 if unused
+         */
+        static constexpr Endpoint single(uint16_t txSize, uint16_t rxSize)
+        {
+            return { USB_Endpoint::BufferMode::SINGLE, txSize, rxSize };
+        }
+
+        /**
+         * Declare a double-buffered IN endpoint
+         *
+         * @param size          Size of each of the two buffers
+         */
+        static constexpr Endpoint doubleTx(uint16_t size)
+        {
+            return { USB_Endpoint::BufferMode::DOUBLE_TX, size, 0 };
+        }
+
+        /**
+         * Declare a double-buffered OUT endpoint
+         *
+         * @param size          Size of each of the two buffers
+         */
+        static constexpr Endpoint doubleRx(uint16_t size)
+        {
+            return { USB_Endpoint::BufferMode::DOUBLE_RX, 0, size };
+        }
+
+        /**
+         * Allocate buffers for endpoints 0..N-1
+         *
+         * @param endpoints     Array of endpoint declarations
+         * @return              Layout
+         */
+        template<size_t N>
+        static constexpr Layout<N> allocate(const Endpoint (&endpoints)[N])
+        {
+            Layout<N> layout = {};
+            uint32_t address = N * DESCRIPTOR_SIZE;
+
+            for (size_t i = 0; i < N; i++) {
+                auto& endpoint = endpoints[i];
+                auto& descriptor = layout.descriptors[i];
+
+                uint16_t txSize = 0;
+                uint16_t rxSize = 0;
+
+                switch (endpoint.mode) {
+                    case USB_Endpoint::BufferMode::SINGLE:
+                        txSize = getTransmissionSize(endpoint.txSize);
+                        rxSize = getReceptionSize(endpoint.rxSize);
+                        break;
+
+                    case USB_Endpoint::BufferMode::DOUBLE_TX:
+                        txSize = getTransmissionSize(endpoint.txSize);
+                        rxSize = txSize;
+                        break;
+
+                    case USB_Endpoint::BufferMode::DOUBLE_RX:
+                        rxSize = getReceptionSize(endpoint.rxSize);
+                        txSize = rxSize;
+                        break;
+                }
+
+                if (txSize > 0) {
+                    descriptor.txAddress = address;
+                    descriptor.txSize = txSize;
+                    address += txSize;
+                }
+
+                if (rxSize > 0) {
+                    descriptor.rxAddress = address;
+                    descriptor.rxSize = rxSize;
+                    address += rxSize;
+                }
+            }
+
+            if (address > USB_SRAM::SIZE) {
+                packetMemoryExceeded();
+            }
+
+            layout.usedSize = address;
+
+            return layout;
+        }
+
+    protected:
+        /**
+         * Not defined, calling it from allocate() makes constant
+         * evaluation fail and a runtime evaluation fail to link
+         */
+        static void packetMemoryExceeded();
+        static void bufferSizeInvalid();
+
+        /**
+         * Return transmit buffer size rounded to halfwords
+         */
+        static constexpr uint16_t getTransmissionSize(uint16_t size)
+        {
+            if (size > MAX_BUFFER_SIZE) {
+                bufferSizeInvalid();
+            }
+
+            return (size + 1) & ~1;
+        }
+
+        /**
+         * Return receive buffer size rounded to what COUNTn_RX can
+         * represent, 2 byte blocks up to 62 bytes, 32 byte blocks above
+         */
+        static constexpr uint16_t getReceptionSize(uint16_t size)
+        {
+            if (size > MAX_BUFFER_SIZE) {
+                bufferSizeInvalid();
+            }
+
+            if (size <= 62) {
+                return (size + 1) & ~1;
+            }
+
+            return (size + 31) & ~31;
+        }
+};
+
+
+}   // namespace mcu
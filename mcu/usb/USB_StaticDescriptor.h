@@ -0,0 +1,90 @@
+/**
+ * @file        USB_StaticDescriptor.h
+ *
+ * USB descriptor backed by a constant byte array
+ *
+ * The constructors are constexpr, so static instances are initialised at
+ * compile time and the data array can stay in flash:
+ *
+ *     static const uint8_t deviceDescriptorData[] = { 18, 1, ... };
+ *     static USB_StaticDescriptor deviceDescriptor(deviceDescriptorData);
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "USB_Descriptor.h"
+
+// System libraries
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+
+namespace mcu {
+
+
+class USB_StaticDescriptor : public USB_Descriptor
+{
+    public:
+        /**
+         * Constructor for an array, length is taken from its size
+         *
+         * @param data          Reference to array
+         */
+        template<size_t N>
+        constexpr USB_StaticDescriptor(const uint8_t (&data)[N])
+            : data(data), length(N) {}
+
+        /**
+         * Constructor
+         *
+         * @param data          Pointer to data
+         * @param length        Length of data in bytes
+         */
+        constexpr USB_StaticDescriptor(const uint8_t* data, uint16_t length)
+            : data(data), length(length) {}
+
+        /**
+         * Return total length
+         */
+        virtual uint16_t onGetLength() override
+        {
+            return length;
+        }
+
+        /**
+         * Return single data byte
+         *
+         * @param index         Data index 0..getLength()-1
+         * @return              Data byte
+         */
+        virtual uint8_t onGetData(int index) override
+        {
+            return data[index];
+        }
+
+        /**
+         * Copy a range of data bytes
+         *
+         * @param offset        Index of first byte 0..getLength()-1
+         * @param buffer        Buffer to be filled with data
+         * @param length        Number of bytes
+         */
+        virtual void getData(int offset, uint8_t buffer[], int length) override
+        {
+            memcpy(buffer, data + offset, length);
+        }
+
+    protected:
+        const uint8_t* data;
+        uint16_t length;
+};
+
+
+}   // namespace mcu
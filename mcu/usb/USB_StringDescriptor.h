@@ -0,0 +1,68 @@
+/**
+ * @file        USB_StringDescriptor.h
+ *
+ * USB string descriptor converting an ASCII string to UTF-16LE
+ *
+ * The string is referenced, not copied, and must stay valid while the
+ * descriptor is in use.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// Local includes
+#include "USB_Descriptor.h"
+
+// System libraries
+#include <cstdint>
+#include <cstring>
+
+
+namespace mcu {
+
+
+class USB_StringDescriptor : public USB_Descriptor
+{
+    public:
+        /**
+         * Return length of descriptor
+         *
+         * @return              Length in bytes
+         */
+        virtual uint16_t onGetLength() override
+        {
+            return 2 + 2 * strlen(text);
+        }
+
+        /**
+         * Return byte of descriptor
+         *
+         * @param index         Byte index
+         * @return              Byte value
+         */
+        virtual uint8_t onGetData(int index) override
+        {
+            if (index == 0) {
+                return onGetLength();
+            } else if (index == 1) {
+                return (uint8_t)Type::STRING;
+            }
+
+            // UTF-16LE, high bytes are 0 for ASCII
+            index -= 2;
+
+            return (index & 1) ? 0 : text[index / 2];
+        }
+
+        /**
+         * ASCII string, must not be nullptr when the descriptor is read
+         */
+        const char* text = nullptr;
+};
+
+
+}   // namespace mcu
@@ -0,0 +1,55 @@
+/**
+ * @file        crc32.h
+ *
+ * Software CRC-32 calculation (IEEE 802.3 polynomial)
+ *
+ * @author      Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// System libraries
+#include <cstdint>
+
+
+namespace mcu {
+
+
+/**
+ * Update a CRC-32 with a block of data
+ *
+ * Calls can be chained by passing the result of the previous call,
+ * start with 0 for a new calculation.
+ *
+ * Example: crc32(0, "123456789", 9) -> 0xCBF43926
+ *
+ * @param   crc             CRC of previous data or 0
+ * @param   data            Data buffer
+ * @param   length          Data length in bytes
+ * @return                  Updated CRC
+ */
+static inline uint32_t crc32(uint32_t crc, const uint8_t data[], int length)
+{
+    static const uint32_t table[16] =
+    {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    crc = ~crc;
+
+    for (auto i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+
+    return ~crc;
+}
+
+
+}   // namespace mcu
@@ -0,0 +1,308 @@
+/**
+ * @file        KVStore_test.cpp
+ *
+ * Host test of the key/value store, including power loss at every flash
+ * operation of a workload that runs garbage collection
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Local includes
+#include "test.h"
+
+// This component
+#include "mcu/storage/KVStore.h"
+#include "mcu/storage/RAM_FlashDevice.h"
+
+// System libraries
+#include <cstring>
+
+
+using namespace mcu;
+
+
+static const uint32_t SECTOR_SIZE = 512;
+static const int SECTOR_COUNT = 4;
+static const int KEY_COUNT = 8;
+static const int VALUE_LENGTH = 20;
+static const int STEP_COUNT = 160;
+static const int ABSENT = -1;
+
+
+/**
+ * Committed state of all keys, plus the operation in progress
+ */
+struct Model
+{
+    int generations[KEY_COUNT + 1];
+    int pendingKey = 0;
+    int pendingGeneration = ABSENT;
+};
+
+
+/**
+ * Return store configuration
+ */
+static inline KVStore::Config getConfig()
+{
+    KVStore::Config config;
+    config.sectorCount = SECTOR_COUNT;
+    config.indexCapacity = 16;
+    config.maxValueLength = 32;
+    config.gcThreshold = 2;
+
+    return config;
+}
+
+
+/**
+ * Fill a value buffer, so key and generation can be verified
+ */
+static inline void fillValue(uint8_t data[], int key, int generation)
+{
+    for (auto i = 0; i < VALUE_LENGTH; i++) {
+        data[i] = (uint8_t)(key * 31 + generation * 7 + i);
+    }
+
+    data[0] = (uint8_t)generation;
+    data[1] = (uint8_t)(generation >> 8);
+}
+
+
+/**
+ * Return key written by a workload step, the first half of the keys is
+ * rarely updated, so collection has to copy them
+ */
+static inline int getKey(int step)
+{
+    if (step < KEY_COUNT) {
+        return 1 + step;
+    } else if (step % 29 == 0) {
+        return 1 + (step / 29) % (KEY_COUNT / 2);
+    }
+
+    return KEY_COUNT / 2 + 1 + step % (KEY_COUNT / 2);
+}
+
+
+/**
+ * Run part of the workload, return false if power was cut
+ */
+static bool runWorkload(KVStore& store, RAM_FlashDevice& flash, Model& model,
+                        int firstStep, int lastStep)
+{
+    for (auto step = firstStep; step < lastStep; step++) {
+        auto key = getKey(step);
+        auto generation = step;
+
+        model.pendingKey = key;
+        KVStore::Status status;
+
+        // Removed keys must not be resurrected by collection or recovery
+        if (key == KEY_COUNT && (step / 64) % 2 == 1) {
+            if (model.generations[key] == ABSENT) {
+                model.pendingKey = 0;
+                continue;
+            }
+
+            model.pendingGeneration = ABSENT;
+            status = store.remove(key);
+        } else {
+            uint8_t data[VALUE_LENGTH];
+            fillValue(data, key, generation);
+            model.pendingGeneration = generation;
+            status = store.write(key, data, VALUE_LENGTH);
+        }
+
+        if (flash.isPowerCut()) {
+            return false;
+        }
+
+        CHECK(status == KVStore::OK);
+
+        model.generations[key] = model.pendingGeneration;
+        model.pendingKey = 0;
+
+        if (step % 50 == 0) {
+            store.collectGarbage();
+
+            if (flash.isPowerCut()) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Check that every key holds its committed value or, for the operation
+ * in progress, the new one, and take the found state as committed
+ */
+static void verify(KVStore& store, Model& model)
+{
+    for (auto key = 1; key <= KEY_COUNT; key++) {
+        auto generation = ABSENT;
+
+        if (store.contains(key)) {
+            uint8_t data[VALUE_LENGTH];
+            uint8_t expected[VALUE_LENGTH];
+
+            CHECK(store.getLength(key) == VALUE_LENGTH);
+            CHECK(store.read(key, data, VALUE_LENGTH) == KVStore::OK);
+
+            generation = data[0] | data[1] << 8;
+            fillValue(expected, key, generation);
+            CHECK(memcmp(data, expected, VALUE_LENGTH) == 0);
+        }
+
+        CHECK(generation == model.generations[key]
+              || (key == model.pendingKey
+                  && generation == model.pendingGeneration));
+
+        model.generations[key] = generation;
+    }
+
+    model.pendingKey = 0;
+}
+
+
+/**
+ * Mount after a power loss, check contents and that the store stays
+ * writable for the rest of the workload
+ */
+static void checkRemount(RAM_FlashDevice& flash, Model& model, int firstStep)
+{
+    auto config = getConfig();
+    KVStore store(flash);
+
+    CHECK(store.init(config) == KVStore::OK);
+    CHECK(store.getFreeSectorCount() >= 1);
+
+    verify(store, model);
+
+    CHECK(runWorkload(store, flash, model, firstStep, firstStep + STEP_COUNT));
+    verify(store, model);
+}
+
+
+/**
+ * Run workload without power loss, return number of flash operations
+ */
+static int testWorkload()
+{
+    RAM_FlashDevice flash(SECTOR_SIZE * SECTOR_COUNT, SECTOR_SIZE);
+    auto config = getConfig();
+    KVStore store(flash);
+    Model model;
+
+    for (auto& generation : model.generations) {
+        generation = ABSENT;
+    }
+
+    CHECK(store.init(config) == KVStore::OK);
+    CHECK(runWorkload(store, flash, model, 0, STEP_COUNT));
+    verify(store, model);
+
+    // Collection must have run several times
+    CHECK(flash.getEraseCount() > SECTOR_COUNT);
+
+    auto operationCount = flash.getProgramCount() + flash.getEraseCount();
+
+    // Remount without power loss
+    checkRemount(flash, model, STEP_COUNT);
+
+    return operationCount;
+}
+
+
+/**
+ * Cut power at every flash operation of the workload, then again at
+ * every operation of the following mount
+ */
+static void testPowerLoss(int operationCount)
+{
+    for (auto cut = 1; cut <= operationCount; cut++) {
+        RAM_FlashDevice flash(SECTOR_SIZE * SECTOR_COUNT, SECTOR_SIZE);
+        Model model;
+
+        for (auto& generation : model.generations) {
+            generation = ABSENT;
+        }
+
+        {
+            auto config = getConfig();
+            KVStore store(flash);
+            CHECK(store.init(config) == KVStore::OK);
+
+            flash.cutPowerAfter(cut);
+            runWorkload(store, flash, model, 0, STEP_COUNT);
+            flash.restorePower();
+        }
+
+        // Power loss during recovery on mount
+        for (auto mountCut = 1; ; mountCut++) {
+            RAM_FlashDevice copy(SECTOR_SIZE * SECTOR_COUNT, SECTOR_SIZE);
+            memcpy(copy.getMemory(), flash.getMemory(),
+                   SECTOR_SIZE * SECTOR_COUNT);
+
+            auto config = getConfig();
+            KVStore store(copy);
+
+            copy.cutPowerAfter(mountCut);
+            store.init(config);
+
+            if (!copy.isPowerCut()) {
+                break;
+            }
+
+            copy.restorePower();
+
+            auto mountModel = model;
+            checkRemount(copy, mountModel, STEP_COUNT);
+        }
+
+        checkRemount(flash, model, STEP_COUNT);
+
+        if (test::failureCount > 0) {
+            printf("power cut after %d operations\n", cut);
+            return;
+        }
+    }
+}
+
+
+/**
+ * Format must fail without successful init
+ */
+static void testInvalidConfig()
+{
+    RAM_FlashDevice flash(SECTOR_SIZE * SECTOR_COUNT, SECTOR_SIZE);
+    auto config = getConfig();
+    KVStore store(flash);
+
+    config.sectorCount = 1;
+    CHECK(store.init(config) == KVStore::INVALID_CONFIG);
+    CHECK(store.format() == KVStore::INVALID_CONFIG);
+
+    config = getConfig();
+    CHECK(store.init(config) == KVStore::OK);
+    CHECK(store.format() == KVStore::OK);
+
+    store.deinit();
+    CHECK(store.format() == KVStore::INVALID_CONFIG);
+}
+
+
+int main()
+{
+    testInvalidConfig();
+
+    auto operationCount = testWorkload();
+    testPowerLoss(operationCount);
+
+    return test::finish("KVStore_test");
+}
@@ -0,0 +1,126 @@
+/**
+ * @file        SDMMC_benchmark.cpp
+ *
+ * Host benchmark of the SDMMC driver stack on the simulated card, to track
+ * driver overhead over time
+ *
+ * The simulated card answers instantly, so results show the CPU time of
+ * driver and simulation. The RAM block device gives the overhead of the
+ * benchmark itself as reference. Cycles are host nanoseconds.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Local includes
+#include "SimulatedCard.h"
+#include "fake_core.h"
+
+// This component
+#include "mcu/sdmmc/SDMMC_BlockCache.h"
+#include "mcu/sdmmc/SDMMC_BlockDevice.h"
+#include "mcu/storage/BlockDevice_Benchmark.h"
+#include "mcu/storage/RAM_BlockDevice.h"
+
+// System libraries
+#include <chrono>
+#include <cstdio>
+
+
+using namespace mcu;
+using test::Background;
+using test::SimulatedCard;
+using test::TestSDMMC;
+
+
+static const uint32_t CYCLE_FREQ = 1000000000;
+
+
+/**
+ * Return host time in ns, wraps like a hardware cycle counter
+ */
+static uint32_t getCycleCount()
+{
+    auto time = std::chrono::steady_clock::now().time_since_epoch();
+
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        time).count();
+}
+
+
+static void print(const char* text)
+{
+    fputs(text, stdout);
+}
+
+
+/**
+ * Run all patterns on a device, return false on failure
+ */
+static bool run(BlockDevice& device, const char* label,
+                uint32_t transferBlockCount)
+{
+    BlockDevice_Benchmark::Config config;
+    config.cycleCounterFunc = getCycleCount;
+    config.cycleFreq = CYCLE_FREQ;
+    config.printFunc = print;
+    config.regionBlockCount = 512;
+    config.transferBlockCount = transferBlockCount;
+
+    BlockDevice_Benchmark benchmark(device);
+
+    if (!benchmark.init(config)) {
+        return false;
+    }
+
+    return benchmark.run(label);
+}
+
+
+int main()
+{
+    auto registers = SimulatedCard::mapRegisters();
+
+    if (registers == nullptr) {
+        printf("SDMMC_benchmark: can't map register block\n");
+        return 1;
+    }
+
+    TestSDMMC sdmmc;
+    SimulatedCard card(registers);
+    card.busyPolls = 0;
+
+    Background background{sdmmc, card};
+    test::setPollFunc(Background::poll, &background);
+
+    auto success = true;
+
+    RAM_BlockDevice ramDevice(SDMMC::BLOCK_SIZE, 1024);
+    success &= run(ramDevice, "RAM", 1);
+
+    SDMMC_BlockDevice device(sdmmc);
+
+    for (auto transferBlockCount : {1, 8}) {
+        success &= run(device, "SDMMC polling", transferBlockCount);
+    }
+
+    // Only the request engine runs, the DMA controller is not simulated
+    sdmmc.enableDMA();
+
+    for (auto transferBlockCount : {1, 8}) {
+        success &= run(device, "SDMMC DMA", transferBlockCount);
+    }
+
+    SDMMC_BlockCache::Config cacheConfig;
+    SDMMC_BlockCache cache(sdmmc);
+    cache.init(cacheConfig);
+
+    SDMMC_BlockDevice cachedDevice(sdmmc, &cache);
+    success &= run(cachedDevice, "SDMMC DMA cached", 1);
+
+    cache.deinit();
+    test::setPollFunc(nullptr);
+
+    return success ? 0 : 1;
+}
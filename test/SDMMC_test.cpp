@@ -0,0 +1,447 @@
+/**
+ * @file        SDMMC_test.cpp
+ *
+ * Host test of the SDMMC request engine against a simulated card, which
+ * answers commands between calls of irq(). While blocking functions
+ * wait, both are advanced by a poll function.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Local includes
+#include "SimulatedCard.h"
+#include "fake_core.h"
+#include "test.h"
+
+// This component
+#include "mcu/core/SysTick.h"
+#include "mcu/sdmmc/SDMMC.h"
+#include "mcu/sdmmc/SDMMC_BlockCache.h"
+#include "mcu/sdmmc/SDMMC_BlockDevice.h"
+
+// System libraries
+#include <cstring>
+#include <vector>
+
+
+using namespace mcu;
+using test::Background;
+using test::SimulatedCard;
+using test::TestSDMMC;
+
+
+static const int MAX_STEPS = 2000;
+static const uint32_t READ_PATTERN = SimulatedCard::READ_PATTERN;
+
+
+/**
+ * Results passed to callbacks
+ */
+struct Callbacks
+{
+    int completeCount = 0;
+    int errorCount = 0;
+};
+
+
+static void completeCallback(SDMMC*, void* context)
+{
+    ((Callbacks*)context)->completeCount++;
+}
+
+
+static void errorCallback(SDMMC*, void* context)
+{
+    ((Callbacks*)context)->errorCount++;
+}
+
+
+/**
+ * Run card and interrupt handler until the request is finished
+ */
+static SDMMC::Status run(SDMMC& sdmmc, SimulatedCard& card)
+{
+    for (auto i = 0; i < MAX_STEPS && sdmmc.isTransferActive(); i++) {
+        card.step();
+        sdmmc.irq();
+    }
+
+    CHECK(!sdmmc.isTransferActive());
+
+    return sdmmc.getTransferStatus();
+}
+
+
+/**
+ * Check received command sequence
+ */
+static bool isSequence(SimulatedCard& card, std::vector<int> commands)
+{
+    auto result = (card.commands == commands);
+
+    if (!result) {
+        printf("commands:");
+        for (auto command : card.commands) {
+            printf(" %d", command);
+        }
+        printf("\n");
+    }
+
+    card.commands.clear();
+
+    return result;
+}
+
+
+/**
+ * Return if all words of a buffer have a value
+ */
+static bool isFilled(uint8_t buffer[], int length, uint32_t value)
+{
+    for (auto i = 0; i < length; i += 4) {
+        uint32_t word;
+        memcpy(&word, &buffer[i], 4);
+
+        if (word != value) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static void testReadWrite(SDMMC_Registers::Block* registers)
+{
+    TestSDMMC sdmmc;
+    SimulatedCard card(registers);
+    Callbacks callbacks;
+
+    sdmmc.setTransferCompleteCallback(completeCallback, &callbacks);
+    sdmmc.setTransferErrorCallback(errorCallback, &callbacks);
+
+    static uint32_t buffer[4 * SDMMC::BLOCK_SIZE / 4];
+    auto data = (uint8_t*)buffer;
+
+    // Multiple block read is ended by CMD12
+    CHECK(sdmmc.startReadBlocks(data, 100, 4) == SDMMC::OK);
+    CHECK(sdmmc.startReadBlocks(data, 100, 4) == SDMMC::BUSY);
+    CHECK(run(sdmmc, card) == SDMMC::OK);
+    CHECK(isSequence(card, {18, 12}));
+    CHECK(card.transferArgument == 100);
+    CHECK(isFilled(data, 4 * SDMMC::BLOCK_SIZE, READ_PATTERN));
+    CHECK(card.state == SDMMC::TRANSFER);
+
+    // Single block read needs no CMD12
+    CHECK(sdmmc.startReadBlocks(data, 7, 1) == SDMMC::OK);
+    CHECK(run(sdmmc, card) == SDMMC::OK);
+    CHECK(isSequence(card, {17}));
+    CHECK(card.transferArgument == 7);
+
+    // Multiple block write announces the block count via ACMD23
+    memset(data, 0x3C, sizeof(buffer));
+    CHECK(sdmmc.startWriteBlocks(data, 200, 3) == SDMMC::OK);
+    CHECK(run(sdmmc, card) == SDMMC::OK);
+    CHECK(isSequence(card, {55, 23, 25, 12}));
+    CHECK(card.blockCountArgument == 3);
+    CHECK(card.transferArgument == 200);
+    CHECK(card.writtenWord == 0x3C3C3C3C);
+    CHECK(card.state == SDMMC::PROGRAM);
+
+    // Next request polls CMD13 until the card has finished programming
+    CHECK(sdmmc.startReadBlocks(data, 100, 2) == SDMMC::OK);
+    CHECK(run(sdmmc, card) == SDMMC::OK);
+    CHECK(isSequence(card, {13, 13, 13, 18, 12}));
+
+    // Single block write, card is ready at the first poll
+    card.busyPolls = 0;
+    CHECK(sdmmc.startWriteBlocks(data, 8, 1) == SDMMC::OK);
+    CHECK(run(sdmmc, card) == SDMMC::OK);
+    CHECK(isSequence(card, {24}));
+    CHECK(sdmmc.startWriteBlocks(data, 9, 1) == SDMMC::OK);
+    CHECK(run(sdmmc, card) == SDMMC::OK);
+    CHECK(isSequence(card, {13, 24}));
+
+    CHECK(callbacks.completeCount == 6);
+    CHECK(callbacks.errorCount == 0);
+
+    CHECK(sdmmc.startReadBlocks(data, 0, 0) == SDMMC::INVALID_PARAMETER);
+}
+
+
+static void testNotInitialised(SDMMC_Registers::Block* registers)
+{
+    TestSDMMC sdmmc;
+    SimulatedCard card(registers);
+
+    sdmmc.deinitCard();
+
+    static uint32_t buffer[SDMMC::BLOCK_SIZE / 4];
+    auto data = (uint8_t*)buffer;
+
+    CHECK(sdmmc.startReadBlocks(data, 0, 1) == SDMMC::NOT_INITIALISED);
+    CHECK(sdmmc.startWriteBlocks(data, 0, 1) == SDMMC::NOT_INITIALISED);
+    CHECK(!sdmmc.isTransferActive());
+    CHECK(card.commands.empty());
+}
+
+
+static void testErrors(SDMMC_Registers::Block* registers)
+{
+    TestSDMMC sdmmc;
+    Callbacks callbacks;
+
+    sdmmc.setTransferCompleteCallback(completeCallback, &callbacks);
+    sdmmc.setTransferErrorCallback(errorCallback, &callbacks);
+
+    static uint32_t buffer[2 * SDMMC::BLOCK_SIZE / 4];
+    auto data = (uint8_t*)buffer;
+
+    // No response to the read command, data path is stopped
+    {
+        SimulatedCard card(registers);
+        card.timeoutCommand = 18;
+        CHECK(sdmmc.startReadBlocks(data, 1, 2) == SDMMC::OK);
+        CHECK(run(sdmmc, card) == SDMMC::CMD_RESPONSE_TIMEOUT);
+        CHECK(isSequence(card, {18}));
+        CHECK(registers->DCTRL == 0);
+        CHECK(registers->MASK == 0);
+    }
+
+    // Corrupted response to ACMD23 ends the write before CMD25
+    {
+        SimulatedCard card(registers);
+        card.crcFailCommand = 23;
+        CHECK(sdmmc.startWriteBlocks(data, 1, 2) == SDMMC::OK);
+        CHECK(run(sdmmc, card) == SDMMC::CMD_RESPONSE_CRC_FAIL);
+        CHECK(isSequence(card, {55, 23}));
+    }
+
+    // Data CRC errors are reported after stopping the card, also for
+    // single blocks
+    {
+        SimulatedCard card(registers);
+        card.dataCRCFail = true;
+        CHECK(sdmmc.startReadBlocks(data, 1, 2) == SDMMC::OK);
+        CHECK(run(sdmmc, card) == SDMMC::DATA_CRC_FAIL);
+        CHECK(isSequence(card, {18, 12}));
+        CHECK(card.state == SDMMC::TRANSFER);
+
+        CHECK(sdmmc.startReadBlocks(data, 1, 1) == SDMMC::OK);
+        CHECK(run(sdmmc, card) == SDMMC::DATA_CRC_FAIL);
+        CHECK(isSequence(card, {17, 12}));
+    }
+
+    // Card that never leaves programming state times out
+    {
+        SimulatedCard card(registers);
+        card.busyPolls = MAX_STEPS;
+        CHECK(sdmmc.startWriteBlocks(data, 1, 1) == SDMMC::OK);
+        CHECK(run(sdmmc, card) == SDMMC::OK);
+        CHECK(isSequence(card, {24}));
+
+        CHECK(sdmmc.startReadBlocks(data, 1, 1) == SDMMC::OK);
+        CHECK(run(sdmmc, card) == SDMMC::TIMEOUT);
+        CHECK(card.commands.size() > 1);
+        CHECK(card.commands.back() == 13);
+    }
+
+    CHECK(callbacks.completeCount == 1);
+    CHECK(callbacks.errorCount == 5);
+}
+
+
+static void testBlockingDMA(SDMMC_Registers::Block* registers)
+{
+    TestSDMMC sdmmc;
+    SimulatedCard card(registers);
+    Callbacks callbacks;
+
+    sdmmc.setTransferCompleteCallback(completeCallback, &callbacks);
+    sdmmc.setTransferErrorCallback(errorCallback, &callbacks);
+    sdmmc.enableDMA();
+
+    Background background{sdmmc, card};
+    test::setPollFunc(Background::poll, &background);
+
+    static uint32_t buffer[4 * SDMMC::BLOCK_SIZE / 4];
+    auto data = (uint8_t*)buffer;
+
+    // Blocking transfers run as requests, without calling the callbacks
+    // of the application
+    CHECK(sdmmc.readBlocks(data, 100, 4) == SDMMC::OK);
+    CHECK(isSequence(card, {18, 12}));
+
+    CHECK(sdmmc.writeBlocks(data, 200, 2) == SDMMC::OK);
+    CHECK(isSequence(card, {55, 23, 25, 12, 13, 13, 13}));
+
+    CHECK(callbacks.completeCount == 0);
+    CHECK(callbacks.errorCount == 0);
+
+    // Following non-blocking transfers still call them
+    CHECK(sdmmc.startReadBlocks(data, 100, 1) == SDMMC::OK);
+
+    while (sdmmc.isTransferActive()) {
+        SysTick::get().getTicks();
+    }
+
+    CHECK(sdmmc.getTransferStatus() == SDMMC::OK);
+    CHECK(callbacks.completeCount == 1);
+
+    test::setPollFunc(nullptr);
+}
+
+
+static void testBlockCache(SDMMC_Registers::Block* registers)
+{
+    typedef SimulatedCard::Write Write;
+
+    TestSDMMC sdmmc;
+    SimulatedCard card(registers);
+    card.busyPolls = 0;
+
+    Background background{sdmmc, card};
+    test::setPollFunc(Background::poll, &background);
+
+    SDMMC_BlockCache::Config config;
+    config.slotCount = 4;
+    config.maxFlushBlockCount = 2;
+    config.idleFlushTime = 0;
+
+    SDMMC_BlockCache cache(sdmmc);
+    cache.init(config);
+
+    static uint32_t buffer[3 * SDMMC::BLOCK_SIZE / 4];
+    auto data = (uint8_t*)buffer;
+
+    // Written blocks are read back from cache without card access
+    memset(data, 0x11, SDMMC::BLOCK_SIZE);
+    CHECK(cache.writeBlock(data, 10) == SDMMC::OK);
+    memset(data, 0, SDMMC::BLOCK_SIZE);
+    CHECK(cache.readBlock(data, 10) == SDMMC::OK);
+    CHECK(isFilled(data, SDMMC::BLOCK_SIZE, 0x11111111));
+    CHECK(card.commands.empty());
+    CHECK(cache.getHitCount() == 1);
+
+    // Multiple block reads take the newer cached copy
+    CHECK(cache.readBlocks(data, 9, 3) == SDMMC::OK);
+    CHECK(isFilled(data, SDMMC::BLOCK_SIZE, READ_PATTERN));
+    CHECK(isFilled(data + SDMMC::BLOCK_SIZE, SDMMC::BLOCK_SIZE, 0x11111111));
+    CHECK(isFilled(data + 2 * SDMMC::BLOCK_SIZE, SDMMC::BLOCK_SIZE,
+                   READ_PATTERN));
+    CHECK(isSequence(card, {17, 17}));
+
+    // Multiple block writes go to card and update the cached copy
+    memset(data, 0x22, 3 * SDMMC::BLOCK_SIZE);
+    CHECK(cache.writeBlocks(data, 9, 3) == SDMMC::OK);
+    CHECK(card.writes == std::vector<Write>({{9, 3}}));
+    CHECK(cache.getDirtyCount() == 0);
+    CHECK(cache.readBlock(data, 10) == SDMMC::OK);
+    CHECK(isFilled(data, SDMMC::BLOCK_SIZE, 0x22222222));
+    card.writes.clear();
+
+    // Adjacent dirty blocks are combined up to maxFlushBlockCount
+    cache.invalidate();
+    cache.resetStatistics();
+
+    for (auto blockNo : {20, 21, 22, 30}) {
+        CHECK(cache.writeBlock(data, blockNo) == SDMMC::OK);
+    }
+
+    CHECK(cache.getDirtyCount() == 4);
+    CHECK(card.writes.empty());
+    CHECK(cache.flush() == SDMMC::OK);
+    CHECK(card.writes == std::vector<Write>({{20, 2}, {22, 1}, {30, 1}}));
+    CHECK(cache.getCardWriteCount() == 3);
+    CHECK(cache.getDirtyCount() == 0);
+    card.writes.clear();
+
+    // Least recently used dirty slot is written when evicted
+    cache.invalidate();
+
+    for (auto blockNo : {40, 42, 44, 46}) {
+        CHECK(cache.writeBlock(data, blockNo) == SDMMC::OK);
+    }
+
+    CHECK(cache.readBlock(data, 40) == SDMMC::OK);
+    CHECK(cache.readBlock(data, 50) == SDMMC::OK);
+    CHECK(card.writes == std::vector<Write>({{42, 1}}));
+    CHECK(cache.getDirtyCount() == 3);
+
+    // Dropped blocks are not written
+    cache.invalidate(44, 3);
+    CHECK(cache.getDirtyCount() == 1);
+    CHECK(cache.flush() == SDMMC::OK);
+    CHECK(card.writes == std::vector<Write>({{42, 1}, {40, 1}}));
+
+    cache.deinit();
+    test::setPollFunc(nullptr);
+}
+
+
+static void blockDeviceCallback(BlockDevice*, BlockDevice::Status status,
+                                void* context)
+{
+    *(BlockDevice::Status*)context = status;
+}
+
+
+static void testBlockDevice(SDMMC_Registers::Block* registers)
+{
+    TestSDMMC sdmmc;
+    Callbacks callbacks;
+
+    sdmmc.setTransferCompleteCallback(completeCallback, &callbacks);
+    sdmmc.setTransferErrorCallback(errorCallback, &callbacks);
+
+    SDMMC_BlockDevice blockDevice(sdmmc);
+
+    static uint32_t buffer[2 * SDMMC::BLOCK_SIZE / 4];
+    auto data = (uint8_t*)buffer;
+
+    // Callbacks of the application are restored after each operation
+    for (auto dataCRCFail : {false, true}) {
+        SimulatedCard card(registers);
+        card.dataCRCFail = dataCRCFail;
+
+        auto status = BlockDevice::Status::BUSY;
+        CHECK(blockDevice.startRead(data, 4, 2, blockDeviceCallback, &status)
+              == BlockDevice::Status::OK);
+        run(sdmmc, card);
+
+        CHECK(status == (dataCRCFail ? BlockDevice::Status::IO_ERROR
+                                     : BlockDevice::Status::OK));
+        CHECK(!blockDevice.isBusy());
+
+        void* context = nullptr;
+        CHECK(sdmmc.getTransferCompleteCallback(context) == completeCallback);
+        CHECK(context == &callbacks);
+        CHECK(sdmmc.getTransferErrorCallback(context) == errorCallback);
+        CHECK(context == &callbacks);
+    }
+
+    CHECK(callbacks.completeCount == 0);
+    CHECK(callbacks.errorCount == 0);
+}
+
+
+int main()
+{
+    auto registers = SimulatedCard::mapRegisters();
+
+    if (registers == nullptr) {
+        printf("SDMMC_test: can't map register block\n");
+        return 1;
+    }
+
+    testReadWrite(registers);
+    testErrors(registers);
+    testNotInitialised(registers);
+    testBlockingDMA(registers);
+    testBlockCache(registers);
+    testBlockDevice(registers);
+
+    return test::finish("SDMMC_test");
+}
@@ -0,0 +1,227 @@
+/**
+ * @file        SimulatedCard.cpp
+ *
+ * Simulated SD card for host tests of the SDMMC driver
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "SimulatedCard.h"
+
+// Local includes
+#include "test.h"
+
+// This component
+#include "mcu/core/SysTick.h"
+#include "mcu/utility/bit_manipulation.h"
+
+// System libraries
+#include <algorithm>
+#include <sys/mman.h>
+
+
+using namespace mcu;
+
+
+namespace test {
+
+
+static const uint32_t STEP_LENGTH = 16;     // Bytes per step of data phase
+
+
+SDMMC_Registers::Block* SimulatedCard::mapRegisters()
+{
+    auto address = (uintptr_t)SDMMC_Registers::get(SDMMC_Registers::SDMMC1);
+    auto pageAddress = address & ~(uintptr_t)0xFFF;
+
+    auto memory = mmap((void*)pageAddress, 0x1000, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+                       -1, 0);
+
+    if (memory != (void*)pageAddress) {
+        return nullptr;
+    }
+
+    return (SDMMC_Registers::Block*)address;
+}
+
+
+void SimulatedCard::step()
+{
+    SysTick::get().irq();
+
+    // ICR bits match the STA bits they clear
+    registers->STA = registers->STA & ~registers->ICR;
+    registers->ICR = 0;
+
+    if (!bitValue(registers->DCTRL, SDMMC_Registers::DCTRL::DTEN)) {
+        registers->STA = bitReset(registers->STA,
+                                  SDMMC_Registers::STA::RXFIFOHF);
+        registers->STA = bitReset(registers->STA,
+                                  SDMMC_Registers::STA::TXFIFOHE);
+    }
+
+    if (!processCommand()) {
+        processData();
+    }
+}
+
+
+bool SimulatedCard::processCommand()
+{
+    if (!bitValue(registers->CMD, SDMMC_Registers::CMD::CPSMEN)) {
+        return false;
+    }
+
+    auto cmdIndex = (int)bitsValue(registers->CMD, 6,
+                                   SDMMC_Registers::CMD::CMDINDEX_0);
+    auto argument = registers->ARG;
+
+    registers->CMD = 0;
+    commands.push_back(cmdIndex);
+
+    if (cmdIndex == timeoutCommand) {
+        registers->STA = bitSet(registers->STA, SDMMC_Registers::STA::CTIMEOUT);
+        return true;
+    }
+
+    if (cmdIndex == crcFailCommand) {
+        registers->STA = bitSet(registers->STA, SDMMC_Registers::STA::CCRCFAIL);
+        return true;
+    }
+
+    // Card status as R1 response
+    uint32_t response = (uint32_t)state << 9;
+
+    switch (cmdIndex) {
+        case 12:
+            if (state == SDMMC::RECEIVE) {
+                state = SDMMC::PROGRAM;
+                busyCount = busyPolls;
+            } else if (state == SDMMC::DATA) {
+                state = SDMMC::TRANSFER;
+            }
+            dataPhase = DataPhase::NONE;
+            break;
+
+        case 13:
+            CHECK(argument == 0x1234u << 16);
+            if (state == SDMMC::PROGRAM && busyCount-- <= 0) {
+                state = SDMMC::TRANSFER;
+                response = (uint32_t)state << 9;
+            }
+            break;
+
+        case 17:
+        case 18:
+            CHECK(state == SDMMC::TRANSFER);
+            state = SDMMC::DATA;
+            dataPhase = DataPhase::START;
+            multipleBlocks = (cmdIndex == 18);
+            transferArgument = argument;
+            break;
+
+        case 23:
+            CHECK(appCommand);
+            blockCountArgument = argument;
+            break;
+
+        case 24:
+        case 25:
+            CHECK(state == SDMMC::TRANSFER);
+            state = SDMMC::RECEIVE;
+            dataPhase = DataPhase::START;
+            multipleBlocks = (cmdIndex == 25);
+            transferArgument = argument;
+            break;
+
+        case 55:
+            response = bitSet(response, 5);     // APP_CMD
+            break;
+    }
+
+    appCommand = (cmdIndex == 55);
+
+    registers->RESPCMD = cmdIndex;
+    registers->RESP1 = response;
+    registers->STA = bitSet(registers->STA, SDMMC_Registers::STA::CMDREND);
+
+    return true;
+}
+
+
+void SimulatedCard::processData()
+{
+    auto dataEnabled = bitValue(registers->DCTRL,
+                                SDMMC_Registers::DCTRL::DTEN);
+    auto receive = bitValue(registers->DCTRL,
+                            SDMMC_Registers::DCTRL::DTDIR);
+
+    if (dataPhase == DataPhase::START && dataEnabled) {
+        if (state == SDMMC::DATA) {
+            CHECK(receive);
+            registers->FIFO = READ_PATTERN;
+            registers->STA = bitSet(registers->STA,
+                                    SDMMC_Registers::STA::RXFIFOHF);
+        } else {
+            CHECK(!receive);
+            registers->STA = bitSet(registers->STA,
+                                    SDMMC_Registers::STA::TXFIFOHE);
+        }
+
+        remainingLength = registers->DLEN & 0x1FFFFFF;
+        registers->DCOUNT = remainingLength;
+        dataPhase = DataPhase::END;
+    } else if (dataPhase == DataPhase::END) {
+        // Flag stays set for the last half FIFO, which the driver moves
+        // in the step the data phase ends
+        if (remainingLength > 0) {
+            remainingLength -= std::min(remainingLength, STEP_LENGTH);
+            registers->DCOUNT = remainingLength;
+            return;
+        }
+
+        if (state == SDMMC::RECEIVE) {
+            writtenWord = registers->FIFO;
+            writes.push_back({transferArgument,
+                              (registers->DLEN & 0x1FFFFFF)
+                              / SDMMC::BLOCK_SIZE});
+
+            if (!multipleBlocks) {
+                state = SDMMC::PROGRAM;
+                busyCount = busyPolls;
+            }
+        } else if (!multipleBlocks) {
+            state = SDMMC::TRANSFER;
+        }
+
+        registers->STA = bitReset(registers->STA,
+                                  SDMMC_Registers::STA::RXFIFOHF);
+        registers->STA = bitReset(registers->STA,
+                                  SDMMC_Registers::STA::TXFIFOHE);
+        registers->STA = bitSet(registers->STA,
+                                dataCRCFail ? SDMMC_Registers::STA::DCRCFAIL
+                                            : SDMMC_Registers::STA::DATAEND);
+
+        // Data path is idle until enabled again
+        registers->DCTRL = bitReset(registers->DCTRL,
+                                    SDMMC_Registers::DCTRL::DTEN);
+
+        dataPhase = DataPhase::NONE;
+    }
+}
+
+
+void Background::poll(void* context)
+{
+    auto background = (Background*)context;
+
+    background->card.step();
+    background->sdmmc.irq();
+}
+
+
+}   // namespace test
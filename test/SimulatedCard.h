@@ -0,0 +1,164 @@
+/**
+ * @file        SimulatedCard.h
+ *
+ * Simulated SD card for host tests of the SDMMC driver, which answers
+ * commands via the register block
+ *
+ * The register block is mapped to its hardware address. FIFO accesses
+ * have no side effects, so all words of a transfer read the same value
+ * and only the last written word is seen by the card. The data phase
+ * lasts long enough for polling functions to move all data, which query
+ * the time twice per half FIFO.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// This component
+#include "mcu/sdmmc/SDMMC.h"
+
+// System libraries
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace test {
+
+
+/**
+ * SDMMC with a card that has been initialised
+ */
+class TestSDMMC : public mcu::SDMMC
+{
+    public:
+        TestSDMMC() : mcu::SDMMC(SDMMC1)
+        {
+            cardInitialised = true;
+            highCapacity = true;
+            rca = 0x1234;
+            cardInfo.blockCount = 1024;
+        }
+
+        /**
+         * Use the DMA path, the DMA controller itself is not simulated
+         */
+        void enableDMA()
+        {
+            dmaEnabled = true;
+        }
+};
+
+
+/**
+ * Card state machine driven by the command and data registers
+ */
+class SimulatedCard
+{
+    public:
+        /**
+         * Value of all words read from the card
+         */
+        static const uint32_t READ_PATTERN = 0xA55A0F0F;
+
+        /**
+         * Map the register block to its hardware address, like on the
+         * target
+         *
+         * @return              Pointer to register block or nullptr
+         */
+        static mcu::SDMMC_Registers::Block* mapRegisters();
+
+        SimulatedCard(mcu::SDMMC_Registers::Block* registers)
+            : registers(registers)
+        {
+            memset((void*)registers, 0, sizeof(*registers));
+        }
+
+        /**
+         * Advance by 1 ms, handles at most one command or data event
+         */
+        void step();
+
+        /**
+         * Received command indices
+         */
+        std::vector<int> commands;
+
+        /**
+         * Block range of a write
+         */
+        struct Write
+        {
+            uint32_t blockNo;
+            uint32_t blockCount;
+
+            bool operator == (const Write& other) const
+            {
+                return blockNo == other.blockNo
+                       && blockCount == other.blockCount;
+            }
+        };
+
+        /**
+         * Completed writes
+         */
+        std::vector<Write> writes;
+
+        /**
+         * Arguments of the last commands
+         */
+        uint32_t transferArgument = 0;
+        uint32_t blockCountArgument = 0;
+        uint32_t writtenWord = 0;
+
+        /**
+         * Behaviour
+         */
+        int busyPolls = 2;          // CMD13 answered in PROGRAM state
+        int timeoutCommand = -1;    // Command answered with timeout
+        int crcFailCommand = -1;    // Command answered with CRC error
+        bool dataCRCFail = false;
+
+        int state = mcu::SDMMC::TRANSFER;
+
+    protected:
+        enum class DataPhase
+        {
+            NONE,
+            START,
+            END
+        };
+
+        bool processCommand();
+        void processData();
+
+        mcu::SDMMC_Registers::Block* registers;
+        DataPhase dataPhase = DataPhase::NONE;
+        bool multipleBlocks = false;
+        bool appCommand = false;
+        int busyCount = 0;
+        uint32_t remainingLength = 0;
+};
+
+
+/**
+ * Driver and card advanced while blocking functions wait
+ */
+struct Background
+{
+    mcu::SDMMC& sdmmc;
+    SimulatedCard& card;
+
+    /**
+     * Poll function for test::setPollFunc(), context is the instance
+     */
+    static void poll(void* context);
+};
+
+
+}   // namespace test
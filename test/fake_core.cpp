@@ -0,0 +1,95 @@
+/**
+ * @file        fake_core.cpp
+ *
+ * Host replacements for core peripherals used by drivers under test
+ *
+ * Time only advances when the test calls SysTick::irq(), one tick per ms.
+ * Interrupts are not enabled, the test calls the driver's irq() itself,
+ * during blocking functions from a poll function.
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+// Corresponding header
+#include "fake_core.h"
+
+// This component
+#include "mcu/core/NVIC.h"
+#include "mcu/core/SysTick.h"
+#include "mcu/rcc/RCC.h"
+
+
+namespace test {
+
+
+static PollFunc pollFunc = nullptr;
+static void* pollContext = nullptr;
+static bool polling = false;
+
+
+void setPollFunc(PollFunc func, void* context)
+{
+    pollFunc = func;
+    pollContext = context;
+}
+
+
+}   // namespace test
+
+
+namespace mcu {
+
+
+static const uint32_t SYSCLK_FREQ = 80000000;
+
+
+uint32_t SysTick::getTicks()
+{
+    if (test::pollFunc != nullptr && !test::polling) {
+        test::polling = true;
+        test::pollFunc(test::pollContext);
+        test::polling = false;
+    }
+
+    return ticks;
+}
+
+
+uint64_t SysTick::getClockCycles()
+{
+    return (uint64_t)ticks * (SYSCLK_FREQ / 1000);
+}
+
+
+void SysTick::irq()
+{
+    ticks++;
+}
+
+
+void NVIC::enableIrq(int irqNum)
+{
+    (void)irqNum;
+}
+
+
+void NVIC::disableIrq(int irqNum)
+{
+    (void)irqNum;
+}
+
+
+uint32_t RCC::getSYSCLKFreq()
+{
+    return SYSCLK_FREQ;
+}
+
+
+SysTick SysTick::instance;
+NVIC NVIC::instance;
+RCC RCC::instance;
+
+
+}   // namespace mcu
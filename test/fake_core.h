@@ -0,0 +1,34 @@
+/**
+ * @file        fake_core.h
+ *
+ * Control of the host replacements for core peripherals
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+namespace test {
+
+
+/**
+ * Poll function type
+ */
+typedef void (*PollFunc)(void*);
+
+
+/**
+ * Set a function called on each SysTick::getTicks(), so simulated
+ * hardware can progress while blocking driver functions wait. Nested
+ * calls from the function itself don't poll again.
+ *
+ * @param func          Poll function or nullptr
+ * @param context       Pointer to context
+ */
+void setPollFunc(PollFunc func, void* context = nullptr);
+
+
+}   // namespace test
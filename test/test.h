@@ -0,0 +1,64 @@
+/**
+ * @file        test.h
+ *
+ * Minimal check macros for host tests
+ *
+ * @author:     Oliver Rockstedt <info@sourcebox.de>
+ * @license     MIT
+ */
+
+
+#pragma once
+
+
+// System libraries
+#include <cstdio>
+
+
+namespace test {
+
+
+/**
+ * Number of failed checks
+ */
+inline int failureCount = 0;
+
+
+/**
+ * Report a failed check, only the first ones are printed
+ */
+static inline void fail(const char* file, int line, const char* condition)
+{
+    if (failureCount++ < 20) {
+        printf("%s:%d: check failed: %s\n", file, line, condition);
+    }
+}
+
+
+/**
+ * Print summary and return exit code for main()
+ */
+static inline int finish(const char* name)
+{
+    if (failureCount > 0) {
+        printf("%s: %d check(s) failed\n", name, failureCount);
+        return 1;
+    }
+
+    printf("%s: passed\n", name);
+    return 0;
+}
+
+
+}   // namespace test
+
+
+/**
+ * Check a condition, continue on failure
+ */
+#define CHECK(condition)                                            \
+    do {                                                            \
+        if (!(condition)) {                                         \
+            test::fail(__FILE__, __LINE__, #condition);             \
+        }                                                           \
+    } while (0)